@@ -6,6 +6,7 @@
  */
 
 #include <u-boot/sha256.h>
+#include <asm/system.h>
 
 extern void sha256_armv8_ce_process(uint32_t state[8], uint8_t const *src,
 				    uint32_t blocks);
@@ -13,8 +14,16 @@ extern void sha256_armv8_ce_process(uint32_t state[8], uint8_t const *src,
 void sha256_process(sha256_context *ctx, const unsigned char *data,
 		    unsigned int blocks)
 {
+	static int present = -1;
+
 	if (!blocks)
 		return;
 
-	sha256_armv8_ce_process(ctx->state, data, blocks);
+	/* The Crypto Extensions are optional, so check the CPU has them */
+	if (present < 0)
+		present = !!(read_id_aa64isar0() & ID_AA64ISAR0_EL1_SHA2);
+	if (present)
+		sha256_armv8_ce_process(ctx->state, data, blocks);
+	else
+		sha256_process_generic(ctx, data, blocks);
 }
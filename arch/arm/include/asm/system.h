@@ -87,6 +87,8 @@
 #define HCR_EL2_AMO_EL2		(1 <<  5) /* Route SErrors to EL2             */
 
 #define ID_AA64ISAR0_EL1_RNDR	(0xFUL << 60) /* RNDR random registers */
+#define ID_AA64ISAR0_EL1_CRC32	(0xFUL << 16) /* CRC32 instructions */
+#define ID_AA64ISAR0_EL1_SHA2	(0xFUL << 12) /* SHA256 instructions */
 /*
  * ID_AA64ISAR1_EL1 bits definitions
  */
@@ -171,6 +173,15 @@ static inline unsigned int current_el(void)
 	return 3 & (el >> 2);
 }
 
+/* Always inlined, since this is also used by EFI runtime services */
+static __always_inline unsigned long read_id_aa64isar0(void)
+{
+	unsigned long val;
+
+	asm volatile("mrs %0, ID_AA64ISAR0_EL1" : "=r" (val));
+	return val;
+}
+
 static inline unsigned int current_pl(void)
 {
 	/* Aarch32 compatibility */
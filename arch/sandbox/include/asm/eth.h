@@ -13,6 +13,8 @@
 
 void sandbox_eth_disable_response(int index, bool disable);
 
+void sandbox_eth_set_batch(int index, bool batch);
+
 void sandbox_eth_skip_timeout(void);
 
 /*
@@ -89,6 +91,7 @@ struct eth_sandbox_priv {
 	uchar fake_host_hwaddr[ARP_HLEN];
 	struct in_addr fake_host_ipaddr;
 	bool disabled;
+	bool batch;
 	u32 irs;
 	u32 iss;
 	uchar * recv_packet_buffer[PKTBUFSRX];
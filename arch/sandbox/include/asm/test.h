@@ -154,6 +154,20 @@ int sandbox_pwm_get_config(struct udevice *dev, uint channel, uint *period_nsp,
  */
 void sandbox_sf_set_block_protect(struct udevice *dev, int bp_mask);
 
+/**
+ * sandbox_sf_set_sfdp() - Emulate a flash which has SFDP tables
+ *
+ * The new JEDEC ID and tables are seen the next time the flash is probed.
+ *
+ * @dev: Device to update
+ * @name: Name of the flash whose JEDEC ID to report, e.g. "mx25r1635f"
+ * @sfdp: SFDP area to serve to Read SFDP, which must stay valid
+ * @size: Size of @sfdp in bytes
+ * Return: 0 if OK, -ENOENT if @name is not a known flash
+ */
+int sandbox_sf_set_sfdp(struct udevice *dev, const char *name,
+			const void *sfdp, uint size);
+
 /**
  * sandbox_get_codec_params() - Read back codec parameters
  *
@@ -243,6 +257,14 @@ uint sandbox_spi_get_speed(struct udevice *dev);
  */
 uint sandbox_spi_get_mode(struct udevice *dev);
 
+/**
+ * sandbox_spi_get_dirmap_reads() - Get the number of direct-mapped reads
+ *
+ * @dev: Device to check
+ * Return: number of reads served through a direct mapping on this bus
+ */
+uint sandbox_spi_get_dirmap_reads(struct udevice *dev);
+
 /**
  * sandbox_get_pch_spi_protect() - Get the PCI SPI protection status
  *
@@ -361,4 +383,26 @@ bool sandbox_sf_bootdev_enabled(void);
  */
 void sandbox_sf_set_enable_bootdevs(bool enable);
 
+/**
+ * sandbox_mmc_set_cqe() - Control the emulated command queue engine
+ *
+ * This also grows a card without a backing file so that it is large enough
+ * for a queued read. Call mmc_init() again afterwards to pick up the size.
+ *
+ * @dev:	MMC device to adjust
+ * @err:	Error to return from the engine, or 0 to read the data
+ * @stuck:	true if the card should refuse to leave command queue mode
+ *		until it is reset with CMD0
+ * Return: 0 if OK, -ENOMEM if the card could not be grown
+ */
+int sandbox_mmc_set_cqe(struct udevice *dev, int err, bool stuck);
+
+/**
+ * sandbox_mmc_get_cqe_reads() - Get the number of reads sent to the engine
+ *
+ * @dev:	MMC device to check
+ * Return: number of calls to the cqe_read() method
+ */
+int sandbox_mmc_get_cqe_reads(struct udevice *dev);
+
 #endif
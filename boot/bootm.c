@@ -346,6 +346,8 @@ static int bootm_find_os(const char *cmd_name, const char *addr_fit)
 			bootstage_error(BOOTSTAGE_ID_FIT_COMPRESSION);
 			return 1;
 		}
+		if (images.fit_os_decomp)
+			images.os.comp = IH_COMP_NONE;
 
 		if (fit_image_get_os(images.fit_hdr_os, images.fit_noffset_os,
 				     &images.os.os)) {
@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Decompressing images as their data arrives
+ *
+ * The compressed data is read in order into a single buffer. Each time more
+ * of it is present, as much as possible is decompressed, so that
+ * decompression can overlap with reading the rest of the image.
+ */
+
+#define LOG_CATEGORY LOGC_BOOT
+
+#include <errno.h>
+#include <gzip.h>
+#include <image.h>
+#include <log.h>
+#include <malloc.h>
+#include <u-boot/lz4.h>
+#include <u-boot/zlib.h>
+#include <linux/sizes.h>
+#include <linux/zstd.h>
+
+/* Amount of gzip data needed before parsing the header, unless that is all */
+#define GZIP_HDR_MAX	0x400
+
+/* Largest zstd window which is accepted, so bounding the memory used */
+#define ZSTD_WINDOW_MAX	SZ_64M
+
+static int decomp_gzip_start(struct image_decomp_stream *ds)
+{
+	z_stream *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->zalloc = gzalloc;
+	s->zfree = gzfree;
+	if (inflateInit2(s, -MAX_WBITS) != Z_OK) {
+		free(s);
+		return -EIO;
+	}
+	s->next_out = ds->dst;
+	s->avail_out = ds->dst_size;
+	ds->priv = s;
+
+	return 0;
+}
+
+static int decomp_gzip_run(struct image_decomp_stream *ds, ulong avail,
+			   bool last)
+{
+	z_stream *s = ds->priv;
+	int ret;
+
+	if (!ds->used) {
+		/* The header has a variable length, so wait for all of it */
+		if (avail < GZIP_HDR_MAX && !last)
+			return -EAGAIN;
+		ret = gzip_parse_header(ds->src, avail);
+		if (ret < 0)
+			return -EINVAL;
+		ds->used = ret;
+	}
+
+	s->next_in = (unsigned char *)ds->src + ds->used;
+	s->avail_in = avail - ds->used;
+	ret = inflate(s, last ? Z_FINISH : Z_NO_FLUSH);
+	ds->used = avail - s->avail_in;
+	ds->out_len = s->next_out - (unsigned char *)ds->dst;
+	if (ret == Z_STREAM_END)
+		return 0;
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+		log_debug("inflate() returned %d\n", ret);
+		return -EINVAL;
+	}
+	if (!s->avail_out)
+		return -ENOSPC;
+
+	return last ? -EINVAL : -EAGAIN;
+}
+
+static void decomp_gzip_end(struct image_decomp_stream *ds)
+{
+	inflateEnd(ds->priv);
+	free(ds->priv);
+}
+
+static int decomp_lz4_start(struct image_decomp_stream *ds)
+{
+	struct ulz4fn_stream *s;
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	ulz4fn_stream_init(s, ds->src, ds->dst, ds->dst_size);
+	ds->priv = s;
+
+	return 0;
+}
+
+static int decomp_lz4_run(struct image_decomp_stream *ds, ulong avail,
+			  bool last)
+{
+	struct ulz4fn_stream *s = ds->priv;
+	int ret;
+
+	ret = ulz4fn_stream_run(s, avail);
+	ds->used = s->pos;
+	ds->out_len = s->out;
+	if (ret == -EAGAIN && last)
+		return -EINVAL;
+	if (ret == -ENOBUFS)
+		return -ENOSPC;
+
+	return ret;
+}
+
+static void decomp_lz4_end(struct image_decomp_stream *ds)
+{
+	free(ds->priv);
+}
+
+static int decomp_zstd_run(struct image_decomp_stream *ds, ulong avail,
+			   bool last)
+{
+	zstd_in_buffer in;
+	zstd_out_buffer out;
+	size_t ret;
+
+	/* The window size in the frame header sets the memory needed */
+	if (!ds->priv) {
+		zstd_frame_header fh;
+		size_t wsize;
+
+		ret = zstd_get_frame_header(&fh, ds->src, avail);
+		if (zstd_is_error(ret))
+			return -EINVAL;
+		if (ret)
+			return last ? -EINVAL : -EAGAIN;
+		if (fh.windowSize > ZSTD_WINDOW_MAX)
+			return -E2BIG;
+		wsize = zstd_dstream_workspace_bound(fh.windowSize);
+		ds->workspace = malloc(wsize);
+		if (!ds->workspace)
+			return -ENOMEM;
+		ds->priv = zstd_init_dstream(fh.windowSize, ds->workspace,
+					     wsize);
+		if (!ds->priv)
+			return -EPERM;
+	}
+
+	in.src = ds->src;
+	in.size = avail;
+	in.pos = ds->used;
+	out.dst = ds->dst;
+	out.size = ds->dst_size;
+	out.pos = ds->out_len;
+	ret = zstd_decompress_stream(ds->priv, &out, &in);
+	ds->used = in.pos;
+	ds->out_len = out.pos;
+	if (zstd_is_error(ret)) {
+		log_debug("zstd error %d\n", zstd_get_error_code(ret));
+		return -EINVAL;
+	}
+	if (!ret)
+		return 0;
+	if (out.pos == out.size)
+		return -ENOSPC;
+
+	return last ? -EINVAL : -EAGAIN;
+}
+
+int image_decomp_stream_start(struct image_decomp_stream *ds, int comp,
+			      const void *src, void *dst, ulong dst_size)
+{
+	memset(ds, '\0', sizeof(*ds));
+	ds->comp = comp;
+	ds->src = src;
+	ds->dst = dst;
+	ds->dst_size = dst_size;
+
+	switch (comp) {
+	case IH_COMP_GZIP:
+		if (CONFIG_IS_ENABLED(GZIP))
+			return decomp_gzip_start(ds);
+		break;
+	case IH_COMP_LZ4:
+		if (CONFIG_IS_ENABLED(LZ4))
+			return decomp_lz4_start(ds);
+		break;
+	case IH_COMP_ZSTD:
+		/* This is set up once the frame header has arrived */
+		if (CONFIG_IS_ENABLED(ZSTD))
+			return 0;
+		break;
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+int image_decomp_stream_run(struct image_decomp_stream *ds, ulong avail,
+			    bool last)
+{
+	switch (ds->comp) {
+	case IH_COMP_GZIP:
+		if (CONFIG_IS_ENABLED(GZIP))
+			return decomp_gzip_run(ds, avail, last);
+		break;
+	case IH_COMP_LZ4:
+		if (CONFIG_IS_ENABLED(LZ4))
+			return decomp_lz4_run(ds, avail, last);
+		break;
+	case IH_COMP_ZSTD:
+		if (CONFIG_IS_ENABLED(ZSTD))
+			return decomp_zstd_run(ds, avail, last);
+		break;
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+void image_decomp_stream_end(struct image_decomp_stream *ds)
+{
+	if (ds->priv) {
+		if (CONFIG_IS_ENABLED(GZIP) && ds->comp == IH_COMP_GZIP)
+			decomp_gzip_end(ds);
+		else if (CONFIG_IS_ENABLED(LZ4) && ds->comp == IH_COMP_LZ4)
+			decomp_lz4_end(ds);
+	}
+	free(ds->workspace);
+	ds->priv = NULL;
+	ds->workspace = NULL;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Computing FIT image hashes ahead of verification
+ *
+ * Hashes can be calculated while an image is being read, so that hashing
+ * overlaps with reading the rest of the data. The results are held in a
+ * small cache which fit_image_check_hash() consults before calculating the
+ * hash itself. Callers clear the cache once verification is complete, so that
+ * a result is never used for data which may since have changed.
+ */
+
+#define LOG_CATEGORY LOGC_BOOT
+
+#include <dm.h>
+#include <errno.h>
+#include <hash.h>
+#include <image.h>
+#include <log.h>
+#include <malloc.h>
+#include <mapmem.h>
+#include <u-boot/hash.h>
+#include <linux/libfdt.h>
+
+/* Number of hash results which can be held */
+#define FIT_HASH_CACHE_SIZE	8
+
+/**
+ * struct fit_hash_result - A hash calculated ahead of verification
+ *
+ * @fit: FIT containing the hash node, NULL if this entry is unused
+ * @noffset: Offset of the hash node
+ * @data: Image data which was hashed
+ * @size: Size of image data
+ * @value_len: Length of @value
+ * @value: Hash value
+ */
+struct fit_hash_result {
+	const void *fit;
+	int noffset;
+	const void *data;
+	size_t size;
+	int value_len;
+	u8 value[FIT_MAX_HASH_LEN];
+};
+
+static struct fit_hash_result fit_hash_cache[FIT_HASH_CACHE_SIZE];
+static int fit_hash_cache_next;
+
+static void fit_hash_cache_add(const void *fit, int noffset, const void *data,
+			       size_t size, const u8 *value, int value_len)
+{
+	struct fit_hash_result *res = &fit_hash_cache[fit_hash_cache_next];
+
+	fit_hash_cache_next = (fit_hash_cache_next + 1) % FIT_HASH_CACHE_SIZE;
+	res->fit = fit;
+	res->noffset = noffset;
+	res->data = data;
+	res->size = size;
+	res->value_len = value_len;
+	memcpy(res->value, value, value_len);
+}
+
+int fit_image_hash_lookup(const void *fit, int noffset, const void *data,
+			  size_t size, u8 *value, int *value_len)
+{
+	int i;
+
+	for (i = 0; i < FIT_HASH_CACHE_SIZE; i++) {
+		struct fit_hash_result *res = &fit_hash_cache[i];
+
+		if (res->fit == fit && res->noffset == noffset &&
+		    res->data == data && res->size == size) {
+			memcpy(value, res->value, res->value_len);
+			*value_len = res->value_len;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void fit_image_hash_clear(void)
+{
+	memset(fit_hash_cache, '\0', sizeof(fit_hash_cache));
+	fit_hash_cache_next = 0;
+}
+
+/* Start a progressive hash, using the hash uclass if available */
+static int fit_hash_ctx_init(struct fit_hash_ctx *hc, int noffset,
+			     const char *name)
+{
+#if defined(CONFIG_DM_HASH)
+	enum HASH_ALGO algo;
+	int ret;
+
+	algo = hash_algo_lookup_by_name(name);
+	if (algo == HASH_ALGO_INVALID)
+		return -EPROTONOSUPPORT;
+	ret = uclass_get_device(UCLASS_HASH, 0, &hc->dev);
+	if (ret)
+		return ret;
+	hc->dm_algo = algo;
+	hc->digest_size = hash_algo_digest_size(algo);
+	ret = hash_init(hc->dev, algo, &hc->ctx);
+#else
+	int ret;
+
+	ret = hash_progressive_lookup_algo(name, &hc->algo);
+	if (ret)
+		return ret;
+	hc->digest_size = hc->algo->digest_size;
+	ret = hc->algo->hash_init(hc->algo, &hc->ctx);
+#endif
+	if (ret)
+		return ret;
+	hc->noffset = noffset;
+
+	return 0;
+}
+
+static int fit_hash_ctx_update(struct fit_hash_ctx *hc, const void *buf,
+			       size_t len)
+{
+#if defined(CONFIG_DM_HASH)
+	return hash_update(hc->dev, hc->ctx, buf, len);
+#else
+	return hc->algo->hash_update(hc->algo, hc->ctx, buf, len, 0);
+#endif
+}
+
+/* Finish the hash, which also frees the context */
+static int fit_hash_ctx_finish(struct fit_hash_ctx *hc, u8 *value)
+{
+	int ret;
+
+#if defined(CONFIG_DM_HASH)
+	ret = hash_finish(hc->dev, hc->ctx, value);
+#else
+	ret = hc->algo->hash_finish(hc->algo, hc->ctx, value,
+				    FIT_MAX_HASH_LEN);
+#endif
+	hc->ctx = NULL;
+
+	return ret;
+}
+
+/**
+ * fit_hash_node_algo() - Get the algorithm to check for a hash node
+ *
+ * @fit: FIT to check
+ * @noffset: Offset of node to check
+ * Return: algorithm name, or NULL if this is not a hash node or its hash is
+ * not checked
+ */
+static const char *fit_hash_node_algo(const void *fit, int noffset)
+{
+	const char *name = fit_get_name(fit, noffset, NULL);
+	const char *algo;
+	const int *ignore;
+	int len;
+
+	if (strncmp(name, FIT_HASH_NODENAME, strlen(FIT_HASH_NODENAME)))
+		return NULL;
+	if (fit_image_hash_get_algo(fit, noffset, &algo))
+		return NULL;
+	ignore = fdt_getprop(fit, noffset, FIT_IGNORE_PROP, &len);
+	if (ignore && len == sizeof(int) && *ignore)
+		return NULL;
+
+	return algo;
+}
+
+int fit_image_hash_stream_start(struct fit_hash_stream *hs, const void *fit,
+				int image_noffset)
+{
+	int noffset;
+
+	hs->fit = fit;
+	hs->count = 0;
+	fdt_for_each_subnode(noffset, fit, image_noffset) {
+		const char *algo = fit_hash_node_algo(fit, noffset);
+
+		if (!algo)
+			continue;
+		if (hs->count == FIT_HASH_STREAM_MAX)
+			break;
+		/* Anything not hashed here is hashed later, when verifying */
+		if (fit_hash_ctx_init(&hs->ctx[hs->count], noffset, algo))
+			continue;
+		hs->count++;
+	}
+
+	return hs->count;
+}
+
+void fit_image_hash_stream_update(struct fit_hash_stream *hs, const void *buf,
+				  size_t len)
+{
+	u8 value[FIT_MAX_HASH_LEN];
+	int i;
+
+	for (i = 0; i < hs->count; i++) {
+		struct fit_hash_ctx *hc = &hs->ctx[i];
+
+		/* On error, free the context and leave this hash for later */
+		if (hc->ctx && fit_hash_ctx_update(hc, buf, len))
+			fit_hash_ctx_finish(hc, value);
+	}
+}
+
+void fit_image_hash_stream_finish(struct fit_hash_stream *hs,
+				  const void *data, size_t size)
+{
+	u8 value[FIT_MAX_HASH_LEN];
+	int i;
+
+	for (i = 0; i < hs->count; i++) {
+		struct fit_hash_ctx *hc = &hs->ctx[i];
+
+		if (!hc->ctx || fit_hash_ctx_finish(hc, value) || !data)
+			continue;
+		fit_hash_cache_add(hs->fit, hc->noffset, data, size, value,
+				   hc->digest_size);
+	}
+	hs->count = 0;
+}
@@ -28,6 +28,7 @@ extern void *aligned_alloc(size_t alignment, size_t size);
 #include <asm/io.h>
 #include <malloc.h>
 #include <memalign.h>
+#include <uthread.h>
 #include <asm/global_data.h>
 #ifdef CONFIG_DM_HASH
 #include <dm.h>
@@ -1338,7 +1339,10 @@ static int fit_image_check_hash(const void *fit, int noffset, const void *data,
 		return -1;
 	}
 
-	if (calculate_hash(data, size, algo, value, &value_len)) {
+	/* Use the hash if it was calculated while loading the image */
+	if (fit_image_hash_lookup(fit, noffset, data, size, value,
+				  &value_len) &&
+	    calculate_hash(data, size, algo, value, &value_len)) {
 		*err_msgp = "Unsupported hash algorithm";
 		return -1;
 	}
@@ -1504,11 +1508,15 @@ int fit_all_image_verify(const void *fit)
 			       fit_get_name(fit, noffset, NULL));
 			count++;
 
-			if (!fit_image_verify(fit, noffset))
+			if (!fit_image_verify(fit, noffset)) {
+				fit_image_hash_clear();
 				return 0;
+			}
 			printf("\n");
 		}
 	}
+	fit_image_hash_clear();
+
 	return 1;
 }
 
@@ -1989,6 +1997,375 @@ int fit_get_data_conf_prop(const void *fit, const char *prop_name,
 	return fit_get_data_tail(fit, noffset, data, size);
 }
 
+#if CONFIG_IS_ENABLED(FIT_EXTERNAL_LOAD)
+/* Amount of image data to read at once, hashing it as it arrives */
+#define FIT_EXTERNAL_CHUNK	SZ_1M
+
+static struct fit_loader *fit_loader;
+
+void fit_set_loader(struct fit_loader *ldr)
+{
+	if (ldr) {
+		const void *fit = map_sysmem(ldr->addr, 0);
+
+		ldr->hdr_crc = crc32(0, fit, fdt_totalsize(fit));
+	}
+	fit_loader = ldr;
+}
+
+/**
+ * fit_get_loader() - Get the loader to use for an image
+ *
+ * @fit: FIT header
+ * @addr: Address of FIT header
+ * @noffset: Image node offset
+ * Return: loader, or NULL if the image data is already in memory
+ */
+static struct fit_loader *fit_get_loader(const void *fit, ulong addr,
+					 int noffset)
+{
+	int len;
+
+	if (!fit_loader || fit_loader->addr != addr ||
+	    fit_image_get_data_size(fit, noffset, &len))
+		return NULL;
+
+	/* The header may have been replaced since the loader was set */
+	if (crc32(0, fit, fdt_totalsize(fit)) != fit_loader->hdr_crc)
+		return NULL;
+
+	return fit_loader;
+}
+
+/**
+ * struct fit_read_job - Reading of an image's external data
+ *
+ * @ldr: Loader to use
+ * @hs: Hashes to calculate as the data arrives, or NULL if none
+ * @offset: Offset of the data within the FIT file
+ * @len: Length of the data
+ * @buf: Buffer to read the data into
+ * @avail: Number of bytes read so far
+ * @err: Error from the loader, or 0 if none
+ * @done: true once reading has stopped
+ */
+struct fit_read_job {
+	struct fit_loader *ldr;
+	struct fit_hash_stream *hs;
+	ulong offset;
+	int len;
+	void *buf;
+	int avail;
+	int err;
+	bool done;
+};
+
+/* Read the next chunk of an image */
+static void fit_read_job_step(struct fit_read_job *job)
+{
+	int size = min(job->len - job->avail, FIT_EXTERNAL_CHUNK);
+	void *buf = job->buf + job->avail;
+
+	job->err = job->ldr->read(job->ldr, job->offset + job->avail, size,
+				  buf);
+	if (!job->err) {
+		if (job->hs)
+			fit_image_hash_stream_update(job->hs, buf, size);
+		job->avail += size;
+	}
+	job->done = job->err || job->avail == job->len;
+}
+
+/* Check whether two regions of memory overlap */
+static bool fit_overlaps(ulong start1, ulong len1, ulong start2, ulong len2)
+{
+	return start1 < start2 + len2 && start2 < start1 + len1;
+}
+
+#if CONFIG_IS_ENABLED(FIT_EXTERNAL_DECOMP)
+static void fit_read_thread(void *arg)
+{
+	struct fit_read_job *job = arg;
+
+	/* Yield after each chunk, so that it can be decompressed */
+	while (!job->done) {
+		fit_read_job_step(job);
+		uthread_schedule();
+	}
+}
+
+/**
+ * fit_read_decomp() - Decompress an image while it is being read
+ *
+ * If possible the image is read in its own thread, so that each chunk is
+ * decompressed while the next one is being read.
+ *
+ * @job: Reading of the compressed data
+ * @comp: Compression algorithm (IH_COMP_...)
+ * @dst: Destination for the uncompressed data
+ * @dst_size: Size of @dst
+ * @lenp: Returns the uncompressed size
+ * Return: 0 if OK, -EPROTONOSUPPORT if @comp is not supported, other -ve on
+ * error
+ */
+static int fit_read_decomp(struct fit_read_job *job, int comp, void *dst,
+			   ulong dst_size, ulong *lenp)
+{
+	struct image_decomp_stream ds;
+	bool threaded = false;
+	uint grp_id = 0;
+	int avail = -1;
+	int ret;
+
+	ret = image_decomp_stream_start(&ds, comp, job->buf, dst, dst_size);
+	if (ret)
+		return ret;
+	printf("   Uncompressing %s while reading\n",
+	       genimg_get_comp_name(comp));
+	if (CONFIG_IS_ENABLED(UTHREAD)) {
+		grp_id = uthread_grp_new_id();
+		threaded = !uthread_create(NULL, fit_read_thread, job, 0,
+					   grp_id);
+	}
+
+	do {
+		if (threaded)
+			uthread_schedule();
+		else
+			fit_read_job_step(job);
+		if (job->err)
+			break;
+		if (job->avail == avail && !job->done)
+			continue;
+		avail = job->avail;
+		ret = image_decomp_stream_run(&ds, avail, job->done);
+	} while (ret == -EAGAIN);
+
+	/* Read the rest, so that the hashes cover all of the data */
+	while (!job->done) {
+		if (threaded)
+			uthread_schedule();
+		else
+			fit_read_job_step(job);
+	}
+	while (threaded && !uthread_grp_done(grp_id))
+		uthread_schedule();
+
+	*lenp = ds.out_len;
+	image_decomp_stream_end(&ds);
+	if (job->err)
+		return job->err;
+
+	return ret;
+}
+
+/**
+ * fit_decomp_data() - Decompress an image which has been read and verified
+ *
+ * @comp: Compression algorithm (IH_COMP_...)
+ * @src: Compressed data
+ * @len: Length of @src
+ * @dst: Destination for the uncompressed data
+ * @dst_size: Size of @dst
+ * @lenp: Returns the uncompressed size
+ * Return: 0 if OK, -EPROTONOSUPPORT if @comp is not supported, other -ve on
+ * error
+ */
+static int fit_decomp_data(int comp, const void *src, ulong len, void *dst,
+			   ulong dst_size, ulong *lenp)
+{
+	struct image_decomp_stream ds;
+	int ret;
+
+	ret = image_decomp_stream_start(&ds, comp, src, dst, dst_size);
+	if (ret)
+		return ret;
+	printf("   Uncompressing %s\n", genimg_get_comp_name(comp));
+	ret = image_decomp_stream_run(&ds, len, true);
+	*lenp = ds.out_len;
+	image_decomp_stream_end(&ds);
+
+	return ret;
+}
+#else
+static int fit_read_decomp(struct fit_read_job *job, int comp, void *dst,
+			   ulong dst_size, ulong *lenp)
+{
+	return -EPROTONOSUPPORT;
+}
+
+static int fit_decomp_data(int comp, const void *src, ulong len, void *dst,
+			   ulong dst_size, ulong *lenp)
+{
+	return -EPROTONOSUPPORT;
+}
+#endif
+
+/**
+ * fit_image_read_external() - Read an image's external data using a loader
+ *
+ * Images which are not compressed or encrypted are read straight to their load
+ * address, if they have one which does not overlap the FIT header. Otherwise
+ * the data is read to where it would be had the whole FIT been read, so that
+ * the memory layout is the same as in that case. The hashes are calculated as
+ * the data arrives and then checked.
+ *
+ * With CONFIG_FIT_EXTERNAL_DECOMP, compressed images which would be
+ * decompressed to their load address are decompressed there. If @verify is
+ * set, this is done only once the compressed data has been verified, so that
+ * the decompressor never sees untrusted data. Otherwise they are decompressed
+ * as they are read.
+ *
+ * @ldr: Loader to use
+ * @fit: FIT header
+ * @noffset: Image node offset
+ * @image_type: Type of image being loaded (IH_TYPE_...)
+ * @load_op: How the load address is used
+ * @verify: true to verify the image hashes
+ * @datap: Returns a pointer to the image data
+ * @sizep: Returns the image size
+ * @decompp: Returns true if the image was decompressed
+ * Return: 0 if OK, -EACCES if verification failed, other -ve on error
+ */
+static int fit_image_read_external(struct fit_loader *ldr, const void *fit,
+				   int noffset, int image_type,
+				   enum fit_load_op load_op, int verify,
+				   void **datap, size_t *sizep, bool *decompp)
+{
+	ulong hdr_size = fdt_totalsize(fit);
+	struct fit_hash_stream hs;
+	struct fit_read_job job;
+	ulong load, inplace, dst_size;
+	uint8_t comp = IH_COMP_NONE;
+	bool has_load, decomp;
+	int offset, len;
+	void *buf;
+	int ret;
+
+	if (fit_image_get_data_position(fit, noffset, &offset)) {
+		if (fit_image_get_data_offset(fit, noffset, &offset))
+			return -ENOENT;
+		offset += ALIGN(hdr_size, 4);
+	}
+	if (fit_image_get_data_size(fit, noffset, &len))
+		return -ENOENT;
+	inplace = ldr->addr + offset;
+	fit_image_get_comp(fit, noffset, &comp);
+	has_load = !fit_image_get_load(fit, noffset, &load) && load &&
+		   fdt_subnode_offset(fit, noffset, FIT_CIPHER_NODENAME) < 0;
+
+	/* Decompress where fit_image_load() or bootm_load_os() would do so */
+	decomp = CONFIG_IS_ENABLED(FIT_EXTERNAL_DECOMP) && has_load &&
+		 comp != IH_COMP_NONE &&
+		 !IS_ENABLED(CONFIG_FIT_IMAGE_POST_PROCESS) &&
+		 (image_type == IH_TYPE_KERNEL ? load_op == FIT_LOAD_IGNORED :
+		  load_op != FIT_LOAD_IGNORED &&
+		  image_type != IH_TYPE_KERNEL_NOLOAD &&
+		  image_type != IH_TYPE_RAMDISK);
+	dst_size = CONFIG_SYS_BOOTM_LEN;
+	if (decomp && (fit_overlaps(load, dst_size, ldr->addr, hdr_size) ||
+		       fit_overlaps(load, dst_size, inplace, len)))
+		decomp = false;
+
+	if (comp == IH_COMP_NONE && has_load &&
+	    !fit_overlaps(load, len, ldr->addr, hdr_size))
+		buf = map_sysmem(load, len);
+	else
+		buf = map_sysmem(inplace, len);
+	log_debug("reading %x bytes from offset %x to %p\n", len, offset, buf);
+
+	memset(&job, '\0', sizeof(job));
+	job.ldr = ldr;
+	job.offset = offset;
+	job.len = len;
+	job.buf = buf;
+	job.done = !len;
+	if (verify) {
+		fit_image_hash_stream_start(&hs, fit, noffset);
+		job.hs = &hs;
+	}
+
+	*decompp = false;
+	*sizep = len;
+	if (decomp && !verify) {
+		ulong unc_len;
+
+		ret = fit_read_decomp(&job, comp, map_sysmem(load, dst_size),
+				      dst_size, &unc_len);
+		if (!ret) {
+			*decompp = true;
+			*sizep = unc_len;
+		} else if (ret == -EPROTONOSUPPORT && !job.avail) {
+			/* leave it to be decompressed after reading */
+			decomp = false;
+		} else if (!job.err) {
+			printf("Error decompressing image (err=%d)\n", ret);
+			if (verify)
+				fit_image_hash_stream_finish(&hs, NULL, 0);
+			return ret;
+		}
+	}
+	while (!job.done)
+		fit_read_job_step(&job);
+	if (job.err) {
+		printf("Error reading image data (err=%d)\n", job.err);
+		if (verify)
+			fit_image_hash_stream_finish(&hs, NULL, 0);
+		return job.err;
+	}
+
+	if (verify) {
+		fit_image_hash_stream_finish(&hs, buf, len);
+		puts("   Verifying Hash Integrity ... ");
+		/* See fit_image_verify() */
+		if (IS_ENABLED(CONFIG_FIT_SIGNATURE) &&
+		    strchr(fit_get_name(fit, noffset, NULL), '@'))
+			ret = 0;
+		else
+			ret = fit_image_verify_with_data(fit, noffset,
+							 gd_fdt_blob(), buf,
+							 len);
+		fit_image_hash_clear();
+		if (!ret) {
+			puts("Bad Data Hash\n");
+			return -EACCES;
+		}
+		puts("OK\n");
+	}
+	if (decomp && verify) {
+		ulong unc_len;
+
+		ret = fit_decomp_data(comp, buf, len,
+				      map_sysmem(load, dst_size), dst_size,
+				      &unc_len);
+		if (!ret) {
+			*decompp = true;
+			*sizep = unc_len;
+		} else if (ret != -EPROTONOSUPPORT) {
+			printf("Error decompressing image (err=%d)\n", ret);
+			return ret;
+		}
+	}
+	*datap = *decompp ? map_sysmem(load, *sizep) : buf;
+
+	return 0;
+}
+#else
+static struct fit_loader *fit_get_loader(const void *fit, ulong addr,
+					 int noffset)
+{
+	return NULL;
+}
+
+static int fit_image_read_external(struct fit_loader *ldr, const void *fit,
+				   int noffset, int image_type,
+				   enum fit_load_op load_op, int verify,
+				   void **datap, size_t *sizep, bool *decompp)
+{
+	return -ENOSYS;
+}
+#endif
+
 static int fit_image_select(const void *fit, int rd_noffset, int verify)
 {
 	fit_image_print(fit, rd_noffset, "   ");
@@ -2080,6 +2457,8 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 	const char *fit_uname;
 	const char *fit_uname_config;
 	const char *fit_base_uname_config;
+	struct fit_loader *ldr;
+	bool decomp = false;
 	const void *fit;
 	void *buf;
 	void *loadbuf;
@@ -2166,7 +2545,9 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 
 	printf("   Trying '%s' %s subimage\n", fit_uname, prop_name);
 
-	ret = fit_image_select(fit, noffset, images->verify);
+	/* With a loader, the hashes are checked as the data is read */
+	ldr = fit_get_loader(fit, addr, noffset);
+	ret = fit_image_select(fit, noffset, images->verify && !ldr);
 	if (ret) {
 		bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
 		return ret;
@@ -2226,7 +2607,16 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 	bootstage_mark(bootstage_id + BOOTSTAGE_SUB_CHECK_ALL_OK);
 
 	/* get image data address and length */
-	if (fit_image_get_data(fit, noffset, (const void **)&buf, &size)) {
+	if (ldr) {
+		ret = fit_image_read_external(ldr, fit, noffset, image_type,
+					      load_op, images->verify, &buf,
+					      &size, &decomp);
+		if (ret) {
+			bootstage_error(bootstage_id + BOOTSTAGE_SUB_GET_DATA);
+			return ret;
+		}
+	} else if (fit_image_get_data(fit, noffset, (const void **)&buf,
+				      &size)) {
 		printf("Could not find %s subimage data!\n", prop_name);
 		bootstage_error(bootstage_id + BOOTSTAGE_SUB_GET_DATA);
 		return -ENOENT;
@@ -2242,6 +2632,10 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 		puts("OK\n");
 	}
 
+	/* bootm_load_os() must not decompress the kernel again */
+	if (image_type == IH_TYPE_KERNEL)
+		images->fit_os_decomp = decomp;
+
 	/* perform any post-processing on the image data */
 	if (!tools_build() && IS_ENABLED(CONFIG_FIT_IMAGE_POST_PROCESS))
 		board_fit_image_post_process(fit, noffset, &buf, &size);
@@ -2288,7 +2682,7 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 	comp = IH_COMP_NONE;
 	loadbuf = buf;
 	/* Kernel images get decompressed later in bootm_load_os(). */
-	if (!fit_image_get_comp(fit, noffset, &comp) &&
+	if (!decomp && !fit_image_get_comp(fit, noffset, &comp) &&
 	    comp != IH_COMP_NONE &&
 	    load_op != FIT_LOAD_IGNORED &&
 	    !(image_type == IH_TYPE_KERNEL ||
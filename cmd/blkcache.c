@@ -6,6 +6,7 @@
  */
 #include <command.h>
 #include <config.h>
+#include <blk.h>
 #include <malloc.h>
 #include <part.h>
 #include <vsprintf.h>
@@ -13,16 +14,30 @@
 static int blkc_show(struct cmd_tbl *cmdtp, int flag,
 		     int argc, char *const argv[])
 {
+	struct block_cache_dev_stats dstats;
 	struct block_cache_stats stats;
+	int i;
+
+	/* read the per-device statistics first, since they are reset too */
+	printf("device        hits    misses readahead\n");
+	for (i = 0; !blkcache_dev_stats(i, &dstats); i++)
+		printf("%-6s %2d %9u %9u %9u\n",
+		       blk_get_uclass_name(dstats.iftype), dstats.devnum,
+		       dstats.hits, dstats.misses, dstats.readaheads);
 	blkcache_stats(&stats);
 
 	printf("hits: %u\n"
 	       "misses: %u\n"
+	       "readaheads: %u\n"
 	       "entries: %u\n"
+	       "size: %lu\n"
 	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       "max cache entries: %u\n"
+	       "max size: %lu\n"
+	       "max readahead blocks: %u\n",
+	       stats.hits, stats.misses, stats.readaheads, stats.entries,
+	       stats.size, stats.max_blocks_per_entry, stats.max_entries,
+	       stats.max_size, stats.max_readahead);
 	return 0;
 }
 
@@ -30,7 +45,11 @@ static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 			  int argc, char *const argv[])
 {
 	unsigned blocks_per_entry, max_entries;
-	if (argc != 3)
+	struct block_cache_stats stats;
+	unsigned long max_size;
+	unsigned max_readahead;
+
+	if (argc < 3 || argc > 5)
 		return CMD_RET_USAGE;
 
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
@@ -38,12 +57,22 @@ static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 	blkcache_configure(blocks_per_entry, max_entries);
 	printf("changed to max of %u entries of %u blocks each\n",
 	       max_entries, blocks_per_entry);
+
+	if (argc > 3) {
+		blkcache_stats(&stats);
+		max_size = simple_strtoul(argv[3], 0, 0) * 1024;
+		max_readahead = argc > 4 ? simple_strtoul(argv[4], 0, 0) :
+			stats.max_readahead;
+		blkcache_configure_size(max_size, max_readahead);
+		printf("changed to max of %lu KiB, reading ahead up to %u blocks\n",
+		       max_size / 1024, max_readahead);
+	}
 	return 0;
 }
 
 static struct cmd_tbl cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
-	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(configure, 5, 0, blkc_configure, "", ""),
 };
 
 static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
@@ -67,9 +96,10 @@ static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 6, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
-	"blkcache configure <blocks> <entries> "
-	"- set max blocks per entry and max cache entries\n"
+	"blkcache configure <blocks> <entries> [<size_kb> [<readahead>]] "
+	"- set max blocks per entry, max cache entries, max cache size\n"
+	"    and max blocks to read ahead\n"
 );
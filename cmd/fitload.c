@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Read the header of a FIT from a filesystem, so that its images can be read
+ * straight to their load addresses when it is booted
+ */
+
+#include <command.h>
+#include <env.h>
+#include <fs.h>
+#include <image.h>
+#include <mapmem.h>
+#include <vsprintf.h>
+#include <linux/errno.h>
+#include <linux/libfdt.h>
+#include <linux/string.h>
+
+/**
+ * struct fitload_priv - Location of the FIT file
+ *
+ * @ifname: Interface name, e.g. "mmc"
+ * @dev_part: Device and partition, e.g. "0:1"
+ * @fname: Filename
+ */
+struct fitload_priv {
+	char ifname[16];
+	char dev_part[32];
+	char fname[256];
+};
+
+static struct fitload_priv fitload_priv;
+static struct fit_loader fitload_ldr;
+
+static int fitload_read_file(struct fitload_priv *priv, ulong addr,
+			     loff_t offset, loff_t len)
+{
+	loff_t actread;
+
+	/* The filesystem is closed after each access, so must be set again */
+	if (fs_set_blk_dev(priv->ifname, priv->dev_part, FS_TYPE_ANY))
+		return -ENODEV;
+	if (fs_read(priv->fname, addr, offset, len, &actread))
+		return -EIO;
+	if (actread != len)
+		return -ENODATA;
+
+	return 0;
+}
+
+static int fitload_read(struct fit_loader *ldr, ulong offset, ulong size,
+			void *buf)
+{
+	return fitload_read_file(ldr->priv, map_to_sysmem(buf), offset, size);
+}
+
+static int do_fitload(struct cmd_tbl *cmdtp, int flag, int argc,
+		      char *const argv[])
+{
+	struct fitload_priv *priv = &fitload_priv;
+	const void *fit;
+	ulong addr, size;
+	int ret;
+
+	if (argc != 5)
+		return CMD_RET_USAGE;
+
+	fit_set_loader(NULL);
+	if (strlcpy(priv->ifname, argv[1], sizeof(priv->ifname)) >=
+	    sizeof(priv->ifname) ||
+	    strlcpy(priv->dev_part, argv[2], sizeof(priv->dev_part)) >=
+	    sizeof(priv->dev_part) ||
+	    strlcpy(priv->fname, argv[4], sizeof(priv->fname)) >=
+	    sizeof(priv->fname))
+		return CMD_RET_USAGE;
+	addr = hextoul(argv[3], NULL);
+
+	/* Read the start of the header to find out how large it is */
+	ret = fitload_read_file(priv, addr, 0, sizeof(struct fdt_header));
+	if (ret) {
+		printf("Cannot read '%s' (err=%d)\n", priv->fname, ret);
+		return CMD_RET_FAILURE;
+	}
+	fit = map_sysmem(addr, 0);
+	if (fdt_magic(fit) != FDT_MAGIC ||
+	    fdt_totalsize(fit) < sizeof(struct fdt_header)) {
+		printf("'%s' is not a FIT\n", priv->fname);
+		return CMD_RET_FAILURE;
+	}
+	size = fdt_totalsize(fit);
+	ret = fitload_read_file(priv, addr, 0, size);
+	if (ret) {
+		printf("Cannot read FIT header (err=%d)\n", ret);
+		return CMD_RET_FAILURE;
+	}
+
+	fitload_ldr.read = fitload_read;
+	fitload_ldr.priv = priv;
+	fitload_ldr.addr = addr;
+	fit_set_loader(&fitload_ldr);
+	printf("%lu bytes of FIT header read\n", size);
+	env_set_hex("fileaddr", addr);
+	env_set_hex("filesize", size);
+
+	return CMD_RET_SUCCESS;
+}
+
+U_BOOT_LONGHELP(fitload,
+	"<interface> <dev[:part]> <addr> <filename>\n"
+	"  - Read the header of FIT 'filename' from 'dev' on 'interface' to\n"
+	"    'addr'. Its images are read from the file when the FIT is\n"
+	"    booted from 'addr'\n");
+
+U_BOOT_CMD(fitload, 5, 0, do_fitload,
+	   "Read a FIT header so its images are read on demand",
+	   fitload_help_text
+);
@@ -193,6 +193,52 @@ static int get_aligned_image_size(struct spl_load_info *info, int data_size,
 	return ALIGN(data_size, spl_get_bl_len(info));
 }
 
+/**
+ * spl_fit_read_hashed() - Read image data, hashing it as it arrives
+ *
+ * The data is read in chunks and each is hashed while it is still in the
+ * cache, rather than hashing the whole image once it has been read. The
+ * hashes are then used when the image is verified.
+ *
+ * @info:	Loader to use
+ * @fit:	FIT containing the image
+ * @node:	Offset of the image node
+ * @offset:	Offset to read from (aligned to the block size)
+ * @size:	Number of bytes to read (aligned to the block size)
+ * @overhead:	Offset of the image data within the bytes read
+ * @length:	Length of the image data
+ * @buf:	Buffer to read into
+ * Return: 0 if OK, -EIO if the read failed
+ */
+static int spl_fit_read_hashed(struct spl_load_info *info, const void *fit,
+			       int node, ulong offset, ulong size,
+			       ulong overhead, size_t length, void *buf)
+{
+	ulong chunk = roundup(IF_ENABLED_INT(CONFIG_SPL_FIT_HASH_STREAM,
+					     CONFIG_SPL_FIT_HASH_STREAM_CHUNK),
+			      spl_get_bl_len(info));
+	ulong end = overhead + length;
+	struct fit_hash_stream hs;
+	ulong pos;
+
+	fit_image_hash_stream_start(&hs, fit, node);
+	for (pos = 0; pos < size && pos < end; pos += chunk) {
+		ulong len = min(chunk, size - pos);
+		ulong from = max(pos, overhead);
+		ulong to = min(pos + len, end);
+
+		if (info->read(info, offset + pos, len, buf + pos) < to - pos) {
+			fit_image_hash_stream_finish(&hs, NULL, 0);
+			return -EIO;
+		}
+		if (from < to)
+			fit_image_hash_stream_update(&hs, buf + from, to - from);
+	}
+	fit_image_hash_stream_finish(&hs, buf + overhead, length);
+
+	return 0;
+}
+
 /**
  * load_simple_fit(): load the image described in a certain FIT node
  * @info:	points to information about the device to load data from
@@ -305,8 +351,15 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 		log_debug("reading from offset %x / %lx size %lx to %p: ",
 			  offset, read_offset, size, src_ptr);
 
-		if (info->read(info, read_offset, size, src_ptr) < length)
+		if (CONFIG_IS_ENABLED(FIT_HASH_STREAM)) {
+			if (spl_fit_read_hashed(info, fit, node, read_offset,
+						size, overhead, length,
+						src_ptr))
+				return -EIO;
+		} else if (info->read(info, read_offset, size, src_ptr) <
+			   length) {
 			return -EIO;
+		}
 
 		debug("External data: dst=%p, offset=%x, size=%lx\n",
 		      src_ptr, offset, (unsigned long)length);
@@ -323,10 +376,14 @@ static int load_simple_fit(struct spl_load_info *info, ulong fit_offset,
 	}
 
 	if (CONFIG_IS_ENABLED(FIT_SIGNATURE)) {
+		int ret;
+
 		printf("## Checking hash(es) for Image %s ... ",
 		       fit_get_name(fit, node, NULL));
-		if (!fit_image_verify_with_data(fit, node, gd_fdt_blob(), src,
-						length))
+		ret = fit_image_verify_with_data(fit, node, gd_fdt_blob(), src,
+						 length);
+		fit_image_hash_clear();
+		if (!ret)
 			return -EPERM;
 		puts("OK\n");
 	}
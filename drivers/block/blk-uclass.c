@@ -7,10 +7,12 @@
 #define LOG_CATEGORY UCLASS_BLK
 
 #include <blk.h>
+#include <cyclic.h>
 #include <dm.h>
 #include <log.h>
 #include <malloc.h>
 #include <part.h>
+#include <asm/cache.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
 #include <dm/uclass-internal.h>
@@ -429,19 +431,208 @@ static int blk_buffer_aligned(struct bounce_buffer *state)
 	return 1;	/* Default, any buffer is OK */
 }
 
-long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+static bool blk_can_queue(struct udevice *dev)
 {
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	const struct blk_ops *ops = blk_get_ops(dev);
-	ulong blks_read;
 
-	if (!ops->read)
-		return -ENOSYS;
+	/* Bounce-buffered transfers are always done synchronously */
+	return ops->submit && ops->poll && !desc->bb;
+#else
+	return false;
+#endif
+}
 
-	if (blkcache_read(desc->uclass_id, desc->devnum,
-			  start, blkcnt, desc->blksz, buf))
-		return blkcnt;
+void blk_queue_setup(struct udevice *dev, uint depth, lbaint_t max_blks)
+{
+	struct blk_queue *q = dev_get_uclass_priv(dev);
+
+	q->depth = depth ? depth : 1;
+	q->max_blks = max_blks;
+}
+
+int blk_poll(struct udevice *dev)
+{
+	struct blk_queue *q = dev_get_uclass_priv(dev);
+	struct blk_req *req, *next;
+	int ret = 0, count = 0;
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	if (q->count) {
+		const struct blk_ops *ops = blk_get_ops(dev);
+
+		ret = ops->poll(dev);
+	}
+#endif
+	list_for_each_entry_safe(req, next, &q->reqs, sibling) {
+		if (ret < 0 && !req->done) {
+			req->result = ret;
+			req->done = true;
+		}
+		if (req->done) {
+			list_del(&req->sibling);
+			q->count--;
+			count++;
+		}
+	}
+	if (ret < 0) {
+		log_debug("%s: poll failed (err=%d)\n", dev->name, ret);
+		return ret;
+	}
+
+	return count;
+}
+
+int blk_submit(struct udevice *dev, struct blk_req *req)
+{
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	struct blk_queue *q = dev_get_uclass_priv(dev);
+	int ret;
+#endif
+
+	req->done = false;
+	req->result = 0;
+
+	if (!blk_can_queue(dev)) {
+		if (req->op == BLK_REQ_WRITE)
+			req->result = blk_write(dev, req->start, req->blkcnt,
+						req->buffer);
+		else
+			req->result = blk_read(dev, req->start, req->blkcnt,
+					       req->buffer);
+		req->done = true;
+
+		return 0;
+	}
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	if (req->op == BLK_REQ_WRITE) {
+		struct blk_desc *desc = dev_get_uclass_plat(dev);
+
+		if (!blk_get_ops(dev)->write)
+			return -ENOSYS;
+		blkcache_invalidate(desc->uclass_id, desc->devnum);
+		blk_mark_changed(desc);
+	}
+
+	for (;;) {
+		if (q->count < q->depth) {
+			ret = blk_get_ops(dev)->submit(dev, req);
+			if (ret != -EBUSY || !q->count)
+				break;
+		}
+		/* Wait for a slot to become free */
+		ret = blk_poll(dev);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			schedule();
+	}
+	if (ret)
+		return log_msg_ret("sub", ret);
+	list_add_tail(&req->sibling, &q->reqs);
+	q->count++;
+#endif
+
+	return 0;
+}
+
+int blk_wait(struct udevice *dev, struct blk_req *req)
+{
+	int ret;
+
+	while (!req->done) {
+		ret = blk_poll(dev);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			schedule();
+	}
+
+	return req->result < 0 ? req->result : 0;
+}
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * blk_read_queued() - Read using several in-flight requests
+ *
+ * The read is split into requests of at most max_blks blocks, keeping the
+ * device queue full until all have been submitted. Requests are retired in
+ * order so that a short read reports the number of contiguous blocks read.
+ *
+ * @dev: Block device to read from
+ * @start: Start block
+ * @blkcnt: Number of blocks to read
+ * @buf: Buffer to read into
+ * Return: number of blocks read, or -ve on error
+ */
+static long blk_read_queued(struct udevice *dev, lbaint_t start,
+			    lbaint_t blkcnt, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	struct blk_queue *q = dev_get_uclass_priv(dev);
+	struct blk_req reqs[CONFIG_BLK_ASYNC_QUEUE_DEPTH];
+	uint depth = min_t(uint, q->depth, ARRAY_SIZE(reqs));
+	lbaint_t max_blks = q->max_blks ? q->max_blks : blkcnt;
+	lbaint_t pos = 0, done = 0;
+	uint head = 0, tail = 0;
+	bool failed = false;
+	long err = 0;
+	int ret;
+
+	while (!failed || head != tail) {
+		struct blk_req *req;
+
+		/* Keep the device queue topped up */
+		while (!failed && pos < blkcnt && tail - head < depth) {
+			lbaint_t cnt = min(blkcnt - pos, max_blks);
+
+			req = &reqs[tail % depth];
+			blk_req_init(req, BLK_REQ_READ, start + pos, cnt,
+				     buf + pos * desc->blksz);
+			err = blk_submit(dev, req);
+			if (err) {
+				failed = true;
+				break;
+			}
+			pos += cnt;
+			tail++;
+		}
+		if (head == tail)
+			break;
+
+		req = &reqs[head++ % depth];
+		ret = blk_wait(dev, req);
+		if (failed)
+			continue;
+		if (ret) {
+			err = ret;
+			failed = true;
+		} else {
+			done += req->result;
+			if (req->result != req->blkcnt)
+				failed = true;
+		}
+	}
+
+	return done || !err ? done : err;
+}
+#endif
 
+/* Read blocks from the device itself, bypassing the block cache */
+static long blk_read_dev(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			 void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	ulong blks_read;
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	if (blk_can_queue(dev))
+		blks_read = blk_read_queued(dev, start, blkcnt, buf);
+	else
+#endif
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
 		int ret;
@@ -460,6 +651,73 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
 		blks_read = ops->read(dev, start, blkcnt, buf);
 	}
 
+	return blks_read;
+}
+
+/**
+ * blk_read_ahead() - Read blocks along with some following ones
+ *
+ * The whole range is added to the block cache, so that subsequent sequential
+ * reads are satisfied from there.
+ *
+ * @dev: Block device to read from
+ * @start: Start block
+ * @blkcnt: Number of blocks requested
+ * @ra: Number of blocks to read after those requested
+ * @buf: Buffer for the requested blocks
+ * Return: true if the read succeeded, false if the caller should fall back to
+ * a normal read
+ */
+static bool blk_read_ahead(struct udevice *dev, lbaint_t start,
+			   lbaint_t blkcnt, lbaint_t ra, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	lbaint_t end = start + blkcnt;
+	bool ok = false;
+	void *rabuf;
+
+	/* Don't read past the end of the device */
+	if (end + ra > desc->lba)
+		ra = desc->lba > end ? desc->lba - end : 0;
+	if (!ra)
+		return false;
+
+	rabuf = memalign(ARCH_DMA_MINALIGN, (blkcnt + ra) * desc->blksz);
+	if (!rabuf)
+		return false;
+	if (blk_read_dev(dev, start, blkcnt + ra, rabuf) == blkcnt + ra) {
+		blkcache_fill(desc->uclass_id, desc->devnum, start, blkcnt + ra,
+			      desc->blksz, rabuf);
+		memcpy(buf, rabuf, blkcnt * desc->blksz);
+		ok = true;
+	}
+	free(rabuf);
+
+	return ok;
+}
+
+long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	ulong blks_read;
+	lbaint_t ra;
+
+	if (!ops->read)
+		return -ENOSYS;
+
+	if (blkcache_read(desc->uclass_id, desc->devnum,
+			  start, blkcnt, desc->blksz, buf))
+		return blkcnt;
+
+	ra = blkcache_readahead(desc->uclass_id, desc->devnum, start, blkcnt);
+	if (ra) {
+		if (blk_read_ahead(dev, start, blkcnt, ra, buf))
+			return blkcnt;
+		blkcache_readahead_cancel(desc->uclass_id, desc->devnum);
+	}
+
+	blks_read = blk_read_dev(dev, start, blkcnt, buf);
 	if (blks_read == blkcnt)
 		blkcache_fill(desc->uclass_id, desc->devnum, start, blkcnt,
 			      desc->blksz, buf);
@@ -478,6 +736,7 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 		return -ENOSYS;
 
 	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	blk_mark_changed(desc);
 
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
@@ -510,6 +769,7 @@ long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
 		return -ENOSYS;
 
 	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	blk_mark_changed(desc);
 
 	return ops->erase(dev, start, blkcnt);
 }
@@ -826,11 +1086,23 @@ static int part_create_block_devices(struct udevice *blk_dev)
 	return 0;
 }
 
+static int blk_pre_probe(struct udevice *dev)
+{
+	struct blk_queue *q = dev_get_uclass_priv(dev);
+
+	INIT_LIST_HEAD(&q->reqs);
+	q->count = 0;
+	q->depth = 1;
+
+	return 0;
+}
+
 static int blk_post_probe(struct udevice *dev)
 {
-	if (CONFIG_IS_ENABLED(PARTITIONS) && blk_enabled()) {
-		struct blk_desc *desc = dev_get_uclass_plat(dev);
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
 
+	blk_mark_changed(desc);
+	if (CONFIG_IS_ENABLED(PARTITIONS) && blk_enabled()) {
 		part_init(desc);
 
 		if (desc->part_type != PART_TYPE_UNKNOWN &&
@@ -844,6 +1116,8 @@ static int blk_post_probe(struct udevice *dev)
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
+	.pre_probe	= blk_pre_probe,
 	.post_probe	= blk_post_probe,
+	.per_device_auto	= sizeof(struct blk_queue),
 	.per_device_plat_auto	= sizeof(struct blk_desc),
 };
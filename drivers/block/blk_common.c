@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Block-device helpers shared by the uclass and legacy implementations
+ */
+
+#include <blk.h>
+
+void blk_mark_changed(struct blk_desc *desc)
+{
+	static unsigned int write_gen;
+
+	desc->write_gen = ++write_gen;
+}
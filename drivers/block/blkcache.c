@@ -11,107 +11,272 @@
 #include <asm/global_data.h>
 #include <linux/ctype.h>
 #include <linux/list.h>
+#include <linux/log2.h>
 
+/* Number of hash buckets, must be a power of two */
+#define BLKCACHE_HASH_SIZE	64
+
+/* Initial read-ahead window, in blocks */
+#define BLKCACHE_RA_MIN		8
+
+/**
+ * struct block_cache_node - A run of cached blocks
+ *
+ * Nodes are hashed by the 'span' (see cache_span_shift()) in which @start lies
+ * and kept on an LRU list, most-recently used first. The data follows the
+ * node in the same allocation.
+ *
+ * @lh: Node in the LRU list
+ * @hash: Node in the hash bucket
+ * @iftype: Interface type of the device (enum uclass_id)
+ * @devnum: Device number
+ * @start: First block held
+ * @blkcnt: Number of blocks held
+ * @blksz: Block size in bytes
+ * @cache: Cached data
+ */
 struct block_cache_node {
 	struct list_head lh;
+	struct hlist_node hash;
 	int iftype;
 	int devnum;
 	lbaint_t start;
 	lbaint_t blkcnt;
 	unsigned long blksz;
-	char *cache;
+	char cache[];
+};
+
+/**
+ * struct block_cache_dev - Per-device access state and statistics
+ *
+ * @lh: Node in the device list
+ * @stats: Statistics for this device
+ * @next: Block following the last one read, used to detect sequential access
+ * @seq: Number of consecutive sequential reads seen
+ * @window: Current read-ahead window in blocks, 0 if not reading ahead
+ * @ra_start: Start block of a read-ahead which may be cached even though it
+ *	exceeds max_blocks_per_entry, or -1 if none
+ */
+struct block_cache_dev {
+	struct list_head lh;
+	struct block_cache_dev_stats stats;
+	lbaint_t next;
+	uint seq;
+	uint window;
+	lbaint_t ra_start;
 };
 
 static LIST_HEAD(block_cache);
+static LIST_HEAD(block_cache_devs);
+static struct hlist_head block_cache_hash[BLKCACHE_HASH_SIZE];
 
 static struct block_cache_stats _stats = {
 	.max_blocks_per_entry = 8,
-	.max_entries = 32
+	.max_entries = CONFIG_BLOCK_CACHE_ENTRIES,
+	.max_size = CONFIG_BLOCK_CACHE_SIZE * 1024,
+	.max_readahead = CONFIG_BLOCK_CACHE_READAHEAD,
 };
 
+/* Largest run of blocks that can be held in a single node */
+static lbaint_t cache_max_blocks(void)
+{
+	return _stats.max_blocks_per_entry + _stats.max_readahead;
+}
+
+/* log2 of the span of blocks covered by each hash key */
+static int cache_span_shift(void)
+{
+	lbaint_t max = cache_max_blocks();
+
+	return max > 1 ? ilog2(__roundup_pow_of_two(max)) : 0;
+}
+
+static struct hlist_head *cache_bucket(int iftype, int devnum, lbaint_t span)
+{
+	ulong key = (ulong)span * 0x9e3779b1UL + devnum * 31 + iftype;
+
+	return &block_cache_hash[(key ^ (key >> 16)) & (BLKCACHE_HASH_SIZE - 1)];
+}
+
+static struct block_cache_dev *cache_dev(int iftype, int devnum, bool create)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (bdev->stats.iftype == iftype && bdev->stats.devnum == devnum)
+			return bdev;
+	}
+	if (!create)
+		return NULL;
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+	bdev->stats.iftype = iftype;
+	bdev->stats.devnum = devnum;
+	bdev->ra_start = -1;
+	list_add_tail(&bdev->lh, &block_cache_devs);
+
+	return bdev;
+}
+
 static struct block_cache_node *cache_find(int iftype, int devnum,
 					   lbaint_t start, lbaint_t blkcnt,
 					   unsigned long blksz)
 {
+	lbaint_t span = start >> cache_span_shift();
 	struct block_cache_node *node;
+	int i;
 
-	list_for_each_entry(node, &block_cache, lh)
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum) &&
-		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
+	/*
+	 * A node holds at most one span of blocks, so any node holding
+	 * @start begins either in the same span or in the one before it
+	 */
+	for (i = 0; i < 2 && i <= span; i++) {
+		struct hlist_head *head = cache_bucket(iftype, devnum, span - i);
+
+		hlist_for_each_entry(node, head, hash) {
+			if (node->iftype == iftype &&
+			    node->devnum == devnum &&
+			    node->blksz == blksz &&
+			    node->start <= start &&
+			    node->start + node->blkcnt >= start + blkcnt) {
+				if (block_cache.next != &node->lh) {
+					/* maintain MRU ordering */
+					list_del(&node->lh);
+					list_add(&node->lh, &block_cache);
+				}
+				return node;
 			}
-			return node;
 		}
-	return 0;
+	}
+
+	return NULL;
+}
+
+static void cache_drop(struct block_cache_node *node)
+{
+	debug("drop: start " LBAF ", count " LBAFU "\n",
+	      node->start, node->blkcnt);
+	list_del(&node->lh);
+	hlist_del(&node->hash);
+	_stats.entries--;
+	_stats.size -= node->blkcnt * node->blksz;
+	free(node);
+}
+
+/* Track sequential access, so that we know when to read ahead */
+static void cache_track(struct block_cache_dev *bdev, lbaint_t start,
+			lbaint_t blkcnt)
+{
+	if (start == bdev->next) {
+		bdev->seq++;
+	} else {
+		bdev->seq = 0;
+		bdev->window = 0;
+	}
+	bdev->next = start + blkcnt;
 }
 
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, true);
 	struct block_cache_node *node = cache_find(iftype, devnum, start,
 						   blkcnt, blksz);
+
+	if (bdev)
+		cache_track(bdev, start, blkcnt);
 	if (node) {
 		const char *src = node->cache + (start - node->start) * blksz;
 		memcpy(buffer, src, blksz * blkcnt);
 		debug("hit: start " LBAF ", count " LBAFU "\n",
 		      start, blkcnt);
 		++_stats.hits;
+		if (bdev)
+			bdev->stats.hits++;
 		return 1;
 	}
 
 	debug("miss: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
 	++_stats.misses;
+	if (bdev)
+		bdev->stats.misses++;
 	return 0;
 }
 
+lbaint_t blkcache_readahead(int iftype, int devnum, lbaint_t start,
+			    lbaint_t blkcnt)
+{
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, false);
+
+	if (!bdev || !bdev->seq || !_stats.max_readahead || !_stats.max_entries ||
+	    blkcnt > _stats.max_blocks_per_entry)
+		return 0;
+
+	/* Ramp up the window for as long as access remains sequential */
+	if (bdev->window)
+		bdev->window = min(bdev->window * 2, _stats.max_readahead);
+	else
+		bdev->window = min_t(uint, BLKCACHE_RA_MIN,
+				     _stats.max_readahead);
+	bdev->ra_start = start;
+	debug("readahead: start " LBAF ", count " LBAFU " + %u\n", start,
+	      blkcnt, bdev->window);
+
+	return bdev->window;
+}
+
+void blkcache_readahead_cancel(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, false);
+
+	if (!bdev)
+		return;
+
+	/* Start again from the smallest window if access stays sequential */
+	bdev->ra_start = -1;
+	bdev->window = 0;
+}
+
 void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, false);
 	struct block_cache_node *node;
+	bool readahead = false;
+	lbaint_t bytes;
+
+	if (bdev && bdev->ra_start == start) {
+		readahead = true;
+		bdev->ra_start = -1;
+	}
 
-	/* don't cache big stuff */
-	if (blkcnt > _stats.max_blocks_per_entry)
+	/* don't cache big stuff, unless it was read ahead for us */
+	if (blkcnt > (readahead ? cache_max_blocks() :
+		      _stats.max_blocks_per_entry))
 		return;
 
 	if (_stats.max_entries == 0)
 		return;
 
 	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
-		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
-			free(node->cache);
-			node->cache = 0;
-		}
-	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
-	}
+	if (bytes > _stats.max_size)
+		return;
 
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
-			return;
-		}
-	}
+	/* pop LRU entries until there is room */
+	while (!list_empty(&block_cache) &&
+	       (_stats.entries >= _stats.max_entries ||
+		_stats.size + bytes > _stats.max_size))
+		cache_drop(list_last_entry(&block_cache,
+					   struct block_cache_node, lh));
+
+	node = malloc(sizeof(*node) + bytes);
+	if (!node)
+		return;
 
 	debug("fill: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
@@ -123,22 +288,34 @@ void blkcache_fill(int iftype, int devnum,
 	node->blksz = blksz;
 	memcpy(node->cache, buffer, bytes);
 	list_add(&node->lh, &block_cache);
+	hlist_add_head(&node->hash, cache_bucket(iftype, devnum,
+						 start >> cache_span_shift()));
 	_stats.entries++;
+	_stats.size += bytes;
+	if (readahead) {
+		_stats.readaheads++;
+		if (bdev)
+			bdev->stats.readaheads++;
+	}
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
-	struct list_head *entry, *n;
-	struct block_cache_node *node;
+	struct block_cache_node *node, *n;
+	struct block_cache_dev *bdev;
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
+	list_for_each_entry_safe(node, n, &block_cache, lh) {
 		if (iftype == -1 ||
-		    (node->iftype == iftype && node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
-			--_stats.entries;
+		    (node->iftype == iftype && node->devnum == devnum))
+			cache_drop(node);
+	}
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (iftype == -1 || (bdev->stats.iftype == iftype &&
+				     bdev->stats.devnum == devnum)) {
+			bdev->seq = 0;
+			bdev->window = 0;
+			bdev->ra_start = -1;
 		}
 	}
 }
@@ -155,16 +332,54 @@ void blkcache_configure(unsigned blocks, unsigned entries)
 
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.readaheads = 0;
+}
+
+void blkcache_configure_size(unsigned long max_size, unsigned max_readahead)
+{
+	if (max_size < _stats.size || max_readahead != _stats.max_readahead)
+		blkcache_invalidate(-1, 0);
+
+	_stats.max_size = max_size;
+	_stats.max_readahead = max_readahead;
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
 {
+	struct block_cache_dev *bdev;
+
 	memcpy(stats, &_stats, sizeof(*stats));
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.readaheads = 0;
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		bdev->stats.hits = 0;
+		bdev->stats.misses = 0;
+		bdev->stats.readaheads = 0;
+	}
+}
+
+int blkcache_dev_stats(int seq, struct block_cache_dev_stats *stats)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (!seq--) {
+			memcpy(stats, &bdev->stats, sizeof(*stats));
+			return 0;
+		}
+	}
+
+	return -ENOENT;
 }
 
 void blkcache_free(void)
 {
+	struct block_cache_dev *bdev, *n;
+
 	blkcache_invalidate(-1, 0);
+	list_for_each_entry_safe(bdev, n, &block_cache_devs, lh) {
+		list_del(&bdev->lh);
+		free(bdev);
+	}
 }
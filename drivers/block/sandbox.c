@@ -52,13 +52,79 @@ static unsigned long host_block_write(struct udevice *dev,
 	return -EIO;
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/* Number of requests which can be queued, and blocks per request */
+#define HOST_BLK_QUEUE_DEPTH	4
+#define HOST_BLK_MAX_BLKS	8
+
+/**
+ * struct host_blk_priv - Private data for the host block device
+ *
+ * @pending: Requests which have been submitted but not yet carried out
+ * @count: Number of entries in @pending
+ */
+struct host_blk_priv {
+	struct blk_req *pending[HOST_BLK_QUEUE_DEPTH];
+	int count;
+};
+
+static int host_block_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+
+	if (priv->count == HOST_BLK_QUEUE_DEPTH)
+		return -EBUSY;
+	priv->pending[priv->count++] = req;
+
+	return 0;
+}
+
+/*
+ * Complete the most recently submitted request first, so that callers cannot
+ * rely on requests completing in the order they were submitted
+ */
+static int host_block_poll(struct udevice *dev)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+	struct blk_req *req;
+
+	if (!priv->count)
+		return 0;
+	req = priv->pending[--priv->count];
+	if (req->op == BLK_REQ_WRITE)
+		req->result = host_block_write(dev, req->start, req->blkcnt,
+					       req->buffer);
+	else
+		req->result = host_block_read(dev, req->start, req->blkcnt,
+					      req->buffer);
+	req->done = true;
+
+	return 1;
+}
+
+static int host_block_probe(struct udevice *dev)
+{
+	blk_queue_setup(dev, HOST_BLK_QUEUE_DEPTH, HOST_BLK_MAX_BLKS);
+
+	return 0;
+}
+#endif
+
 static const struct blk_ops sandbox_host_blk_ops = {
 	.read	= host_block_read,
 	.write	= host_block_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= host_block_submit,
+	.poll	= host_block_poll,
+#endif
 };
 
 U_BOOT_DRIVER(sandbox_host_blk) = {
 	.name		= "sandbox_host_blk",
 	.id		= UCLASS_BLK,
 	.ops		= &sandbox_host_blk_ops,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.probe		= host_block_probe,
+	.priv_auto	= sizeof(struct host_blk_priv),
+#endif
 };
@@ -298,6 +298,7 @@ void fastboot_block_write_sparse_image(struct blk_desc *dev_desc, struct disk_pa
 	sparse.size = info->size;
 	sparse.write = fb_block_sparse_write;
 	sparse.reserve = fb_block_sparse_reserve;
+	sparse.fill = NULL;
 	sparse.mssg = fastboot_fail;
 
 	printf("Flashing sparse image at offset " LBAFU "\n",
@@ -117,6 +117,27 @@ static lbaint_t fb_spi_flash_sparse_write(struct sparse_storage *info,
 	return blkcnt;
 }
 
+/* Erased flash reads as all ones, so such a fill needs no writing */
+static lbaint_t fb_spi_flash_sparse_fill(struct sparse_storage *info,
+					 lbaint_t blk, lbaint_t blkcnt,
+					 u32 fill_val)
+{
+	size_t len = blkcnt * info->blksz;
+	u32 offset = blk * info->blksz;
+	int ret;
+
+	if (fill_val != 0xffffffff)
+		return -ENOSYS;
+
+	ret = spi_flash_erase(flash, offset, ROUND(len, flash->erase_size));
+	if (ret < 0) {
+		printf("Failed to erase sparse chunk (%d)\n", ret);
+		return ret;
+	}
+
+	return blkcnt;
+}
+
 static lbaint_t fb_spi_flash_sparse_reserve(struct sparse_storage *info,
 					    lbaint_t blk, lbaint_t blkcnt)
 {
@@ -185,6 +206,7 @@ void fastboot_spi_flash_write(const char *cmd, void *download_buffer,
 		sparse.size = part_info.size / sparse.blksz;
 		sparse.write = fb_spi_flash_sparse_write;
 		sparse.reserve = fb_spi_flash_sparse_reserve;
+		sparse.fill = fb_spi_flash_sparse_fill;
 		sparse.mssg = fastboot_fail;
 
 		printf("Flashing sparse image at offset " LBAFU "\n",
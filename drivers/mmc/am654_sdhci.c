@@ -81,6 +81,9 @@
 #define DRIVER_STRENGTH_100_OHM	0x3
 #define DRIVER_STRENGTH_40_OHM	0x4
 
+/* The CQHCI registers follow the standard SDHCI ones in the same window */
+#define AM654_SDHCI_CQE_OFFSET	0x200
+
 #define AM654_SDHCI_MIN_FREQ	400000
 #define CLOCK_TOO_SLOW_HZ	50000000
 
@@ -522,6 +525,30 @@ static int am654_sdhci_execute_tuning(struct mmc *mmc, u8 opcode)
 
 	return 0;
 }
+
+static int am654_sdhci_get_tuning(struct sdhci_host *host, u32 *tap)
+{
+	struct am654_sdhci_plat *plat = dev_get_plat(host->mmc->dev);
+
+	*tap = plat->itap_del_sel[host->mmc->selected_mode];
+
+	return 0;
+}
+
+static int am654_sdhci_set_tuning(struct sdhci_host *host, u32 tap)
+{
+	struct am654_sdhci_plat *plat = dev_get_plat(host->mmc->dev);
+	int mode = host->mmc->selected_mode;
+
+	if (tap > ITAPDLY_LAST_INDEX)
+		return -EINVAL;
+
+	plat->itap_del_ena[mode] = ENABLE;
+	plat->itap_del_sel[mode] = tap;
+	am654_sdhci_write_itapdly(plat, tap, plat->itap_del_ena[mode]);
+
+	return 0;
+}
 #endif
 
 void am654_sdhci_set_control_reg(struct sdhci_host *host)
@@ -542,6 +569,8 @@ void am654_sdhci_set_control_reg(struct sdhci_host *host)
 const struct sdhci_ops am654_sdhci_ops = {
 #if CONFIG_IS_ENABLED(MMC_SUPPORTS_TUNING)
 	.platform_execute_tuning = am654_sdhci_execute_tuning,
+	.get_tuning		= am654_sdhci_get_tuning,
+	.set_tuning		= am654_sdhci_set_tuning,
 #endif
 	.deferred_probe		= am654_sdhci_deferred_probe,
 	.set_ios_post		= &am654_sdhci_set_ios_post,
@@ -602,6 +631,8 @@ static int j721e_4bit_sdhci_set_ios_post(struct sdhci_host *host)
 const struct sdhci_ops j721e_4bit_sdhci_ops = {
 #if CONFIG_IS_ENABLED(MMC_SUPPORTS_TUNING)
 	.platform_execute_tuning = am654_sdhci_execute_tuning,
+	.get_tuning		= am654_sdhci_get_tuning,
+	.set_tuning		= am654_sdhci_set_tuning,
 #endif
 	.deferred_probe		= am654_sdhci_deferred_probe,
 	.set_ios_post		= &j721e_4bit_sdhci_set_ios_post,
@@ -737,6 +768,10 @@ static int am654_sdhci_of_to_plat(struct udevice *dev)
 	host->name = dev->name;
 	host->ioaddr = dev_read_addr_ptr(dev);
 	plat->non_removable = dev_read_bool(dev, "non-removable");
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+	if (host->ioaddr && dev_read_bool(dev, "supports-cqe"))
+		host->cqe_ioaddr = host->ioaddr + AM654_SDHCI_CQE_OFFSET;
+#endif
 
 	if (plat->flags & DLL_PRESENT) {
 		ret = dev_read_u32(dev, "ti,trm-icp", &plat->trm_icp);
@@ -8,6 +8,7 @@
 #define LOG_CATEGORY UCLASS_MMC
 
 #include <bootdev.h>
+#include <event.h>
 #include <log.h>
 #include <mmc.h>
 #include <dm.h>
@@ -15,6 +16,7 @@
 #include <dm/device_compat.h>
 #include <dm/lists.h>
 #include <linux/compat.h>
+#include <uthread.h>
 #include "mmc_private.h"
 
 static int dm_mmc_get_b_max(struct udevice *dev, void *dst, lbaint_t blkcnt)
@@ -178,6 +180,63 @@ int mmc_hs400_prepare_ddr(struct mmc *mmc)
 	return dm_mmc_hs400_prepare_ddr(mmc->dev);
 }
 
+#if CONFIG_IS_ENABLED(MMC_CQE)
+static int dm_mmc_cqe_read(struct udevice *dev, lbaint_t start,
+			   lbaint_t blkcnt, void *dst)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->cqe_read)
+		return -ENOSYS;
+
+	return ops->cqe_read(dev, start, blkcnt, dst);
+}
+
+int mmc_cqe_read(struct mmc *mmc, lbaint_t start, lbaint_t blkcnt, void *dst)
+{
+	return dm_mmc_cqe_read(mmc->dev, start, blkcnt, dst);
+}
+
+bool mmc_cqe_supported(struct mmc *mmc)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(mmc->dev);
+
+	return ops->cqe_read && (mmc->cfg->host_caps & MMC_CAP_CQE);
+}
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+static int dm_mmc_get_tuning(struct udevice *dev, u32 *tap)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->get_tuning)
+		return -ENOSYS;
+
+	return ops->get_tuning(dev, tap);
+}
+
+int mmc_get_tuning(struct mmc *mmc, u32 *tap)
+{
+	return dm_mmc_get_tuning(mmc->dev, tap);
+}
+
+static int dm_mmc_set_tuning(struct udevice *dev, u32 tap)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(dev);
+
+	if (!ops->set_tuning)
+		return -ENOSYS;
+
+	return ops->set_tuning(dev, tap);
+}
+
+int mmc_set_tuning(struct mmc *mmc, u32 tap)
+{
+	return dm_mmc_set_tuning(mmc->dev, tap);
+}
+#endif
+
 static int dm_mmc_host_power_cycle(struct udevice *dev)
 {
 	struct dm_mmc_ops *ops = mmc_get_ops(dev);
@@ -390,6 +449,46 @@ void mmc_do_preinit(void)
 	}
 }
 
+#if CONFIG_IS_ENABLED(MMC_PARALLEL_INIT)
+static void mmc_init_thread(void *arg)
+{
+	mmc_init(arg);
+}
+
+/*
+ * Bring up every card at once, switching between them whenever one of them
+ * waits. This runs once the environment is loaded so that cached bus
+ * setups can be used. Errors are reported again when a card is first used.
+ */
+static int mmc_init_all(void)
+{
+	unsigned int grp_id = uthread_grp_new_id();
+	struct udevice *dev;
+	struct uclass *uc;
+	int ret;
+
+	ret = uclass_get(UCLASS_MMC, &uc);
+	if (ret)
+		return 0;
+
+	uclass_foreach_dev(dev, uc) {
+		struct mmc *m = mmc_get_mmc_dev(dev);
+
+		if (!m || !device_active(dev) || m->has_init || !mmc_getcd(m))
+			continue;
+
+		if (uthread_create(NULL, mmc_init_thread, m, 0, grp_id))
+			mmc_init(m);
+	}
+
+	while (!uthread_grp_done(grp_id))
+		uthread_schedule();
+
+	return 0;
+}
+EVENT_SPY_SIMPLE(EVT_SETTINGS_R, mmc_init_all);
+#endif
+
 #if !defined(CONFIG_XPL_BUILD) || defined(CONFIG_SPL_LIBCOMMON_SUPPORT)
 void print_mmc_devices(char separator)
 {
@@ -496,8 +595,10 @@ static int mmc_select_hwpart(struct udevice *bdev, int hwpart)
 		return -EMEDIUMTYPE;
 
 	ret = mmc_switch_part(mmc, hwpart);
-	if (!ret)
+	if (!ret) {
 		blkcache_invalidate(desc->uclass_id, desc->devnum);
+		blk_mark_changed(desc);
+	}
 
 	return ret;
 }
@@ -27,6 +27,7 @@
 #include <linux/list.h>
 #include <linux/printk.h>
 #include <div64.h>
+#include <uthread.h>
 #include "mmc_private.h"
 
 #define DEFAULT_CMD6_TIMEOUT_MS  500
@@ -68,6 +69,15 @@ const char *emmc_hwpart_names[] = {
 
 static int mmc_set_signal_voltage(struct mmc *mmc, uint signal_voltage);
 
+#if CONFIG_IS_ENABLED(UTHREAD)
+/*
+ * Cards brought up in parallel may share a regulator, or the PMIC bus behind
+ * it, and a thread can yield in the middle of a transfer. Let only one card
+ * at a time touch its supplies.
+ */
+static struct uthread_mutex mmc_supply_mutex = UTHREAD_MUTEX_INITIALIZER;
+#endif
+
 #if !CONFIG_IS_ENABLED(DM_MMC)
 
 static int mmc_wait_dat0(struct mmc *mmc, int state, int timeout_us)
@@ -493,6 +503,64 @@ static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
 	return blkcnt;
 }
 
+#if CONFIG_IS_ENABLED(MMC_CQE)
+/*
+ * The card would not leave command queue mode, so legacy commands fail. Reset
+ * it and select the partition again, and stop using the engine.
+ */
+static int mmc_cqe_recover(struct mmc *mmc, struct blk_desc *block_dev)
+{
+	int err;
+
+	log_warning("eMMC stuck in command queue mode, resetting it\n");
+	mmc->has_init = 0;
+	err = mmc_init(mmc);
+	mmc->cmdq_depth = 0;
+	if (!err)
+		err = mmc_switch_part(mmc, block_dev->hwpart);
+	if (!err)
+		err = mmc_set_blocklen(mmc, mmc->read_bl_len);
+
+	return err;
+}
+
+/*
+ * Read blocks with the card in command queue mode and the host's engine
+ * queueing the tasks. Returns -ENOSYS if the normal path should be used,
+ * including when the queued read failed and can be tried again that way.
+ */
+static int mmc_read_blocks_cqe(struct mmc *mmc, struct blk_desc *block_dev,
+			       void *dst, lbaint_t start, lbaint_t blkcnt)
+{
+	int err, ret;
+
+	if (!mmc->cmdq_depth || !mmc->high_capacity ||
+	    block_dev->hwpart == MMC_PART_RPMB || blkcnt < MMC_CQE_MIN_BLKS ||
+	    !mmc_cqe_supported(mmc))
+		return -ENOSYS;
+
+	if (mmc_switch(mmc, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_CMDQ_MODE_EN, 1))
+		return -ENOSYS;
+
+	ret = mmc_cqe_read(mmc, start, blkcnt, dst);
+	/* Don't try again on hosts without an engine */
+	if (ret == -ENOSYS)
+		mmc->cmdq_depth = 0;
+
+	err = mmc_switch(mmc, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_CMDQ_MODE_EN, 0);
+	if (err)
+		err = mmc_switch(mmc, EXT_CSD_CMD_SET_NORMAL,
+				 EXT_CSD_CMDQ_MODE_EN, 0);
+	if (err) {
+		err = mmc_cqe_recover(mmc, block_dev);
+		if (err)
+			return err;
+	}
+
+	return ret ? -ENOSYS : 0;
+}
+#endif
+
 #if !CONFIG_IS_ENABLED(DM_MMC)
 static int mmc_get_b_max(struct mmc *mmc, void *dst, lbaint_t blkcnt)
 {
@@ -546,6 +614,16 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 		return 0;
 	}
 
+#if CONFIG_IS_ENABLED(MMC_CQE)
+	err = mmc_read_blocks_cqe(mmc, block_dev, dst, start, blkcnt);
+	if (!err)
+		return blkcnt;
+	if (err != -ENOSYS) {
+		pr_debug("%s: Failed to read blocks through CQE\n", __func__);
+		return 0;
+	}
+#endif
+
 	b_max = mmc_get_b_max(mmc, dst, blkcnt);
 
 	do {
@@ -1778,7 +1856,10 @@ static int mmc_set_signal_voltage(struct mmc *mmc, uint signal_voltage)
 		return 0;
 
 	mmc->signal_voltage = signal_voltage;
+	/* the host switches its I/O supply here */
+	uthread_mutex_lock(&mmc_supply_mutex);
 	err = mmc_set_ios(mmc);
+	uthread_mutex_unlock(&mmc_supply_mutex);
 	if (err)
 		pr_debug("unable to set voltage (err %d)\n", err);
 
@@ -1791,6 +1872,34 @@ static inline int mmc_set_signal_voltage(struct mmc *mmc, uint signal_voltage)
 }
 #endif
 
+#if CONFIG_IS_ENABLED(MMC_SUPPORTS_TUNING)
+/*
+ * Tune the bus in the current mode. A tuning value cached for this eMMC is
+ * applied instead if the host can restore it: the ext_csd compare done
+ * after selecting the mode catches a value that no longer works. SD cards
+ * have no such check, so they are always tuned.
+ */
+static int mmc_tune(struct mmc *mmc, uint opcode)
+{
+	int err;
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	struct mmc_init_cache *c = &mmc->init_cache;
+
+	if (!IS_SD(mmc) && c->valid && c->has_tap &&
+	    !mmc_set_tuning(mmc, c->tap))
+		return 0;
+#endif
+
+	err = mmc_execute_tuning(mmc, opcode);
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	if (!err)
+		c->has_tap = !mmc_get_tuning(mmc, &c->tap);
+#endif
+
+	return err;
+}
+#endif
+
 #if !CONFIG_IS_ENABLED(MMC_TINY)
 static const struct mode_width_tuning sd_modes_by_pref[] = {
 #if CONFIG_IS_ENABLED(MMC_UHS_SUPPORT)
@@ -1904,8 +2013,7 @@ static int sd_select_mode_and_width(struct mmc *mmc, uint card_caps)
 #if CONFIG_IS_ENABLED(MMC_SUPPORTS_TUNING)
 				/* execute tuning if needed */
 				if (mwt->tuning && !mmc_host_is_spi(mmc)) {
-					err = mmc_execute_tuning(mmc,
-								 mwt->tuning);
+					err = mmc_tune(mmc, mwt->tuning);
 					if (err) {
 						pr_debug("tuning failed\n");
 						goto error;
@@ -2090,7 +2198,7 @@ static int mmc_select_hs400(struct mmc *mmc)
 
 	/* execute tuning if needed */
 	mmc->hs400_tuning = true;
-	err = mmc_execute_tuning(mmc, MMC_CMD_SEND_TUNING_BLOCK_HS200);
+	err = mmc_tune(mmc, MMC_CMD_SEND_TUNING_BLOCK_HS200);
 	mmc->hs400_tuning = false;
 	if (err) {
 		debug("tuning failed\n");
@@ -2283,8 +2391,7 @@ static int mmc_select_mode_and_width(struct mmc *mmc, uint card_caps)
 
 				/* execute tuning if needed */
 				if (mwt->tuning) {
-					err = mmc_execute_tuning(mmc,
-								 mwt->tuning);
+					err = mmc_tune(mmc, mwt->tuning);
 					if (err) {
 						pr_debug("tuning failed : %d\n", err);
 						goto error;
@@ -2324,6 +2431,46 @@ static int mmc_select_mode_and_width(struct mmc *mmc, uint card_caps)
 };
 #endif
 
+#if !CONFIG_IS_ENABLED(MMC_TINY)
+/*
+ * Select the bus mode and width. With MMC_INIT_CACHE the setup that worked
+ * last time for this card is tried on its own first, and the full list of
+ * modes is only worked through if that fails.
+ */
+static int mmc_select_bus(struct mmc *mmc)
+{
+	int (*select)(struct mmc *mmc, uint card_caps) =
+		IS_SD(mmc) ? sd_select_mode_and_width :
+			     mmc_select_mode_and_width;
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	struct mmc_init_cache *c = &mmc->init_cache;
+	int err;
+
+	mmc_init_cache_load(mmc);
+	if (c->valid && (mmc->card_caps & MMC_CAP(c->mode)) &&
+	    (mmc->card_caps & c->width)) {
+		pr_debug("trying cached mode %s width %d\n",
+			 mmc_mode_name(c->mode), bus_width(c->width));
+		err = select(mmc, MMC_CAP(c->mode) | c->width);
+		if (!err) {
+			mmc_init_cache_store(mmc);
+			return 0;
+		}
+	}
+	c->valid = false;
+	c->has_tap = false;
+
+	err = select(mmc, mmc->card_caps);
+	if (!err)
+		mmc_init_cache_store(mmc);
+
+	return err;
+#else
+	return select(mmc, mmc->card_caps);
+#endif
+}
+#endif
+
 #if CONFIG_IS_ENABLED(MMC_TINY)
 DEFINE_CACHE_ALIGN_BUFFER(u8, ext_csd_bkup, MMC_MAX_BLOCK_LEN);
 #endif
@@ -2406,6 +2553,13 @@ static int mmc_startup_v4(struct mmc *mmc)
 	if (mmc->version >= MMC_VERSION_4_5)
 		mmc->gen_cmd6_time = ext_csd[EXT_CSD_GENERIC_CMD6_TIME];
 
+#if CONFIG_IS_ENABLED(MMC_CQE)
+	mmc->cmdq_depth = 0;
+	if (mmc->version >= MMC_VERSION_5_1 &&
+	    (ext_csd[EXT_CSD_CMDQ_SUPPORT] & 0x1))
+		mmc->cmdq_depth = (ext_csd[EXT_CSD_CMDQ_DEPTH] & 0x1f) + 1;
+#endif
+
 	/* The partition data may be non-zero but it is only
 	 * effective if PARTITION_SETTING_COMPLETED is set in
 	 * EXT_CSD, so ignore any data if this bit is not set,
@@ -2739,12 +2893,12 @@ static int mmc_startup(struct mmc *mmc)
 		}
 #endif
 
-		err = sd_select_mode_and_width(mmc, mmc->card_caps);
+		err = mmc_select_bus(mmc);
 	} else {
 		err = mmc_get_capabilities(mmc);
 		if (err)
 			return err;
-		err = mmc_select_mode_and_width(mmc, mmc->card_caps);
+		err = mmc_select_bus(mmc);
 	}
 #endif
 	if (err)
@@ -2829,6 +2983,8 @@ static int mmc_power_init(struct mmc *mmc)
 #if CONFIG_IS_ENABLED(DM_REGULATOR)
 	int ret;
 
+	/* probing a regulator may talk to its PMIC */
+	uthread_mutex_lock(&mmc_supply_mutex);
 	ret = device_get_supply_regulator(mmc->dev, "vmmc-supply",
 					  &mmc->vmmc_supply);
 	if (ret)
@@ -2838,6 +2994,7 @@ static int mmc_power_init(struct mmc *mmc)
 					  &mmc->vqmmc_supply);
 	if (ret)
 		pr_debug("%s: No vqmmc supply\n", mmc->dev->name);
+	uthread_mutex_unlock(&mmc_supply_mutex);
 #endif
 #else /* !CONFIG_DM_MMC */
 	/*
@@ -2870,7 +3027,7 @@ static void mmc_set_initial_state(struct mmc *mmc)
 	mmc_set_clock(mmc, 0, MMC_CLK_ENABLE);
 }
 
-static int mmc_power_on(struct mmc *mmc)
+static int mmc_power_on_supplies(struct mmc *mmc)
 {
 #if CONFIG_IS_ENABLED(DM_MMC) && CONFIG_IS_ENABLED(DM_REGULATOR)
 	if (mmc->vmmc_supply) {
@@ -2896,9 +3053,19 @@ static int mmc_power_on(struct mmc *mmc)
 	return 0;
 }
 
-static int mmc_power_off(struct mmc *mmc)
+static int mmc_power_on(struct mmc *mmc)
+{
+	int ret;
+
+	uthread_mutex_lock(&mmc_supply_mutex);
+	ret = mmc_power_on_supplies(mmc);
+	uthread_mutex_unlock(&mmc_supply_mutex);
+
+	return ret;
+}
+
+static int mmc_power_off_supplies(struct mmc *mmc)
 {
-	mmc_set_clock(mmc, 0, MMC_CLK_DISABLE);
 #if CONFIG_IS_ENABLED(DM_MMC) && CONFIG_IS_ENABLED(DM_REGULATOR)
 	if (mmc->vmmc_supply) {
 		int ret = regulator_set_enable_if_allowed(mmc->vmmc_supply,
@@ -2923,6 +3090,18 @@ static int mmc_power_off(struct mmc *mmc)
 	return 0;
 }
 
+static int mmc_power_off(struct mmc *mmc)
+{
+	int ret;
+
+	mmc_set_clock(mmc, 0, MMC_CLK_DISABLE);
+	uthread_mutex_lock(&mmc_supply_mutex);
+	ret = mmc_power_off_supplies(mmc);
+	uthread_mutex_unlock(&mmc_supply_mutex);
+
+	return ret;
+}
+
 static int mmc_power_cycle(struct mmc *mmc)
 {
 	int ret;
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Cache of the bus setup that last worked for each MMC/SD card
+ *
+ * The setup is kept in the environment variable mmc<seq>_bus, where <seq> is
+ * the sequence number of the controller. Its value is the card's CID as 32
+ * hex digits, then the bus mode (enum bus_mode), the bus width and, if the
+ * host reported one, its tuning value in hex:
+ *
+ *	<cid>,<mode>,<width>[,<tap>]
+ *
+ * A value for another card is ignored. Once the environment is saved, later
+ * boots try the remembered setup first instead of working down the mode
+ * list and tuning the bus again.
+ */
+
+#include <dm.h>
+#include <env.h>
+#include <mmc.h>
+#include <vsprintf.h>
+#include <asm/global_data.h>
+#include <linux/string.h>
+#include "mmc_private.h"
+
+DECLARE_GLOBAL_DATA_PTR;
+
+/* 32 CID digits plus three short fields */
+#define MMC_INIT_CACHE_LEN	64
+
+static void mmc_init_cache_name(struct mmc *mmc, char *name, int size)
+{
+	snprintf(name, size, "mmc%d_bus", dev_seq(mmc->dev));
+}
+
+static void mmc_init_cache_cid(struct mmc *mmc, char *buf, int size)
+{
+	snprintf(buf, size, "%08x%08x%08x%08x", mmc->cid[0], mmc->cid[1],
+		 mmc->cid[2], mmc->cid[3]);
+}
+
+void mmc_init_cache_load(struct mmc *mmc)
+{
+	struct mmc_init_cache *c = &mmc->init_cache;
+	char name[16], cid[36];
+	const char *val;
+	ulong mode, width;
+	char *end;
+
+	memset(c, '\0', sizeof(*c));
+
+	/* The environment may live on this very card */
+	if (!(gd->flags & GD_FLG_ENV_READY))
+		return;
+
+	mmc_init_cache_name(mmc, name, sizeof(name));
+	val = env_get(name);
+	if (!val)
+		return;
+
+	mmc_init_cache_cid(mmc, cid, sizeof(cid));
+	if (strncmp(val, cid, 32) || val[32] != ',')
+		return;
+
+	mode = simple_strtoul(val + 33, &end, 10);
+	if (*end != ',' || mode >= MMC_MODES_END)
+		return;
+
+	width = simple_strtoul(end + 1, &end, 10);
+	switch (width) {
+	case 8:
+		c->width = MMC_MODE_8BIT;
+		break;
+	case 4:
+		c->width = MMC_MODE_4BIT;
+		break;
+	case 1:
+		c->width = MMC_MODE_1BIT;
+		break;
+	default:
+		return;
+	}
+
+	if (*end == ',') {
+		c->tap = hextoul(end + 1, &end);
+		c->has_tap = true;
+	}
+	if (*end) {
+		c->has_tap = false;
+		return;
+	}
+
+	c->mode = mode;
+	c->valid = true;
+}
+
+void mmc_init_cache_store(struct mmc *mmc)
+{
+	struct mmc_init_cache *c = &mmc->init_cache;
+	char name[16], val[MMC_INIT_CACHE_LEN];
+	const char *old;
+	int len;
+
+	if (!(gd->flags & GD_FLG_ENV_READY))
+		return;
+
+	mmc_init_cache_cid(mmc, val, sizeof(val));
+	len = strlen(val);
+	len += snprintf(val + len, sizeof(val) - len, ",%d,%u",
+			mmc->selected_mode, mmc->bus_width);
+	if (c->has_tap)
+		snprintf(val + len, sizeof(val) - len, ",%x", c->tap);
+
+	mmc_init_cache_name(mmc, name, sizeof(name));
+	old = env_get(name);
+	if (old && !strcmp(old, val))
+		return;
+
+	env_set(name, val);
+}
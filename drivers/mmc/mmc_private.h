@@ -17,6 +17,9 @@ int mmc_poll_for_busy(struct mmc *mmc, int timeout);
 
 int mmc_set_blocklen(struct mmc *mmc, int len);
 
+/* Below two full tasks the CMD6 round trips cost more than queueing saves */
+#define MMC_CQE_MIN_BLKS	4096
+
 #if CONFIG_IS_ENABLED(BLK)
 ulong mmc_bread(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 		void *dst);
@@ -132,4 +135,26 @@ int mmc_switch_part(struct mmc *mmc, unsigned int part_num);
  */
 int mmc_switch(struct mmc *mmc, u8 set, u8 index, u8 value);
 
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+/**
+ * mmc_init_cache_load() - Look up the bus setup cached for the current card
+ *
+ * Fills in @mmc->init_cache, which is left invalid if nothing is cached for
+ * this card or the environment is not available yet.
+ *
+ * @mmc:	MMC device, with the CID already read
+ */
+void mmc_init_cache_load(struct mmc *mmc);
+
+/**
+ * mmc_init_cache_store() - Remember the bus setup that is in use
+ *
+ * Updates the environment variable if the setup has changed. The
+ * environment is not saved.
+ *
+ * @mmc:	MMC device
+ */
+void mmc_init_cache_store(struct mmc *mmc);
+#endif
+
 #endif /* _MMC_PRIVATE_H_ */
@@ -298,6 +298,10 @@ static int msm_of_to_plat(struct udevice *dev)
 	if (ret)
 		host->index = 0;
 	priv->base = dev_read_addr_index_ptr(dev, 1);
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+	if (dev_read_bool(dev, "supports-cqe"))
+		host->cqe_ioaddr = dev_read_addr_name_ptr(dev, "cqhci");
+#endif
 
 	if (!host->ioaddr)
 		return -EINVAL;
@@ -12,6 +12,7 @@
 #include <mmc.h>
 #include <os.h>
 #include <asm/test.h>
+#include "mmc_private.h"
 
 struct sandbox_mmc_plat {
 	struct mmc_config cfg;
@@ -26,10 +27,16 @@ struct sandbox_mmc_plat {
 /* Granularity of priv->csize - this is 1MB */
 #define SIZE_MULTIPLE		((1 << (MMC_CMULT + 2)) * MMC_BL_LEN)
 
+/* Room for a queued read of MMC_CQE_MIN_BLKS blocks */
+#define CQE_CARD_SIZE		(4 * SIZE_MULTIPLE)
+
 struct sandbox_mmc_priv {
 	char *buf;
 	int csize;	/* CSIZE value to report */
 	int size;
+	int cqe_err;	/* error to return from the engine */
+	bool cqe_stuck;	/* card refuses to leave command queue mode */
+	int cqe_reads;	/* number of reads sent to the engine */
 };
 
 /**
@@ -44,6 +51,13 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
 	static ulong erase_start, erase_end;
 
+	if (cmd->cmdidx == MMC_CMD_GO_IDLE_STATE)
+		priv->cqe_stuck = false;
+	if (priv->cqe_stuck && cmd->cmdidx == MMC_CMD_SWITCH && !data &&
+	    cmd->cmdarg == ((MMC_SWITCH_MODE_WRITE_BYTE << 24) |
+			    (EXT_CSD_CMDQ_MODE_EN << 16)))
+		return -ETIMEDOUT;
+
 	switch (cmd->cmdidx) {
 	case MMC_CMD_ALL_SEND_CID:
 		memset(cmd->response, '\0', sizeof(cmd->response));
@@ -138,10 +152,59 @@ static int sandbox_mmc_get_cd(struct udevice *dev)
 	return 1;
 }
 
+#if CONFIG_IS_ENABLED(MMC_CQE)
+static int sandbox_mmc_cqe_read(struct udevice *dev, lbaint_t start,
+				lbaint_t blkcnt, void *dst)
+{
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+
+	priv->cqe_reads++;
+	if (priv->cqe_err)
+		return priv->cqe_err;
+	memcpy(dst, &priv->buf[start * mmc->read_bl_len],
+	       blkcnt * mmc->read_bl_len);
+
+	return 0;
+}
+
+int sandbox_mmc_set_cqe(struct udevice *dev, int err, bool stuck)
+{
+	struct sandbox_mmc_plat *plat = dev_get_plat(dev);
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+	char *buf;
+
+	priv->cqe_err = err;
+	priv->cqe_stuck = stuck;
+	if (plat->fname || priv->size >= CQE_CARD_SIZE)
+		return 0;
+
+	buf = realloc(priv->buf, CQE_CARD_SIZE);
+	if (!buf)
+		return -ENOMEM;
+	memset(buf + priv->size, '\0', CQE_CARD_SIZE - priv->size);
+	priv->buf = buf;
+	priv->size = CQE_CARD_SIZE;
+	priv->csize = priv->size / SIZE_MULTIPLE - 1;
+
+	return 0;
+}
+
+int sandbox_mmc_get_cqe_reads(struct udevice *dev)
+{
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+
+	return priv->cqe_reads;
+}
+#endif
+
 static const struct dm_mmc_ops sandbox_mmc_ops = {
 	.send_cmd = sandbox_mmc_send_cmd,
 	.set_ios = sandbox_mmc_set_ios,
 	.get_cd = sandbox_mmc_get_cd,
+#if CONFIG_IS_ENABLED(MMC_CQE)
+	.cqe_read = sandbox_mmc_cqe_read,
+#endif
 };
 
 static int sandbox_mmc_of_to_plat(struct udevice *dev)
@@ -213,6 +276,8 @@ static int sandbox_mmc_bind(struct udevice *dev)
 
 	cfg->name = dev->name;
 	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT;
+	if (CONFIG_IS_ENABLED(MMC_CQE))
+		cfg->host_caps |= MMC_CAP_CQE;
 	cfg->voltages = MMC_VDD_165_195 | MMC_VDD_32_33 | MMC_VDD_33_34;
 	cfg->f_min = 1000000;
 	cfg->f_max = 52000000;
@@ -4,6 +4,7 @@
  */
 
 #include <cpu_func.h>
+#include <errno.h>
 #include <sdhci.h>
 #include <malloc.h>
 #include <asm/cache.h>
@@ -39,6 +40,57 @@ static inline void __sdhci_adma_write_desc(struct sdhci_host *host,
 		sdhci_adma_write_desc(host, desc, addr, len, end);
 }
 
+/**
+ * sdhci_prepare_adma_table_sg() - Populate the ADMA table from a scatter list
+ *
+ * @host:	Pointer to the sdhci_host
+ * @table:	Pointer to the ADMA table
+ * @sg:		Segments to transfer, in order
+ * @nents:	Number of entries in @sg, must be at least one
+ * @max_desc:	Number of descriptors @table has room for
+ *
+ * Fill the ADMA table with one chain covering all of the segments. Segments
+ * longer than ADMA_MAX_LEN are split over several descriptors and only the
+ * last descriptor of the last segment is marked as the end of the chain.
+ *
+ * Return: 0 if OK, -E2BIG if the segments need more than @max_desc
+ * descriptors
+ */
+int sdhci_prepare_adma_table_sg(struct sdhci_host *host,
+				struct sdhci_adma_desc *table,
+				const struct sdhci_adma_sg *sg, int nents,
+				uint max_desc)
+{
+	void *next_desc = table;
+	uint count = 0;
+	int i;
+
+	for (i = 0; i < nents; i++)
+		count += DIV_ROUND_UP(sg[i].len, ADMA_MAX_LEN);
+	if (!count || count > max_desc)
+		return -E2BIG;
+
+	for (i = 0; i < nents; i++) {
+		dma_addr_t addr = sg[i].addr;
+		uint len = sg[i].len;
+
+		while (len > ADMA_MAX_LEN) {
+			__sdhci_adma_write_desc(host, &next_desc, addr,
+						ADMA_MAX_LEN, false);
+			addr += ADMA_MAX_LEN;
+			len -= ADMA_MAX_LEN;
+		}
+		__sdhci_adma_write_desc(host, &next_desc, addr, len,
+					i == nents - 1);
+	}
+
+	flush_cache((phys_addr_t)table,
+		    ROUND(next_desc - (void *)table,
+			  ARCH_DMA_MINALIGN));
+
+	return 0;
+}
+
 /**
  * sdhci_prepare_adma_table() - Populate the ADMA table
  *
@@ -56,23 +108,13 @@ void sdhci_prepare_adma_table(struct sdhci_host *host,
 			      struct sdhci_adma_desc *table,
 			      struct mmc_data *data, dma_addr_t start_addr)
 {
-	dma_addr_t addr = start_addr;
-	uint trans_bytes = data->blocksize * data->blocks;
-	void *next_desc = table;
-	int i = DIV_ROUND_UP(trans_bytes, ADMA_MAX_LEN);
+	struct sdhci_adma_sg sg = {
+		.addr = start_addr,
+		.len = data->blocksize * data->blocks,
+	};
 
-	while (--i) {
-		__sdhci_adma_write_desc(host, &next_desc, addr,
-					ADMA_MAX_LEN, false);
-		addr += ADMA_MAX_LEN;
-		trans_bytes -= ADMA_MAX_LEN;
-	}
-
-	__sdhci_adma_write_desc(host, &next_desc, addr, trans_bytes, true);
-
-	flush_cache((phys_addr_t)table,
-		    ROUND(next_desc - (void *)table,
-			  ARCH_DMA_MINALIGN));
+	sdhci_prepare_adma_table_sg(host, table, &sg, 1,
+				    ADMA_TABLE_NO_ENTRIES);
 }
 
 /**
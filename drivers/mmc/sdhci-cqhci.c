@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * SDHCI command queue engine (CQHCI) support for eMMC 5.1 cards.
+ *
+ * Only queued reads are supported. Tasks are polled for completion, so no
+ * interrupt is needed. Direct commands (DCMD) are not used and the engine is
+ * disabled again after every request, leaving the legacy SDHCI path in
+ * charge of everything else.
+ */
+
+#include <cpu_func.h>
+#include <errno.h>
+#include <log.h>
+#include <malloc.h>
+#include <mmc.h>
+#include <sdhci.h>
+#include <time.h>
+#include <asm/cache.h>
+#include <asm/io.h>
+#include <linux/bitops.h>
+#include <linux/dma-mapping.h>
+
+#define CQHCI_CFG		0x08
+#define  CQHCI_ENABLE		BIT(0)
+#define  CQHCI_TASK_DESC_SZ	BIT(8)
+#define CQHCI_CTL		0x0c
+#define  CQHCI_HALT		BIT(0)
+#define  CQHCI_CLEAR_ALL_TASKS	BIT(8)
+#define CQHCI_IS		0x10
+#define  CQHCI_IS_HAC		BIT(0)
+#define  CQHCI_IS_TCC		BIT(1)
+#define  CQHCI_IS_RED		BIT(2)
+#define  CQHCI_IS_TCL		BIT(3)
+#define  CQHCI_IS_GCE		BIT(4)
+#define  CQHCI_IS_ICCE		BIT(5)
+#define  CQHCI_IS_MASK		(CQHCI_IS_TCC | CQHCI_IS_RED | \
+				 CQHCI_IS_GCE | CQHCI_IS_ICCE)
+#define  CQHCI_IS_ERR		(CQHCI_IS_RED | CQHCI_IS_GCE | CQHCI_IS_ICCE)
+#define CQHCI_ISTE		0x14
+#define CQHCI_TDLBA		0x20
+#define CQHCI_TDLBAU		0x24
+#define CQHCI_TDBR		0x28
+#define CQHCI_TCN		0x2c
+#define CQHCI_SSC2		0x44
+#define CQHCI_TERRI		0x54
+
+/* Task descriptor fields */
+#define CQHCI_VALID		BIT(0)
+#define CQHCI_END		BIT(1)
+#define CQHCI_INT		BIT(2)
+#define CQHCI_ACT_TASK		(0x5 << 3)
+#define CQHCI_DATA_DIR		BIT(12)
+#define CQHCI_BLK_COUNT(x)	((u64)((x) & 0xffff) << 16)
+#define CQHCI_BLK_ADDR(x)	((u64)((x) & 0xffffffff) << 32)
+
+#define CQHCI_MAX_SLOTS		32
+/* 1 MiB per task keeps the descriptor lists small */
+#define CQHCI_TASK_BLKS		2048
+#define CQHCI_TASK_DESCS	DIV_ROUND_UP(CQHCI_TASK_BLKS * \
+					     MMC_MAX_BLOCK_LEN, ADMA_MAX_LEN)
+#define CQHCI_TIMEOUT_US	1000000
+
+static inline void cqhci_writel(struct sdhci_host *host, u32 val, int reg)
+{
+	writel(val, host->cqe_ioaddr + reg);
+}
+
+static inline u32 cqhci_readl(struct sdhci_host *host, int reg)
+{
+	return readl(host->cqe_ioaddr + reg);
+}
+
+/*
+ * Task, link and transfer descriptors are all 128 bits wide when the host
+ * uses 64-bit ADMA, otherwise they are 64 bits
+ */
+static uint cqhci_desc_len(struct sdhci_host *host)
+{
+	return (host->flags & USE_ADMA64) ? 16 : 8;
+}
+
+static uint cqhci_slot_len(struct sdhci_host *host)
+{
+	return 2 * cqhci_desc_len(host);
+}
+
+/*
+ * The engine fixes the spacing of the task slots, so several share a cache
+ * line. Each transfer list gets whole cache lines of its own.
+ */
+static uint cqhci_tasks_len(struct sdhci_host *host)
+{
+	return ROUND(CQHCI_MAX_SLOTS * cqhci_slot_len(host), ARCH_DMA_MINALIGN);
+}
+
+static uint cqhci_trans_len(struct sdhci_host *host)
+{
+	return ROUND(CQHCI_TASK_DESCS * cqhci_desc_len(host),
+		     ARCH_DMA_MINALIGN);
+}
+
+/* Write one ADMA2-style descriptor: attributes, length and address */
+static void cqhci_write_desc(struct sdhci_host *host, void *desc, u32 attr,
+			     uint len, dma_addr_t addr)
+{
+	u32 *d = desc;
+
+	memset(desc, '\0', cqhci_desc_len(host));
+	d[0] = cpu_to_le32(attr | (len & 0xffff) << 16);
+	d[1] = cpu_to_le32(lower_32_bits(addr));
+	if (host->flags & USE_ADMA64)
+		d[2] = cpu_to_le32(upper_32_bits(addr));
+}
+
+/* Fill in the task in @slot and the transfer list it links to */
+static void cqhci_prep_task(struct sdhci_host *host, int slot, lbaint_t start,
+			    uint blocks, dma_addr_t addr)
+{
+	uint desc_len = cqhci_desc_len(host);
+	void *task = host->cqe_desc + slot * cqhci_slot_len(host);
+	void *trans = host->cqe_desc + cqhci_tasks_len(host) +
+		      slot * cqhci_trans_len(host);
+	dma_addr_t trans_addr = host->cqe_desc_addr + (trans - host->cqe_desc);
+	uint len = blocks * MMC_MAX_BLOCK_LEN;
+	void *desc = trans;
+	u64 *t = task;
+
+	while (len > ADMA_MAX_LEN) {
+		cqhci_write_desc(host, desc, ADMA_DESC_ATTR_VALID |
+				 ADMA_DESC_TRANSFER_DATA, ADMA_MAX_LEN, addr);
+		desc += desc_len;
+		addr += ADMA_MAX_LEN;
+		len -= ADMA_MAX_LEN;
+	}
+	cqhci_write_desc(host, desc, ADMA_DESC_ATTR_VALID | ADMA_DESC_ATTR_END |
+			 ADMA_DESC_TRANSFER_DATA, len, addr);
+	desc += desc_len;
+
+	memset(task, '\0', desc_len);
+	t[0] = cpu_to_le64(CQHCI_VALID | CQHCI_END | CQHCI_INT |
+			   CQHCI_ACT_TASK | CQHCI_DATA_DIR |
+			   CQHCI_BLK_COUNT(blocks) | CQHCI_BLK_ADDR(start));
+	cqhci_write_desc(host, task + desc_len,
+			 ADMA_DESC_ATTR_VALID | ADMA_DESC_LINK_DESC, 0,
+			 trans_addr);
+
+	/* The engine only reads the slots, so flushing a neighbour is harmless */
+	flush_cache(ALIGN_DOWN((ulong)task, ARCH_DMA_MINALIGN),
+		    ROUND(cqhci_slot_len(host), ARCH_DMA_MINALIGN));
+	flush_cache((ulong)trans, ROUND(desc - trans, ARCH_DMA_MINALIGN));
+}
+
+static int cqhci_enable(struct sdhci_host *host)
+{
+	u32 cfg = (host->flags & USE_ADMA64) ? CQHCI_TASK_DESC_SZ : 0;
+	u8 ctrl;
+
+	if (!host->cqe_desc) {
+		host->cqe_desc = memalign(ARCH_DMA_MINALIGN,
+					  cqhci_tasks_len(host) +
+					  CQHCI_MAX_SLOTS *
+					  cqhci_trans_len(host));
+		if (!host->cqe_desc)
+			return -ENOMEM;
+		host->cqe_desc_addr = virt_to_phys(host->cqe_desc);
+	}
+
+	/* The engine moves data with ADMA2 and fixed 512-byte blocks */
+	ctrl = sdhci_readb(host, SDHCI_HOST_CONTROL);
+	ctrl &= ~SDHCI_CTRL_DMA_MASK;
+	ctrl |= (host->flags & USE_ADMA64) ? SDHCI_CTRL_ADMA64 :
+					     SDHCI_CTRL_ADMA32;
+	sdhci_writeb(host, ctrl, SDHCI_HOST_CONTROL);
+	sdhci_writew(host, SDHCI_MAKE_BLKSZ(SDHCI_DEFAULT_BOUNDARY_ARG,
+					    MMC_MAX_BLOCK_LEN),
+		     SDHCI_BLOCK_SIZE);
+	sdhci_writel(host, SDHCI_INT_CQE | SDHCI_INT_ERROR_MASK,
+		     SDHCI_INT_ENABLE);
+	sdhci_writel(host, SDHCI_INT_ALL_MASK, SDHCI_INT_STATUS);
+
+	cqhci_writel(host, cfg, CQHCI_CFG);
+	cqhci_writel(host, lower_32_bits(host->cqe_desc_addr), CQHCI_TDLBA);
+	cqhci_writel(host, upper_32_bits(host->cqe_desc_addr), CQHCI_TDLBAU);
+	cqhci_writel(host, host->mmc->rca, CQHCI_SSC2);
+	cqhci_writel(host, CQHCI_IS_MASK, CQHCI_ISTE);
+	cqhci_writel(host, cqhci_readl(host, CQHCI_IS), CQHCI_IS);
+	cqhci_writel(host, cqhci_readl(host, CQHCI_TCN), CQHCI_TCN);
+	cqhci_writel(host, cfg | CQHCI_ENABLE, CQHCI_CFG);
+	cqhci_writel(host, 0, CQHCI_CTL);
+
+	return 0;
+}
+
+static void cqhci_disable(struct sdhci_host *host, bool clear)
+{
+	ulong start = timer_get_us();
+
+	cqhci_writel(host, CQHCI_HALT, CQHCI_CTL);
+	while (!(cqhci_readl(host, CQHCI_CTL) & CQHCI_HALT)) {
+		if (timer_get_us() - start > CQHCI_TIMEOUT_US) {
+			log_warning("CQE halt timed out\n");
+			break;
+		}
+	}
+	if (clear)
+		cqhci_writel(host, CQHCI_HALT | CQHCI_CLEAR_ALL_TASKS,
+			     CQHCI_CTL);
+
+	cqhci_writel(host, 0, CQHCI_ISTE);
+	cqhci_writel(host, cqhci_readl(host, CQHCI_IS), CQHCI_IS);
+	cqhci_writel(host, cqhci_readl(host, CQHCI_CFG) & ~CQHCI_ENABLE,
+		     CQHCI_CFG);
+
+	sdhci_writel(host, SDHCI_INT_ALL_MASK, SDHCI_INT_STATUS);
+	sdhci_writel(host, SDHCI_INT_DATA_MASK | SDHCI_INT_CMD_MASK,
+		     SDHCI_INT_ENABLE);
+}
+
+int sdhci_cqhci_read(struct sdhci_host *host, uint depth, lbaint_t start,
+		     lbaint_t blkcnt, void *dst)
+{
+	ulong len = blkcnt * MMC_MAX_BLOCK_LEN;
+	u32 free_slots, busy = 0;
+	dma_addr_t dma, addr;
+	ulong last;
+	int ret;
+
+	if (!host->cqe_ioaddr)
+		return -ENOSYS;
+
+	depth = clamp(depth, 1U, (uint)CQHCI_MAX_SLOTS);
+	free_slots = depth == CQHCI_MAX_SLOTS ? ~0U : BIT(depth) - 1;
+
+	ret = cqhci_enable(host);
+	if (ret)
+		return ret;
+
+	dma = dma_map_single(dst, len, DMA_FROM_DEVICE);
+	addr = dma;
+	last = timer_get_us();
+	while (blkcnt || busy) {
+		u32 ring = 0;
+		u32 done, is;
+
+		/* Keep every free slot busy with the next part of the read */
+		while (blkcnt && free_slots) {
+			int slot = ffs(free_slots) - 1;
+			uint blocks = min_t(lbaint_t, blkcnt, CQHCI_TASK_BLKS);
+
+			cqhci_prep_task(host, slot, start, blocks, addr);
+			free_slots &= ~BIT(slot);
+			ring |= BIT(slot);
+			start += blocks;
+			blkcnt -= blocks;
+			addr += blocks * MMC_MAX_BLOCK_LEN;
+		}
+		if (ring) {
+			cqhci_writel(host, ring, CQHCI_TDBR);
+			busy |= ring;
+		}
+
+		is = cqhci_readl(host, CQHCI_IS);
+		if ((is & CQHCI_IS_ERR) ||
+		    (sdhci_readl(host, SDHCI_INT_STATUS) & SDHCI_INT_ERROR)) {
+			log_debug("CQE error: is %#x terri %#x\n", is,
+				  cqhci_readl(host, CQHCI_TERRI));
+			ret = -EIO;
+			break;
+		}
+
+		done = cqhci_readl(host, CQHCI_TCN) & busy;
+		if (done) {
+			cqhci_writel(host, done, CQHCI_TCN);
+			cqhci_writel(host, CQHCI_IS_TCC, CQHCI_IS);
+			busy &= ~done;
+			free_slots |= done;
+			last = timer_get_us();
+		} else if (timer_get_us() - last > CQHCI_TIMEOUT_US) {
+			log_debug("CQE timed out, tasks %#x\n", busy);
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+
+	cqhci_disable(host, ret);
+	dma_unmap_single(dma, len, DMA_FROM_DEVICE);
+
+	return ret;
+}
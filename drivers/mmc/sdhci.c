@@ -840,6 +840,46 @@ static int sdhci_set_enhanced_strobe(struct udevice *dev)
 }
 #endif
 
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+static int sdhci_get_tuning(struct udevice *dev, u32 *tap)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+
+	if (host->ops && host->ops->get_tuning)
+		return host->ops->get_tuning(host, tap);
+
+	return -ENOSYS;
+}
+
+static int sdhci_set_tuning(struct udevice *dev, u32 tap)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+
+	if (host->ops && host->ops->set_tuning)
+		return host->ops->set_tuning(host, tap);
+
+	return -ENOSYS;
+}
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+static int sdhci_cqe_read(struct udevice *dev, lbaint_t start,
+			  lbaint_t blkcnt, void *dst)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+	int ret;
+
+	ret = sdhci_cqhci_read(host, mmc->cmdq_depth, start, blkcnt, dst);
+	if (ret && ret != -ENOSYS)
+		sdhci_reset(host, SDHCI_RESET_CMD | SDHCI_RESET_DATA);
+
+	return ret;
+}
+#endif
+
 const struct dm_mmc_ops sdhci_ops = {
 	.send_cmd	= sdhci_send_command,
 	.set_ios	= sdhci_set_ios,
@@ -852,6 +892,13 @@ const struct dm_mmc_ops sdhci_ops = {
 #if CONFIG_IS_ENABLED(MMC_HS400_ES_SUPPORT)
 	.set_enhanced_strobe = sdhci_set_enhanced_strobe,
 #endif
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+	.cqe_read	= sdhci_cqe_read,
+#endif
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	.get_tuning	= sdhci_get_tuning,
+	.set_tuning	= sdhci_set_tuning,
+#endif
 };
 #else
 static const struct mmc_ops sdhci_ops = {
@@ -1020,6 +1067,11 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	if (host->host_caps)
 		cfg->host_caps |= host->host_caps;
 
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+	if (host->cqe_ioaddr)
+		cfg->host_caps |= MMC_CAP_CQE;
+#endif
+
 	cfg->b_max = CONFIG_SYS_MMC_MAX_BLK_COUNT;
 
 	return 0;
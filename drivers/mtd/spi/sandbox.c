@@ -41,13 +41,14 @@ enum sandbox_sf_state {
 	SF_READ_STATUS, /* read the flash's status register */
 	SF_READ_STATUS1, /* read the flash's status register upper 8 bits*/
 	SF_WRITE_STATUS, /* write the flash's status register */
+	SF_READ_SFDP, /* read the flash's SFDP tables */
 };
 
 static const char *sandbox_sf_state_name(enum sandbox_sf_state state)
 {
 	static const char * const states[] = {
 		"CMD", "ID", "ADDR", "READ", "WRITE", "ERASE", "READ_STATUS",
-		"READ_STATUS1", "WRITE_STATUS",
+		"READ_STATUS1", "WRITE_STATUS", "READ_SFDP",
 	};
 	return states[state];
 }
@@ -91,6 +92,9 @@ struct sandbox_spi_flash {
 	u16 status;
 	/* Data describing the flash we're emulating */
 	const struct flash_info *data;
+	/* SFDP area served by Read SFDP, NULL if the flash has none */
+	const u8 *sfdp;
+	uint sfdp_size;
 	/* The file on disk to serv up data from */
 	int fd;
 };
@@ -110,6 +114,35 @@ void sandbox_sf_set_block_protect(struct udevice *dev, int bp_mask)
 	sbsf->status |= bp_mask << STAT_BP_SHIFT;
 }
 
+static const struct flash_info *sandbox_sf_find_info(const char *name)
+{
+	const struct flash_info *data;
+
+	for (data = spi_nor_ids; data->name; data++) {
+		if (!strcasecmp(name, data->name))
+			return data;
+	}
+
+	return NULL;
+}
+
+int sandbox_sf_set_sfdp(struct udevice *dev, const char *name,
+			const void *sfdp, uint size)
+{
+	struct sandbox_spi_flash *sbsf = dev_get_priv(dev);
+	const struct flash_info *data;
+
+	data = sandbox_sf_find_info(name);
+	if (!data)
+		return -ENOENT;
+
+	sbsf->data = data;
+	sbsf->sfdp = sfdp;
+	sbsf->sfdp_size = size;
+
+	return 0;
+}
+
 /**
  * This is a very strange probe function. If it has platform data (which may
  * have come from the device tree) then this function gets the filename and
@@ -119,7 +152,6 @@ static int sandbox_sf_probe(struct udevice *dev)
 {
 	/* spec = idcode:file */
 	struct sandbox_spi_flash *sbsf = dev_get_priv(dev);
-	size_t len, idname_len;
 	const struct flash_info *data;
 	struct sandbox_spi_flash_plat_data *pdata = dev_get_plat(dev);
 	struct sandbox_state *state = state_get_current();
@@ -150,19 +182,11 @@ static int sandbox_sf_probe(struct udevice *dev)
 		spec++;
 	else
 		spec = pdata->device_name;
-	idname_len = strlen(spec);
 	debug("%s: device='%s'\n", __func__, spec);
 
-	for (data = spi_nor_ids; data->name; data++) {
-		len = strlen(data->name);
-		if (idname_len != len)
-			continue;
-		if (!strncasecmp(spec, data->name, len))
-			break;
-	}
-	if (!data->name) {
-		printf("%s: unknown flash '%*s'\n", __func__, (int)idname_len,
-		       spec);
+	data = sandbox_sf_find_info(spec);
+	if (!data) {
+		printf("%s: unknown flash '%s'\n", __func__, spec);
 		ret = -EINVAL;
 		goto error;
 	}
@@ -245,6 +269,12 @@ static int sandbox_sf_process_cmd(struct sandbox_spi_flash *sbsf, const u8 *rx,
 		sbsf->state = SF_ID;
 		sbsf->cmd = SF_ID;
 		break;
+	case SPINOR_OP_RDSFDP:
+		if (!sbsf->sfdp) {
+			debug(" no SFDP tables\n");
+			return -EIO;
+		}
+		fallthrough;
 	case SPINOR_OP_READ_FAST:
 		sbsf->pad_addr_bytes = 1;
 		fallthrough;
@@ -386,6 +416,9 @@ static int sandbox_sf_xfer(struct udevice *dev, unsigned int bitlen,
 			case SPINOR_OP_PP:
 				sbsf->state = SF_WRITE;
 				break;
+			case SPINOR_OP_RDSFDP:
+				sbsf->state = SF_READ_SFDP;
+				break;
 			default:
 				/* assume erase state ... */
 				sbsf->state = SF_ERASE;
@@ -410,6 +443,17 @@ static int sandbox_sf_xfer(struct udevice *dev, unsigned int bitlen,
 			}
 			pos += ret;
 			break;
+		case SF_READ_SFDP:
+			/* Reads past the end of the tables float */
+			cnt = bytes - pos;
+			log_content(" tx: read sfdp(%u)\n", cnt);
+			sandbox_spi_tristate(tx + pos, cnt);
+			if (sbsf->off < sbsf->sfdp_size)
+				memcpy(tx + pos, sbsf->sfdp + sbsf->off,
+				       min(cnt, sbsf->sfdp_size - sbsf->off));
+			sbsf->off += cnt;
+			pos += cnt;
+			break;
 		case SF_READ_STATUS:
 			log_content(" read status: %#x\n", sbsf->status);
 			cnt = bytes - pos;
@@ -71,6 +71,10 @@ struct sfdp_parameter_header {
 #define SFDP_SECTOR_MAP_ID	0xff81	/* Sector Map Table */
 #define SFDP_SST_ID		0x01bf	/* Manufacturer specific Table */
 #define SFDP_PROFILE1_ID	0xff05	/* xSPI Profile 1.0 Table */
+#define SFDP_OCTAL_DDR_ID	0xff0a	/*
+					 * Command Sequences to Change to
+					 * Octal DDR (8D-8D-8D) mode.
+					 */
 #define SFDP_SCCR_MAP_ID	0xff87	/*
 					 * Status, Control and Configuration
 					 * Register Map.
@@ -188,6 +192,10 @@ struct sfdp_header {
 /* Status, Control and Configuration Register Map(SCCR) */
 #define SCCR_DWORD22_OCTAL_DTR_EN_VOLATILE      BIT(31)
 
+/* Command Sequences to Change to Octal DDR (8D-8D-8D) mode */
+#define OCTAL_DDR_SEQ_LEN			GENMASK(31, 24)
+#define OCTAL_DDR_SEQ_MAX_LEN			7
+
 struct sfdp_bfpt {
 	u32	dwords[BFPT_DWORD_MAX];
 };
@@ -2907,6 +2915,106 @@ out:
 	return ret;
 }
 
+/**
+ * spi_nor_parse_octal_ddr() - Parse the Command Sequences to Change to Octal
+ *			       DDR (8D-8D-8D) mode table.
+ * @nor:		pointer to a 'struct spi_nor'
+ * @octal_ddr_header:	pointer to the 'struct sfdp_parameter_header' describing
+ *			the table length and version.
+ *
+ * The table holds up to four commands of two DWORDs each: the command length
+ * in bytes in the top byte of the first DWORD, then up to seven command bytes,
+ * most significant byte first. The commands are kept in nor->octal_dtr_seq
+ * so that spi_nor_sfdp_octal_dtr_enable() can replay them.
+ *
+ * Return: 0 on success, -errno otherwise.
+ */
+static int spi_nor_parse_octal_ddr(struct spi_nor *nor,
+				   const struct sfdp_parameter_header *octal_ddr_header)
+{
+	u32 *table, addr;
+	size_t len;
+	int ret, i;
+
+	len = min_t(size_t, octal_ddr_header->length,
+		    SPI_NOR_OCTAL_DTR_SEQ_DWORDS) * sizeof(*table);
+	table = kzalloc(SPI_NOR_OCTAL_DTR_SEQ_DWORDS * sizeof(*table),
+			GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+
+	addr = SFDP_PARAM_HEADER_PTP(octal_ddr_header);
+	ret = spi_nor_read_sfdp(nor, addr, len, table);
+	if (ret)
+		goto out;
+
+	/* Fix endianness of the table DWORDs. */
+	for (i = 0; i < SPI_NOR_OCTAL_DTR_SEQ_DWORDS; i++)
+		table[i] = le32_to_cpu(table[i]);
+
+	for (i = 0; i < SPI_NOR_OCTAL_DTR_SEQ_DWORDS; i += 2) {
+		if (FIELD_GET(OCTAL_DDR_SEQ_LEN, table[i]) >
+		    OCTAL_DDR_SEQ_MAX_LEN) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	memcpy(nor->octal_dtr_seq, table, sizeof(nor->octal_dtr_seq));
+
+out:
+	kfree(table);
+	return ret;
+}
+
+/**
+ * spi_nor_sfdp_octal_dtr_enable() - Enable octal DTR using the SFDP commands.
+ * @nor:	pointer to a 'struct spi_nor'
+ *
+ * Send, in 1S-1S-1S mode, the commands read from the Command Sequences to
+ * Change to Octal DDR (8D-8D-8D) mode table.
+ *
+ * Return: 0 on success, -errno otherwise.
+ */
+static int spi_nor_sfdp_octal_dtr_enable(struct spi_nor *nor)
+{
+	const u32 *seq = nor->octal_dtr_seq;
+	struct spi_mem_op op;
+	u8 *buf = nor->cmd_buf;
+	int i, j, len, ret;
+
+	for (i = 0; i < SPI_NOR_OCTAL_DTR_SEQ_DWORDS; i += 2) {
+		len = FIELD_GET(OCTAL_DDR_SEQ_LEN, seq[i]);
+		if (!len)
+			break;
+
+		for (j = 0; j < 3; j++)
+			buf[j] = seq[i] >> (16 - 8 * j);
+		for (j = 0; j < 4; j++)
+			buf[3 + j] = seq[i + 1] >> (24 - 8 * j);
+
+		op = (struct spi_mem_op)
+			SPI_MEM_OP(SPI_MEM_OP_CMD(buf[0], 1),
+				   SPI_MEM_OP_NO_ADDR,
+				   SPI_MEM_OP_NO_DUMMY,
+				   SPI_MEM_OP_NO_DATA);
+		if (len > 1) {
+			op.data.dir = SPI_MEM_DATA_OUT;
+			op.data.buswidth = 1;
+			op.data.nbytes = len - 1;
+			op.data.buf.out = buf + 1;
+		}
+
+		ret = spi_mem_exec_op(nor->spi, &op);
+		if (ret) {
+			dev_err(nor->dev, "Failed to enable octal DTR mode\n");
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * spi_nor_parse_sfdp() - parse the Serial Flash Discoverable Parameters.
  * @nor:		pointer to a 'struct spi_nor'
@@ -3017,6 +3125,10 @@ static int spi_nor_parse_sfdp(struct spi_nor *nor,
 			err = spi_nor_parse_sccr(nor, param_header);
 			break;
 
+		case SFDP_OCTAL_DDR_ID:
+			err = spi_nor_parse_octal_ddr(nor, param_header);
+			break;
+
 		default:
 			break;
 		}
@@ -3035,6 +3147,20 @@ static int spi_nor_parse_sfdp(struct spi_nor *nor,
 		}
 	}
 
+	/*
+	 * Offer 8D-8D-8D when the flash describes both the octal DTR fast read
+	 * and a volatile way to switch to it. spi_nor_setup() only picks it if
+	 * the controller supports the ops too, and flash specific late_init()
+	 * hooks may still replace the enable method.
+	 */
+	if (nor->octal_dtr_seq[0] &&
+	    params->reads[SNOR_CMD_READ_8_8_8_DTR].opcode &&
+	    nor->flags & SNOR_F_IO_MODE_EN_VOLATILE) {
+		params->hwcaps.mask |= SNOR_HWCAPS_READ_8_8_8_DTR;
+		params->hwcaps.mask |= SNOR_HWCAPS_PP_8_8_8_DTR;
+		nor->octal_dtr_enable = spi_nor_sfdp_octal_dtr_enable;
+	}
+
 exit:
 	kfree(param_headers);
 	return err;
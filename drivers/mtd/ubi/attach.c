@@ -87,13 +87,45 @@
 #include <linux/math64.h>
 
 #include <ubi_uboot.h>
+#include <uthread.h>
 #include "ubi.h"
 
 static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai);
 
-/* Temporary variables used during scanning */
-static struct ubi_ec_hdr *ech;
-static struct ubi_vid_hdr *vidh;
+/* How many PEBs have their headers read in one go while scanning */
+#define SCAN_BATCH_PEBS 16
+
+/**
+ * struct scan_hdrs - UBI headers of a PEB, read ahead of 'scan_peb()'.
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read_ec_hdr()' returned
+ * @vid_err: what 'ubi_io_read_vid_hdr()' returned
+ * @ech: the erase counter header
+ * @vidh: the volume identifier header
+ */
+struct scan_hdrs {
+	int bad;
+	int ec_err;
+	int vid_err;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vidh;
+};
+
+/**
+ * struct scan_batch - UBI headers of consecutive PEBs.
+ * @ubi: UBI device description object
+ * @start: first PEB of the batch
+ * @count: number of PEBs in the batch
+ * @buf: buffer holding the headers
+ * @hdrs: headers of each PEB
+ */
+struct scan_batch {
+	struct ubi_device *ubi;
+	int start;
+	int count;
+	void *buf;
+	struct scan_hdrs hdrs[SCAN_BATCH_PEBS];
+};
 
 /**
  * add_to_list - add physical eraseblock to a list.
@@ -808,16 +840,18 @@ out_unlock:
  * @ubi: UBI device description object
  * @ai: attaching information
  * @pnum: the physical eraseblock number
+ * @h: the headers of the PEB, as read by read_batch()
  * @vid: The volume ID of the found volume will be stored in this pointer
  * @sqnum: The sqnum of the found volume will be stored in this pointer
  *
- * This function reads UBI headers of PEB @pnum, checks them, and adds
+ * This function checks the UBI headers of PEB @pnum, and adds
  * information about this PEB to the corresponding list or RB-tree in the
  * "attaching info" structure. Returns zero if the physical eraseblock was
  * successfully handled and a negative error code in case of failure.
  */
 static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
-		    int pnum, int *vid, unsigned long long *sqnum)
+		    int pnum, const struct scan_hdrs *h, int *vid,
+		    unsigned long long *sqnum)
 {
 	long long uninitialized_var(ec);
 	int err, bitflips = 0, vol_id = -1, ec_err = 0;
@@ -825,7 +859,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = h->bad;
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -833,7 +867,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = h->ec_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -871,13 +905,13 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		int image_seq;
 
 		/* Make sure UBI version is OK */
-		if (ech->version != UBI_VERSION) {
+		if (h->ech->version != UBI_VERSION) {
 			ubi_err(ubi, "this UBI version is %d, image version is %d",
-				UBI_VERSION, (int)ech->version);
+				UBI_VERSION, (int)h->ech->version);
 			return -EINVAL;
 		}
 
-		ec = be64_to_cpu(ech->ec);
+		ec = be64_to_cpu(h->ech->ec);
 		if (ec > UBI_MAX_ERASECOUNTER) {
 			/*
 			 * Erase counter overflow. The EC headers have 64 bits
@@ -888,7 +922,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 			 */
 			ubi_err(ubi, "erase counter overflow, max is %d",
 				UBI_MAX_ERASECOUNTER);
-			ubi_dump_ec_hdr(ech);
+			ubi_dump_ec_hdr(h->ech);
 			return -EINVAL;
 		}
 
@@ -903,20 +937,20 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		 * sequence number, while other PEBs have non-zero sequence
 		 * number.
 		 */
-		image_seq = be32_to_cpu(ech->image_seq);
+		image_seq = be32_to_cpu(h->ech->image_seq);
 		if (!ubi->image_seq)
 			ubi->image_seq = image_seq;
 		if (image_seq && ubi->image_seq != image_seq) {
 			ubi_err(ubi, "bad image sequence number %d in PEB %d, expected %d",
 				image_seq, pnum, ubi->image_seq);
-			ubi_dump_ec_hdr(ech);
+			ubi_dump_ec_hdr(h->ech);
 			return -EINVAL;
 		}
 	}
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	err = h->vid_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -955,7 +989,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 			 * The EC was OK, but the VID header is corrupted. We
 			 * have to check what is in the data area.
 			 */
-			err = check_corruption(ubi, vidh, pnum);
+			err = check_corruption(ubi, h->vidh, pnum);
 
 		if (err < 0)
 			return err;
@@ -991,16 +1025,16 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		return -EINVAL;
 	}
 
-	vol_id = be32_to_cpu(vidh->vol_id);
+	vol_id = be32_to_cpu(h->vidh->vol_id);
 	if (vid)
 		*vid = vol_id;
 	if (sqnum)
-		*sqnum = be64_to_cpu(vidh->sqnum);
+		*sqnum = be64_to_cpu(h->vidh->sqnum);
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
-		int lnum = be32_to_cpu(vidh->lnum);
+		int lnum = be32_to_cpu(h->vidh->lnum);
 
 		/* Unsupported internal volume */
-		switch (vidh->compat) {
+		switch (h->vidh->compat) {
 		case UBI_COMPAT_DELETE:
 			if (vol_id != UBI_FM_SB_VOLUME_ID
 			    && vol_id != UBI_FM_DATA_VOLUME_ID) {
@@ -1038,7 +1072,7 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 	if (ec_err)
 		ubi_warn(ubi, "valid VID header but corrupted EC header at PEB %d",
 			 pnum);
-	err = ubi_add_to_av(ubi, ai, pnum, ec, vidh, bitflips);
+	err = ubi_add_to_av(ubi, ai, pnum, ec, h->vidh, bitflips);
 	if (err)
 		return err;
 
@@ -1055,6 +1089,150 @@ adjust_mean_ec:
 	return 0;
 }
 
+/**
+ * read_batch - read the UBI headers of a batch of PEBs.
+ * @arg: the &struct scan_batch to fill
+ *
+ * Each PEB has both of its headers read at once, see 'ubi_io_read_hdrs()'.
+ * This may run in a thread of its own, so that the headers of the next batch
+ * are read while the current one is processed.
+ */
+static void read_batch(void *arg)
+{
+	struct scan_batch *batch = arg;
+	struct ubi_device *ubi = batch->ubi;
+	int i;
+
+	for (i = 0; i < batch->count; i++) {
+		struct scan_hdrs *h = &batch->hdrs[i];
+		int pnum = batch->start + i;
+
+		h->bad = ubi_io_is_bad(ubi, pnum);
+		if (!h->bad)
+			ubi_io_read_hdrs(ubi, pnum, h->ech, &h->ec_err,
+					 &h->vid_err);
+	}
+}
+
+static void free_batch(struct scan_batch *batch)
+{
+	if (batch)
+		kfree(batch->buf);
+	kfree(batch);
+}
+
+static struct scan_batch *alloc_batch(struct ubi_device *ubi)
+{
+	struct scan_batch *batch;
+	int i, len;
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return NULL;
+
+	len = ubi->vid_hdr_aloffset + ubi->vid_hdr_alsize;
+	batch->buf = kmalloc(len * SCAN_BATCH_PEBS, GFP_KERNEL);
+	if (!batch->buf) {
+		kfree(batch);
+		return NULL;
+	}
+
+	batch->ubi = ubi;
+	for (i = 0; i < SCAN_BATCH_PEBS; i++) {
+		batch->hdrs[i].ech = batch->buf + i * len;
+		batch->hdrs[i].vidh = (void *)batch->hdrs[i].ech +
+				      ubi->vid_hdr_offset;
+	}
+
+	return batch;
+}
+
+/**
+ * scan_pebs - scan a range of PEBs.
+ * @ubi: UBI device description object
+ * @ai: attach info object
+ * @start: first PEB to scan
+ * @end: PEB to stop scanning at
+ * @fm_anchor: if not %NULL, the newest fastmap anchor PEB found is stored here
+ *
+ * The headers are read in batches of %SCAN_BATCH_PEBS PEBs. Where threads are
+ * available, the next batch is read by another thread while the current one
+ * is added to @ai. Threads only switch when they yield, so the reader runs
+ * whenever this loop yields and hands back while it waits for the flash.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int scan_pebs(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		     int start, int end, int *fm_anchor)
+{
+	struct scan_batch *cur, *next, *tmp;
+	unsigned long long max_sqnum = 0;
+	unsigned int grp_id = 0;
+	bool threaded;
+	int err = -ENOMEM, i;
+
+	cur = alloc_batch(ubi);
+	next = alloc_batch(ubi);
+	if (!cur || !next)
+		goto out;
+
+	cur->start = start;
+	cur->count = min(end - start, SCAN_BATCH_PEBS);
+	read_batch(cur);
+
+	err = 0;
+	while (cur->count > 0) {
+		next->start = cur->start + cur->count;
+		next->count = min(end - next->start, SCAN_BATCH_PEBS);
+		threaded = false;
+		if (next->count > 0) {
+			grp_id = uthread_grp_new_id();
+			threaded = !uthread_create(NULL, read_batch, next, 0,
+						   grp_id);
+			/* Threads do not preempt, let the reader start */
+			if (threaded)
+				uthread_schedule();
+			else
+				read_batch(next);
+		}
+
+		for (i = 0; i < cur->count; i++) {
+			int pnum = cur->start + i, vol_id = -1;
+			unsigned long long sqnum = -1;
+
+			/* Let the reader issue its next read, if it is idle */
+			uthread_schedule();
+
+			dbg_gen("process PEB %d", pnum);
+			err = scan_peb(ubi, ai, pnum, &cur->hdrs[i], &vol_id,
+				       &sqnum);
+			if (err < 0)
+				break;
+
+			if (fm_anchor && vol_id == UBI_FM_SB_VOLUME_ID &&
+			    sqnum > max_sqnum) {
+				max_sqnum = sqnum;
+				*fm_anchor = pnum;
+			}
+		}
+
+		/* The next batch may still be in use by its reader */
+		while (threaded && !uthread_grp_done(grp_id))
+			uthread_schedule();
+		if (err < 0)
+			goto out;
+
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+out:
+	free_batch(next);
+	free_batch(cur);
+	return err;
+}
+
 /**
  * late_analysis - analyze the overall situation with PEB.
  * @ubi: UBI device description object
@@ -1228,30 +1406,15 @@ static void destroy_ai(struct ubi_attach_info *ai)
 static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		    int start)
 {
-	int err, pnum;
+	int err;
 	struct rb_node *rb1, *rb2;
 	struct ubi_ainf_volume *av;
 	struct ubi_ainf_peb *aeb;
 
-	err = -ENOMEM;
-
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
+	err = scan_pebs(ubi, ai, start, ubi->peb_count, NULL);
+	if (err < 0)
 		return err;
 
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
-
-	for (pnum = start; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
-
-		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, ai, pnum, NULL, NULL);
-		if (err < 0)
-			goto out_vidh;
-	}
-
 	ubi_msg(ubi, "scanning is finished");
 
 	/* Calculate mean erase counter */
@@ -1260,7 +1423,7 @@ static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 
 	err = late_analysis(ubi, ai);
 	if (err)
-		goto out_vidh;
+		return err;
 
 	/*
 	 * In case of unknown erase counter we use the mean erase counter
@@ -1285,20 +1448,7 @@ static int scan_all(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		if (aeb->ec == UBI_UNKNOWN)
 			aeb->ec = ai->mean_ec;
 
-	err = self_check_ai(ubi, ai);
-	if (err)
-		goto out_vidh;
-
-	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
-
-	return 0;
-
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
-	return err;
+	return self_check_ai(ubi, ai);
 }
 
 static struct ubi_attach_info *alloc_ai(void)
@@ -1339,37 +1489,11 @@ static struct ubi_attach_info *alloc_ai(void)
  */
 static int scan_fast(struct ubi_device *ubi, struct ubi_attach_info **ai)
 {
-	int err, pnum, fm_anchor = -1;
-	unsigned long long max_sqnum = 0;
-
-	err = -ENOMEM;
+	int err, fm_anchor = -1;
 
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
-		goto out;
-
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
-
-	for (pnum = 0; pnum < UBI_FM_MAX_START; pnum++) {
-		int vol_id = -1;
-		unsigned long long sqnum = -1;
-		cond_resched();
-
-		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, *ai, pnum, &vol_id, &sqnum);
-		if (err < 0)
-			goto out_vidh;
-
-		if (vol_id == UBI_FM_SB_VOLUME_ID && sqnum > max_sqnum) {
-			max_sqnum = sqnum;
-			fm_anchor = pnum;
-		}
-	}
-
-	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
+	err = scan_pebs(ubi, *ai, 0, UBI_FM_MAX_START, &fm_anchor);
+	if (err < 0)
+		return err;
 
 	if (fm_anchor < 0)
 		return UBI_NO_FASTMAP;
@@ -1380,13 +1504,6 @@ static int scan_fast(struct ubi_device *ubi, struct ubi_attach_info **ai)
 		return -ENOMEM;
 
 	return ubi_scan_fastmap(ubi, *ai, fm_anchor);
-
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
-out:
-	return err;
 }
 
 #endif
@@ -1508,6 +1625,7 @@ static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	struct rb_node *rb1, *rb2;
 	struct ubi_ainf_volume *av;
 	struct ubi_ainf_peb *aeb, *last_aeb;
+	struct ubi_vid_hdr *vidh;
 	uint8_t *buf;
 
 	if (!ubi_dbg_chk_gen(ubi))
@@ -1630,6 +1748,10 @@ static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	}
 
 	/* Check that attaching information is correct */
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		return -ENOMEM;
+
 	ubi_rb_for_each_entry(rb1, av, &ai->volumes, rb) {
 		last_aeb = NULL;
 		ubi_rb_for_each_entry(rb2, aeb, &av->root, u.rb) {
@@ -1645,6 +1767,7 @@ static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai)
 					err);
 				if (err > 0)
 					err = -EIO;
+				ubi_free_vid_hdr(ubi, vidh);
 				return err;
 			}
 
@@ -1701,6 +1824,8 @@ static int self_check_ai(struct ubi_device *ubi, struct ubi_attach_info *ai)
 		}
 	}
 
+	ubi_free_vid_hdr(ubi, vidh);
+
 	/*
 	 * Make sure that all the physical eraseblocks are in one of the lists
 	 * or trees.
@@ -1761,6 +1886,7 @@ bad_vid_hdr:
 	ubi_err(ubi, "bad attaching information about volume %d", av->vol_id);
 	ubi_dump_av(av);
 	ubi_dump_vid_hdr(vidh);
+	ubi_free_vid_hdr(ubi, vidh);
 
 out:
 	dump_stack();
@@ -106,6 +106,26 @@ void sandbox_eth_disable_response(int index, bool disable)
 	priv->disabled = disable;
 }
 
+/*
+ * sandbox_eth_set_batch()
+ *
+ * index - The alias index (also DM seq number)
+ * batch - If non-zero, hand over all waiting packets with recv_batch()
+ */
+void sandbox_eth_set_batch(int index, bool batch)
+{
+	struct udevice *dev;
+	struct eth_sandbox_priv *priv;
+	int ret;
+
+	ret = uclass_get_device(UCLASS_ETH, index, &dev);
+	if (ret)
+		return;
+
+	priv = dev_get_priv(dev);
+	priv->batch = batch;
+}
+
 /*
  * sandbox_eth_skip_timeout()
  *
@@ -441,6 +461,36 @@ static int sb_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 	return 0;
 }
 
+static int sb_eth_recv_batch(struct udevice *dev, int flags,
+			     struct eth_rx_pkt *pkts, int max)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	int i;
+
+	/* Receive one packet at a time, unless a test asks otherwise */
+	if (!priv->batch)
+		return -ENOSYS;
+
+	if (skip_timeout) {
+		timer_test_add_offset(11000UL);
+		skip_timeout = false;
+	}
+
+	/*
+	 * The buffers are only moved along when the packets are freed, which
+	 * happens after the whole batch has been processed
+	 */
+	for (i = 0; i < priv->recv_packets && i < max; i++) {
+		pkts[i].packet = priv->recv_packet_buffer[i];
+		pkts[i].length = priv->recv_packet_length[i];
+		pkts[i].csum_ok = false;
+	}
+	debug("eth_sandbox: received %d packets, %d waiting\n", i,
+	      priv->recv_packets - i);
+
+	return i;
+}
+
 static int sb_eth_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct eth_sandbox_priv *priv = dev_get_priv(dev);
@@ -481,6 +531,7 @@ static const struct eth_ops sb_eth_ops = {
 	.start			= sb_eth_start,
 	.send			= sb_eth_send,
 	.recv			= sb_eth_recv,
+	.recv_batch		= sb_eth_recv_batch,
 	.free_pkt		= sb_eth_free_pkt,
 	.stop			= sb_eth_stop,
 	.write_hwaddr		= sb_eth_write_hwaddr,
@@ -15,17 +15,16 @@
 #include <time.h>
 #include <dm/device-internal.h>
 #include <linux/compat.h>
+#include <linux/log2.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
-#define NVME_CQ_ALLOCATION	ALIGN(NVME_CQ_SIZE(NVME_Q_DEPTH), \
-				      ARCH_DMA_MINALIGN)
+#define NVME_CQ_ALLOCATION(depth)	ALIGN(NVME_CQ_SIZE(depth), \
+					      ARCH_DMA_MINALIGN)
 #define ADMIN_TIMEOUT		60
 #define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
 
 static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 {
@@ -44,22 +43,32 @@ static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
-			   int total_len, u64 dma_addr)
+/**
+ * nvme_setup_prps() - Set up the PRP entries for a transfer
+ *
+ * @dev:	NVMe device
+ * @prp_list:	PRP list to fill in if more than two entries are needed. This
+ *		must be large enough for the largest transfer, chaining to the
+ *		following page when it is larger than a page
+ * @prp2:	Returns the value for the PRP2 field of the command
+ * @total_len:	Length of the transfer in bytes
+ * @dma_addr:	Address of the buffer
+ */
+static void nvme_setup_prps(struct nvme_dev *dev, u64 *prp_list, u64 *prp2,
+			    int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
 	int offset = dma_addr & (page_size - 1);
-	u64 *prp_pool;
+	u64 *prp_pool = prp_list;
 	int length = total_len;
 	int i, nprps;
 	u32 prps_per_page = page_size >> 3;
-	u32 num_pages;
 
 	length -= (page_size - offset);
 
 	if (length <= 0) {
 		*prp2 = 0;
-		return 0;
+		return;
 	}
 
 	if (length)
@@ -67,45 +76,26 @@ static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
 
 	if (length <= page_size) {
 		*prp2 = dma_addr;
-		return 0;
+		return;
 	}
 
 	nprps = DIV_ROUND_UP(length, page_size);
-	num_pages = DIV_ROUND_UP(nprps - 1, prps_per_page - 1);
-
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
-		/*
-		 * Always increase in increments of pages.  It doesn't waste
-		 * much memory and reduces the number of allocations.
-		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
-			printf("Error: malloc prp_pool fail\n");
-			return -ENOMEM;
-		}
-		dev->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
-	}
-
-	prp_pool = dev->prp_pool;
 	i = 0;
 	while (nprps) {
 		if ((i == (prps_per_page - 1)) && nprps > 1) {
 			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
 					page_size);
 			i = 0;
-			prp_pool += page_size;
+			prp_pool += prps_per_page;
 		}
 		*(prp_pool + i++) = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
 		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
-
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
-			   num_pages * page_size);
+	*prp2 = (ulong)prp_list;
 
-	return 0;
+	flush_dcache_range((ulong)prp_list,
+			   ALIGN((ulong)(prp_pool + i), ARCH_DMA_MINALIGN));
 }
 
 static __le16 nvme_get_cmd_id(void)
@@ -120,11 +110,11 @@ static u16 nvme_read_completion_status(struct nvme_queue *nvmeq, u16 index)
 	/*
 	 * Single CQ entries are always smaller than a cache line, so we
 	 * can't invalidate them individually. However CQ entries are
-	 * read only by the CPU, so it's safe to always invalidate all of them,
-	 * as the cache line should never become dirty.
+	 * read only by the CPU, so it's safe to invalidate the whole cache
+	 * line holding the entry, as it should never become dirty.
 	 */
-	ulong start = (ulong)&nvmeq->cqes[0];
-	ulong stop = start + NVME_CQ_ALLOCATION;
+	ulong start = ALIGN_DOWN((ulong)&nvmeq->cqes[index], ARCH_DMA_MINALIGN);
+	ulong stop = start + ARCH_DMA_MINALIGN;
 
 	invalidate_dcache_range(start, stop);
 
@@ -233,7 +223,7 @@ static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev,
 		return NULL;
 	memset(nvmeq, 0, sizeof(*nvmeq));
 
-	nvmeq->cqes = (void *)memalign(4096, NVME_CQ_ALLOCATION);
+	nvmeq->cqes = (void *)memalign(4096, NVME_CQ_ALLOCATION(depth));
 	if (!nvmeq->cqes)
 		goto free_nvmeq;
 	memset((void *)nvmeq->cqes, 0, NVME_CQ_SIZE(depth));
@@ -344,7 +334,8 @@ static void nvme_init_queue(struct nvme_queue *nvmeq, u16 qid)
 	nvmeq->q_db = &dev->dbs[qid * 2 * dev->db_stride];
 	memset((void *)nvmeq->cqes, 0, NVME_CQ_SIZE(nvmeq->q_depth));
 	flush_dcache_range((ulong)nvmeq->cqes,
-			   (ulong)nvmeq->cqes + NVME_CQ_ALLOCATION);
+			   (ulong)nvmeq->cqes +
+			   NVME_CQ_ALLOCATION(nvmeq->q_depth));
 	dev->online_queues++;
 }
 
@@ -736,70 +727,276 @@ static int nvme_blk_probe(struct udevice *udev)
 	memcpy(desc->vendor, ndev->vendor, sizeof(ndev->vendor));
 	memcpy(desc->product, ndev->serial, sizeof(ndev->serial));
 	memcpy(desc->revision, ndev->firmware_rev, sizeof(ndev->firmware_rev));
+	blk_queue_setup(udev, ndev->nr_slots,
+			min(1U << (ndev->max_transfer_shift - ns->lba_shift),
+			    0x10000U));
 
 	free(id);
 	return 0;
 }
 
-static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
-			 lbaint_t blkcnt, void *buffer, bool read)
+static int nvme_setup_io_slots(struct nvme_dev *dev)
+{
+	u32 page_size = dev->page_size;
+	u32 prps_per_page = page_size >> 3;
+	u32 nprps, size;
+	int i;
+
+	/* One command id is used per slot; a full queue has one entry unused */
+	dev->nr_slots = dev->queues[NVME_IO_Q]->q_depth - 1;
+	dev->slots = calloc(dev->nr_slots, sizeof(struct nvme_io_slot));
+	if (!dev->slots)
+		return -ENOMEM;
+
+	/*
+	 * Preallocate a PRP list for each slot, large enough for the largest
+	 * transfer. Lists smaller than a page are packed so that none of them
+	 * crosses a page boundary.
+	 */
+	nprps = DIV_ROUND_UP(1U << dev->max_transfer_shift, page_size) + 1;
+	if (nprps <= prps_per_page)
+		size = __roundup_pow_of_two(nprps * sizeof(u64));
+	else
+		size = DIV_ROUND_UP(nprps - 1, prps_per_page - 1) * page_size;
+	dev->prp_slot_size = size;
+	dev->prp_pool = memalign(page_size, dev->nr_slots * size);
+	if (!dev->prp_pool) {
+		free(dev->slots);
+		dev->slots = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < dev->nr_slots; i++)
+		dev->slots[i].prp_list = (void *)dev->prp_pool + i * size;
+
+	return 0;
+}
+
+/* Take a reference to a request while its commands are in flight */
+static void nvme_req_get(struct blk_req *req)
+{
+	req->priv = (void *)((ulong)req->priv + 1);
+}
+
+/* Drop a reference, completing the request when none are left */
+static bool nvme_req_put(struct blk_req *req)
+{
+	req->priv = (void *)((ulong)req->priv - 1);
+	if (req->priv)
+		return false;
+	req->done = true;
+
+	return true;
+}
+
+/* Record that the transfer failed from block @slba onwards */
+static void nvme_req_fail(struct blk_req *req, u64 slba, int err)
+{
+	lbaint_t good = slba - req->start;
+
+	if (req->result < 0)
+		return;
+	req->result = good ? min_t(lbaint_t, req->result, good) : err;
+}
+
+/**
+ * nvme_io_poll() - Process completions on the I/O queue
+ *
+ * If no command completes within the I/O timeout while commands are in
+ * flight, all of them are failed.
+ *
+ * @dev:	NVMe device
+ * Return: number of requests completed, or -ETIMEDOUT
+ */
+static int nvme_io_poll(struct nvme_dev *dev)
+{
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	struct nvme_ops *ops = (struct nvme_ops *)dev->udev->driver->ops;
+	u16 head = nvmeq->cq_head;
+	u16 phase = nvmeq->cq_phase;
+	int completed = 0;
+	bool seen = false;
+	int i;
+
+	while (dev->slots_busy) {
+		struct nvme_io_slot *slot;
+		struct blk_req *req;
+		u16 status, id;
+
+		status = nvme_read_completion_status(nvmeq, head);
+		if ((status & 0x01) != phase)
+			break;
+		id = readw(&nvmeq->cqes[head].command_id);
+		if (++head == nvmeq->q_depth) {
+			head = 0;
+			phase = !phase;
+		}
+		seen = true;
+		if (id >= dev->nr_slots || !dev->slots[id].req) {
+			log_debug("Unexpected completion for command %u\n", id);
+			continue;
+		}
+
+		slot = &dev->slots[id];
+		if (ops && ops->complete_cmd)
+			ops->complete_cmd(nvmeq, &nvmeq->sq_cmds[slot->sq_index]);
+
+		req = slot->req;
+		status >>= 1;
+		if (status) {
+			printf("ERROR: status = %x, command = %d\n", status, id);
+			nvme_req_fail(req, slot->slba, -EIO);
+		} else if (req->op == BLK_REQ_READ) {
+			invalidate_dcache_range(slot->buffer,
+						slot->buffer + slot->len);
+		}
+		slot->req = NULL;
+		dev->slots_busy--;
+		if (nvme_req_put(req))
+			completed++;
+	}
+
+	if (seen) {
+		writel(head, nvmeq->q_db + dev->db_stride);
+		nvmeq->cq_head = head;
+		nvmeq->cq_phase = phase;
+		dev->io_start = timer_get_us();
+	} else if (dev->slots_busy &&
+		   timer_get_us() - dev->io_start >= IO_TIMEOUT * 100000) {
+		printf("ERROR: %d I/O commands timed out\n", dev->slots_busy);
+		for (i = 0; i < dev->nr_slots; i++) {
+			struct nvme_io_slot *slot = &dev->slots[i];
+
+			if (!slot->req)
+				continue;
+			nvme_req_fail(slot->req, slot->slba, -ETIMEDOUT);
+			nvme_req_put(slot->req);
+			slot->req = NULL;
+		}
+		dev->slots_busy = 0;
+
+		return -ETIMEDOUT;
+	}
+
+	return completed;
+}
+
+static struct nvme_io_slot *nvme_get_slot(struct nvme_dev *dev, u16 *idp)
+{
+	int i;
+
+	for (i = 0; i < dev->nr_slots; i++) {
+		if (!dev->slots[i].req) {
+			*idp = i;
+			return &dev->slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * nvme_io_submit() - Submit the commands for a block request
+ *
+ * The request is split into commands of at most the maximum transfer size,
+ * each using its own slot, so that many of them can be in flight at once.
+ * This waits for slots to become free when the queue is full, unless none is
+ * free on entry.
+ *
+ * @ns:		Namespace to access
+ * @req:	Request to submit
+ * Return: 0 if OK, -EBUSY if the queue is full. Once the request has been
+ * accepted, errors are reported through its result when it completes
+ */
+static int nvme_io_submit(struct nvme_ns *ns, struct blk_req *req)
 {
-	struct nvme_ns *ns = dev_get_priv(udev);
 	struct nvme_dev *dev = ns->dev;
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	u32 lbas_max = min(1U << (dev->max_transfer_shift - ns->lba_shift),
+			   0x10000U);
+	ulong buffer = (ulong)req->buffer;
+	u64 total_len = (u64)req->blkcnt << ns->lba_shift;
+	u64 slba = req->start;
+	lbaint_t left = req->blkcnt;
 	struct nvme_command c;
-	struct blk_desc *desc = dev_get_uclass_plat(udev);
-	int status;
-	u64 prp2;
-	u64 total_len = blkcnt << desc->log2blksz;
-	u64 temp_len = total_len;
-	uintptr_t temp_buffer = (uintptr_t)buffer;
+	int ret = 0;
 
-	u64 slba = blknr;
-	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
-	u64 total_lbas = blkcnt;
+	if (dev->slots_busy == dev->nr_slots)
+		return -EBUSY;
 
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
+	flush_dcache_range(buffer, buffer + total_len);
 
-	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
+	memset(&c, 0, sizeof(c));
+	c.rw.opcode = req->op == BLK_REQ_READ ? nvme_cmd_read : nvme_cmd_write;
 	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
-
-	while (total_lbas) {
-		if (total_lbas < lbas) {
-			lbas = (u16)total_lbas;
-			total_lbas = 0;
-		} else {
-			total_lbas -= lbas;
+
+	req->result = req->blkcnt;
+	req->priv = NULL;
+	/* Hold a reference until all commands have been submitted */
+	nvme_req_get(req);
+	while (left) {
+		u32 lbas = min_t(lbaint_t, left, lbas_max);
+		struct nvme_io_slot *slot;
+		u64 prp2;
+		u16 id;
+
+		while (!(slot = nvme_get_slot(dev, &id))) {
+			ret = nvme_io_poll(dev);
+			if (ret < 0)
+				break;
+		}
+		if (!slot) {
+			/* Report the failure when the request completes */
+			nvme_req_fail(req, slba, ret);
+			break;
 		}
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, temp_buffer))
-			return -EIO;
+		slot->slba = slba;
+		slot->buffer = buffer;
+		slot->len = lbas << ns->lba_shift;
+		nvme_setup_prps(dev, slot->prp_list, &prp2, slot->len, buffer);
+		c.rw.command_id = id;
 		c.rw.slba = cpu_to_le64(slba);
-		slba += lbas;
 		c.rw.length = cpu_to_le16(lbas - 1);
-		c.rw.prp1 = cpu_to_le64(temp_buffer);
+		c.rw.prp1 = cpu_to_le64(buffer);
 		c.rw.prp2 = cpu_to_le64(prp2);
-		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
-				&c, NULL, IO_TIMEOUT);
-		if (status)
-			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		temp_buffer += lbas << ns->lba_shift;
+
+		if (!dev->slots_busy)
+			dev->io_start = timer_get_us();
+		slot->req = req;
+		slot->sq_index = nvmeq->sq_tail;
+		dev->slots_busy++;
+		nvme_req_get(req);
+		nvme_submit_cmd(nvmeq, &c);
+
+		slba += lbas;
+		buffer += slot->len;
+		left -= lbas;
 	}
+	nvme_req_put(req);
 
-	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
+	return 0;
+}
 
-	return (total_len - temp_len) >> desc->log2blksz;
+static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
+			 lbaint_t blkcnt, void *buffer, bool read)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct blk_req req;
+	int ret;
+
+	blk_req_init(&req, read ? BLK_REQ_READ : BLK_REQ_WRITE, blknr, blkcnt,
+		     buffer);
+	while (nvme_io_submit(ns, &req) == -EBUSY) {
+		ret = nvme_io_poll(ns->dev);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* A timeout fails all commands in flight, so this always finishes */
+	while (!req.done)
+		nvme_io_poll(ns->dev);
+
+	return req.result;
 }
 
 static ulong nvme_blk_read(struct udevice *udev, lbaint_t blknr,
@@ -814,9 +1011,27 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 	return nvme_blk_rw(udev, blknr, blkcnt, (void *)buffer, false);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int nvme_blk_submit(struct udevice *udev, struct blk_req *req)
+{
+	return nvme_io_submit(dev_get_priv(udev), req);
+}
+
+static int nvme_blk_poll(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+
+	return nvme_io_poll(ns->dev);
+}
+#endif
+
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= nvme_blk_submit,
+	.poll	= nvme_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -831,6 +1046,7 @@ int nvme_init(struct udevice *udev)
 {
 	struct nvme_dev *ndev = dev_get_priv(udev);
 	struct nvme_id_ns *id;
+	struct nvme_ops *ops;
 	int ret;
 
 	ndev->udev = udev;
@@ -850,7 +1066,14 @@ int nvme_init(struct udevice *udev)
 	memset(ndev->queues, 0, NVME_Q_NUM * sizeof(struct nvme_queue *));
 
 	ndev->cap = nvme_readq(&ndev->bar->cap);
-	ndev->q_depth = min_t(int, NVME_CAP_MQES(ndev->cap) + 1, NVME_Q_DEPTH);
+	ops = (struct nvme_ops *)udev->driver->ops;
+	if (ops && ops->submit_cmd) {
+		/* Controller-specific submission handles one command at a time */
+		ndev->q_depth = NVME_AQ_DEPTH;
+	} else {
+		ndev->q_depth = min_t(int, NVME_CAP_MQES(ndev->cap) + 1,
+				      CONFIG_NVME_IO_QUEUE_DEPTH + 1);
+	}
 	ndev->db_stride = 1 << NVME_CAP_STRIDE(ndev->cap);
 	ndev->dbs = ((void __iomem *)ndev->bar) + 4096;
 
@@ -860,15 +1083,6 @@ int nvme_init(struct udevice *udev)
 		goto free_queue;
 	}
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
-		ret = -ENOMEM;
-		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
-	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
-
 	ret = nvme_setup_io_queues(ndev);
 	if (ret) {
 		log_debug("Unable to setup I/O queues(err=%dE)\n", ret);
@@ -877,6 +1091,13 @@ int nvme_init(struct udevice *udev)
 
 	nvme_get_info_from_identify(ndev);
 
+	/* Allocate after the page size and maximum transfer size are known */
+	ret = nvme_setup_io_slots(ndev);
+	if (ret) {
+		printf("Error: %s: Out of memory!\n", udev->name);
+		goto free_queue;
+	}
+
 	/* Create a blk device for each namespace */
 
 	id = memalign(ndev->page_size, sizeof(struct nvme_id_ns));
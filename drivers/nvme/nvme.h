@@ -594,6 +594,28 @@ enum {
 	NVME_CSTS_SHST_MASK	= 3 << 2,
 };
 
+/**
+ * struct nvme_io_slot - An I/O command slot
+ *
+ * Each slot corresponds to a command identifier on the I/O queue, so that a
+ * completion can be matched up with the request it belongs to.
+ *
+ * @req:	Block request this command is part of, NULL if the slot is free
+ * @prp_list:	PRP list for this slot, from the device's PRP pool
+ * @slba:	First block transferred by this command
+ * @buffer:	Address of the data buffer
+ * @len:	Length of the transfer in bytes
+ * @sq_index:	Index of the command in the submission queue
+ */
+struct nvme_io_slot {
+	struct blk_req *req;
+	u64 *prp_list;
+	u64 slba;
+	ulong buffer;
+	u32 len;
+	u16 sq_index;
+};
+
 /* Represents an NVM Express device. Each nvme_dev is a PCI function. */
 struct nvme_dev {
 	struct udevice *udev;
@@ -619,8 +641,12 @@ struct nvme_dev {
 	u32 page_size;
 	u8 vwc;
 	u64 *prp_pool;
-	u32 prp_entry_num;
+	u32 prp_slot_size;
 	u32 nn;
+	struct nvme_io_slot *slots;
+	u32 nr_slots;
+	u32 slots_busy;
+	ulong io_start;
 };
 
 /* Admin queue and a single I/O queue. */
@@ -168,6 +168,7 @@ static int cadence_spi_set_speed(struct udevice *bus, uint hz)
 
 	if (!hz || hz > priv->max_hz)
 		hz = priv->max_hz;
+	priv->dirmap_rdesc = NULL;
 	/* Disable QSPI */
 	cadence_qspi_apb_controller_disable(priv->regbase);
 
@@ -302,6 +303,8 @@ static int cadence_spi_set_mode(struct udevice *bus, uint mode)
 {
 	struct cadence_spi_priv *priv = dev_get_priv(bus);
 
+	priv->dirmap_rdesc = NULL;
+
 	/* Disable QSPI */
 	cadence_qspi_apb_controller_disable(priv->regbase);
 
@@ -327,6 +330,9 @@ static int cadence_spi_mem_exec_op(struct spi_slave *spi,
 	int err = 0;
 	u32 mode;
 
+	/* Any of the ops below may reprogram the read instruction */
+	priv->dirmap_rdesc = NULL;
+
 	/* Set Chip select */
 	cadence_qspi_apb_chipselect(base, spi_chip_select(spi->dev),
 				    priv->is_decoded_cs);
@@ -412,6 +418,78 @@ static bool cadence_spi_mem_supports_op(struct spi_slave *slave,
 		return spi_mem_default_supports_op(slave, op);
 }
 
+static int cadence_spi_mem_dirmap_create(struct spi_mem_dirmap_desc *desc)
+{
+	struct udevice *bus = desc->slave->dev->parent;
+	struct cadence_spi_priv *priv = dev_get_priv(bus);
+
+	/* Only reads go through the AHB window, writes stay indirect */
+	if (desc->info.op_tmpl.data.dir != SPI_MEM_DATA_IN)
+		return -EOPNOTSUPP;
+
+	if (!priv->use_dac_mode || priv->is_dma)
+		return -EOPNOTSUPP;
+
+	/*
+	 * The read instruction is only set up once per mapping, which leaves
+	 * the indirect start address stale. Reads reaching the end of the
+	 * window fall back to indirect mode, so keep mappings strictly inside.
+	 */
+	if (desc->info.offset + desc->info.length >= priv->ahbsize)
+		return -EOPNOTSUPP;
+
+	if (!cadence_spi_mem_supports_op(desc->slave, &desc->info.op_tmpl))
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+static void cadence_spi_mem_dirmap_destroy(struct spi_mem_dirmap_desc *desc)
+{
+	struct udevice *bus = desc->slave->dev->parent;
+	struct cadence_spi_priv *priv = dev_get_priv(bus);
+
+	if (priv->dirmap_rdesc == desc)
+		priv->dirmap_rdesc = NULL;
+}
+
+static ssize_t cadence_spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
+					   u64 offs, size_t len, void *buf)
+{
+	struct udevice *bus = desc->slave->dev->parent;
+	struct cadence_spi_priv *priv = dev_get_priv(bus);
+	struct spi_mem_op op = desc->info.op_tmpl;
+	int err;
+
+	if (offs >= desc->info.length)
+		return -EINVAL;
+
+	op.addr.val = desc->info.offset + offs;
+	op.data.nbytes = min_t(u64, len, desc->info.length - offs);
+	op.data.buf.in = buf;
+
+	cadence_qspi_apb_chipselect(priv->regbase,
+				    spi_chip_select(desc->slave->dev),
+				    priv->is_decoded_cs);
+
+	/*
+	 * The read instruction only has to be programmed once: until another
+	 * op is sent, the window keeps serving reads with it.
+	 */
+	if (priv->dirmap_rdesc != desc) {
+		err = cadence_qspi_apb_read_setup(priv, &op);
+		if (err)
+			return err;
+		priv->dirmap_rdesc = desc;
+	}
+
+	err = cadence_qspi_apb_read_execute(priv, &op);
+	if (err)
+		return err;
+
+	return op.data.nbytes;
+}
+
 static int cadence_spi_of_to_plat(struct udevice *bus)
 {
 	struct cadence_spi_plat *plat = dev_get_plat(bus);
@@ -473,6 +551,9 @@ static int cadence_spi_of_to_plat(struct udevice *bus)
 static const struct spi_controller_mem_ops cadence_spi_mem_ops = {
 	.exec_op = cadence_spi_mem_exec_op,
 	.supports_op = cadence_spi_mem_supports_op,
+	.dirmap_create = cadence_spi_mem_dirmap_create,
+	.dirmap_destroy = cadence_spi_mem_dirmap_destroy,
+	.dirmap_read = cadence_spi_mem_dirmap_read,
 };
 
 static const struct dm_spi_ops cadence_spi_ops = {
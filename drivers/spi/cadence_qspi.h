@@ -261,6 +261,9 @@ struct cadence_spi_priv {
 	bool		use_dac_mode;
 	bool		is_dma;
 
+	/* Read mapping whose instruction is currently programmed */
+	struct spi_mem_dirmap_desc *dirmap_rdesc;
+
 	/* Transaction protocol parameters. */
 	u8		inst_width;
 	u8		addr_width;
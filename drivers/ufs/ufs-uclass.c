@@ -23,10 +23,12 @@
 #include <scsi.h>
 #include <ufs.h>
 #include <asm/io.h>
+#include <asm/unaligned.h>
 #include <asm/dma-mapping.h>
 #include <linux/bitops.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
+#include <linux/sizes.h>
 
 #include "ufs.h"
 
@@ -51,7 +53,7 @@
 /* Timeout after 30 msecs if NOP OUT hangs without response */
 #define NOP_OUT_TIMEOUT    30 /* msecs */
 
-/* Only use one Task Tag for all requests */
+/* Task Tag used for device management and unsplit SCSI requests */
 #define TASK_TAG	0
 
 /* Expose the flag value from utp_upiu_query.value */
@@ -59,8 +61,14 @@
 
 #define MAX_PRDT_ENTRY	262144
 
-/* maximum bytes per request */
-#define UFS_MAX_BYTES	(128 * 256 * 1024)
+/* maximum bytes per transfer request slot */
+#define UFS_MAX_BYTES	(MAX_BUFF * MAX_PRDT_ENTRY)
+
+/* READ(10)/WRITE(10) carry a 16-bit block count; UFS blocks are 4 KiB */
+#define UFS_MAX_SCSI_BYTES	(0xffff * SZ_4K)
+
+/* Do not split a SCSI request into slots smaller than this */
+#define UFS_MIN_SLOT_BYTES	SZ_128K
 
 static inline bool ufshcd_is_hba_active(struct ufs_hba *hba);
 static inline void ufshcd_hba_stop(struct ufs_hba *hba);
@@ -659,22 +667,27 @@ static void ufshcd_host_memory_configure(struct ufs_hba *hba)
 	dma_addr_t cmd_desc_dma_addr;
 	u16 response_offset;
 	u16 prdt_offset;
+	int i;
+
+	response_offset = offsetof(struct utp_transfer_cmd_desc, response_upiu);
+	prdt_offset = offsetof(struct utp_transfer_cmd_desc, prd_table);
 
-	utrdlp = hba->utrdl;
-	cmd_desc_dma_addr = dev_phys_to_bus(hba->dev, (phys_addr_t)(uintptr_t)(hba->ucdl));
+	for (i = 0; i < hba->nutrs; i++) {
+		utrdlp = &hba->utrdl[i];
+		cmd_desc_dma_addr = dev_phys_to_bus(hba->dev,
+						    (phys_addr_t)(uintptr_t)&hba->ucdl[i]);
 
-	utrdlp->command_desc_base_addr_lo =
+		utrdlp->command_desc_base_addr_lo =
 				cpu_to_le32(lower_32_bits(cmd_desc_dma_addr));
-	utrdlp->command_desc_base_addr_hi =
+		utrdlp->command_desc_base_addr_hi =
 				cpu_to_le32(upper_32_bits(cmd_desc_dma_addr));
 
-	response_offset = offsetof(struct utp_transfer_cmd_desc, response_upiu);
-	prdt_offset = offsetof(struct utp_transfer_cmd_desc, prd_table);
-
-	utrdlp->response_upiu_offset = cpu_to_le16(response_offset >> 2);
-	utrdlp->prd_table_offset = cpu_to_le16(prdt_offset >> 2);
-	utrdlp->response_upiu_length = cpu_to_le16(ALIGNED_UPIU_SIZE >> 2);
+		utrdlp->response_upiu_offset = cpu_to_le16(response_offset >> 2);
+		utrdlp->prd_table_offset = cpu_to_le16(prdt_offset >> 2);
+		utrdlp->response_upiu_length = cpu_to_le16(ALIGNED_UPIU_SIZE >> 2);
+	}
 
+	/* Device management commands always use TASK_TAG */
 	hba->ucd_req_ptr = (struct utp_upiu_req *)hba->ucdl;
 	hba->ucd_rsp_ptr =
 		(struct utp_upiu_rsp *)&hba->ucdl->response_upiu;
@@ -687,23 +700,23 @@ static void ufshcd_host_memory_configure(struct ufs_hba *hba)
  */
 static int ufshcd_memory_alloc(struct ufs_hba *hba)
 {
-	/* Allocate one Transfer Request Descriptor
+	/* Allocate one Transfer Request Descriptor per slot
 	 * Should be aligned to 1k boundary.
 	 */
 	hba->utrdl = memalign(1024,
-			      ALIGN(sizeof(struct utp_transfer_req_desc),
-				    ARCH_DMA_MINALIGN));
+			      ALIGN(sizeof(struct utp_transfer_req_desc) *
+				    hba->nutrs, ARCH_DMA_MINALIGN));
 	if (!hba->utrdl) {
 		dev_err(hba->dev, "Transfer Descriptor memory allocation failed\n");
 		return -ENOMEM;
 	}
 
-	/* Allocate one Command Descriptor
+	/* Allocate one Command Descriptor per slot
 	 * Should be aligned to 1k boundary.
 	 */
 	hba->ucdl = memalign(1024,
-			     ALIGN(sizeof(struct utp_transfer_cmd_desc),
-				   ARCH_DMA_MINALIGN));
+			     ALIGN(sizeof(struct utp_transfer_cmd_desc) *
+				   hba->nutrs, ARCH_DMA_MINALIGN));
 	if (!hba->ucdl) {
 		dev_err(hba->dev, "Command descriptor memory allocation failed\n");
 		return -ENOMEM;
@@ -783,10 +796,11 @@ static void ufshcd_cache_invalidate(void *addr, unsigned long size)
  * descriptor according to request
  */
 static void ufshcd_prepare_req_desc_hdr(struct ufs_hba *hba,
+					unsigned int task_tag,
 					u32 *upiu_flags,
 					enum dma_data_direction cmd_dir)
 {
-	struct utp_transfer_req_desc *req_desc = hba->utrdl;
+	struct utp_transfer_req_desc *req_desc = &hba->utrdl[task_tag];
 	u32 data_direction;
 	u32 dword_0;
 
@@ -894,7 +908,7 @@ static int ufshcd_comp_devman_upiu(struct ufs_hba *hba,
 
 	hba->dev_cmd.type = cmd_type;
 
-	ufshcd_prepare_req_desc_hdr(hba, &upiu_flags, DMA_NONE);
+	ufshcd_prepare_req_desc_hdr(hba, TASK_TAG, &upiu_flags, DMA_NONE);
 	switch (cmd_type) {
 	case DEV_CMD_TYPE_QUERY:
 		ufshcd_prepare_utp_query_req_upiu(hba, upiu_flags);
@@ -909,13 +923,26 @@ static int ufshcd_comp_devman_upiu(struct ufs_hba *hba,
 	return ret;
 }
 
-static int ufshcd_send_command(struct ufs_hba *hba, unsigned int task_tag)
+/**
+ * ufshcd_send_commands() - Ring the doorbell for several slots and wait
+ * @hba: per adapter instance
+ * @slots: bitmask of the transfer request slots to start
+ *
+ * The completion interrupt is raised as soon as any slot completes, so keep
+ * polling until the controller has also cleared every doorbell bit we set.
+ * Slots still pending on error or timeout are cleared from the list.
+ *
+ * Return: 0 if all slots completed, -ve on error
+ */
+static int ufshcd_send_commands(struct ufs_hba *hba, u32 slots)
 {
 	unsigned long start;
 	u32 intr_status;
 	u32 enabled_intr_status;
+	bool completed = false;
+	int err = 0;
 
-	ufshcd_writel(hba, 1 << task_tag, REG_UTP_TRANSFER_REQ_DOOR_BELL);
+	ufshcd_writel(hba, slots, REG_UTP_TRANSFER_REQ_DOOR_BELL);
 
 	/* Make sure doorbell reg is updated before reading interrupt status */
 	wmb();
@@ -931,19 +958,32 @@ static int ufshcd_send_command(struct ufs_hba *hba, unsigned int task_tag)
 			if (get_timer(start) > QUERY_REQ_TIMEOUT) {
 				dev_err(hba->dev,
 					"Timedout waiting for UTP response\n");
-				return -ETIMEDOUT;
+				err = -ETIMEDOUT;
+				break;
 			}
 		}
 
 		if (enabled_intr_status & UFSHCD_ERROR_MASK) {
 			dev_err(hba->dev, "Error in status:%08x\n",
 				enabled_intr_status);
-
-			return -1;
+			err = -1;
+			break;
 		}
-	} while (!(enabled_intr_status & UTP_TRANSFER_REQ_COMPL));
 
-	return 0;
+		if (enabled_intr_status & UTP_TRANSFER_REQ_COMPL)
+			completed = true;
+	} while (!completed ||
+		 (ufshcd_readl(hba, REG_UTP_TRANSFER_REQ_DOOR_BELL) & slots));
+
+	if (err)
+		ufshcd_writel(hba, ~slots, REG_UTP_TRANSFER_REQ_LIST_CLEAR);
+
+	return err;
+}
+
+static int ufshcd_send_command(struct ufs_hba *hba, unsigned int task_tag)
+{
+	return ufshcd_send_commands(hba, BIT(task_tag));
 }
 
 /**
@@ -960,9 +1000,9 @@ static inline int ufshcd_get_req_rsp(struct utp_upiu_rsp *ucd_rsp_ptr)
  * ufshcd_get_tr_ocs - Get the UTRD Overall Command Status
  *
  */
-static inline int ufshcd_get_tr_ocs(struct ufs_hba *hba)
+static inline int ufshcd_get_tr_ocs(struct ufs_hba *hba, unsigned int task_tag)
 {
-	struct utp_transfer_req_desc *req_desc = hba->utrdl;
+	struct utp_transfer_req_desc *req_desc = &hba->utrdl[task_tag];
 
 	ufshcd_cache_invalidate(req_desc, sizeof(*req_desc));
 
@@ -1037,7 +1077,7 @@ static int ufshcd_exec_dev_cmd(struct ufs_hba *hba, enum dev_cmd_type cmd_type,
 	if (err)
 		return err;
 
-	err = ufshcd_get_tr_ocs(hba);
+	err = ufshcd_get_tr_ocs(hba, TASK_TAG);
 	if (err) {
 		dev_err(hba->dev, "Error in OCS:%d\n", err);
 		return -EINVAL;
@@ -1587,15 +1627,19 @@ static int ufshcd_uic_change_pwr_mode(struct ufs_hba *hba, u8 mode)
 
 static
 void ufshcd_prepare_utp_scsi_cmd_upiu(struct ufs_hba *hba,
+				      unsigned int task_tag,
 				      struct scsi_cmd *pccb, u32 upiu_flags)
 {
-	struct utp_upiu_req *ucd_req_ptr = hba->ucd_req_ptr;
+	struct utp_transfer_cmd_desc *ucd = &hba->ucdl[task_tag];
+	struct utp_upiu_req *ucd_req_ptr = (struct utp_upiu_req *)ucd;
+	struct utp_upiu_rsp *ucd_rsp_ptr =
+		(struct utp_upiu_rsp *)ucd->response_upiu;
 	unsigned int cdb_len;
 
 	/* command descriptor fields */
 	ucd_req_ptr->header.dword_0 =
 			UPIU_HEADER_DWORD(UPIU_TRANSACTION_COMMAND, upiu_flags,
-					  pccb->lun, TASK_TAG);
+					  pccb->lun, task_tag);
 	ucd_req_ptr->header.dword_1 =
 			UPIU_HEADER_DWORD(UPIU_COMMAND_SET_TYPE_SCSI, 0, 0, 0);
 
@@ -1608,9 +1652,9 @@ void ufshcd_prepare_utp_scsi_cmd_upiu(struct ufs_hba *hba,
 	memset(ucd_req_ptr->sc.cdb, 0, UFS_CDB_SIZE);
 	memcpy(ucd_req_ptr->sc.cdb, pccb->cmd, cdb_len);
 
-	memset(hba->ucd_rsp_ptr, 0, sizeof(struct utp_upiu_rsp));
+	memset(ucd_rsp_ptr, 0, sizeof(struct utp_upiu_rsp));
 	ufshcd_cache_flush(ucd_req_ptr, sizeof(*ucd_req_ptr));
-	ufshcd_cache_flush(hba->ucd_rsp_ptr, sizeof(*hba->ucd_rsp_ptr));
+	ufshcd_cache_flush(ucd_rsp_ptr, sizeof(*ucd_rsp_ptr));
 }
 
 static inline void prepare_prdt_desc(struct ufs_hba *hba,
@@ -1624,10 +1668,11 @@ static inline void prepare_prdt_desc(struct ufs_hba *hba,
 	entry->upper_addr = cpu_to_le32(upper_32_bits(da));
 }
 
-static void prepare_prdt_table(struct ufs_hba *hba, struct scsi_cmd *pccb)
+static void prepare_prdt_table(struct ufs_hba *hba, unsigned int task_tag,
+			       struct scsi_cmd *pccb)
 {
-	struct utp_transfer_req_desc *req_desc = hba->utrdl;
-	struct ufshcd_sg_entry *prd_table = hba->ucd_prdt_ptr;
+	struct utp_transfer_req_desc *req_desc = &hba->utrdl[task_tag];
+	struct ufshcd_sg_entry *prd_table = hba->ucdl[task_tag].prd_table;
 	ulong datalen = pccb->datalen;
 	int table_length;
 	u8 *buf;
@@ -1656,30 +1701,122 @@ static void prepare_prdt_table(struct ufs_hba *hba, struct scsi_cmd *pccb)
 	ufshcd_cache_flush(req_desc, sizeof(*req_desc));
 }
 
-static int ufs_scsi_exec(struct udevice *scsi_dev, struct scsi_cmd *pccb)
+/**
+ * ufs_scsi_get_rw() - Decode the LBA and block count of a read/write CDB
+ * @pccb: SCSI command
+ * @lba: returns the first logical block
+ * @blocks: returns the number of blocks
+ *
+ * Return: true if @pccb is a READ(10), READ(16) or WRITE(10) moving data
+ */
+static bool ufs_scsi_get_rw(struct scsi_cmd *pccb, u64 *lba, u32 *blocks)
 {
-	struct ufs_hba *hba = dev_get_uclass_priv(scsi_dev->parent);
+	switch (pccb->cmd[0]) {
+	case SCSI_READ10:
+	case SCSI_WRITE10:
+		*lba = get_unaligned_be32(&pccb->cmd[2]);
+		*blocks = get_unaligned_be16(&pccb->cmd[7]);
+		break;
+	case SCSI_READ16:
+		*lba = get_unaligned_be64(&pccb->cmd[2]);
+		*blocks = get_unaligned_be32(&pccb->cmd[10]);
+		break;
+	default:
+		return false;
+	}
+
+	return *blocks && pccb->datalen && !(pccb->datalen % *blocks);
+}
+
+static void ufs_scsi_set_rw(struct scsi_cmd *pccb, u64 lba, u32 blocks)
+{
+	if (pccb->cmd[0] == SCSI_READ16) {
+		put_unaligned_be64(lba, &pccb->cmd[2]);
+		put_unaligned_be32(blocks, &pccb->cmd[10]);
+	} else {
+		put_unaligned_be32(lba, &pccb->cmd[2]);
+		put_unaligned_be16(blocks, &pccb->cmd[7]);
+	}
+}
+
+/**
+ * ufs_scsi_split() - Spread a SCSI request over the transfer request slots
+ * @hba: per adapter instance
+ * @pccb: SCSI command to send
+ *
+ * Reads and writes are cut into runs of whole blocks, one per slot, so that
+ * the device can work on all of them at once. Anything else, and requests
+ * too small to be worth splitting, go to TASK_TAG alone.
+ *
+ * Return: bitmask of the slots that were prepared, 0 if the request does not
+ * fit in the slots
+ */
+static u32 ufs_scsi_split(struct ufs_hba *hba, struct scsi_cmd *pccb)
+{
+	struct scsi_cmd chunk;
+	u32 blocks, blksz, per_slot, n;
 	u32 upiu_flags;
-	int ocs, result = 0;
-	u8 scsi_status;
+	u32 slots = 0;
+	u64 lba;
+	int tag;
 
-	ufshcd_prepare_req_desc_hdr(hba, &upiu_flags, pccb->dma_dir);
-	ufshcd_prepare_utp_scsi_cmd_upiu(hba, pccb, upiu_flags);
-	prepare_prdt_table(hba, pccb);
+	if (hba->nutrs == 1 || pccb->datalen <= UFS_MIN_SLOT_BYTES ||
+	    !ufs_scsi_get_rw(pccb, &lba, &blocks)) {
+		ufshcd_prepare_req_desc_hdr(hba, TASK_TAG, &upiu_flags,
+					    pccb->dma_dir);
+		ufshcd_prepare_utp_scsi_cmd_upiu(hba, TASK_TAG, pccb,
+						 upiu_flags);
+		prepare_prdt_table(hba, TASK_TAG, pccb);
 
-	ufshcd_cache_flush(pccb->pdata, pccb->datalen);
+		return BIT(TASK_TAG);
+	}
 
-	ufshcd_send_command(hba, TASK_TAG);
+	blksz = pccb->datalen / blocks;
+	per_slot = max_t(u32, DIV_ROUND_UP(blocks, hba->nutrs),
+			 DIV_ROUND_UP(UFS_MIN_SLOT_BYTES, blksz));
+	per_slot = min_t(u32, per_slot, UFS_MAX_BYTES / blksz);
 
-	ufshcd_cache_invalidate(pccb->pdata, pccb->datalen);
+	chunk = *pccb;
+	for (tag = 0; blocks && tag < hba->nutrs; tag++) {
+		n = min(blocks, per_slot);
+		chunk.datalen = n * blksz;
+		ufs_scsi_set_rw(&chunk, lba, n);
+
+		ufshcd_prepare_req_desc_hdr(hba, tag, &upiu_flags,
+					    chunk.dma_dir);
+		ufshcd_prepare_utp_scsi_cmd_upiu(hba, tag, &chunk, upiu_flags);
+		prepare_prdt_table(hba, tag, &chunk);
+
+		slots |= BIT(tag);
+		chunk.pdata += chunk.datalen;
+		lba += n;
+		blocks -= n;
+	}
+
+	return blocks ? 0 : slots;
+}
+
+/**
+ * ufs_scsi_check_slot() - Check the outcome of a completed SCSI command
+ * @hba: per adapter instance
+ * @task_tag: slot the command ran in
+ *
+ * Return: 0 on success, -EINVAL on any error
+ */
+static int ufs_scsi_check_slot(struct ufs_hba *hba, unsigned int task_tag)
+{
+	struct utp_upiu_rsp *ucd_rsp_ptr =
+		(struct utp_upiu_rsp *)hba->ucdl[task_tag].response_upiu;
+	int ocs, result = 0;
+	u8 scsi_status;
 
-	ocs = ufshcd_get_tr_ocs(hba);
+	ocs = ufshcd_get_tr_ocs(hba, task_tag);
 	switch (ocs) {
 	case OCS_SUCCESS:
-		result = ufshcd_get_req_rsp(hba->ucd_rsp_ptr);
+		result = ufshcd_get_req_rsp(ucd_rsp_ptr);
 		switch (result) {
 		case UPIU_TRANSACTION_RESPONSE:
-			result = ufshcd_get_rsp_upiu_result(hba->ucd_rsp_ptr);
+			result = ufshcd_get_rsp_upiu_result(ucd_rsp_ptr);
 
 			scsi_status = result & MASK_SCSI_STATUS;
 			if (scsi_status)
@@ -1706,6 +1843,37 @@ static int ufs_scsi_exec(struct udevice *scsi_dev, struct scsi_cmd *pccb)
 	return 0;
 }
 
+static int ufs_scsi_exec(struct udevice *scsi_dev, struct scsi_cmd *pccb)
+{
+	struct ufs_hba *hba = dev_get_uclass_priv(scsi_dev->parent);
+	u32 slots;
+	int tag, err;
+
+	slots = ufs_scsi_split(hba, pccb);
+	if (!slots)
+		return -EINVAL;
+
+	ufshcd_cache_flush(pccb->pdata, pccb->datalen);
+
+	err = ufshcd_send_commands(hba, slots);
+
+	ufshcd_cache_invalidate(pccb->pdata, pccb->datalen);
+
+	if (err)
+		return err;
+
+	for (tag = 0; tag < hba->nutrs; tag++) {
+		if (!(slots & BIT(tag)))
+			continue;
+
+		err = ufs_scsi_check_slot(hba, tag);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 static inline int ufshcd_read_desc(struct ufs_hba *hba, enum desc_idn desc_id,
 				   int desc_index, u8 *buf, u32 size)
 {
@@ -2180,7 +2348,6 @@ int ufshcd_probe(struct udevice *ufs_dev, struct ufs_hba_ops *hba_ops)
 	scsi_plat = dev_get_uclass_plat(scsi_dev);
 	scsi_plat->max_id = UFSHCD_MAX_ID;
 	scsi_plat->max_lun = UFS_MAX_LUNS;
-	scsi_plat->max_bytes_per_req = UFS_MAX_BYTES;
 
 	hba->dev = ufs_dev;
 	hba->ops = hba_ops;
@@ -2222,6 +2389,13 @@ int ufshcd_probe(struct udevice *ufs_dev, struct ufs_hba_ops *hba_ops)
 	/* Get Interrupt bit mask per version */
 	hba->intr_mask = ufshcd_get_intr_mask(hba);
 
+	hba->nutrs = min_t(int, CONFIG_UFS_QUEUE_DEPTH,
+			   (hba->capabilities &
+			    MASK_TRANSFER_REQUESTS_SLOTS_SDB) + 1);
+	scsi_plat->max_bytes_per_req = min_t(u64,
+					     (u64)UFS_MAX_BYTES * hba->nutrs,
+					     UFS_MAX_SCSI_BYTES);
+
 	/* Allocate memory for host memory space */
 	err = ufshcd_memory_alloc(hba);
 	if (err) {
@@ -702,8 +702,10 @@ struct ufs_hba {
 	u32			version;
 	u32			intr_mask;
 	enum ufshcd_quirks	quirks;
+	/* Number of transfer request slots in use */
+	int			nutrs;
 
-	/* Virtual memory reference */
+	/* Virtual memory reference, one entry per transfer request slot */
 	struct utp_transfer_cmd_desc *ucdl;
 	struct utp_transfer_req_desc *utrdl;
 	/* TODO: Add Task Manegement Support */
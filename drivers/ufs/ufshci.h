@@ -379,7 +379,8 @@ struct ufshcd_sg_entry {
 	__le32    size;
 };
 
-#define MAX_BUFF	128
+/* Keep each slot's command descriptor 128-byte aligned */
+#define MAX_BUFF	ALIGN(CONFIG_UFS_PRDT_ENTRIES, 8)
 /**
  * struct utp_transfer_cmd_desc - UFS Command Descriptor structure
  * @command_upiu: Command UPIU Frame address
@@ -8,6 +8,7 @@
 
 #include <blk.h>
 #include <dm.h>
+#include <malloc.h>
 #include <part.h>
 #include <virtio_types.h>
 #include <virtio.h>
@@ -15,6 +16,23 @@
 #include <linux/log2.h>
 #include "virtio_blk.h"
 
+/**
+ * struct virtio_blk_slot - state of a request queued to the device
+ *
+ * @out_hdr: request header, the first buffer of the request
+ * @wz: write-zeroes range, for VIRTIO_BLK_T_WRITE_ZEROES
+ * @status: status written by the device
+ * @req: block request this is part of, or NULL if the slot is free
+ * @start: first block of the request
+ */
+struct virtio_blk_slot {
+	struct virtio_blk_outhdr out_hdr;
+	struct virtio_blk_discard_write_zeroes wz;
+	u8 status;
+	struct blk_req *req;
+	lbaint_t start;
+};
+
 /**
  * struct virtio_blk_priv - private data for virtio block device
  */
@@ -23,11 +41,31 @@ struct virtio_blk_priv {
 	struct virtqueue *vq;
 	/** @blksz_shift - log2 of block size divided by 512 */
 	u32 blksz_shift;
+	/** @slots - one for each request which can be queued */
+	struct virtio_blk_slot *slots;
+	/** @nr_slots - number of slots */
+	u32 nr_slots;
+	/** @slots_busy - number of requests queued to the device */
+	u32 slots_busy;
+	/** @max_seg_size - maximum size of a data segment in bytes */
+	u32 max_seg_size;
+	/** @max_segs - maximum number of data segments in a request */
+	u32 max_segs;
+	/** @max_blks - maximum number of blocks in a request */
+	lbaint_t max_blks;
+	/** @sg - scatterlist entries for header, data segments and status */
+	struct virtio_sg *sg;
+	/** @sgs - pointers to @sg, as passed to virtqueue_add() */
+	struct virtio_sg **sgs;
 };
 
 static const u32 feature[] = {
+	VIRTIO_BLK_F_SIZE_MAX,
+	VIRTIO_BLK_F_SEG_MAX,
 	VIRTIO_BLK_F_BLK_SIZE,
-	VIRTIO_BLK_F_WRITE_ZEROES
+	VIRTIO_BLK_F_WRITE_ZEROES,
+	VIRTIO_RING_F_INDIRECT_DESC,
+	VIRTIO_RING_F_EVENT_IDX,
 };
 
 static void virtio_blk_init_header_sg(struct udevice *dev, u64 sector, u32 type,
@@ -61,65 +99,235 @@ static void virtio_blk_init_status_sg(u8 *status, struct virtio_sg *sg)
 	sg->length = sizeof(*status);
 }
 
-static void virtio_blk_init_data_sg(void *buffer, lbaint_t blkcnt, struct virtio_sg *sg)
+/* Split the data into segments no larger than the device accepts */
+static uint virtio_blk_init_data_sg(struct virtio_blk_priv *priv, void *buffer,
+				    lbaint_t blkcnt, struct virtio_sg *sg)
 {
-	sg->addr = buffer;
-	sg->length = blkcnt * 512;
+	size_t left = blkcnt * 512;
+	uint n;
+
+	for (n = 0; left; n++) {
+		sg[n].addr = buffer;
+		sg[n].length = min_t(size_t, left, priv->max_seg_size);
+		buffer += sg[n].length;
+		left -= sg[n].length;
+	}
+
+	return n;
 }
 
-static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
-			       lbaint_t blkcnt, void *buffer, u32 type)
+/* Take a reference to a request while its parts are queued */
+static void virtio_blk_req_get(struct blk_req *req)
+{
+	req->priv = (void *)((ulong)req->priv + 1);
+}
+
+/* Drop a reference, completing the request when none are left */
+static bool virtio_blk_req_put(struct blk_req *req)
+{
+	req->priv = (void *)((ulong)req->priv - 1);
+	if (req->priv)
+		return false;
+	req->done = true;
+
+	return true;
+}
+
+/* Record that the transfer failed from block @start onwards */
+static void virtio_blk_req_fail(struct blk_req *req, lbaint_t start, int err)
+{
+	lbaint_t good = start - req->start;
+
+	if (req->result < 0)
+		return;
+	req->result = good ? min_t(lbaint_t, req->result, good) : err;
+}
+
+/**
+ * virtio_blk_add() - Queue a single request to the device
+ *
+ * @dev:	virtio block device
+ * @slot:	free slot to use
+ * @type:	VIRTIO_BLK_T_... request type
+ * @start:	first block
+ * @blkcnt:	number of blocks, at most priv->max_blks for reads and writes
+ * @buffer:	data buffer, or NULL for VIRTIO_BLK_T_WRITE_ZEROES
+ * Return: 0 if OK, -ENOSPC if the ring is full, other -ve on error
+ */
+static int virtio_blk_add(struct udevice *dev, struct virtio_blk_slot *slot,
+			  u32 type, lbaint_t start, lbaint_t blkcnt,
+			  void *buffer)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
-	struct virtio_blk_outhdr out_hdr;
-	struct virtio_blk_discard_write_zeroes wz_hdr;
+	u64 sector = (u64)start << priv->blksz_shift;
 	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg hdr_sg, wz_sg, data_sg, status_sg;
-	struct virtio_sg *sgs[3];
-	u8 status;
-	int ret;
+	struct virtio_sg *sg = priv->sg;
+	uint nsegs, i;
 
-	sector <<= priv->blksz_shift;
 	blkcnt <<= priv->blksz_shift;
-	virtio_blk_init_header_sg(dev, sector, type, &out_hdr, &hdr_sg);
-	sgs[num_out++] = &hdr_sg;
+	virtio_blk_init_header_sg(dev, sector, type, &slot->out_hdr, sg++);
+	num_out++;
 
 	switch (type) {
 	case VIRTIO_BLK_T_IN:
 	case VIRTIO_BLK_T_OUT:
-		virtio_blk_init_data_sg(buffer, blkcnt, &data_sg);
+		nsegs = virtio_blk_init_data_sg(priv, buffer, blkcnt, sg);
+		sg += nsegs;
 		if (type & VIRTIO_BLK_T_OUT)
-			sgs[num_out++] = &data_sg;
+			num_out += nsegs;
 		else
-			sgs[num_out + num_in++] = &data_sg;
+			num_in += nsegs;
 		break;
 
 	case VIRTIO_BLK_T_WRITE_ZEROES:
-		virtio_blk_init_write_zeroes_sg(dev, sector, blkcnt, &wz_hdr, &wz_sg);
-		sgs[num_out++] = &wz_sg;
+		virtio_blk_init_write_zeroes_sg(dev, sector, blkcnt, &slot->wz,
+						sg++);
+		num_out++;
 		break;
 
 	default:
 		return -EINVAL;
 	}
 
-	virtio_blk_init_status_sg(&status, &status_sg);
-	sgs[num_out + num_in++] = &status_sg;
-	log_debug("dev=%s, active=%d, priv=%p, priv->vq=%p\n", dev->name,
-		  device_active(dev), priv, priv->vq);
+	slot->status = VIRTIO_BLK_S_IOERR;
+	virtio_blk_init_status_sg(&slot->status, sg);
+	num_in++;
+	for (i = 0; i < num_out + num_in; i++)
+		priv->sgs[i] = &priv->sg[i];
 
-	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
-	if (ret)
-		return ret;
+	return virtqueue_add(priv->vq, priv->sgs, num_out, num_in);
+}
+
+/**
+ * virtio_blk_poll_vq() - Process completed requests
+ *
+ * @dev:	virtio block device
+ * Return: number of block requests completed
+ */
+static int virtio_blk_poll_vq(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_slot *slot;
+	int completed = 0;
+
+	/* The header is the first buffer, so this gives us the slot */
+	while ((slot = virtqueue_get_buf(priv->vq, NULL))) {
+		struct blk_req *req = slot->req;
+
+		if (!req) {
+			log_debug("Unexpected completion %p\n", slot);
+			continue;
+		}
+		if (slot->status != VIRTIO_BLK_S_OK)
+			virtio_blk_req_fail(req, slot->start, -EIO);
+		slot->req = NULL;
+		priv->slots_busy--;
+		if (virtio_blk_req_put(req))
+			completed++;
+	}
+
+	return completed;
+}
 
+static struct virtio_blk_slot *virtio_blk_get_slot(struct virtio_blk_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < priv->nr_slots; i++) {
+		if (!priv->slots[i].req)
+			return &priv->slots[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * virtio_blk_queue() - Queue the requests needed for a block request
+ *
+ * The transfer is split into requests of at most priv->max_blks blocks, which
+ * are all placed in the ring before the device is notified. If the ring fills
+ * up, this notifies the device and waits for space, unless nothing could be
+ * queued at all.
+ *
+ * @dev:	virtio block device
+ * @req:	block request to queue
+ * @type:	VIRTIO_BLK_T_... request type
+ * Return: 0 if OK, -EBUSY if the ring is full. Once the request has been
+ * accepted, errors are reported through its result when it completes
+ */
+static int virtio_blk_queue(struct udevice *dev, struct blk_req *req, u32 type)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	lbaint_t start = req->start;
+	lbaint_t left = req->blkcnt;
+	void *buffer = req->buffer;
+	bool queued = false;
+
+	req->result = req->blkcnt;
+	req->priv = NULL;
+	/* Hold a reference until all parts have been queued */
+	virtio_blk_req_get(req);
+	while (left) {
+		struct virtio_blk_slot *slot = virtio_blk_get_slot(priv);
+		lbaint_t blkcnt = left;
+		int ret = -ENOSPC;
+
+		if (type != VIRTIO_BLK_T_WRITE_ZEROES)
+			blkcnt = min(blkcnt, priv->max_blks);
+		if (slot)
+			ret = virtio_blk_add(dev, slot, type, start, blkcnt,
+					     buffer);
+		if (ret == -ENOSPC && priv->slots_busy) {
+			if (!queued)
+				return -EBUSY;
+			/* Let the device make room in the ring */
+			virtqueue_kick(priv->vq);
+			virtio_blk_poll_vq(dev);
+			continue;
+		}
+		if (ret) {
+			/* Report the failure when the request completes */
+			virtio_blk_req_fail(req, start, ret);
+			break;
+		}
+
+		slot->req = req;
+		slot->start = start;
+		priv->slots_busy++;
+		virtio_blk_req_get(req);
+		queued = true;
+
+		start += blkcnt;
+		if (buffer)
+			buffer += blkcnt << (priv->blksz_shift + 9);
+		left -= blkcnt;
+	}
 	virtqueue_kick(priv->vq);
+	virtio_blk_req_put(req);
+
+	return 0;
+}
+
+static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
+			       lbaint_t blkcnt, void *buffer, u32 type)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct blk_req req;
+
+	log_debug("dev=%s, active=%d, priv=%p, priv->vq=%p\n", dev->name,
+		  device_active(dev), priv, priv->vq);
+
+	blk_req_init(&req, type == VIRTIO_BLK_T_IN ? BLK_REQ_READ :
+		     BLK_REQ_WRITE, sector, blkcnt, buffer);
+	while (virtio_blk_queue(dev, &req, type) == -EBUSY)
+		virtio_blk_poll_vq(dev);
 
 	log_debug("wait...");
-	while (!virtqueue_get_buf(priv->vq, NULL))
-		;
+	while (!req.done)
+		virtio_blk_poll_vq(dev);
 	log_debug("done\n");
 
-	return status == VIRTIO_BLK_S_OK ? blkcnt >> priv->blksz_shift : -EIO;
+	return req.result;
 }
 
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
@@ -146,6 +354,19 @@ static ulong virtio_blk_erase(struct udevice *dev, lbaint_t start,
 	return virtio_blk_do_req(dev, start, blkcnt, NULL, VIRTIO_BLK_T_WRITE_ZEROES);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int virtio_blk_submit(struct udevice *dev, struct blk_req *req)
+{
+	return virtio_blk_queue(dev, req, req->op == BLK_REQ_READ ?
+				VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT);
+}
+
+static int virtio_blk_poll(struct udevice *dev)
+{
+	return virtio_blk_poll_vq(dev);
+}
+#endif
+
 static int virtio_blk_bind(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -185,7 +406,8 @@ static int virtio_blk_probe(struct udevice *dev)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
-	u64 cap;
+	u32 seg_max, size_max, num, nsegs;
+	u64 cap, max_bytes;
 	int ret;
 	u32 blk_size;
 
@@ -207,13 +429,66 @@ static int virtio_blk_probe(struct udevice *dev)
 	priv->blksz_shift = desc->log2blksz - 9;
 	desc->lba >>= priv->blksz_shift;
 
+	num = virtqueue_get_vring_size(priv->vq);
+	if (virtio_cread_feature(dev, VIRTIO_BLK_F_SEG_MAX,
+				 struct virtio_blk_config, seg_max, &seg_max))
+		seg_max = 1;
+	/* Without indirect descriptors each segment takes a ring entry */
+	if (!priv->vq->indirect)
+		seg_max = min(seg_max, num - 2);
+	priv->max_segs = max(seg_max, 1U);
+	if (virtio_cread_feature(dev, VIRTIO_BLK_F_SIZE_MAX,
+				 struct virtio_blk_config, size_max, &size_max) ||
+	    !size_max)
+		size_max = U32_MAX;
+	priv->max_seg_size = size_max;
+
+	max_bytes = min_t(u64, (u64)priv->max_segs * priv->max_seg_size,
+			  CONFIG_VIRTIO_BLK_REQ_SIZE * 1024);
+	priv->max_blks = max_t(lbaint_t, max_bytes >> desc->log2blksz, 1);
+	nsegs = DIV_ROUND_UP((u64)priv->max_blks << desc->log2blksz,
+			     priv->max_seg_size);
+
+	/* Each request needs at least a header and a status descriptor */
+	priv->nr_slots = priv->vq->indirect ? num : num / 2;
+	priv->slots = calloc(priv->nr_slots, sizeof(struct virtio_blk_slot));
+	priv->sg = calloc(nsegs + 2, sizeof(struct virtio_sg));
+	priv->sgs = calloc(nsegs + 2, sizeof(struct virtio_sg *));
+	if (!priv->slots || !priv->sg || !priv->sgs) {
+		free(priv->slots);
+		free(priv->sg);
+		free(priv->sgs);
+		return -ENOMEM;
+	}
+	blk_queue_setup(dev, priv->nr_slots, priv->max_blks);
+	log_debug("%s: %u slots, %u segs of %u bytes, %u blocks per request\n",
+		  dev->name, priv->nr_slots, priv->max_segs, priv->max_seg_size,
+		  (uint)priv->max_blks);
+
 	return 0;
 }
 
+static int virtio_blk_remove(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	ret = virtio_reset(dev);
+	free(priv->slots);
+	free(priv->sg);
+	free(priv->sgs);
+
+	return ret;
+}
+
 static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
 	.erase	= virtio_blk_erase,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= virtio_blk_submit,
+	.poll	= virtio_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
@@ -222,7 +497,7 @@ U_BOOT_DRIVER(virtio_blk) = {
 	.ops	= &virtio_blk_ops,
 	.bind	= virtio_blk_bind,
 	.probe	= virtio_blk_probe,
-	.remove	= virtio_reset,
+	.remove	= virtio_blk_remove,
 	.priv_auto	= sizeof(struct virtio_blk_priv),
 	.flags	= DM_FLAG_ACTIVE_DMA,
 };
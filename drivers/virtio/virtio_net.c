@@ -12,7 +12,7 @@
 #include "virtio_net.h"
 
 /* Amount of buffers to keep in the RX virtqueue */
-#define VIRTIO_NET_NUM_RX_BUFS	32
+#define VIRTIO_NET_NUM_RX_BUFS	CONFIG_VIRTIO_NET_RX_BUFS
 
 /*
  * This value comes from the VirtIO spec: 1500 for maximum packet size,
@@ -20,6 +20,28 @@
  */
 #define VIRTIO_NET_RX_BUF_SIZE	1526
 
+/* Amount of packets which can be queued for sending */
+#define VIRTIO_NET_NUM_TX_BUFS	16
+
+#define VIRTIO_NET_TX_BUF_SIZE	\
+	(sizeof(struct virtio_net_hdr_v1) + PKTSIZE_ALIGN)
+
+/**
+ * struct virtio_net_priv - Private data for a virtio net device
+ *
+ * @rx_vq: Receive queue
+ * @tx_vq: Transmit queue
+ * @rx_buff: Receive buffers, each starting with the virtio net header
+ * @rx_merge: Buffer used to put together a packet which the device spread
+ *	over several receive buffers
+ * @tx_buff: Transmit buffers, each holding a header and a packet
+ * @tx_busy: true for each transmit buffer queued to the device
+ * @tx_next: Transmit buffer to try first
+ * @rx_running: true once the receive buffers have been queued
+ * @rx_kick: true if buffers have been put back in the receive queue without
+ *	telling the device
+ * @net_hdr_len: Size of the virtio net header
+ */
 struct virtio_net_priv {
 	union {
 		struct virtqueue *vqs[2];
@@ -30,41 +52,57 @@ struct virtio_net_priv {
 	};
 
 	char rx_buff[VIRTIO_NET_NUM_RX_BUFS][VIRTIO_NET_RX_BUF_SIZE];
+	char rx_merge[VIRTIO_NET_TX_BUF_SIZE];
+	char tx_buff[VIRTIO_NET_NUM_TX_BUFS][VIRTIO_NET_TX_BUF_SIZE];
+	bool tx_busy[VIRTIO_NET_NUM_TX_BUFS];
+	int tx_next;
 	bool rx_running;
+	bool rx_kick;
 	int net_hdr_len;
 };
 
 /*
- * For simplicity, the driver only negotiates the VIRTIO_NET_F_MAC feature.
- * For the VIRTIO_NET_F_STATUS feature, we don't negotiate it, hence per spec
- * we should assume the link is always active.
+ * The driver negotiates the VIRTIO_NET_F_MAC feature, plus mergeable receive
+ * buffers and receive checksum offload, so that the device can tell us which
+ * packets it has already checked. For the VIRTIO_NET_F_STATUS feature, we
+ * don't negotiate it, hence per spec we should assume the link is always
+ * active.
  */
 static const u32 feature[] = {
-	VIRTIO_NET_F_MAC
+	VIRTIO_NET_F_MAC,
+	VIRTIO_NET_F_GUEST_CSUM,
+	VIRTIO_NET_F_MRG_RXBUF,
 };
 
 static const u32 feature_legacy[] = {
-	VIRTIO_NET_F_MAC
+	VIRTIO_NET_F_MAC,
+	VIRTIO_NET_F_GUEST_CSUM,
+	VIRTIO_NET_F_MRG_RXBUF,
 };
 
+static void virtio_net_rx_add(struct virtio_net_priv *priv, void *buf)
+{
+	struct virtio_sg sg = { buf, VIRTIO_NET_RX_BUF_SIZE };
+	struct virtio_sg *sgs[] = { &sg };
+
+	virtqueue_add(priv->rx_vq, sgs, 0, 1);
+	priv->rx_kick = true;
+}
+
 static int virtio_net_start(struct udevice *dev)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
-	struct virtio_sg sg;
-	struct virtio_sg *sgs[] = { &sg };
-	int i;
+	int i, num;
 
 	if (!priv->rx_running) {
-		/* receive buffer length is always 1526 */
-		sg.length = VIRTIO_NET_RX_BUF_SIZE;
-
-		/* setup the receive buffer address */
-		for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++) {
-			sg.addr = priv->rx_buff[i];
-			virtqueue_add(priv->rx_vq, sgs, 0, 1);
-		}
+		/* setup the receive buffers, as many as the queue holds */
+		num = min_t(int, VIRTIO_NET_NUM_RX_BUFS,
+			    virtqueue_get_vring_size(priv->rx_vq));
+		for (i = 0; i < num; i++)
+			virtio_net_rx_add(priv, priv->rx_buff[i]);
 
 		virtqueue_kick(priv->rx_vq);
+		priv->rx_kick = false;
 
 		/* setup the receive queue only once */
 		priv->rx_running = true;
@@ -73,62 +111,205 @@ static int virtio_net_start(struct udevice *dev)
 	return 0;
 }
 
+/* Take back the transmit buffers which the device has finished with */
+static void virtio_net_tx_reclaim(struct virtio_net_priv *priv)
+{
+	char *buf;
+
+	while ((buf = virtqueue_get_buf(priv->tx_vq, NULL))) {
+		int slot = (buf - priv->tx_buff[0]) / VIRTIO_NET_TX_BUF_SIZE;
+
+		priv->tx_busy[slot] = false;
+	}
+}
+
+/*
+ * The packet is copied into a transmit buffer, so that it can be queued
+ * without waiting for the device to send the previous ones.
+ */
 static int virtio_net_send(struct udevice *dev, void *packet, int length)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
-	struct virtio_net_hdr hdr;
-	struct virtio_net_hdr_v1 hdr_v1;
-	struct virtio_sg hdr_sg;
-	struct virtio_sg data_sg = { packet, length };
+	struct virtio_sg hdr_sg, data_sg;
 	struct virtio_sg *sgs[] = { &hdr_sg, &data_sg };
-	int ret;
+	int slot, ret;
+	char *buf;
 
-	if (priv->net_hdr_len == sizeof(struct virtio_net_hdr))
-		hdr_sg.addr = &hdr;
-	else
-		hdr_sg.addr = &hdr_v1;
-	hdr_sg.length = priv->net_hdr_len;
+	if (length > PKTSIZE_ALIGN)
+		return -EMSGSIZE;
+
+	slot = priv->tx_next;
+	while (priv->tx_busy[slot])
+		virtio_net_tx_reclaim(priv);
+	priv->tx_next = (slot + 1) % VIRTIO_NET_NUM_TX_BUFS;
 
-	memset(hdr_sg.addr, 0, priv->net_hdr_len);
+	buf = priv->tx_buff[slot];
+	memset(buf, 0, priv->net_hdr_len);
+	memcpy(buf + priv->net_hdr_len, packet, length);
+	hdr_sg.addr = buf;
+	hdr_sg.length = priv->net_hdr_len;
+	data_sg.addr = buf + priv->net_hdr_len;
+	data_sg.length = length;
 
 	ret = virtqueue_add(priv->tx_vq, sgs, 2, 0);
 	if (ret)
 		return ret;
+	priv->tx_busy[slot] = true;
 
 	virtqueue_kick(priv->tx_vq);
 
-	while (1) {
-		if (virtqueue_get_buf(priv->tx_vq, NULL))
+	return 0;
+}
+
+/*
+ * Put together a packet which the device spread over several buffers. The
+ * extra buffers go straight back to the receive queue.
+ */
+static int virtio_net_merge(struct udevice *dev, char *buf, unsigned int len,
+			    int num_buffers)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	unsigned int total = len;
+	bool fits = true;
+	char *frag;
+
+	if (len > sizeof(priv->rx_merge))
+		fits = false;
+	else
+		memcpy(priv->rx_merge, buf, len);
+
+	while (--num_buffers) {
+		frag = virtqueue_get_buf(priv->rx_vq, &len);
+		if (!frag)
 			break;
+		if (fits && total + len <= sizeof(priv->rx_merge))
+			memcpy(priv->rx_merge + total, frag, len);
+		else
+			fits = false;
+		total += len;
+		virtio_net_rx_add(priv, frag);
 	}
+	virtio_net_rx_add(priv, buf);
 
-	return 0;
+	/* the packet is too large for the network stack, so drop it */
+	if (!fits || num_buffers)
+		return 0;
+
+	return total;
 }
 
-static int virtio_net_recv(struct udevice *dev, int flags, uchar **packetp)
+/**
+ * virtio_net_get_pkt() - Get the next packet from the receive queue
+ *
+ * @dev: virtio net device
+ * @pkt: Returns the packet; its length is 0 if the packet is to be dropped
+ * Return: 0 if OK, -EAGAIN if there is no packet
+ */
+static int virtio_net_get_pkt(struct udevice *dev, struct eth_rx_pkt *pkt)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
+	struct virtio_net_hdr_v1 *hdr;
 	unsigned int len;
-	void *buf;
+	char *buf;
+	int num;
 
 	buf = virtqueue_get_buf(priv->rx_vq, &len);
 	if (!buf)
 		return -EAGAIN;
 
-	*packetp = buf + priv->net_hdr_len;
-	return len - priv->net_hdr_len;
+	hdr = (struct virtio_net_hdr_v1 *)buf;
+	num = 1;
+	if (virtio_has_feature(dev, VIRTIO_NET_F_MRG_RXBUF))
+		num = virtio16_to_cpu(dev, hdr->num_buffers);
+	if (num > 1) {
+		len = virtio_net_merge(dev, buf, len, num);
+		buf = priv->rx_merge;
+		hdr = (struct virtio_net_hdr_v1 *)buf;
+	}
+
+	pkt->packet = (uchar *)buf + priv->net_hdr_len;
+	pkt->length = max_t(int, len - priv->net_hdr_len, 0);
+	pkt->csum_ok = false;
+	if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		u16 start = virtio16_to_cpu(dev, hdr->csum_start);
+		u16 offset = virtio16_to_cpu(dev, hdr->csum_offset);
+		u16 sum;
+
+		/*
+		 * The device left the checksum to be completed: the field
+		 * holds the sum of the pseudo header, so add in the rest
+		 */
+		if (start + offset + sizeof(sum) > pkt->length) {
+			pkt->length = 0;
+		} else {
+			sum = compute_ip_checksum(pkt->packet + start,
+						  pkt->length - start);
+			memcpy(pkt->packet + start + offset, &sum, sizeof(sum));
+			pkt->csum_ok = true;
+		}
+	} else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+		pkt->csum_ok = true;
+	}
+
+	return 0;
+}
+
+static int virtio_net_recv(struct udevice *dev, int flags, uchar **packetp)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	struct eth_rx_pkt pkt;
+	int ret;
+
+	if (priv->rx_kick) {
+		virtqueue_kick(priv->rx_vq);
+		priv->rx_kick = false;
+	}
+
+	ret = virtio_net_get_pkt(dev, &pkt);
+	if (ret)
+		return ret;
+
+	*packetp = pkt.packet;
+	return pkt.length;
+}
+
+static int virtio_net_recv_batch(struct udevice *dev, int flags,
+				 struct eth_rx_pkt *pkts, int max)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	int count;
+
+	if (priv->rx_kick) {
+		virtqueue_kick(priv->rx_vq);
+		priv->rx_kick = false;
+	}
+
+	for (count = 0; count < max; count++) {
+		if (virtio_net_get_pkt(dev, &pkts[count]))
+			break;
+		/* there is only one buffer for merged packets */
+		if (pkts[count].packet == (uchar *)priv->rx_merge +
+		    priv->net_hdr_len) {
+			count++;
+			break;
+		}
+	}
+
+	return count;
 }
 
 static int virtio_net_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct virtio_net_priv *priv = dev_get_priv(dev);
-	void *buf = packet - priv->net_hdr_len;
-	struct virtio_sg sg = { buf, VIRTIO_NET_RX_BUF_SIZE };
-	struct virtio_sg *sgs[] = { &sg };
+	char *buf = (char *)packet - priv->net_hdr_len;
 
-	/* Put the buffer back to the rx ring */
-	virtqueue_add(priv->rx_vq, sgs, 0, 1);
-	virtqueue_kick(priv->rx_vq);
+	/*
+	 * Put the buffer back to the rx ring; the device is told when the
+	 * ring is next polled. The buffers of a merged packet are already
+	 * back.
+	 */
+	if (buf != priv->rx_merge)
+		virtio_net_rx_add(priv, buf);
 
 	return 0;
 }
@@ -208,7 +389,7 @@ static int virtio_net_probe(struct udevice *dev)
 	 * VIRTIO_NET_F_MRG_RXBUF was negotiated. Without that feature
 	 * the structure was 2 bytes shorter.
 	 */
-	if (uc_priv->legacy)
+	if (uc_priv->legacy && !virtio_has_feature(dev, VIRTIO_NET_F_MRG_RXBUF))
 		priv->net_hdr_len = sizeof(struct virtio_net_hdr);
 	else
 		priv->net_hdr_len = sizeof(struct virtio_net_hdr_v1);
@@ -220,6 +401,7 @@ static const struct eth_ops virtio_net_ops = {
 	.start = virtio_net_start,
 	.send = virtio_net_send,
 	.recv = virtio_net_recv,
+	.recv_batch = virtio_net_recv_batch,
 	.free_pkt = virtio_net_free_pkt,
 	.stop = virtio_net_stop,
 	.write_hwaddr = virtio_net_write_hwaddr,
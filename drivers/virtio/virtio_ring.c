@@ -95,12 +95,42 @@ static void virtqueue_detach_desc(struct virtqueue *vq, unsigned int idx)
 	bb = &vq->vring.bouncebufs[idx];
 	bounce_buffer_stop(bb);
 	desc->addr = cpu_to_virtio64(vq->vdev, (u64)(uintptr_t)bb->user_buffer);
+	/* Hand the caller's buffer back from virtqueue_get_buf() */
+	vq->vring_desc_shadow[idx].addr = (u64)(uintptr_t)bb->user_buffer;
+}
+
+static struct vring_desc *virtqueue_alloc_indirect(struct virtqueue *vq,
+						   struct virtio_sg *sgs[],
+						   unsigned int out_sgs,
+						   unsigned int in_sgs)
+{
+	unsigned int total = out_sgs + in_sgs;
+	struct vring_desc *desc;
+	unsigned int n;
+
+	desc = malloc(total * sizeof(*desc));
+	if (!desc)
+		return NULL;
+
+	for (n = 0; n < total; n++) {
+		u16 flags = n + 1 < total ? VRING_DESC_F_NEXT : 0;
+
+		if (n >= out_sgs)
+			flags |= VRING_DESC_F_WRITE;
+		desc[n].addr = cpu_to_virtio64(vq->vdev,
+					       (u64)(uintptr_t)sgs[n]->addr);
+		desc[n].len = cpu_to_virtio32(vq->vdev, sgs[n]->length);
+		desc[n].flags = cpu_to_virtio16(vq->vdev, flags);
+		desc[n].next = cpu_to_virtio16(vq->vdev, n + 1);
+	}
+
+	return desc;
 }
 
 int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		  unsigned int out_sgs, unsigned int in_sgs)
 {
-	struct vring_desc *desc;
+	struct vring_desc *desc, *indir = NULL;
 	unsigned int descs_used = out_sgs + in_sgs;
 	unsigned int i, n, avail, uninitialized_var(prev);
 	int head;
@@ -112,7 +142,20 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	desc = vq->vring.desc;
 	i = head;
 
-	if (vq->num_free < descs_used) {
+	/* Fall back to a plain chain if the table cannot be allocated */
+	if (vq->indirect && descs_used > 1 && vq->num_free)
+		indir = virtqueue_alloc_indirect(vq, sgs, out_sgs, in_sgs);
+
+	if (indir) {
+		struct virtio_sg sg = {
+			.addr = indir,
+			.length = descs_used * sizeof(*indir),
+		};
+
+		prev = i;
+		i = virtqueue_attach_desc(vq, i, &sg, VRING_DESC_F_INDIRECT);
+		descs_used = 1;
+	} else if (vq->num_free < descs_used) {
 		debug("Can't add buf len %i - avail = %i\n",
 		      descs_used, vq->num_free);
 		/*
@@ -123,15 +166,15 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		if (out_sgs)
 			virtio_notify(vq->vdev, vq);
 		return -ENOSPC;
-	}
-
-	for (n = 0; n < descs_used; n++) {
-		u16 flags = VRING_DESC_F_NEXT;
+	} else {
+		for (n = 0; n < descs_used; n++) {
+			u16 flags = VRING_DESC_F_NEXT;
 
-		if (n >= out_sgs)
-			flags |= VRING_DESC_F_WRITE;
-		prev = i;
-		i = virtqueue_attach_desc(vq, i, sgs[n], flags);
+			if (n >= out_sgs)
+				flags |= VRING_DESC_F_WRITE;
+			prev = i;
+			i = virtqueue_attach_desc(vq, i, sgs[n], flags);
+		}
 	}
 	/* Last one doesn't continue */
 	vq->vring_desc_shadow[prev].flags &= ~VRING_DESC_F_NEXT;
@@ -145,6 +188,7 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 
 	/* Mark the descriptor as the head of a chain. */
 	vq->vring_desc_shadow[head].chain_head = true;
+	vq->vring_desc_shadow[head].indir_desc = indir;
 
 	/*
 	 * Put entry in available array (but don't update avail->idx
@@ -210,6 +254,8 @@ static void detach_buf(struct virtqueue *vq, unsigned int head)
 
 	/* Unmark the descriptor as the head of a chain. */
 	vq->vring_desc_shadow[head].chain_head = false;
+	free(vq->vring_desc_shadow[head].indir_desc);
+	vq->vring_desc_shadow[head].indir_desc = NULL;
 
 	/* Put back on free list: unmap first-level descriptors and find end */
 	i = head;
@@ -236,8 +282,10 @@ static inline bool more_used(const struct virtqueue *vq)
 
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 {
+	struct vring_desc *indir;
 	unsigned int i;
 	u16 last_used;
+	void *data;
 
 	if (!more_used(vq)) {
 		debug("(%s.%d): No more buffers in queue\n",
@@ -269,7 +317,14 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		return NULL;
 	}
 
+	/* Return the first buffer, as passed to virtqueue_add() */
+	indir = vq->vring_desc_shadow[i].indir_desc;
+	if (indir)
+		data = (void *)(uintptr_t)virtio64_to_cpu(vq->vdev, indir->addr);
+
 	detach_buf(vq, i);
+	if (!indir)
+		data = (void *)(uintptr_t)vq->vring_desc_shadow[i].addr;
 	vq->last_used_idx++;
 	/*
 	 * If we expect an interrupt for the next entry, tell host
@@ -280,7 +335,7 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		virtio_store_mb(&vring_used_event(&vq->vring),
 				cpu_to_virtio16(vq->vdev, vq->last_used_idx));
 
-	return (void *)(uintptr_t)vq->vring_desc_shadow[i].addr;
+	return data;
 }
 
 static struct virtqueue *__vring_new_virtqueue(unsigned int index,
@@ -315,6 +370,9 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	list_add_tail(&vq->list, &uc_priv->vqs);
 
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	/* Buffers in an indirect table cannot be bounced */
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
+		       !vring.bouncebufs;
 
 	/* Tell other side not to bother us */
 	vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
@@ -396,6 +454,10 @@ err_free_queue:
 
 void vring_del_virtqueue(struct virtqueue *vq)
 {
+	unsigned int i;
+
+	for (i = 0; i < vq->vring.num; i++)
+		free(vq->vring_desc_shadow[i].indir_desc);
 	virtio_free_pages(vq->vdev, vq->vring.desc,
 			  DIV_ROUND_UP(vq->vring.size, PAGE_SIZE));
 	free(vq->vring_desc_shadow);
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0+
 #include "internal.h"
 #include "decompress.h"
+#include <linux/sizes.h>
 
 static int erofs_map_blocks_flatmode(struct erofs_inode *inode,
 				     struct erofs_map_blocks *map,
@@ -271,6 +272,307 @@ int z_erofs_read_one_data(struct erofs_inode *inode,
 	return 0;
 }
 
+/* Largest run of compressed data fetched with a single read */
+#define Z_EROFS_BATCH_MAX	SZ_1M
+/* Most pclusters gathered into a single read */
+#define Z_EROFS_BATCH_COUNT	16
+
+/* Number of decompressed pclusters kept for partial reads */
+#define Z_EROFS_CACHE_COUNT	4
+#if CONFIG_IS_ENABLED(FS_EROFS_ZIP)
+/* Largest decompressed pcluster which is kept */
+#define Z_EROFS_CACHE_MAX	(CONFIG_FS_EROFS_ZIP_CACHE_SIZE * SZ_1K / \
+				 Z_EROFS_CACHE_COUNT)
+#else
+#define Z_EROFS_CACHE_MAX	0
+#endif
+
+/**
+ * struct z_erofs_pcluster - A pcluster waiting to be decompressed
+ *
+ * @pa: Position of the compressed data on the device
+ * @llen: Decompressed length of the whole pcluster
+ * @partial: true if the pcluster must be decompressed with partial decoding
+ *	even when all of it is wanted
+ * @cache: true to decompress the whole pcluster into the cache, then copy the
+ *	wanted part to the destination
+ * @rq: Decompression request for the wanted part. Its input is filled in once
+ *	the compressed data has been read
+ */
+struct z_erofs_pcluster {
+	erofs_off_t pa;
+	u64 llen;
+	bool partial;
+	bool cache;
+	struct z_erofs_decompress_req rq;
+};
+
+/**
+ * struct z_erofs_batch - Physically contiguous pclusters read together
+ *
+ * Extents are mapped from the end of the file backwards, so each pcluster
+ * added to the batch must end where the previous one starts.
+ *
+ * @start: Position of the first byte of compressed data on the device
+ * @len: Total length of compressed data
+ * @count: Number of pclusters in @pcl
+ * @bufsize: Size of @raw
+ * @raw: Buffer holding the compressed data
+ * @pcl: Pclusters in the batch
+ */
+struct z_erofs_batch {
+	erofs_off_t start;
+	u64 len;
+	int count;
+	unsigned int bufsize;
+	char *raw;
+	struct z_erofs_pcluster pcl[Z_EROFS_BATCH_COUNT];
+};
+
+/**
+ * struct z_erofs_cached_pcluster - A decompressed pcluster
+ *
+ * @pa: Position of the compressed data on the device
+ * @plen: Length of the compressed data
+ * @llen: Decompressed length, 0 if this entry is unused
+ * @alg: Compression algorithm
+ * @partial: true if the pcluster was decompressed with partial decoding
+ * @last_used: Value of z_erofs_cache_tick when the entry was last used
+ * @alloced: Size of @data
+ * @data: Decompressed data
+ */
+struct z_erofs_cached_pcluster {
+	erofs_off_t pa;
+	unsigned int plen;
+	u64 llen;
+	unsigned int alg;
+	bool partial;
+	ulong last_used;
+	unsigned int alloced;
+	char *data;
+};
+
+static struct z_erofs_cached_pcluster z_erofs_cache[Z_EROFS_CACHE_COUNT];
+static ulong z_erofs_cache_tick;
+
+void z_erofs_drop_cache(void)
+{
+	int i;
+
+	for (i = 0; i < Z_EROFS_CACHE_COUNT; i++)
+		z_erofs_cache[i].llen = 0;
+}
+
+static struct z_erofs_cached_pcluster *
+z_erofs_cache_find(const struct z_erofs_pcluster *pcl)
+{
+	int i;
+
+	for (i = 0; i < Z_EROFS_CACHE_COUNT; i++) {
+		struct z_erofs_cached_pcluster *cp = &z_erofs_cache[i];
+
+		if (cp->llen == pcl->llen && cp->pa == pcl->pa &&
+		    cp->plen == pcl->rq.inputsize && cp->alg == pcl->rq.alg &&
+		    cp->partial == pcl->partial) {
+			cp->last_used = ++z_erofs_cache_tick;
+			return cp;
+		}
+	}
+
+	return NULL;
+}
+
+/* Pick an unused entry, or else the least recently used one */
+static struct z_erofs_cached_pcluster *z_erofs_cache_victim(void)
+{
+	struct z_erofs_cached_pcluster *victim = &z_erofs_cache[0];
+	int i;
+
+	for (i = 0; i < Z_EROFS_CACHE_COUNT; i++) {
+		struct z_erofs_cached_pcluster *cp = &z_erofs_cache[i];
+
+		if (!cp->llen)
+			return cp;
+		if (cp->last_used < victim->last_used)
+			victim = cp;
+	}
+
+	return victim;
+}
+
+/* Copy the wanted part of a decompressed pcluster to the destination */
+static void z_erofs_cache_copy(const struct z_erofs_pcluster *pcl,
+			       const struct z_erofs_cached_pcluster *cp)
+{
+	const struct z_erofs_decompress_req *rq = &pcl->rq;
+
+	memcpy(rq->out, cp->data + rq->decodedskip,
+	       rq->decodedlength - rq->decodedskip);
+}
+
+static int z_erofs_decompress_cached(struct z_erofs_pcluster *pcl)
+{
+	struct z_erofs_cached_pcluster *cp = z_erofs_cache_victim();
+	struct z_erofs_decompress_req rq = pcl->rq;
+	int ret;
+
+	if (cp->alloced < pcl->llen) {
+		char *tmp;
+
+		tmp = realloc(cp->data, pcl->llen);
+		if (!tmp)
+			return -ENOMEM;
+		cp->data = tmp;
+		cp->alloced = pcl->llen;
+	}
+
+	/* keep the entry unused until the data is valid */
+	cp->llen = 0;
+	rq.out = cp->data;
+	rq.decodedskip = 0;
+	rq.decodedlength = pcl->llen;
+	rq.partial_decoding = pcl->partial;
+	ret = z_erofs_decompress(&rq);
+	if (ret < 0)
+		return ret;
+
+	cp->pa = pcl->pa;
+	cp->plen = rq.inputsize;
+	cp->llen = pcl->llen;
+	cp->alg = rq.alg;
+	cp->partial = pcl->partial;
+	cp->last_used = ++z_erofs_cache_tick;
+	z_erofs_cache_copy(pcl, cp);
+
+	return 0;
+}
+
+/* Read the compressed data of a batch at once, then decompress each pcluster */
+static int z_erofs_batch_flush(struct z_erofs_batch *batch)
+{
+	int i, ret;
+
+	if (!batch->count)
+		return 0;
+
+	if (batch->len > batch->bufsize) {
+		char *tmp;
+
+		tmp = realloc(batch->raw, batch->len);
+		if (!tmp)
+			return -ENOMEM;
+		batch->raw = tmp;
+		batch->bufsize = batch->len;
+	}
+
+	ret = erofs_dev_read(0, batch->raw, batch->start, batch->len);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < batch->count; i++) {
+		struct z_erofs_pcluster *pcl = &batch->pcl[i];
+
+		pcl->rq.in = batch->raw + pcl->pa - batch->start;
+		if (pcl->cache)
+			ret = z_erofs_decompress_cached(pcl);
+		else
+			ret = z_erofs_decompress(&pcl->rq);
+		if (ret < 0)
+			return ret;
+	}
+	batch->count = 0;
+	batch->len = 0;
+
+	return 0;
+}
+
+static int z_erofs_batch_add(struct z_erofs_batch *batch,
+			     const struct z_erofs_pcluster *pcl)
+{
+	int ret;
+
+	if (batch->count &&
+	    (batch->count == Z_EROFS_BATCH_COUNT ||
+	     pcl->pa + pcl->rq.inputsize != batch->start ||
+	     batch->len + pcl->rq.inputsize > Z_EROFS_BATCH_MAX)) {
+		ret = z_erofs_batch_flush(batch);
+		if (ret)
+			return ret;
+	}
+
+	batch->pcl[batch->count++] = *pcl;
+	batch->start = pcl->pa;
+	batch->len += pcl->rq.inputsize;
+
+	return 0;
+}
+
+/*
+ * Arrange for the wanted part of an extent to be decompressed into @buffer.
+ * Data which can be produced without decompression is copied straight away;
+ * anything else is added to @batch.
+ */
+static int z_erofs_queue_data(struct z_erofs_batch *batch,
+			      struct erofs_map_blocks *map, char *buffer,
+			      erofs_off_t skip, erofs_off_t length, bool trimmed)
+{
+	struct z_erofs_cached_pcluster *cp;
+	struct z_erofs_pcluster pcl;
+	struct erofs_map_dev mdev;
+	int ret;
+
+	/* no device id here, thus it will always succeed */
+	mdev = (struct erofs_map_dev) {
+		.m_pa = map->m_pa,
+	};
+	ret = erofs_map_dev(&mdev);
+	if (ret) {
+		DBG_BUGON(1);
+		return ret;
+	}
+
+	/* uncompressed data is read directly into the destination */
+	if (map->m_algorithmformat == Z_EROFS_COMPRESSION_SHIFTED) {
+		if (length > map->m_plen)
+			return -EFSCORRUPTED;
+		return erofs_dev_read(mdev.m_deviceid, buffer, mdev.m_pa + skip,
+				      length - skip);
+	}
+
+	pcl.pa = mdev.m_pa;
+	pcl.llen = map->m_llen;
+	pcl.partial = !(map->m_flags & EROFS_MAP_FULL_MAPPED) ||
+		(map->m_flags & EROFS_MAP_PARTIAL_REF);
+	pcl.rq = (struct z_erofs_decompress_req) {
+		.out = buffer,
+		.decodedskip = skip,
+		.interlaced_offset =
+			map->m_algorithmformat == Z_EROFS_COMPRESSION_INTERLACED ?
+				erofs_blkoff(map->m_la) : 0,
+		.inputsize = map->m_plen,
+		.decodedlength = length,
+		.alg = map->m_algorithmformat,
+		.partial_decoding = trimmed ? true : pcl.partial,
+	};
+
+	/*
+	 * Only part of the pcluster is wanted, so decompress all of it into the
+	 * cache, where the rest is likely to be wanted by the next read
+	 */
+	pcl.cache = (skip || trimmed) &&
+		map->m_algorithmformat != Z_EROFS_COMPRESSION_INTERLACED &&
+		pcl.llen <= Z_EROFS_CACHE_MAX;
+	if (pcl.cache) {
+		cp = z_erofs_cache_find(&pcl);
+		if (cp) {
+			z_erofs_cache_copy(&pcl, cp);
+			return 0;
+		}
+	}
+
+	return z_erofs_batch_add(batch, &pcl);
+}
+
 static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 			     erofs_off_t size, erofs_off_t offset)
 {
@@ -278,11 +580,14 @@ static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 	struct erofs_map_blocks map = {
 		.index = UINT_MAX,
 	};
+	struct z_erofs_batch *batch;
 	bool trimmed;
-	unsigned int bufsize = 0;
-	char *raw = NULL;
 	int ret = 0;
 
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return -ENOMEM;
+
 	end = offset + size;
 	while (end > offset) {
 		map.m_la = end - 1;
@@ -318,26 +623,21 @@ static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 			continue;
 		}
 
-		if (map.m_plen > bufsize) {
-			char *tmp;
-
-			bufsize = map.m_plen;
-			tmp = realloc(raw, bufsize);
-			if (!tmp) {
-				ret = -ENOMEM;
-				break;
-			}
-			raw = tmp;
-		}
-
-		ret = z_erofs_read_one_data(inode, &map, raw,
-					    buffer + end - offset, skip, length,
-					    trimmed);
+		if (map.m_flags & EROFS_MAP_FRAGMENT)
+			ret = z_erofs_read_one_data(inode, &map, NULL,
+						    buffer + end - offset, skip,
+						    length, trimmed);
+		else
+			ret = z_erofs_queue_data(batch, &map,
+						 buffer + end - offset, skip,
+						 length, trimmed);
 		if (ret < 0)
 			break;
 	}
-	if (raw)
-		free(raw);
+	if (!ret)
+		ret = z_erofs_batch_flush(batch);
+	free(batch->raw);
+	free(batch);
 	return ret < 0 ? ret : 0;
 }
 
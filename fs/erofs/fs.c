@@ -9,6 +9,25 @@ static struct erofs_ctxt {
 	struct blk_desc *cur_dev;
 } ctxt;
 
+/**
+ * struct erofs_cache_key - Identifies the filesystem whose data is cached
+ *
+ * @dev: Block device, NULL if nothing is cached
+ * @part_start: Start of the partition
+ * @write_gen: Value of the device's write_gen when the cache was filled
+ * @build_time: Build time of the filesystem
+ * @build_time_nsec: Nanoseconds part of the build time
+ * @uuid: UUID of the filesystem
+ */
+static struct erofs_cache_key {
+	struct blk_desc *dev;
+	lbaint_t part_start;
+	uint write_gen;
+	u64 build_time;
+	u32 build_time_nsec;
+	u8 uuid[16];
+} cache_key;
+
 int erofs_dev_read(int device_id, void *buf, u64 offset, size_t len)
 {
 	lbaint_t sect;
@@ -32,6 +51,28 @@ int erofs_blk_read(void *buf, erofs_blk_t start, u32 nblocks)
 			 erofs_pos(nblocks));
 }
 
+/* Drop cached data unless it belongs to the filesystem just probed */
+static void erofs_check_cache(void)
+{
+	struct erofs_cache_key *key = &cache_key;
+
+	if (key->dev == ctxt.cur_dev &&
+	    key->part_start == ctxt.cur_part_info.start &&
+	    key->write_gen == ctxt.cur_dev->write_gen &&
+	    key->build_time == sbi.build_time &&
+	    key->build_time_nsec == sbi.build_time_nsec &&
+	    !memcmp(key->uuid, sbi.uuid, sizeof(key->uuid)))
+		return;
+
+	z_erofs_drop_cache();
+	key->dev = ctxt.cur_dev;
+	key->part_start = ctxt.cur_part_info.start;
+	key->write_gen = ctxt.cur_dev->write_gen;
+	key->build_time = sbi.build_time;
+	key->build_time_nsec = sbi.build_time_nsec;
+	memcpy(key->uuid, sbi.uuid, sizeof(key->uuid));
+}
+
 int erofs_probe(struct blk_desc *fs_dev_desc,
 		struct disk_partition *fs_partition)
 {
@@ -43,6 +84,7 @@ int erofs_probe(struct blk_desc *fs_dev_desc,
 	ret = erofs_read_superblock();
 	if (ret)
 		goto error;
+	erofs_check_cache();
 
 	return 0;
 error:
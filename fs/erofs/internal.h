@@ -345,6 +345,14 @@ int z_erofs_read_one_data(struct erofs_inode *inode,
 			  struct erofs_map_blocks *map, char *raw, char *buffer,
 			  erofs_off_t skip, erofs_off_t length, bool trimmed);
 
+/**
+ * z_erofs_drop_cache() - Forget all cached decompressed pclusters
+ *
+ * This must be called whenever a different filesystem is mounted, or the
+ * device may have been written.
+ */
+void z_erofs_drop_cache(void);
+
 static inline int erofs_get_occupied_size(const struct erofs_inode *inode,
 					  erofs_off_t *size)
 {
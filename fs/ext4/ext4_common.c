@@ -1570,16 +1570,267 @@ static struct ext4_extent_header *ext4fs_get_extent_block
 	}
 }
 
+/*
+ * Group descriptors and inodes are cached across mounts, so that loading
+ * several files from the same filesystem does not read the same metadata
+ * again. Extent maps are allocated, so they are only kept until the
+ * filesystem is closed. The caches are only used while the device, partition
+ * and superblock are unchanged and nothing has been written to the device.
+ */
+
+/* Number of group descriptors and inodes held, each direct-mapped */
+#define EXT4_GD_CACHE_SIZE	(IS_ENABLED(CONFIG_XPL_BUILD) ? 4 : 64)
+#define EXT4_INODE_CACHE_SIZE	(IS_ENABLED(CONFIG_XPL_BUILD) ? 8 : 64)
+
+/* Number of files whose extent map is held */
+#define EXT4_EXTENT_MAP_COUNT	4
+
+/* Maximum depth of an extent tree */
+#define EXT4_EXT_MAX_DEPTH	5
+
+/* Extents longer than this are uninitialised */
+#define EXT_INIT_MAX_LEN	32768
+
+/**
+ * struct ext4_cache_state - Identifies the filesystem the caches describe
+ *
+ * @dev: Block device
+ * @part_start: Start sector of the partition
+ * @write_gen: Value of the device's write_gen when the caches were filled
+ * @sblock: Superblock of the filesystem
+ * @gen: Generation of cached data, incremented whenever it is discarded. Cache
+ *	entries from any other generation are invalid
+ */
+struct ext4_cache_state {
+	struct blk_desc *dev;
+	lbaint_t part_start;
+	uint write_gen;
+	struct ext2_sblock sblock;
+	uint gen;
+};
+
+struct ext4_gd_cache_entry {
+	uint gen;
+	int group;
+	struct ext2_block_group desc;
+};
+
+struct ext4_inode_cache_entry {
+	uint gen;
+	int ino;
+	struct ext2_inode inode;
+};
+
+static struct ext4_cache_state ext4_cache;
+static struct ext4_gd_cache_entry ext4_gd_cache[EXT4_GD_CACHE_SIZE];
+static struct ext4_inode_cache_entry ext4_inode_cache[EXT4_INODE_CACHE_SIZE];
+static struct ext4_extent_map ext4_extent_maps[EXT4_EXTENT_MAP_COUNT];
+static int ext4_extent_map_next;
+
+static void ext4fs_extent_map_free(struct ext4_extent_map *map)
+{
+	free(map->runs);
+	memset(map, '\0', sizeof(*map));
+}
+
+/* Drop all extent maps, freeing their runs */
+static void ext4fs_extent_maps_free(void)
+{
+	int i;
+
+	for (i = 0; i < EXT4_EXTENT_MAP_COUNT; i++)
+		ext4fs_extent_map_free(&ext4_extent_maps[i]);
+	ext4_extent_map_next = 0;
+}
+
+/* Get the current cache generation, discarding the caches if stale */
+static uint ext4fs_cache_gen(const struct ext2_data *data)
+{
+	struct ext4_cache_state *st = &ext4_cache;
+	struct blk_desc *dev = get_fs()->dev_desc;
+
+	if (st->gen && st->dev == dev && st->part_start == part_offset &&
+	    st->write_gen == dev->write_gen &&
+	    !memcmp(&st->sblock, &data->sblock, sizeof(st->sblock)))
+		return st->gen;
+
+	ext4fs_extent_maps_free();
+	st->dev = dev;
+	st->part_start = part_offset;
+	st->write_gen = dev->write_gen;
+	memcpy(&st->sblock, &data->sblock, sizeof(st->sblock));
+	if (!++st->gen)
+		st->gen++;
+
+	return st->gen;
+}
+
+static int ext4fs_extent_map_add(struct ext4_extent_map *map,
+				 const struct ext4_extent *ext)
+{
+	u32 lblk = le32_to_cpu(ext->ee_block);
+	uint len = le16_to_cpu(ext->ee_len);
+	struct ext4_extent_run *run;
+	u64 pblk;
+
+	pblk = ((u64)le16_to_cpu(ext->ee_start_hi) << 32) +
+		le32_to_cpu(ext->ee_start_lo);
+	if (len > EXT_INIT_MAX_LEN) {
+		len -= EXT_INIT_MAX_LEN;
+		pblk = 0;
+	}
+	if (!len)
+		return 0;
+
+	if (map->count) {
+		run = &map->runs[map->count - 1];
+		if (lblk < (u64)run->lblk + run->len)
+			return -EINVAL;
+		/* Merge extents which are also contiguous on disk */
+		if (pblk && run->pblk && run->lblk + run->len == lblk &&
+		    run->pblk + run->len == pblk) {
+			run->len += len;
+			return 0;
+		}
+	}
+	if (map->count == map->alloced) {
+		int alloced = max(map->alloced * 2, 16);
+
+		run = realloc(map->runs, alloced * sizeof(*run));
+		if (!run)
+			return -ENOMEM;
+		map->runs = run;
+		map->alloced = alloced;
+	}
+	run = &map->runs[map->count++];
+	run->lblk = lblk;
+	run->len = len;
+	run->pblk = pblk;
+
+	return 0;
+}
+
+/* Add the extents under a node of the extent tree to the map */
+static int ext4fs_extent_map_walk(struct ext4_extent_map *map,
+				  const struct ext4_extent_header *eh,
+				  int size, int max_depth)
+{
+	struct ext2_data *data = ext4fs_root;
+	int log2_blksz = LOG2_BLOCK_SIZE(data) - get_fs()->dev_desc->log2blksz;
+	int blksz = EXT2_BLOCK_SIZE(data);
+	int entries = le16_to_cpu(eh->eh_entries);
+	int depth = le16_to_cpu(eh->eh_depth);
+	const struct ext4_extent_idx *index;
+	void *buf;
+	int i, ret;
+
+	if (le16_to_cpu(eh->eh_magic) != EXT4_EXT_MAGIC || depth > max_depth ||
+	    sizeof(*eh) + entries * sizeof(struct ext4_extent) > size)
+		return -EINVAL;
+
+	if (!depth) {
+		const struct ext4_extent *extent = (void *)(eh + 1);
+
+		for (i = 0; i < entries; i++) {
+			ret = ext4fs_extent_map_add(map, &extent[i]);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	}
+
+	buf = memalign(ARCH_DMA_MINALIGN, blksz);
+	if (!buf)
+		return -ENOMEM;
+	index = (void *)(eh + 1);
+	for (i = 0, ret = 0; i < entries && !ret; i++) {
+		u64 block;
+
+		block = ((u64)le16_to_cpu(index[i].ei_leaf_hi) << 32) +
+			le32_to_cpu(index[i].ei_leaf_lo);
+		if (!ext4fs_devread((lbaint_t)block << log2_blksz, 0, blksz,
+				    buf))
+			ret = -EIO;
+		else
+			ret = ext4fs_extent_map_walk(map, buf, blksz,
+						     depth - 1);
+	}
+	free(buf);
+
+	return ret;
+}
+
+struct ext4_extent_map *ext4fs_get_extent_map(struct ext2fs_node *node)
+{
+	struct ext2_inode *inode = &node->inode;
+	uint gen = ext4fs_cache_gen(node->data);
+	struct ext4_extent_map *map;
+	int i;
+
+	for (i = 0; i < EXT4_EXTENT_MAP_COUNT; i++) {
+		map = &ext4_extent_maps[i];
+		if (map->gen == gen && map->ino == node->ino &&
+		    !memcmp(&map->root, &inode->b.blocks, sizeof(map->root)))
+			return map;
+	}
+
+	map = &ext4_extent_maps[ext4_extent_map_next];
+	map->gen = 0;
+	map->count = 0;
+	if (ext4fs_extent_map_walk(map, (void *)inode->b.blocks.dir_blocks,
+				   sizeof(inode->b.blocks),
+				   EXT4_EXT_MAX_DEPTH)) {
+		log_debug("cannot map extents of inode %d\n", node->ino);
+		ext4fs_extent_map_free(map);
+		return NULL;
+	}
+	map->gen = gen;
+	map->ino = node->ino;
+	memcpy(&map->root, &inode->b.blocks, sizeof(map->root));
+	ext4_extent_map_next = (ext4_extent_map_next + 1) %
+		EXT4_EXTENT_MAP_COUNT;
+
+	return map;
+}
+
+int ext4fs_extent_map_find(const struct ext4_extent_map *map, u32 lblk)
+{
+	int lo = 0, hi = map->count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		const struct ext4_extent_run *run = &map->runs[mid];
+
+		if ((u64)run->lblk + run->len <= lblk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
 static int ext4fs_blockgroup
 	(struct ext2_data *data, int group, struct ext2_block_group *blkgrp)
 {
+	struct ext4_gd_cache_entry *gc = NULL;
 	long int blkno;
 	unsigned int blkoff, desc_per_blk;
 	int log2blksz = get_fs()->dev_desc->log2blksz;
 	int desc_size = get_fs()->gdsize;
+	uint gen;
 
 	if (desc_size == 0)
 		return 0;
+	gen = ext4fs_cache_gen(data);
+	if (desc_size <= sizeof(gc->desc)) {
+		gc = &ext4_gd_cache[group % EXT4_GD_CACHE_SIZE];
+		if (gc->gen == gen && gc->group == group) {
+			memcpy(blkgrp, &gc->desc, desc_size);
+			return 1;
+		}
+	}
 	desc_per_blk = EXT2_BLOCK_SIZE(data) / desc_size;
 
 	if (desc_per_blk == 0)
@@ -1591,13 +1842,22 @@ static int ext4fs_blockgroup
 	debug("ext4fs read %d group descriptor (blkno %ld blkoff %u)\n",
 	      group, blkno, blkoff);
 
-	return ext4fs_devread((lbaint_t)blkno <<
-			      (LOG2_BLOCK_SIZE(data) - log2blksz),
-			      blkoff, desc_size, (char *)blkgrp);
+	if (!ext4fs_devread((lbaint_t)blkno <<
+			    (LOG2_BLOCK_SIZE(data) - log2blksz),
+			    blkoff, desc_size, (char *)blkgrp))
+		return 0;
+	if (gc) {
+		gc->gen = gen;
+		gc->group = group;
+		memcpy(&gc->desc, blkgrp, desc_size);
+	}
+
+	return 1;
 }
 
 int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 {
+	struct ext4_inode_cache_entry *ic;
 	struct ext2_block_group *blkgrp;
 	struct ext2_sblock *sblock = &data->sblock;
 	struct ext_filesystem *fs = get_fs();
@@ -1605,6 +1865,15 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 	int inodes_per_block, status;
 	long int blkno;
 	unsigned int blkoff;
+	uint gen;
+	int idx;
+
+	gen = ext4fs_cache_gen(data);
+	ic = &ext4_inode_cache[(uint)ino % EXT4_INODE_CACHE_SIZE];
+	if (ic->gen == gen && ic->ino == ino) {
+		memcpy(inode, &ic->inode, sizeof(*inode));
+		return 1;
+	}
 
 	/* Allocate blkgrp based on gdsize (for 64-bit support). */
 	blkgrp = zalloc(get_fs()->gdsize);
@@ -1612,12 +1881,12 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 		return 0;
 
 	/* It is easier to calculate if the first inode is 0. */
-	ino--;
+	idx = ino - 1;
 	if ( le32_to_cpu(sblock->inodes_per_group) == 0 || fs->inodesz == 0) {
 		free(blkgrp);
 		return 0;
 	}
-	status = ext4fs_blockgroup(data, ino / le32_to_cpu
+	status = ext4fs_blockgroup(data, idx / le32_to_cpu
 				   (sblock->inodes_per_group), blkgrp);
 	if (status == 0) {
 		free(blkgrp);
@@ -1630,8 +1899,8 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 		return 0;
 	}
 	blkno = ext4fs_bg_get_inode_table_id(blkgrp, fs) +
-	    (ino % le32_to_cpu(sblock->inodes_per_group)) / inodes_per_block;
-	blkoff = (ino % inodes_per_block) * fs->inodesz;
+	    (idx % le32_to_cpu(sblock->inodes_per_group)) / inodes_per_block;
+	blkoff = (idx % inodes_per_block) * fs->inodesz;
 
 	/* Free blkgrp as it is no longer required. */
 	free(blkgrp);
@@ -1642,6 +1911,9 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 				sizeof(struct ext2_inode), (char *)inode);
 	if (status == 0)
 		return 0;
+	ic->gen = gen;
+	ic->ino = ino;
+	memcpy(&ic->inode, inode, sizeof(*inode));
 
 	return 1;
 }
@@ -2042,6 +2314,7 @@ void ext4fs_close(void)
 		free(ext4fs_root);
 		ext4fs_root = NULL;
 	}
+	ext4fs_extent_maps_free();
 
 	ext4fs_reinit_global();
 }
@@ -47,6 +47,61 @@ static inline void *zalloc(size_t size)
 	return kzalloc(size, 0);
 }
 
+/**
+ * struct ext4_extent_run - A run of logical blocks in a file
+ *
+ * @lblk: First logical block
+ * @len: Number of blocks
+ * @pblk: First physical block, or 0 if the run is an uninitialised extent,
+ *	which reads as zeroes
+ */
+struct ext4_extent_run {
+	u32 lblk;
+	u32 len;
+	u64 pblk;
+};
+
+/**
+ * struct ext4_extent_map - The decoded extent tree of a file
+ *
+ * @gen: Metadata-cache generation the map belongs to, 0 if unused
+ * @ino: Inode number
+ * @root: Copy of the root of the extent tree held in the inode, used to check
+ *	that the map still describes the file
+ * @count: Number of runs
+ * @alloced: Number of runs allocated
+ * @runs: Runs of blocks, in order of logical block
+ */
+struct ext4_extent_map {
+	uint gen;
+	int ino;
+	struct datablocks root;
+	int count;
+	int alloced;
+	struct ext4_extent_run *runs;
+};
+
+/**
+ * ext4fs_get_extent_map() - Get the extent map of a file
+ *
+ * The map is built by reading the whole extent tree the first time it is
+ * needed, then kept until the filesystem is closed or changes.
+ *
+ * @node: File, which must use extents
+ * Return: extent map, or NULL if it could not be built
+ */
+struct ext4_extent_map *ext4fs_get_extent_map(struct ext2fs_node *node);
+
+/**
+ * ext4fs_extent_map_find() - Find the run containing or following a block
+ *
+ * @map: Extent map to search
+ * @lblk: Logical block number
+ * Return: index of the first run which ends after @lblk, or map->count if
+ * there is none
+ */
+int ext4fs_extent_map_find(const struct ext4_extent_map *map, u32 lblk);
+
 int ext4fs_read_inode(struct ext2_data *data, int ino,
 		      struct ext2_inode *inode);
 int ext4fs_read_file(struct ext2fs_node *node, loff_t pos, loff_t len,
@@ -29,6 +29,7 @@
 #include <part.h>
 #include <rtc.h>
 #include <u-boot/uuid.h>
+#include <linux/sizes.h>
 #include "ext4_common.h"
 
 int ext4fs_symlinknest;
@@ -63,6 +64,66 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 		free(node);
 }
 
+/* Largest number of bytes read from the device in one request */
+#define EXT4_MAX_READ	SZ_1G
+
+/*
+ * Read part of a file using its extent map. Each run of blocks is read
+ * straight into the buffer with a single request; holes and uninitialised
+ * extents read as zeroes.
+ */
+static int ext4fs_read_extents(struct ext2fs_node *node,
+			       const struct ext4_extent_map *map, loff_t pos,
+			       loff_t len, char *buf)
+{
+	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data);
+	int log2_sect = log2_fs_blocksize - get_fs()->dev_desc->log2blksz;
+	loff_t end = pos + len;
+	int i;
+
+	i = ext4fs_extent_map_find(map, pos >> log2_fs_blocksize);
+	while (pos < end) {
+		const struct ext4_extent_run *run = NULL;
+		u32 lblk = pos >> log2_fs_blocksize;
+		loff_t n = end - pos;
+
+		if (i < map->count)
+			run = &map->runs[i];
+		if (run && (u64)run->lblk + run->len <= lblk) {
+			i++;
+			continue;
+		}
+
+		if (!run || lblk < run->lblk) {
+			/* Hole */
+			if (run)
+				n = min(n, ((loff_t)run->lblk <<
+					    log2_fs_blocksize) - pos);
+			memset(buf, '\0', n);
+		} else {
+			n = min(n, (((loff_t)run->lblk + run->len) <<
+				    log2_fs_blocksize) - pos);
+			if (run->pblk) {
+				lbaint_t sector;
+				int offset;
+
+				n = min_t(loff_t, n, EXT4_MAX_READ);
+				sector = (lbaint_t)(run->pblk + lblk -
+						    run->lblk) << log2_sect;
+				offset = pos & ((1 << log2_fs_blocksize) - 1);
+				if (!ext4fs_devread(sector, offset, n, buf))
+					return -1;
+			} else {
+				memset(buf, '\0', n);
+			}
+		}
+		pos += n;
+		buf += n;
+	}
+
+	return 0;
+}
+
 /*
  * Taken from openmoko-kernel mailing list: By Andy green
  * Optimized read file API : collects and defers contiguous sector
@@ -99,6 +160,19 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 		return -1;
 	}
 
+	/* Files with extents are read a run at a time, using the extent map */
+	if (le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL) {
+		struct ext4_extent_map *map = ext4fs_get_extent_map(node);
+
+		if (map) {
+			ext_cache_fini(&cache);
+			if (ext4fs_read_extents(node, map, pos, len, buf))
+				return -1;
+			*actread = len;
+			return 0;
+		}
+	}
+
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
 
 	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
@@ -387,64 +387,215 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	return ret;
 }
 
-/*
- * Read at most 'size' bytes from the specified cluster into 'buffer'.
- * Return 0 on success, -1 otherwise.
+/* Number of files whose cluster runs are remembered */
+#define FAT_MAP_FILES	4
+
+/**
+ * struct fat_extent - A run of consecutive clusters in a file
+ *
+ * @index: Index within the file of the first cluster
+ * @clust: First cluster
+ * @count: Number of clusters
  */
-static int
-get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
+struct fat_extent {
+	u32 index;
+	u32 clust;
+	u32 count;
+};
+
+/**
+ * struct fat_map - The cluster runs making up (the start of) a file
+ *
+ * This is built by following the cluster chain in the FAT as far as needed,
+ * then kept so that later reads of the same file need not follow it again.
+ * It is only used while no blocks have been written to the device, since a
+ * write may change the FAT. The volume ID guards against a media change.
+ *
+ * @dev: Block device, NULL if this entry is unused
+ * @part_start: Start of the partition on @dev
+ * @write_gen: Value of @dev->write_gen when the map was built
+ * @volume_id: Volume serial number
+ * @start: First cluster of the file
+ * @clusters: Number of clusters mapped so far
+ * @last: Value of the FAT entry for the last mapped cluster
+ * @used: Number of entries in use in @ext
+ * @alloced: Number of entries allocated in @ext
+ * @ext: Cluster runs, in file order
+ */
+struct fat_map {
+	struct blk_desc *dev;
+	lbaint_t part_start;
+	unsigned int write_gen;
+	u32 volume_id;
+	u32 start;
+	u32 clusters;
+	u32 last;
+	int used;
+	int alloced;
+	struct fat_extent *ext;
+};
+
+static struct fat_map fat_maps[FAT_MAP_FILES];
+static int fat_map_next;
+
+static bool fat_map_valid(fsdata *mydata, struct fat_map *map)
 {
-	__u32 startsect;
-	int ret;
+	return map->dev == cur_dev && map->part_start == cur_part_info.start &&
+		map->write_gen == cur_dev->write_gen &&
+		map->volume_id == mydata->volume_id;
+}
 
-	if (clustnum > 0) {
-		startsect = clust_to_sect(mydata, clustnum);
+/* Add a cluster to the end of a map */
+static int fat_map_add(struct fat_map *map, u32 clust)
+{
+	struct fat_extent *ext = map->used ? &map->ext[map->used - 1] : NULL;
+
+	if (ext && ext->clust + ext->count == clust) {
+		ext->count++;
 	} else {
-		startsect = mydata->rootdir_sect;
+		if (map->used == map->alloced) {
+			int alloced = max(map->alloced * 2, 16);
+
+			ext = realloc(map->ext, alloced * sizeof(*ext));
+			if (!ext)
+				return -ENOMEM;
+			map->ext = ext;
+			map->alloced = alloced;
+		}
+		ext = &map->ext[map->used++];
+		ext->index = map->clusters;
+		ext->clust = clust;
+		ext->count = 1;
 	}
+	map->clusters++;
 
-	debug("gc - clustnum: %d, startsect: %d\n", clustnum, startsect);
-
-	if ((unsigned long)buffer & (ARCH_DMA_MINALIGN - 1)) {
-		ALLOC_CACHE_ALIGN_BUFFER(__u8, tmpbuf, mydata->sect_size);
-
-		debug("FAT: Misaligned buffer address (%p)\n", buffer);
+	return 0;
+}
 
-		while (size >= mydata->sect_size) {
-			ret = disk_read(startsect++, 1, tmpbuf);
-			if (ret != 1) {
-				debug("Error reading data (got %d)\n", ret);
-				return -1;
-			}
+/**
+ * fat_map_file() - Get the cluster runs of a file
+ *
+ * @mydata:	file system description
+ * @start:	first cluster of the file
+ * @clusters:	number of clusters needed
+ * Return:	map holding at least @clusters clusters, or NULL on error
+ */
+static struct fat_map *fat_map_file(fsdata *mydata, u32 start, u32 clusters)
+{
+	struct fat_map *map = NULL;
+	int i;
 
-			memcpy(buffer, tmpbuf, mydata->sect_size);
-			buffer += mydata->sect_size;
-			size -= mydata->sect_size;
+	for (i = 0; i < FAT_MAP_FILES; i++) {
+		if (fat_map_valid(mydata, &fat_maps[i]) &&
+		    fat_maps[i].start == start) {
+			map = &fat_maps[i];
+			break;
 		}
-	} else if (size >= mydata->sect_size) {
-		__u32 bytes_read;
-		__u32 sect_count = size / mydata->sect_size;
+	}
 
-		ret = disk_read(startsect, sect_count, buffer);
-		if (ret != sect_count) {
-			debug("Error reading data (got %d)\n", ret);
-			return -1;
+	if (!map) {
+		map = &fat_maps[fat_map_next];
+		fat_map_next = (fat_map_next + 1) % FAT_MAP_FILES;
+		map->dev = NULL;
+		if (CHECK_CLUST(start, mydata->fatsize)) {
+			debug("curclust: 0x%x\n", start);
+			printf("Invalid FAT entry\n");
+			return NULL;
 		}
-		bytes_read = sect_count * mydata->sect_size;
-		startsect += sect_count;
-		buffer += bytes_read;
-		size -= bytes_read;
+		map->part_start = cur_part_info.start;
+		map->write_gen = cur_dev->write_gen;
+		map->volume_id = mydata->volume_id;
+		map->start = start;
+		map->clusters = 0;
+		map->used = 0;
+		map->last = start;
+		map->dev = cur_dev;
 	}
-	if (size) {
-		ALLOC_CACHE_ALIGN_BUFFER(__u8, tmpbuf, mydata->sect_size);
 
-		ret = disk_read(startsect, 1, tmpbuf);
-		if (ret != 1) {
-			debug("Error reading data (got %d)\n", ret);
-			return -1;
+	/* Follow the chain only as far as this read needs */
+	while (map->clusters < clusters) {
+		u32 clust = map->last;
+
+		if (map->clusters) {
+			if (CHECK_CLUST(clust, mydata->fatsize)) {
+				debug("curclust: 0x%x\n", clust);
+				printf("Invalid FAT entry\n");
+				map->dev = NULL;
+				return NULL;
+			}
+		}
+		if (fat_map_add(map, clust)) {
+			map->dev = NULL;
+			return NULL;
 		}
+		map->last = get_fatent(mydata, clust);
+	}
 
-		memcpy(buffer, tmpbuf, size);
+	return map;
+}
+
+/* Find the run holding the cluster at index @idx in the file */
+static struct fat_extent *fat_map_find(struct fat_map *map, u32 idx)
+{
+	int lo = 0, hi = map->used - 1;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+
+		if (map->ext[mid].index <= idx)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return &map->ext[lo];
+}
+
+/**
+ * fat_read_run() - Read part of a run of clusters
+ *
+ * Whole sectors are read straight into @buffer when it is suitably aligned.
+ * Anything else goes through @bounce.
+ *
+ * @mydata:	file system description
+ * @clust:	first cluster of the run
+ * @offset:	byte offset into the run
+ * @buffer:	buffer into which to read
+ * @size:	number of bytes to read
+ * @bounce:	cache-aligned buffer of one cluster
+ * Return:	0 on success, -1 on error
+ */
+static int fat_read_run(fsdata *mydata, u32 clust, loff_t offset, __u8 *buffer,
+			loff_t size, __u8 *bounce)
+{
+	ulong bytesperclust = mydata->clust_size * mydata->sect_size;
+	/* FAT files are smaller than 4GiB, so avoid 64-bit division */
+	u32 sect = clust_to_sect(mydata, clust) + (u32)offset / mydata->sect_size;
+	u32 skip = (u32)offset % mydata->sect_size;
+
+	while (size) {
+		ulong len, nsect;
+
+		if (!skip && size >= mydata->sect_size &&
+		    !((ulong)buffer & (ARCH_DMA_MINALIGN - 1))) {
+			nsect = size / mydata->sect_size;
+			if (disk_read(sect, nsect, buffer) != nsect)
+				return -1;
+			len = nsect * mydata->sect_size;
+		} else {
+			nsect = min_t(ulong, DIV_ROUND_UP(skip + size,
+							  mydata->sect_size),
+				      bytesperclust / mydata->sect_size);
+			if (disk_read(sect, nsect, bounce) != nsect)
+				return -1;
+			len = min_t(loff_t, nsect * mydata->sect_size - skip,
+				    size);
+			memcpy(buffer, bounce + skip, len);
+			skip = 0;
+		}
+		sect += nsect;
+		buffer += len;
+		size -= len;
 	}
 
 	return 0;
@@ -457,6 +608,9 @@ get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
  * into 'buffer'. Update the number of bytes read in *gotsize or return -1 on
  * fatal errors.
  *
+ * Each run of consecutive clusters is read with a single request, using the
+ * map from fat_map_file().
+ *
  * @mydata:	file system description
  * @dentprt:	directory entry pointer
  * @pos:	position from where to read
@@ -470,9 +624,10 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 {
 	loff_t filesize = FAT2CPU32(dentptr->size);
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
-	__u32 curclust = START(dentptr);
-	__u32 endclust, newclust;
-	loff_t actsize;
+	__u8 *bounce = NULL;
+	struct fat_map *map;
+	int ret = 0;
+	u32 idx;
 
 	*gotsize = 0;
 	debug("Filesize: %llu bytes\n", filesize);
@@ -487,101 +642,44 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 
 	debug("%llu bytes\n", filesize);
 
-	actsize = bytesperclust;
-
-	/* go to cluster at pos */
-	while (actsize <= pos) {
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize += bytesperclust;
-	}
-
-	/* actsize > pos */
-	actsize -= bytesperclust;
-	filesize -= actsize;
-	pos -= actsize;
-
-	/* align to beginning of next cluster if any */
-	if (pos) {
-		__u8 *tmp_buffer;
-
-		actsize = min(filesize, (loff_t)bytesperclust);
-		tmp_buffer = malloc_cache_aligned(actsize);
-		if (!tmp_buffer) {
-			debug("Error: allocating buffer\n");
-			return -1;
-		}
-
-		if (get_cluster(mydata, curclust, tmp_buffer, actsize) != 0) {
-			printf("Error reading cluster\n");
-			free(tmp_buffer);
-			return -1;
-		}
-		filesize -= actsize;
-		actsize -= pos;
-		memcpy(buffer, tmp_buffer + pos, actsize);
-		free(tmp_buffer);
-		*gotsize += actsize;
-		if (!filesize)
-			return 0;
-		buffer += actsize;
-
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-	}
+	/* FAT files are smaller than 4GiB, so avoid 64-bit division */
+	map = fat_map_file(mydata, START(dentptr),
+			   (u32)(filesize - 1) / bytesperclust + 1);
+	if (!map)
+		return -1;
 
-	actsize = bytesperclust;
-	endclust = curclust;
-
-	do {
-		/* search for consecutive clusters */
-		while (actsize < filesize) {
-			newclust = get_fatent(mydata, endclust);
-			if ((newclust - 1) != endclust)
-				goto getit;
-			if (CHECK_CLUST(newclust, mydata->fatsize)) {
-				debug("curclust: 0x%x\n", newclust);
-				printf("Invalid FAT entry\n");
+	idx = (u32)pos / bytesperclust;
+	while (pos < filesize) {
+		struct fat_extent *ext = fat_map_find(map, idx);
+		loff_t ext_pos = (loff_t)ext->index * bytesperclust;
+		loff_t len;
+
+		len = min(filesize, ext_pos + (loff_t)ext->count * bytesperclust) -
+			pos;
+		if (!bounce && ((u32)(pos | len) % mydata->sect_size ||
+				(ulong)buffer & (ARCH_DMA_MINALIGN - 1))) {
+			bounce = malloc_cache_aligned(bytesperclust);
+			if (!bounce) {
+				debug("Error: allocating buffer\n");
 				return -1;
 			}
-			endclust = newclust;
-			actsize += bytesperclust;
-		}
-
-		/* get remaining bytes */
-		actsize = filesize;
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
-			printf("Error reading cluster\n");
-			return -1;
 		}
-		*gotsize += actsize;
-		return 0;
-getit:
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+		debug("run: cluster %u, %u clusters, reading %llu bytes\n",
+		      ext->clust, ext->count, len);
+		if (fat_read_run(mydata, ext->clust, pos - ext_pos, buffer, len,
+				 bounce)) {
 			printf("Error reading cluster\n");
-			return -1;
+			ret = -1;
+			break;
 		}
-		*gotsize += (int)actsize;
-		filesize -= actsize;
-		buffer += actsize;
+		*gotsize += len;
+		buffer += len;
+		pos += len;
+		idx = ext->index + ext->count;
+	}
+	free(bounce);
 
-		curclust = get_fatent(mydata, endclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize = bytesperclust;
-		endclust = curclust;
-	} while (1);
+	return ret;
 }
 
 /*
@@ -831,6 +929,22 @@ static int get_fs_info(fsdata *mydata)
 		mydata->root_cluster = 0;
 	}
 
+	mydata->volume_id = get_unaligned_le32(volinfo.volume_id);
+
+	/*
+	 * Read as much of the FAT at once as the buffer size allows, so that
+	 * following a long cluster chain takes few reads
+	 */
+	mydata->fatbufblocks = FATBUF_MIN_BLOCKS;
+	if (!IS_ENABLED(CONFIG_XPL_BUILD)) {
+		int blocks = CONFIG_FS_FAT_FATBUF_SIZE / mydata->sect_size;
+
+		blocks = min_t(u32, blocks, roundup(mydata->fatlength,
+						    FATBUF_MIN_BLOCKS));
+		mydata->fatbufblocks = max(rounddown(blocks, FATBUF_MIN_BLOCKS),
+					   FATBUF_MIN_BLOCKS);
+	}
+
 	mydata->fatbufnum = -1;
 	fat_mark_clean(mydata);
 	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE);
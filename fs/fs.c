@@ -159,6 +159,12 @@ struct fstype_info {
 	 * filesystem.
 	 */
 	bool null_dev_desc_ok;
+	/*
+	 * Can the results of looking up paths be cached between commands?
+	 * This requires that the filesystem only changes when its block
+	 * device is written, which updates the device's write_gen.
+	 */
+	bool dcache_ok;
 	int (*probe)(struct blk_desc *fs_dev_desc,
 		     struct disk_partition *fs_partition);
 	int (*ls)(const char *dirname);
@@ -196,6 +202,7 @@ static struct fstype_info fstypes[] = {
 		.fstype = FS_TYPE_FAT,
 		.name = "fat",
 		.null_dev_desc_ok = false,
+		.dcache_ok = true,
 		.probe = fat_set_blk_dev,
 		.close = fat_close,
 		.ls = fs_ls_generic,
@@ -229,6 +236,7 @@ static struct fstype_info fstypes[] = {
 		.fstype = FS_TYPE_EXT,
 		.name = "ext4",
 		.null_dev_desc_ok = false,
+		.dcache_ok = true,
 		.probe = ext4fs_probe,
 		.close = ext4fs_close,
 		.ls = fs_ls_generic,
@@ -318,6 +326,7 @@ static struct fstype_info fstypes[] = {
 		.fstype = FS_TYPE_BTRFS,
 		.name = "btrfs",
 		.null_dev_desc_ok = false,
+		.dcache_ok = true,
 		.probe = btrfs_probe,
 		.close = btrfs_close,
 		.ls = btrfs_ls,
@@ -338,6 +347,7 @@ static struct fstype_info fstypes[] = {
 		.fstype = FS_TYPE_SQUASHFS,
 		.name = "squashfs",
 		.null_dev_desc_ok = false,
+		.dcache_ok = true,
 		.probe = sqfs_probe,
 		.opendir = sqfs_opendir,
 		.readdir = sqfs_readdir,
@@ -360,6 +370,7 @@ static struct fstype_info fstypes[] = {
 		.fstype = FS_TYPE_EROFS,
 		.name = "erofs",
 		.null_dev_desc_ok = false,
+		.dcache_ok = true,
 		.probe = erofs_probe,
 		.opendir = erofs_opendir,
 		.readdir = erofs_readdir,
@@ -419,6 +430,123 @@ static struct fstype_info fstypes[] = {
 	},
 };
 
+/* Number of path lookups held in the cache */
+#define FS_DCACHE_ENTRIES	32
+
+/* Length of the longest path which is cached, including terminator */
+#define FS_DCACHE_PATH_LEN	128
+
+enum fs_dcache_op {
+	FS_DCACHE_EXISTS,
+	FS_DCACHE_SIZE,
+};
+
+/**
+ * struct fs_dcache_entry - The result of looking up a path
+ *
+ * @desc: Block device, NULL if this entry is unused
+ * @part_start: Start sector of the partition
+ * @write_gen: Value of the device's write_gen when the path was looked up
+ * @fstype: Filesystem type
+ * @op: Operation which looked up the path
+ * @ret: Value returned by the operation
+ * @size: Size returned by FS_DCACHE_SIZE
+ * @path: Path which was looked up
+ */
+struct fs_dcache_entry {
+	struct blk_desc *desc;
+	lbaint_t part_start;
+	uint write_gen;
+	int fstype;
+	enum fs_dcache_op op;
+	int ret;
+	loff_t size;
+	char path[FS_DCACHE_PATH_LEN];
+};
+
+/**
+ * struct fs_probe_hint - The filesystem found when a partition was last probed
+ *
+ * @desc: Block device, NULL if none
+ * @part_start: Start sector of the partition
+ * @write_gen: Value of the device's write_gen when it was probed
+ * @fstype: Filesystem type which was found
+ */
+struct fs_probe_hint {
+	struct blk_desc *desc;
+	lbaint_t part_start;
+	uint write_gen;
+	int fstype;
+};
+
+static struct fs_dcache_entry fs_dcache[FS_DCACHE_ENTRIES];
+static int fs_dcache_next;
+static uint fs_dcache_hits;
+static struct fs_probe_hint fs_last_probe;
+
+static struct fs_dcache_entry *fs_dcache_find(struct fstype_info *info,
+					      enum fs_dcache_op op,
+					      const char *path)
+{
+	int i;
+
+	if (!CONFIG_IS_ENABLED(FS_DCACHE) || !info->dcache_ok || !fs_dev_desc)
+		return NULL;
+
+	for (i = 0; i < FS_DCACHE_ENTRIES; i++) {
+		struct fs_dcache_entry *ent = &fs_dcache[i];
+
+		if (ent->desc == fs_dev_desc &&
+		    ent->part_start == fs_partition.start &&
+		    ent->write_gen == fs_dev_desc->write_gen &&
+		    ent->fstype == info->fstype && ent->op == op &&
+		    !strcmp(ent->path, path)) {
+			fs_dcache_hits++;
+			return ent;
+		}
+	}
+
+	return NULL;
+}
+
+uint fs_dcache_get_hits(void)
+{
+	return fs_dcache_hits;
+}
+
+static void fs_dcache_add(struct fstype_info *info, enum fs_dcache_op op,
+			  const char *path, int ret, loff_t size)
+{
+	struct fs_dcache_entry *ent;
+
+	if (!CONFIG_IS_ENABLED(FS_DCACHE) || !info->dcache_ok ||
+	    !fs_dev_desc || strlen(path) >= FS_DCACHE_PATH_LEN ||
+	    ret == -ENOMEM)
+		return;
+
+	ent = &fs_dcache[fs_dcache_next];
+	fs_dcache_next = (fs_dcache_next + 1) % FS_DCACHE_ENTRIES;
+	ent->desc = fs_dev_desc;
+	ent->part_start = fs_partition.start;
+	ent->write_gen = fs_dev_desc->write_gen;
+	ent->fstype = info->fstype;
+	ent->op = op;
+	ent->ret = ret;
+	ent->size = size;
+	strcpy(ent->path, path);
+}
+
+/* Drop cached lookups, after the filesystem may have been changed */
+static void fs_dcache_invalidate(void)
+{
+	if (!CONFIG_IS_ENABLED(FS_DCACHE))
+		return;
+
+	memset(fs_dcache, '\0', sizeof(fs_dcache));
+	fs_dcache_next = 0;
+	fs_last_probe.desc = NULL;
+}
+
 static struct fstype_info *fs_get_info(int fstype)
 {
 	struct fstype_info *info;
@@ -459,39 +587,73 @@ const char *fs_get_type_name(void)
 	return fs_get_info(fs_type)->name;
 }
 
-int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
+static int fs_probe_one(struct fstype_info *info, int fstype, int part)
 {
-	struct fstype_info *info;
-	int part, i;
+	if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
+			fstype != info->fstype)
+		return -1;
 
-	part = part_get_info_by_dev_and_name_or_num(ifname, dev_part_str, &fs_dev_desc,
-						    &fs_partition, 1);
-	if (part < 0)
+	if (!fs_dev_desc && !info->null_dev_desc_ok)
 		return -1;
 
-	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
-		if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
-				fstype != info->fstype)
-			continue;
+	if (info->probe(fs_dev_desc, &fs_partition))
+		return -1;
+	fs_type = info->fstype;
+	fs_dev_part = part;
 
-		if (!fs_dev_desc && !info->null_dev_desc_ok)
-			continue;
+	return 0;
+}
+
+/*
+ * Probe the current partition for a filesystem of type @fstype, or any type
+ * for FS_TYPE_ANY. The type found last time on this partition is tried first.
+ */
+static int fs_probe(int fstype, int part)
+{
+	struct fs_probe_hint *hint = &fs_last_probe;
+	struct fstype_info *info, *last = NULL;
+	int i;
 
-		if (!info->probe(fs_dev_desc, &fs_partition)) {
-			fs_type = info->fstype;
-			fs_dev_part = part;
+	if (CONFIG_IS_ENABLED(FS_DCACHE) && fs_dev_desc &&
+	    hint->desc == fs_dev_desc &&
+	    hint->part_start == fs_partition.start &&
+	    hint->write_gen == fs_dev_desc->write_gen) {
+		last = fs_get_info(hint->fstype);
+		if (!fs_probe_one(last, fstype, part))
 			return 0;
+	}
+
+	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
+		if (info == last || fs_probe_one(info, fstype, part))
+			continue;
+		if (fs_dev_desc) {
+			hint->desc = fs_dev_desc;
+			hint->part_start = fs_partition.start;
+			hint->write_gen = fs_dev_desc->write_gen;
+			hint->fstype = info->fstype;
 		}
+		return 0;
 	}
 
 	return -1;
 }
 
+int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
+{
+	int part;
+
+	part = part_get_info_by_dev_and_name_or_num(ifname, dev_part_str, &fs_dev_desc,
+						    &fs_partition, 1);
+	if (part < 0)
+		return -1;
+
+	return fs_probe(fstype, part);
+}
+
 /* set current blk device w/ blk_desc + partition # */
 int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 {
-	struct fstype_info *info;
-	int ret, i;
+	int ret;
 
 	if (part >= 1)
 		ret = part_get_info(desc, part, &fs_partition);
@@ -501,15 +663,7 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 		return ret;
 	fs_dev_desc = desc;
 
-	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
-		if (!info->probe(fs_dev_desc, &fs_partition)) {
-			fs_type = info->fstype;
-			fs_dev_part = part;
-			return 0;
-		}
-	}
-
-	return -1;
+	return fs_probe(FS_TYPE_ANY, part);
 }
 
 void fs_close(void)
@@ -543,11 +697,17 @@ int fs_ls(const char *dirname)
 
 int fs_exists(const char *filename)
 {
-	int ret;
-
 	struct fstype_info *info = fs_get_info(fs_type);
+	struct fs_dcache_entry *ent;
+	int ret;
 
-	ret = info->exists(filename);
+	ent = fs_dcache_find(info, FS_DCACHE_EXISTS, filename);
+	if (ent) {
+		ret = ent->ret;
+	} else {
+		ret = info->exists(filename);
+		fs_dcache_add(info, FS_DCACHE_EXISTS, filename, ret, 0);
+	}
 
 	fs_close();
 
@@ -556,11 +716,20 @@ int fs_exists(const char *filename)
 
 int fs_size(const char *filename, loff_t *size)
 {
-	int ret;
-
 	struct fstype_info *info = fs_get_info(fs_type);
+	struct fs_dcache_entry *ent;
+	int ret;
 
-	ret = info->size(filename, size);
+	ent = fs_dcache_find(info, FS_DCACHE_SIZE, filename);
+	if (ent) {
+		ret = ent->ret;
+		if (!ret)
+			*size = ent->size;
+	} else {
+		ret = info->size(filename, size);
+		fs_dcache_add(info, FS_DCACHE_SIZE, filename, ret,
+			      ret ? 0 : *size);
+	}
 
 	fs_close();
 
@@ -650,6 +819,7 @@ int fs_write(const char *filename, ulong addr, loff_t offset, loff_t len,
 	buf = map_sysmem(addr, len);
 	ret = info->write(filename, buf, offset, len, actwrite);
 	unmap_sysmem(buf);
+	fs_dcache_invalidate();
 
 	if (ret < 0 && len != *actwrite) {
 		log_err("** Unable to write file %s **\n", filename);
@@ -719,6 +889,7 @@ int fs_unlink(const char *filename)
 	struct fstype_info *info = fs_get_info(fs_type);
 
 	ret = info->unlink(filename);
+	fs_dcache_invalidate();
 
 	fs_close();
 
@@ -732,6 +903,7 @@ int fs_mkdir(const char *dirname)
 	struct fstype_info *info = fs_get_info(fs_type);
 
 	ret = info->mkdir(dirname);
+	fs_dcache_invalidate();
 
 	fs_close();
 
@@ -744,6 +916,7 @@ int fs_ln(const char *fname, const char *target)
 	int ret;
 
 	ret = info->ln(fname, target);
+	fs_dcache_invalidate();
 
 	if (ret < 0) {
 		log_err("** Unable to create link %s -> %s **\n", fname, target);
@@ -760,6 +933,7 @@ int fs_rename(const char *old_path, const char *new_path)
 	int ret;
 
 	ret = info->rename(old_path, new_path);
+	fs_dcache_invalidate();
 
 	if (ret < 0) {
 		log_debug("Unable to rename %s -> %s\n", old_path, new_path);
@@ -26,8 +26,47 @@
 
 #define MAX_SYMLINK_NEST 8
 
+/* Largest number of blocks held in the block cache */
+#define SQFS_BLOCK_CACHE_MAX 16
+
+/**
+ * struct sqfs_cached_block - A decompressed data or fragment block
+ *
+ * @start: Position of the block on disk in bytes, 0 if this entry is unused
+ * @len: Length of the decompressed data
+ * @alloced: Size of @data
+ * @last_used: Value of sqfs_block_tick when the block was last used
+ * @data: Decompressed data
+ */
+struct sqfs_cached_block {
+	u64 start;
+	unsigned long len;
+	size_t alloced;
+	ulong last_used;
+	char *data;
+};
+
+/**
+ * struct sqfs_cache_key - Identifies the filesystem described by the caches
+ *
+ * @dev: Block device, NULL if the caches are empty
+ * @part_start: Start of the partition
+ * @write_gen: Value of the device's write_gen when the caches were filled
+ * @sblk: Superblock of the filesystem
+ */
+struct sqfs_cache_key {
+	struct blk_desc *dev;
+	lbaint_t part_start;
+	uint write_gen;
+	struct squashfs_super_block sblk;
+};
+
 static struct squashfs_ctxt ctxt;
 static int symlinknest;
+static struct sqfs_cache_key sqfs_cache_key;
+static struct squashfs_tables *sqfs_tables;
+static struct sqfs_cached_block sqfs_block_cache[SQFS_BLOCK_CACHE_MAX];
+static ulong sqfs_block_tick;
 
 static int sqfs_readdir_nest(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp);
 
@@ -62,6 +101,40 @@ static int sqfs_read_sblk(struct squashfs_super_block **sblk)
 	return 0;
 }
 
+static void sqfs_put_tables(struct squashfs_tables *tables)
+{
+	if (!tables || --tables->refs)
+		return;
+
+	free(tables->inode_table);
+	free(tables->dir_table);
+	free(tables->pos_list);
+	free(tables);
+}
+
+/* Empty the caches if they do not describe the current filesystem */
+static void sqfs_cache_check(void)
+{
+	struct sqfs_cache_key *key = &sqfs_cache_key;
+	int i;
+
+	if (key->dev == ctxt.cur_dev &&
+	    key->part_start == ctxt.cur_part_info.start &&
+	    key->write_gen == ctxt.cur_dev->write_gen &&
+	    !memcmp(&key->sblk, ctxt.sblk, sizeof(key->sblk)))
+		return;
+
+	sqfs_put_tables(sqfs_tables);
+	sqfs_tables = NULL;
+	for (i = 0; i < SQFS_BLOCK_CACHE_MAX; i++)
+		sqfs_block_cache[i].start = 0;
+
+	key->dev = ctxt.cur_dev;
+	key->part_start = ctxt.cur_part_info.start;
+	key->write_gen = ctxt.cur_dev->write_gen;
+	memcpy(&key->sblk, ctxt.sblk, sizeof(key->sblk));
+}
+
 static int sqfs_count_tokens(const char *filename)
 {
 	int token_count = 1, l;
@@ -914,13 +987,50 @@ out:
 	return metablks_count;
 }
 
+/*
+ * Get the decompressed inode and directory tables, reading them only if they
+ * are not already cached. Release them with sqfs_put_tables().
+ */
+static struct squashfs_tables *sqfs_get_tables(void)
+{
+	struct squashfs_tables *tables;
+
+	sqfs_cache_check();
+	if (sqfs_tables) {
+		sqfs_tables->refs++;
+		return sqfs_tables;
+	}
+
+	tables = calloc(1, sizeof(*tables));
+	if (!tables)
+		return NULL;
+	tables->refs = 1;
+
+	if (sqfs_read_inode_table(&tables->inode_table))
+		goto err;
+
+	tables->metablks_count = sqfs_read_directory_table(&tables->dir_table,
+							   &tables->pos_list);
+	if (tables->metablks_count < 1)
+		goto err;
+
+	/* Keep a reference for the cache */
+	tables->refs++;
+	sqfs_tables = tables;
+
+	return tables;
+err:
+	sqfs_put_tables(tables);
+
+	return NULL;
+}
+
 static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 {
-	unsigned char *inode_table = NULL, *dir_table = NULL;
-	int j, token_count = 0, ret = 0, metablks_count;
+	int j, token_count = 0, ret = 0;
 	struct squashfs_dir_stream *dirs;
 	char **token_list = NULL, *path = NULL;
-	u32 *pos_list = NULL;
+	struct squashfs_tables *tables;
 
 	dirs = calloc(1, sizeof(*dirs));
 	if (!dirs)
@@ -933,17 +1043,12 @@ static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 	dirs->inode_table = NULL;
 	dirs->dir_table = NULL;
 
-	ret = sqfs_read_inode_table(&inode_table);
-	if (ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	metablks_count = sqfs_read_directory_table(&dir_table, &pos_list);
-	if (metablks_count < 1) {
+	tables = sqfs_get_tables();
+	if (!tables) {
 		ret = -EINVAL;
 		goto out;
 	}
+	dirs->tables = tables;
 
 	/* Tokenize filename */
 	token_count = sqfs_count_tokens(filename);
@@ -972,10 +1077,10 @@ static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 	 * ldir's (extended directory) size is greater than dir, so it works as
 	 * a general solution for the malloc size, since 'i' is a union.
 	 */
-	dirs->inode_table = inode_table;
-	dirs->dir_table = dir_table;
-	ret = sqfs_search_dir(dirs, token_list, token_count, pos_list,
-			      metablks_count);
+	dirs->inode_table = tables->inode_table;
+	dirs->dir_table = tables->dir_table;
+	ret = sqfs_search_dir(dirs, token_list, token_count, tables->pos_list,
+			      tables->metablks_count);
 	if (ret)
 		goto out;
 
@@ -1001,12 +1106,9 @@ out:
 			free(token_list[j]);
 		free(token_list);
 	}
-	free(pos_list);
 	free(path);
-	if (ret) {
-		free(inode_table);
-		free(dirs);
-	}
+	if (ret)
+		sqfs_closedir((struct fs_dir_stream *)dirs);
 
 	return ret;
 }
@@ -1369,11 +1471,114 @@ static int sqfs_get_lregfile_info(struct squashfs_lreg_inode *lreg,
 	return datablk_count;
 }
 
+/* Pick the block-cache entry to hold a new block */
+static struct sqfs_cached_block *sqfs_block_cache_victim(void)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	struct sqfs_cached_block *victim = NULL;
+	int i, count;
+
+	count = CONFIG_FS_SQUASHFS_BLOCK_CACHE_SIZE * 1024 / block_size;
+	count = clamp(count, 1, SQFS_BLOCK_CACHE_MAX);
+	for (i = 0; i < count; i++) {
+		struct sqfs_cached_block *blk = &sqfs_block_cache[i];
+
+		if (!blk->start)
+			return blk;
+		if (!victim || blk->last_used < victim->last_used)
+			victim = blk;
+	}
+
+	return victim;
+}
+
+/**
+ * sqfs_get_block() - Get the contents of a data or fragment block
+ *
+ * The block is decompressed into the block cache, unless it is there already.
+ *
+ * @start: Position of the block on disk, in bytes
+ * @size: Size of the block on disk, with its SquashFS 'uncompressed' flag
+ * @datap: Returns the block's data, valid until the next call
+ * @lenp: Returns the length of the block's data
+ * Return: 0 if OK, -ve on error
+ */
+static int sqfs_get_block(u64 start, u32 size, char **datap,
+			  unsigned long *lenp)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	u64 blk_start, n_blks, table_offset, table_size;
+	struct sqfs_cached_block *blk;
+	char *buffer = NULL;
+	size_t buf_size;
+	int i, ret;
+
+	sqfs_cache_check();
+	for (i = 0; i < SQFS_BLOCK_CACHE_MAX; i++) {
+		blk = &sqfs_block_cache[i];
+		if (blk->start && blk->start == start) {
+			blk->last_used = ++sqfs_block_tick;
+			*datap = blk->data;
+			*lenp = blk->len;
+			return 0;
+		}
+	}
+
+	table_size = SQFS_BLOCK_SIZE(size);
+	if (table_size > block_size)
+		return -EINVAL;
+
+	blk = sqfs_block_cache_victim();
+	blk->start = 0;
+	if (blk->alloced < block_size) {
+		free(blk->data);
+		blk->alloced = 0;
+		blk->data = malloc(block_size);
+		if (!blk->data)
+			return -ENOMEM;
+		blk->alloced = block_size;
+	}
+
+	blk_start = lldiv(start, ctxt.cur_dev->blksz);
+	table_offset = start - blk_start * ctxt.cur_dev->blksz;
+	n_blks = DIV_ROUND_UP(table_size + table_offset, ctxt.cur_dev->blksz);
+	if (__builtin_mul_overflow(n_blks, ctxt.cur_dev->blksz, &buf_size))
+		return -EINVAL;
+
+	buffer = malloc_cache_aligned(buf_size);
+	if (!buffer)
+		return -ENOMEM;
+
+	if (sqfs_disk_read(blk_start, n_blks, buffer) < 0) {
+		ret = -EIO;
+		goto out;
+	}
+
+	if (SQFS_COMPRESSED_BLOCK(size)) {
+		blk->len = block_size;
+		ret = sqfs_decompress(&ctxt, blk->data, &blk->len,
+				      buffer + table_offset, table_size);
+		if (ret)
+			goto out;
+	} else {
+		memcpy(blk->data, buffer + table_offset, table_size);
+		blk->len = table_size;
+	}
+	blk->start = start;
+	blk->last_used = ++sqfs_block_tick;
+	*datap = blk->data;
+	*lenp = blk->len;
+	ret = 0;
+out:
+	free(buffer);
+
+	return ret;
+}
+
 static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 			  loff_t len, loff_t *actread)
 {
-	char *dir = NULL, *fragment_block, *datablock = NULL;
-	char *fragment = NULL, *file = NULL, *resolved, *data;
+	char *dir = NULL, *fragment_block, *file = NULL, *resolved, *data;
 	u64 start, n_blks, table_size, data_offset, table_offset, sparse_size;
 	int ret, j, i_number, datablk_count = 0;
 	struct squashfs_super_block *sblk = ctxt.sblk;
@@ -1388,7 +1593,6 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 	unsigned long dest_len;
 	struct fs_dirent *dent;
 	unsigned char *ipos;
-	size_t buf_size;
 
 	*actread = 0;
 
@@ -1500,33 +1704,36 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 		len = finfo.size;
 	}
 
-	if (datablk_count) {
-		data_offset = finfo.start;
-		datablock = malloc(get_unaligned_le32(&sblk->block_size));
-		if (!datablock) {
-			ret = -ENOMEM;
-			goto out;
-		}
-	}
-
+	data_offset = finfo.start;
 	for (j = 0; j < datablk_count; j++) {
 		char *data_buffer;
 
-		start = lldiv(data_offset, ctxt.cur_dev->blksz);
 		table_size = SQFS_BLOCK_SIZE(finfo.blk_sizes[j]);
-		table_offset = data_offset - (start * ctxt.cur_dev->blksz);
-		n_blks = DIV_ROUND_UP(table_size + table_offset,
-				      ctxt.cur_dev->blksz);
 
-		/* Don't load any data for sparse blocks */
 		if (finfo.blk_sizes[j] == 0) {
-			n_blks = 0;
-			table_offset = 0;
-			data_buffer = NULL;
-			data = NULL;
+			/* This is a sparse block */
+			sparse_size = get_unaligned_le32(&sblk->block_size);
+			if ((*actread + sparse_size) > len)
+				sparse_size = len - *actread;
+			memset(buf + *actread, 0, sparse_size);
+			*actread += sparse_size;
+		} else if (SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
+			ret = sqfs_get_block(data_offset, finfo.blk_sizes[j],
+					     &data, &dest_len);
+			if (ret)
+				goto out;
+
+			if ((*actread + dest_len) > len)
+				dest_len = len - *actread;
+			memcpy(buf + *actread, data, dest_len);
+			*actread += dest_len;
 		} else {
+			/* Uncompressed blocks are copied without caching */
+			start = lldiv(data_offset, ctxt.cur_dev->blksz);
+			table_offset = data_offset - (start * ctxt.cur_dev->blksz);
+			n_blks = DIV_ROUND_UP(table_size + table_offset,
+					      ctxt.cur_dev->blksz);
 			data_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
 			if (!data_buffer) {
 				ret = -ENOMEM;
 				goto out;
@@ -1540,105 +1747,46 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 				 * image with mksquashfs's -b <block_size> option.
 				 */
 				printf("Error: too many data blocks to be read.\n");
+				free(data_buffer);
 				goto out;
 			}
 
 			data = data_buffer + table_offset;
-		}
-
-		/* Load the data */
-		if (finfo.blk_sizes[j] == 0) {
-			/* This is a sparse block */
-			sparse_size = get_unaligned_le32(&sblk->block_size);
-			if ((*actread + sparse_size) > len)
-				sparse_size = len - *actread;
-			memset(buf + *actread, 0, sparse_size);
-			*actread += sparse_size;
-		} else if (SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
-			dest_len = get_unaligned_le32(&sblk->block_size);
-			ret = sqfs_decompress(&ctxt, datablock, &dest_len,
-					      data, table_size);
-			if (ret)
-				goto out;
-
-			if ((*actread + dest_len) > len)
-				dest_len = len - *actread;
-			memcpy(buf + *actread, datablock, dest_len);
-			*actread += dest_len;
-		} else {
 			if ((*actread + table_size) > len)
 				table_size = len - *actread;
 			memcpy(buf + *actread, data, table_size);
 			*actread += table_size;
+			free(data_buffer);
 		}
 
-		data_offset += table_size;
-		free(data_buffer);
+		data_offset += SQFS_BLOCK_SIZE(finfo.blk_sizes[j]);
 		if (*actread >= len)
 			break;
 	}
+	ret = 0;
 
 	/*
 	 * There is no need to continue if the file is not fragmented.
 	 */
-	if (!finfo.frag) {
-		ret = 0;
-		goto out;
-	}
-
-	start = lldiv(frag_entry.start, ctxt.cur_dev->blksz);
-	table_size = SQFS_BLOCK_SIZE(frag_entry.size);
-	table_offset = frag_entry.start - (start * ctxt.cur_dev->blksz);
-	n_blks = DIV_ROUND_UP(table_size + table_offset, ctxt.cur_dev->blksz);
-
-	if (__builtin_mul_overflow(n_blks, ctxt.cur_dev->blksz, &buf_size)) {
-		ret = -EINVAL;
+	if (!finfo.frag || *actread >= len)
 		goto out;
-	}
 
-	fragment = malloc_cache_aligned(buf_size);
-
-	if (!fragment) {
-		ret = -ENOMEM;
+	/* Small files share a fragment block, so it is likely to be cached */
+	ret = sqfs_get_block(frag_entry.start, frag_entry.size,
+			     &fragment_block, &dest_len);
+	if (ret)
 		goto out;
-	}
 
-	ret = sqfs_disk_read(start, n_blks, fragment);
-	if (ret < 0)
+	if (finfo.offset > dest_len ||
+	    finfo.size - *actread > dest_len - finfo.offset) {
+		ret = -EINVAL;
 		goto out;
-
-	/* File compressed and fragmented */
-	if (finfo.frag && finfo.comp) {
-		dest_len = get_unaligned_le32(&sblk->block_size);
-		fragment_block = malloc(dest_len);
-		if (!fragment_block) {
-			ret = -ENOMEM;
-			goto out;
-		}
-
-		ret = sqfs_decompress(&ctxt, fragment_block, &dest_len,
-				      (void *)fragment  + table_offset,
-				      frag_entry.size);
-		if (ret) {
-			free(fragment_block);
-			goto out;
-		}
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
-
-		free(fragment_block);
-
-	} else if (finfo.frag && !finfo.comp) {
-		fragment_block = (void *)fragment + table_offset;
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
 	}
+	memcpy(buf + *actread, &fragment_block[finfo.offset],
+	       finfo.size - *actread);
+	*actread = finfo.size;
 
 out:
-	free(fragment);
-	free(datablock);
 	free(file);
 	free(dir);
 	free(finfo.blk_sizes);
@@ -1817,8 +1965,7 @@ void sqfs_closedir(struct fs_dir_stream *dirs)
 		return;
 
 	sqfs_dirs = (struct squashfs_dir_stream *)dirs;
-	free(sqfs_dirs->inode_table);
-	free(sqfs_dirs->dir_table);
+	sqfs_put_tables(sqfs_dirs->tables);
 	free(sqfs_dirs->dir_header);
 	free(sqfs_dirs);
 }
@@ -247,6 +247,21 @@ struct squashfs_fragment_block_entry {
 	u32 _unused;
 };
 
+/*
+ * Decompressed inode and directory tables. These are kept between calls and
+ * shared by directory streams, so that looking up each path does not
+ * decompress them again. 'refs' counts the streams using them, plus one
+ * while they are cached.
+ */
+struct squashfs_tables {
+	int refs;
+	unsigned char *inode_table;
+	unsigned char *dir_table;
+	/* Positions of the directory table's metadata blocks */
+	u32 *pos_list;
+	int metablks_count;
+};
+
 struct squashfs_dir_stream {
 	struct fs_dir_stream fs_dirs;
 	struct fs_dirent dentp;
@@ -272,8 +287,9 @@ struct squashfs_dir_stream {
 	struct squashfs_ldir_inode i_ldir;
 	/*
 	 * References to the tables' beginnings. They are assigned in
-	 * sqfs_opendir() and freed in sqfs_closedir().
+	 * sqfs_opendir() and released in sqfs_closedir().
 	 */
+	struct squashfs_tables *tables;
 	unsigned char *inode_table;
 	unsigned char *dir_table;
 };
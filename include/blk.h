@@ -10,6 +10,7 @@
 #include <bouncebuf.h>
 #include <dm/uclass-id.h>
 #include <efi.h>
+#include <linux/list.h>
 
 #ifdef CONFIG_SYS_64BIT_LBA
 typedef uint64_t lbaint_t;
@@ -76,6 +77,12 @@ struct blk_desc {
 	char		product[BLK_PRD_SIZE + 1]; /* device product number */
 	char		revision[BLK_REV_SIZE + 1]; /* firmware revision */
 	enum sig_type	sig_type;	/* Partition table signature type */
+	/*
+	 * Changed on each write or erase, or when the device or its partition
+	 * table is (re)initialised, so that caches can check it. See
+	 * blk_mark_changed()
+	 */
+	unsigned int	write_gen;
 	union {
 		uint32_t mbr_sig;	/* MBR integer signature */
 		efi_guid_t guid_sig;	/* GPT GUID Signature */
@@ -124,6 +131,35 @@ int blkcache_read(int iftype, int dev,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer);
 
+/**
+ * blkcache_readahead() - decide whether to read ahead after a cache miss
+ *
+ * This should be called after blkcache_read() reports a miss. If the device
+ * is being read sequentially, it returns the number of blocks to read after
+ * the requested ones. The caller should then read the combined range and pass
+ * all of it to blkcache_fill(), which caches it as a single entry.
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number of the read
+ * @param blkcnt - number of blocks requested
+ *
+ * Return: number of extra blocks to read, 0 for none
+ */
+lbaint_t blkcache_readahead(int iftype, int dev, lbaint_t start,
+			    lbaint_t blkcnt);
+
+/**
+ * blkcache_readahead_cancel() - report that a read-ahead could not be done
+ *
+ * This should be called when the read suggested by blkcache_readahead() is
+ * not made or fails, so that the read-ahead is forgotten.
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ */
+void blkcache_readahead_cancel(int iftype, int dev);
+
 /**
  * blkcache_fill() - make data read from a block device available
  * to the block cache
@@ -157,24 +193,58 @@ void blkcache_invalidate(int iftype, int dev);
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
+/**
+ * blkcache_configure_size() - configure block cache memory and read-ahead
+ *
+ * @param max_size - maximum number of bytes of data held in the cache
+ * @param max_readahead - maximum number of blocks to read ahead, 0 to disable
+ */
+void blkcache_configure_size(unsigned long max_size, unsigned max_readahead);
+
 /*
  * statistics of the block cache
  */
 struct block_cache_stats {
 	unsigned hits;
 	unsigned misses;
+	unsigned readaheads; /* number of read-ahead entries filled */
 	unsigned entries; /* current entry count */
+	unsigned long size; /* current number of bytes cached */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
+	unsigned long max_size;
+	unsigned max_readahead; /* in blocks */
+};
+
+/*
+ * per-device statistics of the block cache
+ */
+struct block_cache_dev_stats {
+	int iftype;
+	int devnum;
+	unsigned hits;
+	unsigned misses;
+	unsigned readaheads;
 };
 
 /**
  * get_blkcache_stats() - return statistics and reset
  *
+ * The per-device statistics are reset as well.
+ *
  * @param stats - statistics are copied here
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_dev_stats() - return statistics for a device
+ *
+ * @param seq - index of the device to return (0 for first)
+ * @param stats - statistics are copied here
+ * Return: 0 if OK, -ENOENT if there is no device with that index
+ */
+int blkcache_dev_stats(int seq, struct block_cache_dev_stats *stats);
+
 /** blkcache_free() - free all memory allocated to the block cache */
 void blkcache_free(void);
 
@@ -187,6 +257,14 @@ static inline int blkcache_read(int iftype, int dev,
 	return 0;
 }
 
+static inline lbaint_t blkcache_readahead(int iftype, int dev,
+					  lbaint_t start, lbaint_t blkcnt)
+{
+	return 0;
+}
+
+static inline void blkcache_readahead_cancel(int iftype, int dev) {}
+
 static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
@@ -197,8 +275,79 @@ static inline void blkcache_free(void) {}
 
 #endif
 
+/**
+ * blk_mark_changed() - Record that the contents of a block device may change
+ *
+ * This gives @desc a value of write_gen which no block device has used
+ * before, so that caches keyed on the device and its write_gen discard what
+ * they hold, even if @desc has been reused for a different device.
+ *
+ * @desc: Block device descriptor
+ */
+void blk_mark_changed(struct blk_desc *desc);
+
 struct udevice;
 
+/**
+ * enum blk_req_op - Operation carried out by a queued block request
+ *
+ * @BLK_REQ_READ: Read blocks from the device into the buffer
+ * @BLK_REQ_WRITE: Write blocks from the buffer to the device
+ */
+enum blk_req_op {
+	BLK_REQ_READ,
+	BLK_REQ_WRITE,
+};
+
+/**
+ * struct blk_req - A queued (asynchronous) block request
+ *
+ * Requests are allocated by the caller, set up with blk_req_init() and passed
+ * to blk_submit(). The request must remain valid until it has completed, i.e.
+ * until @done is set by the driver, typically from within blk_poll().
+ *
+ * @op:		Operation to perform
+ * @start:	Start block number (0=first)
+ * @blkcnt:	Number of blocks to transfer
+ * @buffer:	Destination buffer for reads, or source buffer for writes
+ * @result:	Number of blocks transferred, or -ve error number, once @done
+ *		is set
+ * @done:	true once the request has completed
+ * @priv:	Private data for use by the driver while the request is in
+ *		flight, e.g. the command slot used for the request
+ * @sibling:	Node in the per-device list of in-flight requests
+ */
+struct blk_req {
+	enum blk_req_op op;
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+	long result;
+	bool done;
+	void *priv;
+	struct list_head sibling;
+};
+
+/**
+ * struct blk_queue - Per-device request queue
+ *
+ * This is the uclass-private data for block devices. Drivers which implement
+ * the submit() and poll() methods describe the capabilities of their queue
+ * with blk_queue_setup() when they are probed.
+ *
+ * @reqs:	List of in-flight requests (struct blk_req)
+ * @count:	Number of requests in @reqs
+ * @depth:	Maximum number of requests which may be in flight at once
+ * @max_blks:	Maximum number of blocks per request when splitting a large
+ *		read, or 0 for no limit
+ */
+struct blk_queue {
+	struct list_head reqs;
+	uint count;
+	uint depth;
+	lbaint_t max_blks;
+};
+
 /* Operations on block devices */
 struct blk_ops {
 	/**
@@ -258,6 +407,35 @@ struct blk_ops {
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/**
+	 * submit() - queue a request without waiting for it to complete
+	 *
+	 * The driver starts the transfer (or queues it in hardware) and
+	 * returns. Completion is reported by setting @req->result and then
+	 * @req->done from within poll().
+	 *
+	 * @dev:	Block device to use
+	 * @req:	Request to queue
+	 * @return 0 if queued, -EBUSY if the device has no free slot, other
+	 * -ve on error
+	 */
+	int (*submit)(struct udevice *dev, struct blk_req *req);
+
+	/**
+	 * poll() - check for completed requests
+	 *
+	 * This must not block waiting for a request to complete, but it may
+	 * report a timeout for a request which has been in flight for too
+	 * long.
+	 *
+	 * @dev:	Block device to check
+	 * @return number of requests completed by this call, or -ve on a
+	 * device error, in which case all in-flight requests are failed
+	 */
+	int (*poll)(struct udevice *dev);
+#endif	/* BLK_ASYNC */
+
 #if IS_ENABLED(CONFIG_BOUNCE_BUFFER)
 	/**
 	 * buffer_aligned() - test memory alignment of block operation buffer
@@ -331,6 +509,77 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
  */
 long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt);
 
+/**
+ * blk_req_init() - Set up a queued block request
+ *
+ * @req: Request to set up
+ * @op: Operation to perform
+ * @start: Start block for the transfer
+ * @blkcnt: Number of blocks to transfer
+ * @buffer: Buffer to transfer into / out of
+ */
+static inline void blk_req_init(struct blk_req *req, enum blk_req_op op,
+				lbaint_t start, lbaint_t blkcnt, void *buffer)
+{
+	req->op = op;
+	req->start = start;
+	req->blkcnt = blkcnt;
+	req->buffer = buffer;
+	req->result = 0;
+	req->done = false;
+	req->priv = NULL;
+}
+
+/**
+ * blk_submit() - Queue a request on a block device
+ *
+ * If the driver supports queued requests, this returns as soon as the request
+ * has been handed to the driver, waiting only for a free slot if the device
+ * queue is full. Otherwise the request is carried out synchronously and is
+ * complete on return.
+ *
+ * Data read this way bypasses the block cache. Writes invalidate it.
+ *
+ * @dev: Block device to use
+ * @req: Request to submit, set up with blk_req_init()
+ * Return: 0 if the request was accepted, -ve on error
+ */
+int blk_submit(struct udevice *dev, struct blk_req *req);
+
+/**
+ * blk_poll() - Check for completion of queued requests
+ *
+ * @dev: Block device to check
+ * Return: number of requests which completed, or -ve on error
+ */
+int blk_poll(struct udevice *dev);
+
+/**
+ * blk_wait() - Wait for a queued request to complete
+ *
+ * Other requests on the device may complete while waiting. Other uthreads are
+ * scheduled while the device is busy.
+ *
+ * @dev: Block device to which @req was submitted
+ * @req: Request to wait for
+ * Return: 0 if the request completed successfully, -ve on error
+ */
+int blk_wait(struct udevice *dev, struct blk_req *req);
+
+/**
+ * blk_queue_setup() - Describe the request queue of a block device
+ *
+ * This should be called by drivers which implement the submit() and poll()
+ * methods, typically from their probe() method. blk_read() then splits large
+ * reads into requests of at most @max_blks blocks, keeping up to @depth of
+ * them in flight at once.
+ *
+ * @dev: Block device to set up
+ * @depth: Number of requests the device can have in flight
+ * @max_blks: Maximum number of blocks in each request, 0 for no limit
+ */
+void blk_queue_setup(struct udevice *dev, uint depth, lbaint_t max_blks);
+
 /**
  * blk_find_device() - Find a block device
  *
@@ -549,6 +798,7 @@ static inline ulong blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 			       lbaint_t blkcnt, const void *buffer)
 {
 	blkcache_invalidate(block_dev->uclass_id, block_dev->devnum);
+	blk_mark_changed(block_dev);
 	return block_dev->block_write(block_dev, start, blkcnt, buffer);
 }
 
@@ -556,6 +806,7 @@ static inline ulong blk_derase(struct blk_desc *block_dev, lbaint_t start,
 			       lbaint_t blkcnt)
 {
 	blkcache_invalidate(block_dev->uclass_id, block_dev->devnum);
+	blk_mark_changed(block_dev);
 	return block_dev->block_erase(block_dev, start, blkcnt);
 }
 
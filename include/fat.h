@@ -24,7 +24,12 @@ struct disk_partition;
 #define DIRENTSPERCLUST	((mydata->clust_size * mydata->sect_size) / \
 			 sizeof(dir_entry))
 
-#define FATBUFBLOCKS	6
+/*
+ * The FAT buffer is a multiple of this many sectors, so that a FAT12 entry is
+ * never split across two buffers
+ */
+#define FATBUF_MIN_BLOCKS	6
+#define FATBUFBLOCKS	(mydata->fatbufblocks)
 #define FATBUFSIZE	(mydata->sect_size * FATBUFBLOCKS)
 #define FAT12BUFSIZE	((FATBUFSIZE*2)/3)
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
@@ -173,10 +178,12 @@ typedef struct {
 	__u16	clust_size;	/* Size of clusters in sectors */
 	int	data_begin;	/* The sector of the first cluster, can be negative */
 	int	fatbufnum;	/* Used by get_fatent, init to -1 */
+	int	fatbufblocks;	/* Size of fatbuf in sectors */
 	int	rootdir_size;	/* Size of root dir for non-FAT32 */
 	__u32	root_cluster;	/* First cluster of root dir for FAT32 */
 	u32	total_sect;	/* Number of sectors */
 	int	fats;		/* Number of FATs */
+	u32	volume_id;	/* Volume serial number */
 } fsdata;
 
 struct fat_itr;
@@ -111,6 +111,17 @@ int fs_get_type(void);
  */
 const char *fs_get_type_name(void);
 
+/**
+ * fs_dcache_get_hits() - Get the number of lookups answered from the cache
+ *
+ * This counts the calls to fs_exists() and fs_size() which were answered
+ * without asking the filesystem, since U-Boot started. It is intended for
+ * tests.
+ *
+ * Return: number of cache hits
+ */
+uint fs_dcache_get_hits(void);
+
 /*
  * Print the list of files on the partition previously set by fs_set_blk_dev(),
  * in directory "dirname".
@@ -26,6 +26,16 @@ struct sparse_storage {
 				 lbaint_t blk,
 				 lbaint_t blkcnt);
 
+	/*
+	 * Optional: set blocks to a repeated 32-bit value without being given
+	 * the data, e.g. by erasing. Return the number of blocks used, or
+	 * -ENOSYS if the value cannot be handled this way
+	 */
+	lbaint_t	(*fill)(struct sparse_storage *info,
+				lbaint_t blk,
+				lbaint_t blkcnt,
+				u32 fill_val);
+
 	void		(*mssg)(const char *str, char *response);
 };
 
@@ -369,6 +369,7 @@ struct bootm_headers {
 	void		*fit_hdr_os;	/* os FIT image header */
 	const char	*fit_uname_os;	/* os subimage node unit name */
 	int		fit_noffset_os;	/* os subimage node offset */
+	bool		fit_os_decomp;	/* os decompressed while being read */
 
 	void		*fit_hdr_rd;	/* init ramdisk FIT image header */
 	const char	*fit_uname_rd;	/* init ramdisk subimage node unit name */
@@ -1014,6 +1015,67 @@ int image_decomp(int comp, ulong load, ulong image_start, int type,
 		 void *load_buf, void *image_buf, ulong image_len,
 		 uint unc_len, ulong *load_end);
 
+/**
+ * struct image_decomp_stream - Decompression of an image as it arrives
+ *
+ * The compressed data arrives in order in a single buffer. As much of it as
+ * possible is decompressed each time more is present.
+ *
+ * @comp:	Compression algorithm (IH_COMP_...)
+ * @src:	Compressed data
+ * @dst:	Destination for the uncompressed data
+ * @dst_size:	Size of @dst
+ * @used:	Number of bytes of @src used so far
+ * @out_len:	Number of bytes written to @dst so far
+ * @workspace:	Memory allocated for the decompressor, or NULL
+ * @priv:	Decompressor state
+ */
+struct image_decomp_stream {
+	int comp;
+	const void *src;
+	void *dst;
+	ulong dst_size;
+	ulong used;
+	ulong out_len;
+	void *workspace;
+	void *priv;
+};
+
+/**
+ * image_decomp_stream_start() - Set up to decompress an image as it arrives
+ *
+ * Only gzip, LZ4 and Zstandard are supported, if enabled
+ *
+ * @ds:		Stream state to set up
+ * @comp:	Compression algorithm (IH_COMP_...)
+ * @src:	Compressed data, which need not be present yet
+ * @dst:	Destination for the uncompressed data
+ * @dst_size:	Size of @dst
+ * Return: 0 if OK, -EPROTONOSUPPORT if @comp is not supported, -ENOMEM if
+ * out of memory
+ */
+int image_decomp_stream_start(struct image_decomp_stream *ds, int comp,
+			      const void *src, void *dst, ulong dst_size);
+
+/**
+ * image_decomp_stream_run() - Decompress as much of an image as possible
+ *
+ * @ds:		Stream state
+ * @avail:	Number of bytes of compressed data now present
+ * @last:	true if all the compressed data is present
+ * Return: 0 if decompression is complete, -EAGAIN if more data is needed,
+ * -ENOSPC if @ds->dst is too small, other -ve on error
+ */
+int image_decomp_stream_run(struct image_decomp_stream *ds, ulong avail,
+			    bool last);
+
+/**
+ * image_decomp_stream_end() - Free the decompressor state
+ *
+ * @ds:		Stream state
+ */
+void image_decomp_stream_end(struct image_decomp_stream *ds);
+
 /**
  * Set up properties in the FDT
  *
@@ -1355,6 +1417,153 @@ static inline int fit_config_verify(const void *fit, int conf_noffset)
 }
 #endif
 int fit_all_image_verify(const void *fit);
+
+/* Maximum number of hash nodes per image which can be hashed while reading */
+#define FIT_HASH_STREAM_MAX	4
+
+/**
+ * struct fit_hash_ctx - Progressive hash of image data for a hash node
+ *
+ * @noffset:	Offset of the hash node
+ * @digest_size: Size of the hash value in bytes
+ * @algo:	Hash algorithm, if the hash uclass is not used
+ * @dev:	Hash device, if the hash uclass is used
+ * @dm_algo:	Hash algorithm (enum HASH_ALGO) for @dev
+ * @ctx:	Hash context, or NULL if hashing failed
+ */
+struct fit_hash_ctx {
+	int noffset;
+	int digest_size;
+	struct hash_algo *algo;
+	struct udevice *dev;
+	int dm_algo;
+	void *ctx;
+};
+
+/**
+ * struct fit_hash_stream - Hashes of an image calculated as it is read
+ *
+ * @fit:	FIT containing the image
+ * @count:	Number of hashes being calculated
+ * @ctx:	Hash for each hash node of the image
+ */
+struct fit_hash_stream {
+	const void *fit;
+	int count;
+	struct fit_hash_ctx ctx[FIT_HASH_STREAM_MAX];
+};
+
+/**
+ * fit_image_hash_stream_start() - Start hashing an image while it is read
+ *
+ * The image is then passed in pieces, in order, to
+ * fit_image_hash_stream_update(). Hash nodes which cannot be handled this
+ * way are hashed as normal when the image is verified.
+ *
+ * @hs:		Stream state to set up
+ * @fit:	FIT containing the image
+ * @image_noffset: Offset of the image node
+ * Return: number of hash nodes being calculated
+ */
+int fit_image_hash_stream_start(struct fit_hash_stream *hs, const void *fit,
+				int image_noffset);
+
+/**
+ * fit_image_hash_stream_update() - Hash the next part of an image
+ *
+ * @hs:		Stream state
+ * @buf:	Image data which has just been read
+ * @len:	Length of data
+ */
+void fit_image_hash_stream_update(struct fit_hash_stream *hs, const void *buf,
+				  size_t len);
+
+/**
+ * fit_image_hash_stream_finish() - Finish hashing an image
+ *
+ * This records the hashes for use by fit_image_verify_with_data()
+ *
+ * @hs:		Stream state
+ * @data:	Image data, as it will be passed for verification, or NULL to
+ *		discard the hashes
+ * @size:	Size of image data
+ */
+void fit_image_hash_stream_finish(struct fit_hash_stream *hs,
+				  const void *data, size_t size);
+
+#if CONFIG_IS_ENABLED(FIT_HASH_CACHE)
+/**
+ * fit_image_hash_lookup() - Look up a hash calculated ahead of verification
+ *
+ * @fit:	FIT containing the hash node
+ * @noffset:	Offset of the hash node
+ * @data:	Image data being verified
+ * @size:	Size of image data
+ * @value:	Returns the hash value (FIT_MAX_HASH_LEN bytes)
+ * @value_len:	Returns the length of the hash value
+ * Return: 0 if found, -ENOENT if the hash must be calculated
+ */
+int fit_image_hash_lookup(const void *fit, int noffset, const void *data,
+			  size_t size, uint8_t *value, int *value_len);
+
+/**
+ * fit_image_hash_clear() - Drop all hashes calculated ahead of verification
+ *
+ * This must be called once the images have been verified, since the image
+ * data may change afterwards.
+ */
+void fit_image_hash_clear(void);
+
+#else
+static inline int fit_image_hash_lookup(const void *fit, int noffset,
+					const void *data, size_t size,
+					uint8_t *value, int *value_len)
+{
+	return -ENOENT;
+}
+
+static inline void fit_image_hash_clear(void)
+{
+}
+#endif
+
+/**
+ * struct fit_loader - Reads the external data of a FIT on demand
+ *
+ * This allows a FIT with external data to be booted after reading just its
+ * header (the FDT part) into memory. fit_image_load() then reads each image
+ * as it is needed, straight to its load address where possible, and checks
+ * its hashes as the data arrives.
+ *
+ * @read:	Read part of the FIT file
+ *		@ldr: Loader
+ *		@offset: Offset within the FIT file
+ *		@size: Number of bytes to read
+ *		@buf: Buffer to read into
+ *		Return: 0 if OK, -ve on error
+ * @priv:	Private data for @read
+ * @addr:	Address of the FIT header in memory
+ * @hdr_crc:	CRC32 of the FIT header, set by fit_set_loader()
+ */
+struct fit_loader {
+	int (*read)(struct fit_loader *ldr, ulong offset, ulong size,
+		    void *buf);
+	void *priv;
+	ulong addr;
+	u32 hdr_crc;
+};
+
+/**
+ * fit_set_loader() - Set the loader for a FIT whose data is not in memory
+ *
+ * The loader is used for images in the FIT at @ldr->addr, for as long as the
+ * header there is unchanged. This needs CONFIG_FIT_EXTERNAL_LOAD
+ *
+ * @ldr:	Loader, whose FIT header must already be in memory, or NULL to
+ *		read all image data from memory
+ */
+void fit_set_loader(struct fit_loader *ldr);
+
 int fit_config_decrypt(const void *fit, int conf_noffset);
 int fit_image_check_os(const void *fit, int noffset, uint8_t os);
 int fit_image_check_arch(const void *fit, int noffset, uint8_t arch);
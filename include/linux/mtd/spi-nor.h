@@ -290,6 +290,8 @@ static inline u8 spi_nor_get_protocol_width(enum spi_nor_protocol proto)
 }
 
 #define SPI_NOR_MAX_CMD_SIZE	8
+/* Four commands of two DWORDs each, see JESD216C */
+#define SPI_NOR_OCTAL_DTR_SEQ_DWORDS	8
 enum spi_nor_ops {
 	SPI_NOR_OPS_READ = 0,
 	SPI_NOR_OPS_WRITE,
@@ -532,6 +534,8 @@ struct spi_flash {
  * @reg_proto		the SPI protocol for read_reg/write_reg/erase operations
  * @cmd_buf:		used by the write_reg
  * @cmd_ext_type:	the command opcode extension for DTR mode.
+ * @octal_dtr_seq:	commands that switch the flash to 8D-8D-8D mode, as read
+ *			from SFDP
  * @fixups:		flash-specific fixup hooks.
  * @prepare:		[OPTIONAL] do some preparations for the
  *			read/write/erase/lock/unlock operations
@@ -582,6 +586,9 @@ struct spi_nor {
 	u32			flags;
 	u8			cmd_buf[SPI_NOR_MAX_CMD_SIZE];
 	enum spi_nor_cmd_ext	cmd_ext_type;
+#if CONFIG_IS_ENABLED(SPI_FLASH_SFDP_SUPPORT)
+	u32			octal_dtr_seq[SPI_NOR_OCTAL_DTR_SEQ_DWORDS];
+#endif
 	struct spi_nor_fixups	*fixups;
 
 	int (*setup)(struct spi_nor *nor, const struct flash_info *info,
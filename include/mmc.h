@@ -67,6 +67,7 @@ struct bd_info;
 #define MMC_CAP_NONREMOVABLE	BIT(14)
 #define MMC_CAP_NEEDS_POLL	BIT(15)
 #define MMC_CAP_CD_ACTIVE_HIGH  BIT(16)
+#define MMC_CAP_CQE		BIT(17)	/* host has a command queue engine */
 
 #define MMC_MODE_8BIT		BIT(30)
 #define MMC_MODE_4BIT		BIT(29)
@@ -209,6 +210,7 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 /*
  * EXT_CSD fields
  */
+#define EXT_CSD_CMDQ_MODE_EN		15	/* R/W */
 #define EXT_CSD_BOOT_SIZE_MULT_MICRON	125	/* R/W, vendor specific field */
 #define EXT_CSD_ENH_START_ADDR		136	/* R/W */
 #define EXT_CSD_ENH_SIZE_MULT		140	/* R/W */
@@ -240,6 +242,8 @@ static inline bool mmc_is_tuning_cmd(uint cmdidx)
 #define EXT_CSD_BOOT_MULT		226	/* RO */
 #define EXT_CSD_SEC_FEATURE		231	/* RO */
 #define EXT_CSD_GENERIC_CMD6_TIME       248     /* RO */
+#define EXT_CSD_CMDQ_DEPTH		307	/* RO */
+#define EXT_CSD_CMDQ_SUPPORT		308	/* RO */
 #define EXT_CSD_BKOPS_SUPPORT		502	/* RO */
 
 /*
@@ -573,6 +577,44 @@ struct dm_mmc_ops {
 	 * @return 0 if success, -ve on error
 	 */
 	int (*hs400_prepare_ddr)(struct udevice *dev);
+
+#if CONFIG_IS_ENABLED(MMC_CQE)
+	/**
+	 * cqe_read() - Read blocks through the command queue engine
+	 *
+	 * The card is already in command queue mode. The host queues the
+	 * read as one or more tasks, waits for all of them and leaves its
+	 * engine disabled again, so that normal commands can follow.
+	 *
+	 * @dev:	Device to read from
+	 * @start:	First block to read
+	 * @blkcnt:	Number of blocks to read
+	 * @dst:	Destination buffer
+	 * @return 0 if OK, -ENOSYS if there is no engine, other -ve on error
+	 */
+	int (*cqe_read)(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			void *dst);
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	/**
+	 * get_tuning() - Get the result of the last tuning
+	 *
+	 * @dev:	Device to check
+	 * @tap:	Returns a host-specific value for set_tuning()
+	 * @return 0 if OK, -ENOSYS if not supported, other -ve on error
+	 */
+	int (*get_tuning)(struct udevice *dev, u32 *tap);
+
+	/**
+	 * set_tuning() - Apply a tuning result instead of tuning again
+	 *
+	 * @dev:	Device to update
+	 * @tap:	Value returned by get_tuning() for the same card and mode
+	 * @return 0 if OK, -ENOSYS if not supported, other -ve on error
+	 */
+	int (*set_tuning)(struct udevice *dev, u32 tap);
+#endif
 };
 
 #define mmc_get_ops(dev)        ((struct dm_mmc_ops *)(dev)->driver->ops)
@@ -591,6 +633,10 @@ int mmc_reinit(struct mmc *mmc);
 int mmc_get_b_max(struct mmc *mmc, void *dst, lbaint_t blkcnt);
 int mmc_hs400_prepare_ddr(struct mmc *mmc);
 int mmc_send_stop_transmission(struct mmc *mmc, bool write);
+int mmc_cqe_read(struct mmc *mmc, lbaint_t start, lbaint_t blkcnt, void *dst);
+bool mmc_cqe_supported(struct mmc *mmc);
+int mmc_get_tuning(struct mmc *mmc, u32 *tap);
+int mmc_set_tuning(struct mmc *mmc, u32 tap);
 
 #else
 struct mmc_ops {
@@ -686,6 +732,23 @@ static inline bool supports_uhs(uint caps)
 #endif
 }
 
+/**
+ * struct mmc_init_cache - Bus setup remembered from an earlier init
+ *
+ * @valid:	true if @mode and @width were cached for the current card
+ * @has_tap:	true if @tap holds a tuning result
+ * @mode:	Bus mode
+ * @width:	Bus width capability (MMC_MODE_1BIT, _4BIT or _8BIT)
+ * @tap:	Host-specific tuning value, see get_tuning() in dm_mmc_ops
+ */
+struct mmc_init_cache {
+	bool valid;
+	bool has_tap;
+	enum bus_mode mode;
+	uint width;
+	u32 tap;
+};
+
 /*
  * With CONFIG_DM_MMC enabled, struct mmc can be accessed from the MMC device
  * with mmc_get_mmc_dev().
@@ -721,6 +784,9 @@ struct mmc {
 	u8 part_config;
 	u8 gen_cmd6_time;	/* units: 10 ms */
 	u8 part_switch_time;	/* units: 10 ms */
+#if CONFIG_IS_ENABLED(MMC_CQE)
+	u8 cmdq_depth;		/* 0 if command queueing is not supported */
+#endif
 	uint tran_speed;
 	uint legacy_speed; /* speed for the legacy mode provided by the card */
 	uint read_bl_len;
@@ -775,6 +841,9 @@ struct mmc {
 	bool hs400_tuning:1;
 
 	enum bus_mode user_speed_mode; /* input speed mode from user */
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+	struct mmc_init_cache init_cache;	/* last working bus setup */
+#endif
 
 	/*
 	 * If CONFIG_CYCLIC is not set, struct cyclic_info is
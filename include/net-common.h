@@ -267,6 +267,19 @@ enum eth_recv_flags {
 	ETH_RECV_CHECK_DEVICE		= 1 << 0,
 };
 
+/**
+ * struct eth_rx_pkt - A received packet returned by the recv_batch() method
+ *
+ * @packet: Packet buffer
+ * @length: Length of packet in bytes, 0 if it should be dropped
+ * @csum_ok: true if the device has checked the UDP or TCP checksum
+ */
+struct eth_rx_pkt {
+	uchar *packet;
+	int length;
+	bool csum_ok;
+};
+
 /**
  * struct eth_ops - functions of Ethernet MAC controllers
  *
@@ -277,6 +290,14 @@ enum eth_recv_flags {
  *	 indicate that the hardware receive FIFO is empty. If 0 is returned, the
  *	 network stack will not process the empty packet, but free_pkt() will be
  *	 called if supplied
+ * recv_batch: Like recv, but return up to max packets already received by
+ *	       the hardware in one call, filling in pkts. Return the number of
+ *	       packets, 0 if there are none or an error, or -ENOSYS to have
+ *	       recv() used instead. free_pkt() is called for each packet, in
+ *	       order, once all of them have been processed. If a packet causes
+ *	       the device to be stopped, the rest of the batch is neither
+ *	       processed nor freed. Used instead of recv() if supplied -
+ *	       optional
  * free_pkt: Give the driver an opportunity to manage its packet buffer memory
  *	     when the network stack is finished processing it. This will only be
  *	     called when no error was returned from recv - optional
@@ -301,6 +322,8 @@ struct eth_ops {
 	int (*start)(struct udevice *dev);
 	int (*send)(struct udevice *dev, void *packet, int length);
 	int (*recv)(struct udevice *dev, int flags, uchar **packetp);
+	int (*recv_batch)(struct udevice *dev, int flags,
+			  struct eth_rx_pkt *pkts, int max);
 	int (*free_pkt)(struct udevice *dev, uchar *packet, int length);
 	void (*stop)(struct udevice *dev);
 	int (*mcast)(struct udevice *dev, const u8 *enetaddr, int join);
@@ -467,6 +490,12 @@ void copy_filename(char *dst, const char *src, int size);
 /* Processes a received packet */
 void net_process_received_packet(uchar *in_packet, int len);
 
+/*
+ * true while processing a packet whose UDP or TCP checksum has already been
+ * checked by the device, so that it need not be checked again
+ */
+extern bool net_rx_csum_ok;
+
 /**
  * update_tftp - Update firmware over TFTP (via DFU)
  *
@@ -87,6 +87,8 @@ struct ip_tcp_hdr {
 #define TCP_OPT_LEN_A	0x0a		/* Timestamp Length		*/
 #define TCP_MSS		1460		/* Max segment size		*/
 #define TCP_SCALE	0x01		/* Scale			*/
+#define TCP_MAX_SCALE	14		/* Largest window scale, RFC 7323 */
+#define TCP_MAX_WIN	0xffff		/* Largest unscaled window	*/
 
 /**
  * struct tcp_mss - TCP option structure for MSS (Max segment size)
@@ -142,7 +144,13 @@ struct sack_edges {
  * from the "hills" or packets received.
  */
 
-#define TCP_SACK_HILLS	4
+#define TCP_SACK_HILLS	8
+
+/*
+ * With the timestamp option there is only room for three SACK blocks in
+ * the TCP header
+ */
+#define TCP_SACK_BLOCKS	3
 
 /**
  * struct tcp_sack_v - TCP option structure for SACK
@@ -352,14 +360,25 @@ enum tcp_status {
  *
  * @irs:		Initial receive sequence number
  * @rcv_nxt:		Receive next
- * @rcv_wnd:		Receive window (in bytes)
+ * @rcv_wnd:		Receive window (in bytes). The on_create() callback may
+ *			  enlarge it if rx() can accept data far ahead of
+ *			  rcv_nxt
  *
  * @loc_timestamp:	Local timestamp
  * @rmt_timestamp:	Remote timestamp
  *
+ * @loc_win_scale:	Local window scale factor, applied to the receive
+ *			  window we advertise
  * @rmt_win_scale:	Remote window scale factor
+ * @win_scale_ok:	Non-zero if the remote side offered window scaling
+ * @sack_ok:		Non-zero if the remote side permits SACK
  *
  * @lost:		Used for SACK
+ * @sack_recent:	Sequence number of the most recent out-of-order
+ *			  segment, whose block is reported first
+ *
+ * @ack_pending:	Number of received segments not yet acknowledged
+ * @ack_time:		Arrival time of the first unacknowledged segment
  *
  * @retry_cnt:		Number of retry attempts remaining. Only SYN, FIN
  *			  or DATA segments are tried to retransmit.
@@ -419,10 +438,18 @@ struct tcp_stream {
 	u32		rmt_timestamp;
 
 	/* TCP window scale */
+	u8		loc_win_scale;
 	u8		rmt_win_scale;
+	int		win_scale_ok;
+	int		sack_ok;
 
 	/* TCP sliding window control used to request re-TX */
 	struct tcp_sack_v lost;
+	u32		sack_recent;
+
+	/* delayed acknowledgment */
+	int		ack_pending;
+	ulong		ack_time;
 
 	/* used for data retransmission */
 	int		retry_cnt;
@@ -520,5 +547,10 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 
 void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int len);
 
+/* Option and SACK handling, also used by the tests */
+void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len);
+void tcp_parse_options(struct tcp_stream *tcp, uchar *o, int o_len, bool syn);
+int net_set_ack_options(struct tcp_stream *tcp, union tcp_build_pkt *b);
+
 u16 tcp_set_pseudo_header(uchar *pkt, struct in_addr src, struct in_addr dest,
 			  int tcp_len, int pkt_len);
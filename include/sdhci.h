@@ -125,6 +125,7 @@
 #define  SDHCI_INT_CARD_INSERT	BIT(6)
 #define  SDHCI_INT_CARD_REMOVE	BIT(7)
 #define  SDHCI_INT_CARD_INT	BIT(8)
+#define  SDHCI_INT_CQE		BIT(14)
 #define  SDHCI_INT_ERROR	BIT(15)
 #define  SDHCI_INT_TIMEOUT	BIT(16)
 #define  SDHCI_INT_CRC		BIT(17)
@@ -296,6 +297,24 @@ struct sdhci_ops {
 	 */
 	int	(*set_enhanced_strobe)(struct sdhci_host *host);
 
+	/**
+	 * get_tuning() - Get the tuning result for the current mode
+	 *
+	 * @host: SDHCI host structure
+	 * @tap: Returns the value to pass to set_tuning()
+	 * Return: 0 if successful, -ve on error
+	 */
+	int	(*get_tuning)(struct sdhci_host *host, u32 *tap);
+
+	/**
+	 * set_tuning() - Apply an earlier tuning result to the current mode
+	 *
+	 * @host: SDHCI host structure
+	 * @tap: Value returned by get_tuning()
+	 * Return: 0 if successful, -ve on error
+	 */
+	int	(*set_tuning)(struct sdhci_host *host, u32 tap);
+
 #ifdef CONFIG_MMC_SDHCI_ADMA_HELPERS
 	void	(*adma_write_desc)(struct sdhci_host *host, void **desc,
 				   dma_addr_t addr, int len, bool end);
@@ -333,6 +352,17 @@ struct sdhci_adma_desc {
 #endif
 } __packed;
 
+/**
+ * struct sdhci_adma_sg - One segment of an ADMA2 scatter list
+ *
+ * @addr: DMA address of the segment
+ * @len: Length of the segment in bytes
+ */
+struct sdhci_adma_sg {
+	dma_addr_t addr;
+	uint len;
+};
+
 struct sdhci_host {
 	const char *name;
 	void *ioaddr;
@@ -365,6 +395,11 @@ struct sdhci_host {
 #if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
 	struct sdhci_adma_desc *adma_desc_table;
 #endif
+#if CONFIG_IS_ENABLED(MMC_SDHCI_CQHCI)
+	void *cqe_ioaddr;	/* CQHCI registers, NULL if not present */
+	void *cqe_desc;		/* Task and transfer descriptor lists */
+	dma_addr_t cqe_desc_addr;
+#endif
 };
 
 #ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
@@ -542,5 +577,27 @@ struct sdhci_adma_desc *sdhci_adma_init(void);
 void sdhci_prepare_adma_table(struct sdhci_host *host,
 			      struct sdhci_adma_desc *table,
 			      struct mmc_data *data, dma_addr_t start_addr);
+int sdhci_prepare_adma_table_sg(struct sdhci_host *host,
+				struct sdhci_adma_desc *table,
+				const struct sdhci_adma_sg *sg, int nents,
+				uint max_desc);
+
+/**
+ * sdhci_cqhci_read() - Read blocks through the command queue engine
+ *
+ * Queue the read as a series of tasks on the CQHCI block at
+ * @host->cqe_ioaddr, keeping up to @depth of them in flight, and wait for all
+ * of them to complete. The card must already be in command queue mode. The
+ * engine is halted and disabled again before returning.
+ *
+ * @host:	SDHCI host structure
+ * @depth:	Number of tasks the card accepts at once (1 to 32)
+ * @start:	First block to read, in 512-byte units
+ * @blkcnt:	Number of blocks to read
+ * @dst:	Destination buffer
+ * Return: 0 if OK, -ENOSYS if the host has no engine, other -ve on error
+ */
+int sdhci_cqhci_read(struct sdhci_host *host, uint depth, lbaint_t start,
+		     lbaint_t blkcnt, void *dst);
 
 #endif /* __SDHCI_HW_H */
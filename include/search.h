@@ -47,6 +47,12 @@ struct hsearch_data {
 	struct env_entry_node *table;
 	unsigned int size;
 	unsigned int filled;
+	/* Number of deleted slots, which still lengthen searches */
+	unsigned int deleted;
+	/* Table index of each of the 'filled' entries, in order of key */
+	unsigned int *sorted;
+	/* Set while importing into a new table, to run callbacks at the end */
+	bool hold_callbacks;
 /*
  * Callback function which will check whether the given change for variable
  * "item" to "newval" may be applied or not, and possibly apply such change.
@@ -58,7 +64,10 @@ struct hsearch_data {
 			 enum env_op, int flag);
 };
 
-/* Create a new hash table which will contain at most "nel" elements.  */
+/*
+ * Create a new hash table with room for "nel" elements. The table grows as
+ * needed when more are entered.
+ */
 int hcreate_r(size_t nel, struct hsearch_data *htab);
 
 /* Destroy current internal hash table.  */
@@ -88,6 +88,21 @@ uint32_t crc32_wd(uint32_t crc, const unsigned char *buf, uint len,
  */
 uint32_t crc32_no_comp(uint32_t crc, const unsigned char *buf, uint len);
 
+/**
+ * crc32_no_comp_generic() - Calculate the CRC32 without CPU acceleration
+ *
+ * This is the portable implementation which crc32_no_comp() falls back to
+ * when the CPU lacks CRC instructions. It is mostly useful for testing.
+ *
+ * @crc: Input crc to chain from a previous calculution (use 0 to start a new
+ *	calculation)
+ * @buf: Bytes to checksum
+ * @len: Number of bytes to checksum
+ * Return: checksum value
+ */
+uint32_t crc32_no_comp_generic(uint32_t crc, const unsigned char *buf,
+			       uint len);
+
 /**
  * crc32_wd_buf - Perform CRC32 on a buffer and return result in buffer
  *
@@ -115,7 +130,8 @@ void crc32c_init(uint32_t *crc32c_table, uint32_t pol);
  * crc32c_cal() - Perform CRC32 on a buffer given a table
  *
  * This algorithm uses the table (set up by crc32c_init() to speed up
- * processing.
+ * processing. If the table is for the Castagnoli polynomial and the CPU has
+ * CRC32C instructions, these are used instead.
  *
  * @crc: Previous crc (use 0 at start)
  * @data: Data bytes to checksum
@@ -126,4 +142,19 @@ void crc32c_init(uint32_t *crc32c_table, uint32_t pol);
 uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
 		    uint32_t *crc32c_table);
 
+/**
+ * crc32c_cal_generic() - Perform CRC32 on a buffer using only the table
+ *
+ * This is the portable implementation which crc32c_cal() falls back to when
+ * the CPU lacks CRC32C instructions. It is mostly useful for testing.
+ *
+ * @crc: Initial crc value
+ * @data: Data to checksum
+ * @length: Length of data
+ * @crc32c_table: CRC table
+ * Return: CRC value
+ */
+uint32_t crc32c_cal_generic(uint32_t crc, const char *data, int length,
+			    uint32_t *crc32c_table);
+
 #endif /* _UBOOT_CRC_H */
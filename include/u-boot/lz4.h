@@ -21,6 +21,51 @@
  */
 int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn);
 
+/**
+ * struct ulz4fn_stream - State for decompressing LZ4 data as it arrives
+ *
+ * @src: Source data, which arrives in order
+ * @dst: Destination for uncompressed data
+ * @dstn: Size of destination buffer
+ * @pos: Number of bytes of source data used so far
+ * @out: Number of bytes of uncompressed data written so far
+ * @has_block_checksum: true if each block is followed by a checksum
+ * @started: true once the frame header has been read
+ */
+struct ulz4fn_stream {
+	const void *src;
+	void *dst;
+	size_t dstn;
+	size_t pos;
+	size_t out;
+	bool has_block_checksum;
+	bool started;
+};
+
+/**
+ * ulz4fn_stream_init() - Set up to decompress LZ4 data as it arrives
+ *
+ * @s: Stream state to set up
+ * @src: Source data to decompress, which need not be present yet
+ * @dst: Destination for uncompressed data
+ * @dstn: Size of destination buffer
+ */
+void ulz4fn_stream_init(struct ulz4fn_stream *s, const void *src, void *dst,
+			size_t dstn);
+
+/**
+ * ulz4fn_stream_run() - Decompress as much of the LZ4 data as is present
+ *
+ * Each block is decompressed once all of it has arrived. This can be called
+ * again when more data is present, until the end of the frame is reached.
+ *
+ * @s: Stream state
+ * @srcn: Number of bytes of source data now present
+ * Return: 0 if the frame is complete, -EAGAIN if more data is needed, or
+ *	another error as for ulz4fn()
+ */
+int ulz4fn_stream_run(struct ulz4fn_stream *s, size_t srcn);
+
 /**
  * LZ4_decompress_safe() - Decompression protected against buffer overflow
  * @source: source address of the compressed data
@@ -37,6 +37,32 @@ void sha256_finish(sha256_context * ctx, uint8_t digest[SHA256_SUM_LEN]);
 void sha256_csum_wd(const unsigned char *input, unsigned int ilen,
 		unsigned char *output, unsigned int chunk_sz);
 
+#if !CONFIG_IS_ENABLED(MBEDTLS_LIB_CRYPTO)
+/**
+ * sha256_process() - Hash whole 64-byte blocks
+ *
+ * This may be provided by architecture code which uses CPU instructions to
+ * speed things up, in which case it falls back to sha256_process_generic() if
+ * the CPU lacks them.
+ *
+ * @ctx: Hash context
+ * @data: Data to hash
+ * @blocks: Number of 64-byte blocks in @data
+ */
+void sha256_process(sha256_context *ctx, const unsigned char *data,
+		    unsigned int blocks);
+
+/**
+ * sha256_process_generic() - Hash whole 64-byte blocks in portable C
+ *
+ * @ctx: Hash context
+ * @data: Data to hash
+ * @blocks: Number of 64-byte blocks in @data
+ */
+void sha256_process_generic(sha256_context *ctx, const unsigned char *data,
+			    unsigned int blocks);
+#endif
+
 int sha256_hmac(const unsigned char *key, int keylen,
 		const unsigned char *input, unsigned int ilen,
 		unsigned char *output);
@@ -20,6 +20,9 @@
 #include <watchdog.h>
 #endif
 #include "u-boot/zlib.h"
+#ifdef CONFIG_ARM64_CRC32
+#include <asm/system.h>
+#endif
 
 #ifdef USE_HOSTCC
 #define __efi_runtime
@@ -82,7 +85,7 @@ static void __efi_runtime make_crc_table(void)
   }
   crc_table_empty = 0;
 }
-#elif !defined(CONFIG_ARM64_CRC32)
+#else
 /* ========================================================================
  * Table of CRC-32's of all single-byte values (made by make_crc_table)
  */
@@ -180,14 +183,9 @@ const uint32_t * ZEXPORT get_crc_table()
 /* No ones complement version. JFFS2 (and other things ?)
  * don't use ones compliment in their CRC calculations.
  */
-uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
+uint32_t __efi_runtime crc32_no_comp_generic(uint32_t crc, const Bytef *buf,
+					     uInt len)
 {
-#ifdef CONFIG_ARM64_CRC32
-    crc = cpu_to_le32(crc);
-    while (len--)
-        crc = __builtin_aarch64_crc32b(crc, *buf++);
-    return le32_to_cpu(crc);
-#else
     const uint32_t *tab = crc_table;
     const uint32_t *b =(const uint32_t *)buf;
     size_t rem_len;
@@ -225,10 +223,51 @@ uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
     }
 
     return le32_to_cpu(crc);
-#endif
 }
 #undef DO_CRC
 
+#ifdef CONFIG_ARM64_CRC32
+/* -1 until the CPU has been checked, then 1 if it has the CRC32 instructions */
+static int __efi_runtime_data crc32_hw = -1;
+
+/*
+ * The CRC32 instructions are optional before ARMv8.1, so check for them the
+ * first time they are needed rather than trusting the build
+ */
+static bool __efi_runtime crc32_hw_present(void)
+{
+	if (crc32_hw < 0)
+		crc32_hw = !!(read_id_aa64isar0() & ID_AA64ISAR0_EL1_CRC32);
+
+	return crc32_hw;
+}
+
+/* Checksum eight bytes per instruction, once @buf is aligned */
+static uint32_t __efi_runtime crc32_arm64(uint32_t crc, const Bytef *buf,
+					  uInt len)
+{
+	crc = cpu_to_le32(crc);
+	for (; len && ((ulong)buf & 7); len--)
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+	for (; len >= 8; len -= 8, buf += 8)
+		crc = __builtin_aarch64_crc32x(crc, le64_to_cpu(*(const u64 *)buf));
+	while (len--)
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+
+	return le32_to_cpu(crc);
+}
+#endif
+
+uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
+{
+#ifdef CONFIG_ARM64_CRC32
+	if (crc32_hw_present())
+		return crc32_arm64(crc, buf, len);
+#endif
+
+	return crc32_no_comp_generic(crc, buf, len);
+}
+
 uint32_t __efi_runtime crc32(uint32_t crc, const Bytef *p, uInt len)
 {
      return crc32_no_comp(crc ^ 0xffffffffL, p, len) ^ 0xffffffffL;
@@ -11,9 +11,16 @@
  */
 
 #include <compiler.h>
+#include <u-boot/crc.h>
+#ifdef CONFIG_ARM64_CRC32
+#include <asm/system.h>
+#endif
 
-uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
-		    uint32_t *crc32c_table)
+/* Bit-reflected Castagnoli polynomial, as implemented by CPU instructions */
+#define CRC32C_POLY_LE	0x82F63B78
+
+uint32_t crc32c_cal_generic(uint32_t crc, const char *data, int length,
+			    uint32_t *crc32c_table)
 {
 	while (length--)
 		crc = crc32c_table[(u8)(crc ^ *data++)] ^ (crc >> 8);
@@ -21,6 +28,48 @@ uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
 	return crc;
 }
 
+#ifdef CONFIG_ARM64_CRC32
+static uint32_t crc32c_arm64(uint32_t crc, const u8 *data, int length)
+{
+	for (; length > 0 && ((ulong)data & 7); length--)
+		crc = __builtin_aarch64_crc32cb(crc, *data++);
+	for (; length >= 8; length -= 8, data += 8)
+		crc = __builtin_aarch64_crc32cx(crc,
+						le64_to_cpu(*(const u64 *)data));
+	for (; length > 0; length--)
+		crc = __builtin_aarch64_crc32cb(crc, *data++);
+
+	return crc;
+}
+
+/*
+ * Use the CRC32C instructions if the CPU has them. They only implement the
+ * Castagnoli polynomial, which is in table[128] for a bit-reflected table.
+ */
+static bool crc32c_hw_usable(const uint32_t *crc32c_table)
+{
+	static int present = -1;
+
+	if (crc32c_table[128] != CRC32C_POLY_LE)
+		return false;
+	if (present < 0)
+		present = !!(read_id_aa64isar0() & ID_AA64ISAR0_EL1_CRC32);
+
+	return present;
+}
+#endif
+
+uint32_t crc32c_cal(uint32_t crc, const char *data, int length,
+		    uint32_t *crc32c_table)
+{
+#ifdef CONFIG_ARM64_CRC32
+	if (crc32c_hw_usable(crc32c_table))
+		return crc32c_arm64(crc, (const u8 *)data, length);
+#endif
+
+	return crc32c_cal_generic(crc, data, length, crc32c_table);
+}
+
 void crc32c_init(uint32_t *crc32c_table, uint32_t pol)
 {
 	int i, j;
@@ -15,7 +15,6 @@
 #include <errno.h>
 #include <log.h>
 #include <malloc.h>
-#include <sort.h>
 
 #ifdef USE_HOSTCC		/* HOST build */
 # include <string.h>
@@ -61,6 +60,9 @@ struct env_entry_node {
 static void _hdelete(const char *key, struct hsearch_data *htab,
 		     struct env_entry *ep, int idx);
 
+/* Set while a callback runs, during which the table must not move */
+static bool in_callback;
+
 /*
  * hcreate()
  */
@@ -83,6 +85,162 @@ static int isprime(unsigned int number)
 	return number % div != 0;
 }
 
+/* Round a table size up to a prime, as needed by the double hash method */
+static unsigned int hprime(size_t nel)
+{
+	nel |= 1;		/* make odd */
+	while (!isprime(nel))
+		nel += 2;
+
+	return nel;
+}
+
+/* Compute a value for the given string. Perhaps use a better method. */
+static unsigned int hkey(const char *key)
+{
+	unsigned int len = strlen(key);
+	unsigned int hval = len;
+	unsigned int count = len;
+
+	while (count-- > 0) {
+		hval <<= 4;
+		hval += key[count];
+	}
+
+	return hval;
+}
+
+/*
+ * The sorted index
+ *
+ * htab->sorted holds the table index of each entry, in order of key, so that
+ * hexport_r() need not sort the whole table each time. It is updated as
+ * entries are added and deleted, which moves at most htab->filled integers.
+ */
+
+/* Find the position of @key in the sorted index, or where it should go */
+static unsigned int hsorted_pos(struct hsearch_data *htab, const char *key)
+{
+	unsigned int lo = 0, hi = htab->filled;
+
+	/* Entries often arrive in order, e.g. when importing an exported env */
+	if (hi && strcmp(htab->table[htab->sorted[hi - 1]].entry.key, key) < 0)
+		return hi;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (strcmp(htab->table[htab->sorted[mid]].entry.key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Add a new entry to the sorted index, before it is counted in 'filled' */
+static void hsorted_add(struct hsearch_data *htab, unsigned int idx)
+{
+	unsigned int pos = hsorted_pos(htab, htab->table[idx].entry.key);
+
+	memmove(&htab->sorted[pos + 1], &htab->sorted[pos],
+		(htab->filled - pos) * sizeof(*htab->sorted));
+	htab->sorted[pos] = idx;
+}
+
+/* Remove an entry from the sorted index, while it is counted in 'filled' */
+static void hsorted_del(struct hsearch_data *htab, unsigned int idx)
+{
+	unsigned int pos = hsorted_pos(htab, htab->table[idx].entry.key);
+
+	if (pos < htab->filled && htab->sorted[pos] == idx)
+		memmove(&htab->sorted[pos], &htab->sorted[pos + 1],
+			(htab->filled - pos - 1) * sizeof(*htab->sorted));
+}
+
+/* Find a free slot in a table which has no deleted entries */
+static unsigned int hslot(struct env_entry_node *table, unsigned int size,
+			  unsigned int hval)
+{
+	unsigned int hval2 = 1 + hval % (size - 2);
+	unsigned int idx = hval;
+
+	while (table[idx].used) {
+		if (idx <= hval2)
+			idx = size + idx - hval2;
+		else
+			idx -= hval2;
+	}
+
+	return idx;
+}
+
+/*
+ * Move all entries to a new table of (at least) @nel elements, dropping any
+ * deleted slots along the way. Entries are visited through the sorted index,
+ * which is rewritten with their new positions.
+ *
+ * Since this moves every entry, it must not happen while anyone holds a
+ * pointer to one, i.e. while a callback is running.
+ */
+static int hresize(struct hsearch_data *htab, size_t nel)
+{
+	struct env_entry_node *table;
+	unsigned int *sorted;
+	unsigned int i;
+
+	nel = hprime(nel);
+	table = calloc(nel + 1, sizeof(struct env_entry_node));
+	sorted = calloc(nel, sizeof(*sorted));
+	if (!table || !sorted) {
+		free(table);
+		free(sorted);
+		return -ENOMEM;
+	}
+
+	debug("Resize Hash Table: %p N=%u -> %u\n", htab, htab->size,
+	      (uint)nel);
+	for (i = 0; i < htab->filled; i++) {
+		struct env_entry_node *node = &htab->table[htab->sorted[i]];
+		unsigned int hval = hkey(node->entry.key) % nel;
+		unsigned int idx;
+
+		if (hval == 0)
+			++hval;
+		idx = hslot(table, nel, hval);
+		table[idx] = *node;
+		table[idx].used = hval;
+		sorted[i] = idx;
+	}
+
+	free(htab->table);
+	free(htab->sorted);
+	htab->table = table;
+	htab->sorted = sorted;
+	htab->size = nel;
+	htab->deleted = 0;
+
+	return 0;
+}
+
+/*
+ * Make room for another entry, keeping the table at most 3/4 full (counting
+ * deleted slots) so that searches stay short. The size doubles each time, so
+ * the cost of moving entries is constant per entry, on average.
+ */
+static void hgrow(struct hsearch_data *htab)
+{
+	size_t used = htab->filled + htab->deleted + 1;
+
+	if (in_callback || used * 4 <= (size_t)htab->size * 3)
+		return;
+
+	/* If it is mostly deleted slots, just clean them out */
+	if (hresize(htab, max_t(size_t, htab->size, (htab->filled + 1) * 2)))
+		debug("Resize Hash Table: out of memory\n");
+}
+
 /*
  * Before using the hash table we must allocate memory for it.
  * Test for an existing table are done. We allocate one element
@@ -107,17 +265,21 @@ int hcreate_r(size_t nel, struct hsearch_data *htab)
 	}
 
 	/* Change nel to the first prime number not smaller as nel. */
-	nel |= 1;		/* make odd */
-	while (!isprime(nel))
-		nel += 2;
+	nel = hprime(nel);
 
 	htab->size = nel;
 	htab->filled = 0;
+	htab->deleted = 0;
 
 	/* allocate memory and zero out */
 	htab->table = (struct env_entry_node *)calloc(htab->size + 1,
 						sizeof(struct env_entry_node));
-	if (htab->table == NULL) {
+	htab->sorted = calloc(htab->size, sizeof(*htab->sorted));
+	if (htab->table == NULL || htab->sorted == NULL) {
+		free(htab->table);
+		free(htab->sorted);
+		htab->table = NULL;
+		htab->sorted = NULL;
 		__set_errno(ENOMEM);
 		return 0;
 	}
@@ -155,9 +317,11 @@ void hdestroy_r(struct hsearch_data *htab)
 		}
 	}
 	free(htab->table);
+	free(htab->sorted);
 
 	/* the sign for an existing table is an value != NULL in htable */
 	htab->table = NULL;
+	htab->sorted = NULL;
 }
 
 /*
@@ -218,15 +382,13 @@ int hmatch_r(const char *match, int last_idx, struct env_entry **retval,
 }
 
 static int
-do_callback(const struct env_entry *e, const char *name, const char *value,
-	    enum env_op op, int flags)
+do_callback(const struct hsearch_data *htab, const struct env_entry *e,
+	    const char *name, const char *value, enum env_op op, int flags)
 {
 	int ret = 0;
 
 #ifndef CONFIG_XPL_BUILD
-	static bool in_callback;
-
-	if (!e->callback || in_callback)
+	if (!e->callback || in_callback || htab->hold_callbacks)
 		return 0;
 
 	/*
@@ -274,8 +436,9 @@ static inline int _compare_and_overwrite_entry(struct env_entry item,
 			}
 
 			/* If there is a callback, call it */
-			if (do_callback(&htab->table[idx].entry, item.key,
-					item.data, env_op_overwrite, flag)) {
+			if (do_callback(htab, &htab->table[idx].entry,
+					item.key, item.data, env_op_overwrite,
+					flag)) {
 				debug("callback() rejected setting variable "
 					"%s, skipping it!\n", item.key);
 				__set_errno(EINVAL);
@@ -303,25 +466,19 @@ int hsearch_r(struct env_entry item, enum env_action action,
 	      struct env_entry **retval, struct hsearch_data *htab, int flag)
 {
 	unsigned int hval;
-	unsigned int count;
-	unsigned int len = strlen(item.key);
 	unsigned int idx;
 	unsigned int first_deleted = 0;
 	int ret;
 
-	/* Compute an value for the given string. Perhaps use a better method. */
-	hval = len;
-	count = len;
-	while (count-- > 0) {
-		hval <<= 4;
-		hval += item.key[count];
-	}
+	/* Grow first, since the indices below are only valid for this table */
+	if (action == ENV_ENTER)
+		hgrow(htab);
 
 	/*
 	 * First hash function:
 	 * simply take the modul but prevent zero.
 	 */
-	hval %= htab->size;
+	hval = hkey(item.key) % htab->size;
 	if (hval == 0)
 		++hval;
 
@@ -398,16 +555,21 @@ int hsearch_r(struct env_entry item, enum env_action action,
 		if (first_deleted)
 			idx = first_deleted;
 
-		htab->table[idx].used = hval;
 		htab->table[idx].entry.key = strdup(item.key);
 		htab->table[idx].entry.data = strdup(item.data);
 		if (!htab->table[idx].entry.key ||
 		    !htab->table[idx].entry.data) {
+			free((void *)htab->table[idx].entry.key);
+			free(htab->table[idx].entry.data);
 			__set_errno(ENOMEM);
 			*retval = NULL;
 			return 0;
 		}
+		if (first_deleted)
+			--htab->deleted;
+		htab->table[idx].used = hval;
 
+		hsorted_add(htab, idx);
 		++htab->filled;
 
 		/* This is a new entry, so look up a possible callback */
@@ -427,8 +589,8 @@ int hsearch_r(struct env_entry item, enum env_action action,
 		}
 
 		/* If there is a callback, call it */
-		if (do_callback(&htab->table[idx].entry, item.key, item.data,
-				env_op_create, flag)) {
+		if (do_callback(htab, &htab->table[idx].entry, item.key,
+				item.data, env_op_create, flag)) {
 			debug("callback() rejected setting variable "
 				"%s, skipping it!\n", item.key);
 			_hdelete(item.key, htab, &htab->table[idx].entry, idx);
@@ -462,12 +624,14 @@ static void _hdelete(const char *key, struct hsearch_data *htab,
 {
 	/* free used entry */
 	debug("hdelete: DELETING key \"%s\"\n", key);
+	hsorted_del(htab, idx);
 	free((void *)ep->key);
 	free(ep->data);
 	ep->flags = 0;
 	htab->table[idx].used = USED_DELETED;
 
 	--htab->filled;
+	++htab->deleted;
 }
 
 int hdelete_r(const char *key, struct hsearch_data *htab, int flag)
@@ -495,7 +659,7 @@ int hdelete_r(const char *key, struct hsearch_data *htab, int flag)
 	}
 
 	/* If there is a callback, call it */
-	if (do_callback(&htab->table[idx].entry, key, NULL,
+	if (do_callback(htab, &htab->table[idx].entry, key, NULL,
 			env_op_delete, flag)) {
 		debug("callback() rejected deleting variable "
 			"%s, skipping it!\n", key);
@@ -526,7 +690,7 @@ int hdelete_r(const char *key, struct hsearch_data *htab, int flag)
  * for later re-import.
  *
  * The entries in the result list will be sorted by ascending key
- * values.
+ * values, taken from the sorted index.
  *
  * If the separator character is different from NUL, then any
  * separator characters and backslash characters in the values will
@@ -551,14 +715,6 @@ int hdelete_r(const char *key, struct hsearch_data *htab, int flag)
  *		bytes in the string will be '\0'-padded.
  */
 
-static int cmpkey(const void *p1, const void *p2)
-{
-	struct env_entry *e1 = *(struct env_entry **)p1;
-	struct env_entry *e2 = *(struct env_entry **)p2;
-
-	return (strcmp(e1->key, e2->key));
-}
-
 static int match_string(int flag, const char *str, const char *pat, void *priv)
 {
 	switch (flag & H_MATCH_METHOD) {
@@ -617,14 +773,26 @@ static int match_entry(struct env_entry *ep, int flag, int argc,
 	return 0;
 }
 
+/* Check whether an entry should be exported */
+static bool export_entry(struct env_entry *ep, int flag, int argc,
+			 char *const argv[])
+{
+	if (argc > 0 && !match_entry(ep, flag, argc, argv))
+		return false;
+
+	if ((flag & H_HIDE_DOT) && ep->key[0] == '.')
+		return false;
+
+	return true;
+}
+
 ssize_t hexport_r(struct hsearch_data *htab, const char sep, int flag,
 		 char **resp, size_t size,
 		 int argc, char *const argv[])
 {
-	struct env_entry *list[htab->size];
 	char *res, *p;
 	size_t totlen;
-	int i, n;
+	int i;
 
 	/* Test for correct arguments.  */
 	if ((resp == NULL) || (htab == NULL)) {
@@ -636,54 +804,32 @@ ssize_t hexport_r(struct hsearch_data *htab, const char sep, int flag,
 	      htab, htab->size, htab->filled, (ulong)size);
 	/*
 	 * Pass 1:
-	 * search used entries,
-	 * save addresses and compute total length
+	 * search used entries and compute total length
 	 */
-	for (i = 1, n = 0, totlen = 0; i <= htab->size; ++i) {
-
-		if (htab->table[i].used > 0) {
-			struct env_entry *ep = &htab->table[i].entry;
-			int found = match_entry(ep, flag, argc, argv);
-
-			if ((argc > 0) && (found == 0))
-				continue;
+	for (i = 0, totlen = 0; i < htab->filled; ++i) {
+		struct env_entry *ep = &htab->table[htab->sorted[i]].entry;
 
-			if ((flag & H_HIDE_DOT) && ep->key[0] == '.')
-				continue;
-
-			list[n++] = ep;
+		if (!export_entry(ep, flag, argc, argv))
+			continue;
 
-			totlen += strlen(ep->key);
+		totlen += strlen(ep->key);
 
-			if (sep == '\0') {
-				totlen += strlen(ep->data);
-			} else {	/* check if escapes are needed */
-				char *s = ep->data;
+		if (sep == '\0') {
+			totlen += strlen(ep->data);
+		} else {	/* check if escapes are needed */
+			char *s = ep->data;
 
-				while (*s) {
+			while (*s) {
+				++totlen;
+				/* add room for needed escape chars */
+				if ((*s == sep) || (*s == '\\'))
 					++totlen;
-					/* add room for needed escape chars */
-					if ((*s == sep) || (*s == '\\'))
-						++totlen;
-					++s;
-				}
+				++s;
 			}
-			totlen += 2;	/* for '=' and 'sep' char */
 		}
+		totlen += 2;	/* for '=' and 'sep' char */
 	}
 
-#ifdef DEBUG
-	/* Pass 1a: print unsorted list */
-	printf("Unsorted: n=%d\n", n);
-	for (i = 0; i < n; ++i) {
-		printf("\t%3d: %p ==> %-10s => %s\n",
-		       i, list[i], list[i]->key, list[i]->data);
-	}
-#endif
-
-	/* Sort list by keys */
-	qsort(list, n, sizeof(struct env_entry *), cmpkey);
-
 	/* Check if the user supplied buffer size is sufficient */
 	if (size) {
 		if (size < totlen + 1) {	/* provided buffer too small */
@@ -713,15 +859,19 @@ ssize_t hexport_r(struct hsearch_data *htab, const char sep, int flag,
 	 * Pass 2:
 	 * export sorted list of result data
 	 */
-	for (i = 0, p = res; i < n; ++i) {
+	for (i = 0, p = res; i < htab->filled; ++i) {
+		struct env_entry *ep = &htab->table[htab->sorted[i]].entry;
 		const char *s;
 
-		s = list[i]->key;
+		if (!export_entry(ep, flag, argc, argv))
+			continue;
+
+		s = ep->key;
 		while (*s)
 			*p++ = *s++;
 		*p++ = '=';
 
-		s = list[i]->data;
+		s = ep->data;
 
 		while (*s) {
 			if ((*s == sep) || (*s == '\\'))
@@ -768,6 +918,73 @@ static int drop_var_from_set(const char *name, int nvars, char * vars[])
 	return res;
 }
 
+/*
+ * Count the entries in linearized data, as an upper bound for sizing the
+ * hash table. The data ends at the first empty entry.
+ */
+static size_t himport_count(const char *env, size_t size, const char sep)
+{
+	size_t i, count = 1;
+
+	for (i = 0; i < size; i++) {
+		if (env[i] && env[i] != sep)
+			continue;
+		if (!env[i] && (!i || !env[i - 1]))
+			break;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * Run the create callbacks held back while importing into a new table. This
+ * happens in order of key, once all variables are present. Any variable whose
+ * callback rejects it is deleted, as it would have been when it was entered.
+ */
+static void himport_callbacks(struct hsearch_data *htab, int flag)
+{
+	unsigned int i, n = htab->filled;
+	size_t len = 0;
+	char **names, *p;
+
+	/*
+	 * Callbacks can add and delete variables, which may move entries or
+	 * reuse their slots, so look each one up again by name
+	 */
+	for (i = 0; i < n; i++)
+		len += strlen(htab->table[htab->sorted[i]].entry.key) + 1;
+	names = malloc(n * sizeof(*names) + len);
+	if (!names) {
+		__set_errno(ENOMEM);
+		return;
+	}
+	p = (char *)(names + n);
+	for (i = 0; i < n; i++) {
+		names[i] = strcpy(p, htab->table[htab->sorted[i]].entry.key);
+		p += strlen(p) + 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct env_entry e, *ep;
+		int idx;
+
+		e.key = names[i];
+		idx = hsearch_r(e, ENV_FIND, &ep, htab, 0);
+		if (!idx)
+			continue;
+		if (do_callback(htab, ep, ep->key, ep->data, env_op_create,
+				flag)) {
+#if !IS_ENABLED(CONFIG_ENV_WRITEABLE_LIST)
+			printf("himport_r: can't insert \"%s=%s\" into hash table\n",
+			       ep->key, ep->data);
+#endif
+			_hdelete(ep->key, htab, ep, idx);
+		}
+	}
+	free(names);
+}
+
 /*
  * Import linearized data into hash table.
  *
@@ -804,6 +1021,9 @@ static int drop_var_from_set(const char *name, int nvars, char * vars[])
  *
  * In theory, arbitrary separator characters can be used, but only
  * '\0' and '\n' have really been tested.
+ *
+ * When importing into a new hash table, the table is sized to hold all the
+ * entries and create callbacks are held back until every entry is present.
  */
 
 int himport_r(struct hsearch_data *htab,
@@ -812,6 +1032,7 @@ int himport_r(struct hsearch_data *htab,
 {
 	char *data, *sp, *dp, *name, *value;
 	char *localvars[nvars];
+	bool bulk = false;
 	int i;
 
 	/* Test for correct arguments.  */
@@ -865,17 +1086,22 @@ int himport_r(struct hsearch_data *htab,
 	 */
 
 	if (!htab->table) {
-		int nent = CONFIG_ENV_MIN_ENTRIES + size / 8;
+		size_t nent = CONFIG_ENV_MIN_ENTRIES + size / 8;
+		size_t count = himport_count(data, size, sep);
 
 		if (nent > CONFIG_ENV_MAX_ENTRIES)
 			nent = CONFIG_ENV_MAX_ENTRIES;
 
-		debug("Create Hash Table: N=%d\n", nent);
+		/* Make sure everything fits without growing the table */
+		nent = max(nent, count + count / 3 + 1);
+
+		debug("Create Hash Table: N=%lu\n", (ulong)nent);
 
 		if (hcreate_r(nent, htab) == 0) {
 			free(data);
 			return 0;
 		}
+		bulk = true;
 	}
 
 	if (!size) {
@@ -895,6 +1121,7 @@ int himport_r(struct hsearch_data *htab,
 		size -= ignored_crs;
 		dp = data;
 	}
+	htab->hold_callbacks = bulk;
 	/* Parse environment; allow for '\0' and 'sep' as separators */
 	do {
 		struct env_entry e, *rv;
@@ -944,6 +1171,7 @@ int himport_r(struct hsearch_data *htab,
 
 		if (*name == 0) {
 			debug("INSERT: unable to use an empty key\n");
+			htab->hold_callbacks = false;
 			__set_errno(EINVAL);
 			free(data);
 			return 0;
@@ -973,6 +1201,10 @@ int himport_r(struct hsearch_data *htab,
 	debug("INSERT: free(data = %p)\n", data);
 	free(data);
 
+	htab->hold_callbacks = false;
+	if (bulk && !IS_ENABLED(CONFIG_XPL_BUILD))
+		himport_callbacks(htab, flag);
+
 	if (flag & H_NOCLEAR)
 		goto end;
 
@@ -49,16 +49,43 @@
 
 static void default_log(const char *ignored, char *response) {}
 
-static lbaint_t write_sparse_chunk_raw(struct sparse_storage *info,
+/**
+ * struct sparse_write_ctx - State kept while writing a sparse image
+ *
+ * @info: Storage being written
+ * @response: Fastboot response buffer
+ * @bounce: Buffer for raw data which is not aligned for DMA, NULL until needed
+ * @fill_buf: Buffer holding the fill pattern, NULL until needed
+ * @fill_buf_blks: Size of @fill_buf in blocks
+ * @fill_buf_val: Value @fill_buf is filled with
+ * @run_type: Type of the chunks in the pending run, CHUNK_TYPE_FILL or
+ *	CHUNK_TYPE_DONT_CARE, or 0 if there is no run
+ * @run_blkcnt: Number of blocks in the pending run
+ * @run_val: Fill value of the pending run
+ */
+struct sparse_write_ctx {
+	struct sparse_storage *info;
+	char *response;
+	void *bounce;
+	u32 *fill_buf;
+	lbaint_t fill_buf_blks;
+	u32 fill_buf_val;
+	u16 run_type;
+	lbaint_t run_blkcnt;
+	u32 run_val;
+};
+
+static lbaint_t write_sparse_chunk_raw(struct sparse_write_ctx *ctx,
 				       lbaint_t blk, lbaint_t blkcnt,
-				       void *data,
-				       char *response)
+				       void *data)
 {
+	struct sparse_storage *info = ctx->info;
 	lbaint_t n = blkcnt, write_blks, blks = 0;
 	lbaint_t aligned_buf_blks = FASTBOOT_MAX_BLK_WRITE;
-	uint32_t *aligned_buf = NULL;
 
-	if (CONFIG_IS_ENABLED(SYS_DCACHE_OFF)) {
+	/* Write straight from the image when the buffer is suitable for DMA */
+	if (CONFIG_IS_ENABLED(SYS_DCACHE_OFF) ||
+	    IS_ALIGNED((ulong)data, ARCH_DMA_MINALIGN)) {
 		write_blks = info->write(info, blk, n, data);
 		if (write_blks < n)
 			goto write_fail;
@@ -66,105 +93,198 @@ static lbaint_t write_sparse_chunk_raw(struct sparse_storage *info,
 		return write_blks;
 	}
 
-	aligned_buf = memalign(ARCH_DMA_MINALIGN, info->blksz * aligned_buf_blks);
-	if (!aligned_buf) {
-		info->mssg("Malloc failed for: CHUNK_TYPE_RAW", response);
-		return -ENOMEM;
+	if (!ctx->bounce) {
+		ctx->bounce = memalign(ARCH_DMA_MINALIGN,
+				       info->blksz * aligned_buf_blks);
+		if (!ctx->bounce) {
+			info->mssg("Malloc failed for: CHUNK_TYPE_RAW",
+				   ctx->response);
+			return -ENOMEM;
+		}
 	}
 
 	while (blkcnt > 0) {
 		n = min(aligned_buf_blks, blkcnt);
-		memcpy(aligned_buf, data, n * info->blksz);
+		memcpy(ctx->bounce, data, n * info->blksz);
 
 		/* write_blks might be > n due to NAND bad-blocks */
-		write_blks = info->write(info, blk + blks, n, aligned_buf);
-		if (write_blks < n) {
-			free(aligned_buf);
+		write_blks = info->write(info, blk + blks, n, ctx->bounce);
+		if (write_blks < n)
 			goto write_fail;
-		}
 
 		blks += write_blks;
 		data += n * info->blksz;
 		blkcnt -= n;
 	}
 
-	free(aligned_buf);
 	return blks;
 
 write_fail:
 	if (IS_ERR_VALUE(write_blks)) {
 		printf("%s: Write failed, block #" LBAFU " [" LBAFU "] (%lld)\n",
 		       __func__, blk + blks, n, (long long)write_blks);
-		info->mssg("flash write failure", response);
+		info->mssg("flash write failure", ctx->response);
 		return write_blks;
 	}
 
 	/* write_blks < n */
 	printf("%s: Write failed, block #" LBAFU " [" LBAFU "]\n",
 	       __func__, blk + blks, n);
-	info->mssg("flash write failure(incomplete)", response);
+	info->mssg("flash write failure(incomplete)", ctx->response);
 	return -1;
 }
 
-int write_sparse_image(struct sparse_storage *info,
-		       const char *part_name, void *data, char *response)
+/* Fill the fill buffer with a value, doubling the filled part each time */
+static void sparse_fill_buf_set(struct sparse_write_ctx *ctx, u32 fill_val)
 {
-	lbaint_t blk;
-	lbaint_t blkcnt;
-	lbaint_t blks;
-	uint64_t bytes_written = 0;
-	unsigned int chunk;
-	unsigned int offset;
-	uint64_t chunk_data_sz;
-	uint32_t *fill_buf = NULL;
-	uint32_t fill_val;
-	sparse_header_t *sparse_header;
-	chunk_header_t *chunk_header;
-	uint32_t total_blocks = 0;
-	int fill_buf_num_blks;
+	size_t size = ctx->fill_buf_blks * ctx->info->blksz;
+	size_t done = ctx->info->blksz;
 	int i;
-	int j;
 
-	fill_buf_num_blks = CONFIG_IMAGE_SPARSE_FILLBUF_SIZE / info->blksz;
+	for (i = 0; i < done / sizeof(fill_val); i++)
+		ctx->fill_buf[i] = fill_val;
+	while (done < size) {
+		size_t len = min(done, size - done);
 
-	/* Read and skip over sparse image header */
-	sparse_header = (sparse_header_t *)data;
+		memcpy((char *)ctx->fill_buf + done, ctx->fill_buf, len);
+		done += len;
+	}
+	ctx->fill_buf_val = fill_val;
+}
 
-	data += sparse_header->file_hdr_sz;
-	if (sparse_header->file_hdr_sz > sizeof(sparse_header_t)) {
-		/*
-		 * Skip the remaining bytes in a header that is longer than
-		 * we expected.
-		 */
-		data += (sparse_header->file_hdr_sz - sizeof(sparse_header_t));
+static lbaint_t write_sparse_fill(struct sparse_write_ctx *ctx, lbaint_t blk,
+				  lbaint_t blkcnt, u32 fill_val)
+{
+	struct sparse_storage *info = ctx->info;
+	lbaint_t blks, done = 0;
+	lbaint_t i, j;
+
+	/* Let the storage set the blocks itself if it can, e.g. by erasing */
+	if (info->fill) {
+		blks = info->fill(info, blk, blkcnt, fill_val);
+		if (blks != -ENOSYS) {
+			if (IS_ERR_VALUE(blks) || blks < blkcnt) {
+				printf("%s: Fill failed, block #" LBAFU " [" LBAFU "]\n",
+				       __func__, blk, blkcnt);
+				info->mssg("flash write failure",
+					   ctx->response);
+				return -1;
+			}
+			return blks;
+		}
 	}
 
-	if (!info->mssg)
-		info->mssg = default_log;
+	if (!ctx->fill_buf) {
+		ctx->fill_buf_blks = CONFIG_IMAGE_SPARSE_FILLBUF_SIZE /
+			info->blksz;
+		ctx->fill_buf = memalign(ARCH_DMA_MINALIGN,
+					 ROUNDUP(info->blksz *
+						 ctx->fill_buf_blks,
+						 ARCH_DMA_MINALIGN));
+		if (!ctx->fill_buf) {
+			info->mssg("Malloc failed for: CHUNK_TYPE_FILL",
+				   ctx->response);
+			return -1;
+		}
+		sparse_fill_buf_set(ctx, fill_val);
+	} else if (ctx->fill_buf_val != fill_val) {
+		sparse_fill_buf_set(ctx, fill_val);
+	}
 
-	debug("=== Sparse Image Header ===\n");
-	debug("magic: 0x%x\n", sparse_header->magic);
-	debug("major_version: 0x%x\n", sparse_header->major_version);
-	debug("minor_version: 0x%x\n", sparse_header->minor_version);
-	debug("file_hdr_sz: %d\n", sparse_header->file_hdr_sz);
-	debug("chunk_hdr_sz: %d\n", sparse_header->chunk_hdr_sz);
-	debug("blk_sz: %d\n", sparse_header->blk_sz);
-	debug("total_blks: %d\n", sparse_header->total_blks);
-	debug("total_chunks: %d\n", sparse_header->total_chunks);
+	for (i = 0; i < blkcnt;) {
+		j = min(blkcnt - i, ctx->fill_buf_blks);
+		blks = info->write(info, blk + done, j, ctx->fill_buf);
+		/* blks might be > j (eg. NAND bad-blocks) */
+		if (IS_ERR_VALUE(blks) || blks < j) {
+			printf("%s: %s " LBAFU " [" LBAFU "]\n", __func__,
+			       "Write failed, block #", blk + done, j);
+			info->mssg("flash write failure", ctx->response);
+			return -1;
+		}
+		done += blks;
+		i += j;
+	}
 
-	/*
-	 * Verify that the sparse block size is a multiple of our
-	 * storage backend block size
-	 */
-	div_u64_rem(sparse_header->blk_sz, info->blksz, &offset);
-	if (offset) {
-		printf("%s: Sparse image block size issue [%u]\n",
-		       __func__, sparse_header->blk_sz);
-		info->mssg("sparse image block size issue", response);
+	return done;
+}
+
+/*
+ * Write out the pending run of FILL or DONT_CARE chunks, moving @blkp on past
+ * it
+ */
+static int sparse_flush_run(struct sparse_write_ctx *ctx, lbaint_t *blkp)
+{
+	struct sparse_storage *info = ctx->info;
+	lbaint_t blks;
+
+	switch (ctx->run_type) {
+	case CHUNK_TYPE_FILL:
+		blks = write_sparse_fill(ctx, *blkp, ctx->run_blkcnt,
+					 ctx->run_val);
+		if (IS_ERR_VALUE(blks))
+			return -1;
+		*blkp += blks;
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+		*blkp += info->reserve(info, *blkp, ctx->run_blkcnt);
+		break;
+	}
+	ctx->run_type = 0;
+	ctx->run_blkcnt = 0;
+
+	return 0;
+}
+
+/*
+ * Add FILL or DONT_CARE chunks to the pending run, so that neighbouring chunks
+ * of the same kind are handled with one call
+ */
+static int sparse_add_run(struct sparse_write_ctx *ctx, lbaint_t *blkp,
+			  u16 type, lbaint_t blkcnt, u32 fill_val)
+{
+	if (ctx->run_type && (ctx->run_type != type ||
+			      (type == CHUNK_TYPE_FILL &&
+			       ctx->run_val != fill_val))) {
+		if (sparse_flush_run(ctx, blkp))
+			return -1;
+	}
+	ctx->run_type = type;
+	ctx->run_blkcnt += blkcnt;
+	ctx->run_val = fill_val;
+
+	return 0;
+}
+
+static int sparse_check_size(struct sparse_write_ctx *ctx, lbaint_t blk,
+			     lbaint_t blkcnt)
+{
+	struct sparse_storage *info = ctx->info;
+
+	if (blk + ctx->run_blkcnt + blkcnt > info->start + info->size) {
+		printf("%s: Request would exceed partition size!\n", __func__);
+		info->mssg("Request would exceed partition size!",
+			   ctx->response);
 		return -1;
 	}
 
-	puts("Flashing Sparse Image\n");
+	return 0;
+}
+
+static int write_sparse_chunks(struct sparse_write_ctx *ctx,
+			       sparse_header_t *sparse_header, void *data,
+			       const char *part_name)
+{
+	struct sparse_storage *info = ctx->info;
+	char *response = ctx->response;
+	lbaint_t blk;
+	lbaint_t blkcnt;
+	lbaint_t blks;
+	uint64_t bytes_written = 0;
+	unsigned int chunk;
+	uint64_t chunk_data_sz;
+	uint32_t fill_val;
+	chunk_header_t *chunk_header;
+	uint32_t total_blocks = 0;
 
 	/* Start processing chunks */
 	blk = info->start;
@@ -200,17 +320,11 @@ int write_sparse_image(struct sparse_storage *info,
 				return -1;
 			}
 
-			if (blk + blkcnt > info->start + info->size) {
-				printf(
-				    "%s: Request would exceed partition size!\n",
-				    __func__);
-				info->mssg("Request would exceed partition size!",
-					   response);
+			if (sparse_check_size(ctx, blk, blkcnt) ||
+			    sparse_flush_run(ctx, &blk))
 				return -1;
-			}
 
-			blks = write_sparse_chunk_raw(info, blk, blkcnt,
-						      data, response);
+			blks = write_sparse_chunk_raw(ctx, blk, blkcnt, data);
 			if (IS_ERR_VALUE(blks))
 				return -1;
 
@@ -227,62 +341,23 @@ int write_sparse_image(struct sparse_storage *info,
 				return -1;
 			}
 
-			fill_buf = (uint32_t *)
-				   memalign(ARCH_DMA_MINALIGN,
-					    ROUNDUP(
-						info->blksz * fill_buf_num_blks,
-						ARCH_DMA_MINALIGN));
-			if (!fill_buf) {
-				info->mssg("Malloc failed for: CHUNK_TYPE_FILL",
-					   response);
-				return -1;
-			}
-
 			fill_val = *(uint32_t *)data;
 			data = (char *)data + sizeof(uint32_t);
 
-			for (i = 0;
-			     i < (info->blksz * fill_buf_num_blks /
-				  sizeof(fill_val));
-			     i++)
-				fill_buf[i] = fill_val;
-
-			if (blk + blkcnt > info->start + info->size) {
-				printf(
-				    "%s: Request would exceed partition size!\n",
-				    __func__);
-				info->mssg("Request would exceed partition size!",
-					   response);
+			if (sparse_check_size(ctx, blk, blkcnt) ||
+			    sparse_add_run(ctx, &blk, CHUNK_TYPE_FILL, blkcnt,
+					   fill_val))
 				return -1;
-			}
 
-			for (i = 0; i < blkcnt;) {
-				j = blkcnt - i;
-				if (j > fill_buf_num_blks)
-					j = fill_buf_num_blks;
-				blks = info->write(info, blk, j, fill_buf);
-				/* blks might be > j (eg. NAND bad-blocks) */
-				if (blks < j) {
-					printf("%s: %s " LBAFU " [%d]\n",
-					       __func__,
-					       "Write failed, block #",
-					       blk, j);
-					info->mssg("flash write failure",
-						   response);
-					free(fill_buf);
-					return -1;
-				}
-				blk += blks;
-				i += j;
-			}
 			bytes_written += ((u64)blkcnt) * info->blksz;
 			total_blocks += DIV_ROUND_UP_ULL(chunk_data_sz,
 							 sparse_header->blk_sz);
-			free(fill_buf);
 			break;
 
 		case CHUNK_TYPE_DONT_CARE:
-			blk += info->reserve(info, blk, blkcnt);
+			if (sparse_add_run(ctx, &blk, CHUNK_TYPE_DONT_CARE,
+					   blkcnt, 0))
+				return -1;
 			total_blocks += chunk_header->chunk_sz;
 			break;
 
@@ -304,6 +379,8 @@ int write_sparse_image(struct sparse_storage *info,
 			return -1;
 		}
 	}
+	if (sparse_flush_run(ctx, &blk))
+		return -1;
 
 	debug("Wrote %d blocks, expected to write %d blocks\n",
 	      total_blocks, sparse_header->total_blks);
@@ -316,3 +393,60 @@ int write_sparse_image(struct sparse_storage *info,
 
 	return 0;
 }
+
+int write_sparse_image(struct sparse_storage *info,
+		       const char *part_name, void *data, char *response)
+{
+	struct sparse_write_ctx ctx = {
+		.info = info,
+		.response = response,
+	};
+	sparse_header_t *sparse_header;
+	unsigned int offset;
+	int ret;
+
+	/* Read and skip over sparse image header */
+	sparse_header = (sparse_header_t *)data;
+
+	data += sparse_header->file_hdr_sz;
+	if (sparse_header->file_hdr_sz > sizeof(sparse_header_t)) {
+		/*
+		 * Skip the remaining bytes in a header that is longer than
+		 * we expected.
+		 */
+		data += (sparse_header->file_hdr_sz - sizeof(sparse_header_t));
+	}
+
+	if (!info->mssg)
+		info->mssg = default_log;
+
+	debug("=== Sparse Image Header ===\n");
+	debug("magic: 0x%x\n", sparse_header->magic);
+	debug("major_version: 0x%x\n", sparse_header->major_version);
+	debug("minor_version: 0x%x\n", sparse_header->minor_version);
+	debug("file_hdr_sz: %d\n", sparse_header->file_hdr_sz);
+	debug("chunk_hdr_sz: %d\n", sparse_header->chunk_hdr_sz);
+	debug("blk_sz: %d\n", sparse_header->blk_sz);
+	debug("total_blks: %d\n", sparse_header->total_blks);
+	debug("total_chunks: %d\n", sparse_header->total_chunks);
+
+	/*
+	 * Verify that the sparse block size is a multiple of our
+	 * storage backend block size
+	 */
+	div_u64_rem(sparse_header->blk_sz, info->blksz, &offset);
+	if (offset) {
+		printf("%s: Sparse image block size issue [%u]\n",
+		       __func__, sparse_header->blk_sz);
+		info->mssg("sparse image block size issue", response);
+		return -1;
+	}
+
+	puts("Flashing Sparse Image\n");
+
+	ret = write_sparse_chunks(&ctx, sparse_header, data, part_name);
+	free(ctx.bounce);
+	free(ctx.fill_buf);
+
+	return ret;
+}
@@ -15,22 +15,30 @@
 
 #define LZ4F_BLOCKUNCOMPRESSED_FLAG 0x80000000U
 
-__rcode int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
+__rcode void ulz4fn_stream_init(struct ulz4fn_stream *s, const void *src,
+				void *dst, size_t dstn)
+{
+	memset(s, '\0', sizeof(*s));
+	s->src = src;
+	s->dst = dst;
+	s->dstn = dstn;
+}
+
+__rcode int ulz4fn_stream_run(struct ulz4fn_stream *s, size_t srcn)
 {
-	const void *end = dst + *dstn;
-	const void *in = src;
-	void *out = dst;
-	int has_block_checksum;
+	const void *src = s->src;
+	const void *end = s->dst + s->dstn;
+	const void *in = src + s->pos;
+	void *out = s->dst + s->out;
 	int ret;
-	*dstn = 0;
 
-	{ /* With in-place decompression the header may become invalid later. */
+	if (!s->started) { /* With in-place decompression the header may become invalid later. */
 		u32 magic;
 		u8 flags, version, independent_blocks, has_content_size;
 		u8 block_desc;
 
 		if (srcn < sizeof(u32) + 3*sizeof(u8))
-			return -EINVAL;	/* input overrun */
+			return -EAGAIN;	/* input overrun */
 
 		magic = get_unaligned_le32(in);
 		in += sizeof(u32);
@@ -41,7 +49,7 @@ __rcode int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 
 		version = (flags >> 6) & 0x3;
 		independent_blocks = (flags >> 5) & 0x1;
-		has_block_checksum = (flags >> 4) & 0x1;
+		s->has_block_checksum = (flags >> 4) & 0x1;
 		has_content_size = (flags >> 3) & 0x1;
 
 		/* We assume there's always only a single, standard frame. */
@@ -54,24 +62,30 @@ __rcode int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 
 		if (has_content_size) {
 			if (srcn < sizeof(u32) + 3*sizeof(u8) + sizeof(u64))
-				return -EINVAL;	/* input overrun */
+				return -EAGAIN;	/* input overrun */
 			in += sizeof(u64);
 		}
 		/* Header checksum byte */
 		in += sizeof(u8);
+		s->started = true;
 	}
 
 	while (1) {
 		u32 block_header, block_size;
 
+		/* Each block is only decompressed once all of it is present */
+		if (in - src + sizeof(u32) > srcn) {
+			ret = -EAGAIN;		/* input overrun */
+			break;
+		}
 		block_header = get_unaligned_le32(in);
-		in += sizeof(u32);
 		block_size = block_header & ~LZ4F_BLOCKUNCOMPRESSED_FLAG;
 
-		if (in - src + block_size > srcn) {
-			ret = -EINVAL;		/* input overrun */
+		if (in - src + sizeof(u32) + block_size > srcn) {
+			ret = -EAGAIN;		/* input overrun */
 			break;
 		}
+		in += sizeof(u32);
 
 		if (!block_size) {
 			ret = 0;	/* decompression successful */
@@ -99,10 +113,24 @@ __rcode int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 		}
 
 		in += block_size;
-		if (has_block_checksum)
+		if (s->has_block_checksum)
 			in += sizeof(u32);
 	}
 
-	*dstn = out - dst;
+	s->pos = in - src;
+	s->out = out - s->dst;
 	return ret;
 }
+
+__rcode int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
+{
+	struct ulz4fn_stream s;
+	int ret;
+
+	ulz4fn_stream_init(&s, src, dst, *dstn);
+	ret = ulz4fn_stream_run(&s, srcn);
+	*dstn = s.out;
+
+	/* All the data is present, so running out of it is an error */
+	return ret == -EAGAIN ? -EINVAL : ret;
+}
@@ -180,25 +180,49 @@ void string_to_enetaddr(const char *addr, uint8_t *enetaddr)
 
 uint compute_ip_checksum(const void *vptr, uint nbytes)
 {
-	int sum, oddbyte;
-	const unsigned short *ptr = vptr;
+	const u8 *ptr = vptr;
+	u64 sum = 0;
+	int oddbyte;
+
+	/*
+	 * The ones' complement sum of the 32-bit words, folded to 16 bits, is
+	 * the same as that of the 16-bit words, so add up a word at a time
+	 * once the data is suitably aligned.
+	 */
+	if (!((ulong)ptr & 1)) {
+		if (((ulong)ptr & 2) && nbytes > 1) {
+			sum += *(const u16 *)ptr;
+			ptr += 2;
+			nbytes -= 2;
+		}
+		while (nbytes >= 16) {
+			const u32 *p = (const u32 *)ptr;
 
-	sum = 0;
+			sum += (u64)p[0] + p[1] + p[2] + p[3];
+			ptr += 16;
+			nbytes -= 16;
+		}
+		while (nbytes >= 4) {
+			sum += *(const u32 *)ptr;
+			ptr += 4;
+			nbytes -= 4;
+		}
+	}
 	while (nbytes > 1) {
-		sum += *ptr++;
+		sum += *(const u16 *)ptr;
+		ptr += 2;
 		nbytes -= 2;
 	}
 	if (nbytes == 1) {
 		oddbyte = 0;
-		((u8 *)&oddbyte)[0] = *(u8 *)ptr;
+		((u8 *)&oddbyte)[0] = *ptr;
 		((u8 *)&oddbyte)[1] = 0;
 		sum += oddbyte;
 	}
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
-	sum = ~sum & 0xffff;
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
 
-	return sum;
+	return ~sum & 0xffff;
 }
 
 uint add_ip_checksums(uint offset, uint sum, uint new)
@@ -432,6 +432,44 @@ int eth_send(void *packet, int length)
 	return ret;
 }
 
+bool net_rx_csum_ok;
+
+/* Receive the packets which the device has ready with a single call */
+static int eth_rx_batch(struct udevice *current)
+{
+	struct eth_rx_pkt pkts[ETH_PACKETS_BATCH_RECV];
+	int count;
+	int i;
+
+	count = eth_get_ops(current)->recv_batch(current, ETH_RECV_CHECK_DEVICE,
+						 pkts, ETH_PACKETS_BATCH_RECV);
+	if (count <= 0)
+		return count;
+
+	for (i = 0; i < count; i++) {
+		if (pkts[i].length > 0) {
+			net_rx_csum_ok = pkts[i].csum_ok;
+			net_process_received_packet(pkts[i].packet,
+						    pkts[i].length);
+			net_rx_csum_ok = false;
+		}
+
+		/*
+		 * A packet may cause the device to be stopped or removed, in
+		 * which case the buffers are no longer the batch's to free
+		 */
+		if (eth_get_dev() != current || !eth_is_active(current))
+			return 0;
+	}
+	if (eth_get_ops(current)->free_pkt) {
+		for (i = 0; i < count; i++)
+			eth_get_ops(current)->free_pkt(current, pkts[i].packet,
+						       pkts[i].length);
+	}
+
+	return 0;
+}
+
 int eth_rx(void)
 {
 	struct udevice *current;
@@ -447,6 +485,12 @@ int eth_rx(void)
 	if (!eth_is_active(current))
 		return -EINVAL;
 
+	if (eth_get_ops(current)->recv_batch) {
+		ret = eth_rx_batch(current);
+		if (ret != -ENOSYS)
+			goto done;
+	}
+
 	/* Process up to 32 packets at one time */
 	flags = ETH_RECV_CHECK_DEVICE;
 	for (i = 0; i < ETH_PACKETS_BATCH_RECV; i++) {
@@ -461,6 +505,7 @@ int eth_rx(void)
 		if (!eth_is_active(current))
 			break;
 	}
+done:
 	if (ret == -EAGAIN)
 		ret = 0;
 	if (ret < 0) {
@@ -36,6 +36,7 @@
 #define TCP_SEND_RETRY		3
 #define TCP_SEND_TIMEOUT	2000UL
 #define TCP_RX_INACTIVE_TIMEOUT	30000UL
+#define TCP_DELAYED_ACK_TIMEOUT	40UL
 #if PKTBUFSRX != 0
   #define TCP_RCV_WND_SIZE	(PKTBUFSRX * TCP_MSS)
 #else
@@ -45,7 +46,7 @@
 #define TCP_PACKET_OK		0
 #define TCP_PACKET_DROP		1
 
-static struct tcp_stream tcp_stream;
+static struct tcp_stream tcp_streams[CONFIG_PROT_TCP_STREAMS];
 
 static int (*tcp_stream_on_create)(struct tcp_stream *tcp);
 
@@ -76,6 +77,31 @@ static uint random_port(void)
 	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
 }
 
+/**
+ * tcp_local_port() - choose a local port for a new connection
+ *
+ * Connections opened within the same tick would otherwise get the same
+ * random port, so step past any port which is already in use.
+ *
+ * Return: port number from 1024 to 17407
+ */
+static uint tcp_local_port(void)
+{
+	uint port = random_port();
+	int i;
+
+	for (i = 0; i < CONFIG_PROT_TCP_STREAMS; i++) {
+		if (tcp_streams[i].state != TCP_CLOSED &&
+		    tcp_streams[i].lport == port) {
+			port = RANDOM_PORT_START +
+				(port + 1 - RANDOM_PORT_START) % RANDOM_PORT_RANGE;
+			i = -1;
+		}
+	}
+
+	return port;
+}
+
 static inline s32 tcp_seq_cmp(u32 a, u32 b)
 {
 	return (s32)(a - b);
@@ -172,17 +198,20 @@ static void tcp_stream_destroy(struct tcp_stream *tcp)
 void tcp_init(void)
 {
 	static int initialized;
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
 	tcp_stream_on_create = NULL;
 	if (!initialized) {
 		initialized = 1;
-		memset(tcp, 0, sizeof(struct tcp_stream));
+		memset(tcp_streams, 0, sizeof(tcp_streams));
 	}
 
-	tcp_stream_set_state(tcp, TCP_CLOSED);
-	tcp_stream_set_status(tcp, TCP_ERR_RST);
-	tcp_stream_destroy(tcp);
+	for (tcp = tcp_streams; tcp < tcp_streams + CONFIG_PROT_TCP_STREAMS;
+	     tcp++) {
+		tcp_stream_set_state(tcp, TCP_CLOSED);
+		tcp_stream_set_status(tcp, TCP_ERR_RST);
+		tcp_stream_destroy(tcp);
+	}
 }
 
 void tcp_stream_set_on_create_handler(int (*on_create)(struct tcp_stream *))
@@ -193,15 +222,25 @@ void tcp_stream_set_on_create_handler(int (*on_create)(struct tcp_stream *))
 static struct tcp_stream *tcp_stream_add(struct in_addr rhost,
 					 u16 rport, u16 lport)
 {
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
-	if (!tcp_stream_on_create ||
-	    tcp->state != TCP_CLOSED)
+	if (!tcp_stream_on_create)
+		return NULL;
+
+	/* a stream which is closed but not yet destroyed is still in use */
+	for (tcp = tcp_streams; tcp < tcp_streams + CONFIG_PROT_TCP_STREAMS;
+	     tcp++) {
+		if (tcp->state == TCP_CLOSED && !tcp->rhost.s_addr)
+			break;
+	}
+	if (tcp == tcp_streams + CONFIG_PROT_TCP_STREAMS)
 		return NULL;
 
 	tcp_stream_init(tcp, rhost, rport, lport);
-	if (!tcp_stream_on_create(tcp))
+	if (!tcp_stream_on_create(tcp)) {
+		memset(tcp, 0, sizeof(struct tcp_stream));
 		return NULL;
+	}
 
 	return tcp;
 }
@@ -209,12 +248,15 @@ static struct tcp_stream *tcp_stream_add(struct in_addr rhost,
 struct tcp_stream *tcp_stream_get(int is_new, struct in_addr rhost,
 				  u16 rport, u16 lport)
 {
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
-	if (tcp->rhost.s_addr == rhost.s_addr &&
-	    tcp->rport == rport &&
-	    tcp->lport == lport)
-		return tcp;
+	for (tcp = tcp_streams; tcp < tcp_streams + CONFIG_PROT_TCP_STREAMS;
+	     tcp++) {
+		if (tcp->rhost.s_addr == rhost.s_addr &&
+		    tcp->rport == rport &&
+		    tcp->lport == lport)
+			return tcp;
+	}
 
 	return is_new ? tcp_stream_add(rhost, rport, lport) : NULL;
 }
@@ -281,12 +323,34 @@ static void tcp_stream_set_time_handler(struct tcp_stream *tcp, ulong msec,
 static void tcp_send_packet(struct tcp_stream *tcp, u8 action,
 			    u32 tcp_seq_num, u32 tcp_ack_num, u32 tx_len)
 {
+	/* any ACK sent covers the segments waiting for a delayed ACK */
+	if (action & TCP_ACK)
+		tcp->ack_pending = 0;
 	tcp->tx_packets++;
 	net_send_tcp_packet(tx_len, tcp->rhost, tcp->rport,
 			    tcp->lport, action, tcp_seq_num,
 			    tcp_ack_num);
 }
 
+/**
+ * tcp_sack_opt_len() - get the length of the SACK option sent with an ACK
+ * @tcp: tcp stream
+ *
+ * Return: option length, or TCP_OPT_LEN_2 if no SACK blocks are sent, in
+ * which case two NOPs take the place of the option
+ */
+static int tcp_sack_opt_len(struct tcp_stream *tcp)
+{
+	int cnt;
+
+	if (!IS_ENABLED(CONFIG_PROT_TCP_SACK) || !tcp->sack_ok ||
+	    tcp->lost.len <= TCP_OPT_LEN_2)
+		return TCP_OPT_LEN_2;
+
+	cnt = (tcp->lost.len - TCP_OPT_LEN_2) / TCP_OPT_LEN_8;
+	return TCP_OPT_LEN_2 + min(cnt, TCP_SACK_BLOCKS) * TCP_OPT_LEN_8;
+}
+
 static void tcp_send_repeat(struct tcp_stream *tcp)
 {
 	uchar *ptr;
@@ -307,7 +371,7 @@ static void tcp_send_repeat(struct tcp_stream *tcp)
 
 	if (tcp->retry_tx_len > 0) {
 		tcp_opts_size = ROUND_TCPHDR_BYTES(TCP_TSOPT_SIZE +
-						   tcp->lost.len);
+						   tcp_sack_opt_len(tcp));
 		ptr = net_tx_packet + net_eth_hdr_size() +
 			IP_TCP_HDR_SIZE + tcp_opts_size;
 
@@ -362,7 +426,7 @@ static void tcp_steam_tx_try(struct tcp_stream *tcp)
 	    !tcp->tx)
 		return;
 
-	tcp_opts_size = ROUND_TCPHDR_BYTES(TCP_TSOPT_SIZE + tcp->lost.len);
+	tcp_opts_size = ROUND_TCPHDR_BYTES(TCP_TSOPT_SIZE + tcp_sack_opt_len(tcp));
 	tx_len = TCP_MSS - tcp_opts_size;
 	if (tcp->fin_tx) {
 		/* do not try to send beyonds FIN packet limits */
@@ -404,8 +468,12 @@ static void tcp_stream_poll(struct tcp_stream *tcp, ulong time)
 	ulong	delta;
 	void	(*handler)(struct tcp_stream *tcp);
 
-	if (tcp->state == TCP_CLOSED)
+	if (tcp->state == TCP_CLOSED) {
+		/* the stream was closed while handling another one */
+		if (tcp->rhost.s_addr)
+			tcp_stream_destroy(tcp);
 		return;
+	}
 
 	/* handle rx inactivity timeout */
 	delta = msec_to_ticks(tcp->rx_inactiv_timeout);
@@ -417,6 +485,12 @@ static void tcp_stream_poll(struct tcp_stream *tcp, ulong time)
 		return;
 	}
 
+	/* send an ACK which was held back waiting for another segment */
+	if (tcp->ack_pending &&
+	    time - tcp->ack_time >= msec_to_ticks(TCP_DELAYED_ACK_TIMEOUT))
+		tcp_send_packet(tcp, tcp_stream_fin_needed(tcp, tcp->snd_una) |
+				TCP_ACK, tcp->snd_una, tcp->rcv_nxt, 0);
+
 	/* handle retransmit timeout */
 	if (tcp->time_handler &&
 	    time - tcp->time_start >= tcp->time_delta) {
@@ -434,8 +508,9 @@ void tcp_streams_poll(void)
 	struct tcp_stream	*tcp;
 
 	time = get_timer(0);
-	tcp = &tcp_stream;
-	tcp_stream_poll(tcp, time);
+	for (tcp = tcp_streams; tcp < tcp_streams + CONFIG_PROT_TCP_STREAMS;
+	     tcp++)
+		tcp_stream_poll(tcp, time);
 }
 
 /**
@@ -476,6 +551,40 @@ u16 tcp_set_pseudo_header(uchar *pkt, struct in_addr src, struct in_addr dest,
 	return compute_ip_checksum(pkt + PSEUDO_PAD_SIZE, checksum_len);
 }
 
+/**
+ * tcp_set_sack_blocks() - fill in the SACK blocks of an ACK
+ * @tcp: tcp stream
+ * @hill: SACK blocks in the packet
+ * @cnt: number of blocks to fill in
+ *
+ * The block holding the most recently received segment goes first, as
+ * RFC 2018 asks, followed by the others in sequence order.
+ */
+static void tcp_set_sack_blocks(struct tcp_stream *tcp,
+				struct sack_edges *hill, int cnt)
+{
+	int i, n, first = 0;
+
+	n = (tcp->lost.len - TCP_OPT_LEN_2) / TCP_OPT_LEN_8;
+	for (i = 0; i < n; i++) {
+		if (tcp_seq_cmp(tcp->sack_recent, tcp->lost.hill[i].l) >= 0 &&
+		    tcp_seq_cmp(tcp->sack_recent, tcp->lost.hill[i].r) < 0) {
+			first = i;
+			break;
+		}
+	}
+
+	hill[0].l = htonl(tcp->lost.hill[first].l);
+	hill[0].r = htonl(tcp->lost.hill[first].r);
+	for (i = 0, n = 1; n < cnt; i++) {
+		if (i == first)
+			continue;
+		hill[n].l = htonl(tcp->lost.hill[i].l);
+		hill[n].r = htonl(tcp->lost.hill[i].r);
+		n++;
+	}
+}
+
 /**
  * net_set_ack_options() - set TCP options in acknowledge packets
  * @tcp: tcp stream
@@ -492,34 +601,24 @@ int net_set_ack_options(struct tcp_stream *tcp, union tcp_build_pkt *b)
 	b->sack.t_opt.t_snd = htons(tcp->loc_timestamp);
 	b->sack.t_opt.t_rcv = tcp->rmt_timestamp;
 	b->sack.sack_v.kind = TCP_1_NOP;
-	b->sack.sack_v.len = 0;
+	b->sack.sack_v.len = TCP_1_NOP;
 
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
-		if (tcp->lost.len > TCP_OPT_LEN_2) {
+		int sack_len = tcp_sack_opt_len(tcp);
+
+		if (sack_len > TCP_OPT_LEN_2) {
 			debug_cond(DEBUG_DEV_PKT, "TCP ack opt lost.len %x\n",
 				   tcp->lost.len);
-			b->sack.sack_v.len = tcp->lost.len;
 			b->sack.sack_v.kind = TCP_V_SACK;
-			b->sack.sack_v.hill[0].l = htonl(tcp->lost.hill[0].l);
-			b->sack.sack_v.hill[0].r = htonl(tcp->lost.hill[0].r);
-
-			/*
-			 * These SACK structures are initialized with NOPs to
-			 * provide TCP header alignment padding. There are 4
-			 * SACK structures used for both header padding and
-			 * internally.
-			 */
-			b->sack.sack_v.hill[1].l = htonl(tcp->lost.hill[1].l);
-			b->sack.sack_v.hill[1].r = htonl(tcp->lost.hill[1].r);
-			b->sack.sack_v.hill[2].l = htonl(tcp->lost.hill[2].l);
-			b->sack.sack_v.hill[2].r = htonl(tcp->lost.hill[2].r);
-			b->sack.sack_v.hill[3].l = TCP_O_NOP;
-			b->sack.sack_v.hill[3].r = TCP_O_NOP;
+			b->sack.sack_v.len = sack_len;
+			tcp_set_sack_blocks(tcp, b->sack.sack_v.hill,
+					    (sack_len - TCP_OPT_LEN_2) /
+					    TCP_OPT_LEN_8);
 		}
 
 		b->sack.hdr.tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(ROUND_TCPHDR_LEN(TCP_HDR_SIZE +
 										 TCP_TSOPT_SIZE +
-										 tcp->lost.len));
+										 sack_len));
 	} else {
 		b->sack.sack_v.kind = 0;
 		b->sack.hdr.tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(ROUND_TCPHDR_LEN(TCP_HDR_SIZE +
@@ -548,8 +647,13 @@ void net_set_syn_options(struct tcp_stream *tcp, union tcp_build_pkt *b)
 	b->ip.mss.kind = TCP_O_MSS;
 	b->ip.mss.len = TCP_OPT_LEN_4;
 	b->ip.mss.mss = htons(TCP_MSS);
+	/* use the smallest scale which lets the whole window be offered */
+	tcp->loc_win_scale = 0;
+	while (tcp->loc_win_scale < TCP_MAX_SCALE &&
+	       (tcp->rcv_wnd >> tcp->loc_win_scale) > TCP_MAX_WIN)
+		tcp->loc_win_scale++;
 	b->ip.scale.kind = TCP_O_SCL;
-	b->ip.scale.scale = TCP_SCALE;
+	b->ip.scale.scale = tcp->loc_win_scale;
 	b->ip.scale.len = TCP_OPT_LEN_3;
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
 		b->ip.sack_p.kind = TCP_P_SACK;
@@ -594,6 +698,7 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 {
 	union tcp_build_pkt *b = (union tcp_build_pkt *)pkt;
 	char buf[24];
+	u32 win;
 	int pkt_hdr_len;
 	int pkt_len;
 	int tcp_len;
@@ -655,8 +760,13 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 	 * SOCs is may not be considered a constraint to buffer space, if
 	 * it is, then the u-boot tftp or nfs kernel netboot should be
 	 * considered.
+	 *
+	 * The window in a SYN segment is never scaled (RFC 7323).
 	 */
-	b->ip.hdr.tcp_win = htons(tcp->rcv_wnd >> TCP_SCALE);
+	win = tcp->rcv_wnd;
+	if (!(action & TCP_SYN))
+		win >>= tcp->loc_win_scale;
+	b->ip.hdr.tcp_win = htons(min_t(u32, win, TCP_MAX_WIN));
 
 	b->ip.hdr.tcp_xsum = 0;
 	b->ip.hdr.tcp_ugr = 0;
@@ -694,6 +804,7 @@ void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
 {
 	int i, j, cnt, cnt_move;
 
+	tcp->sack_recent = tcp_seq_num;
 	cnt = (tcp->lost.len - TCP_OPT_LEN_2) / TCP_OPT_LEN_8;
 	for (i = 0; i < cnt; i++) {
 		if (tcp_seq_cmp(tcp->lost.hill[i].r, tcp_seq_num) < 0)
@@ -719,7 +830,8 @@ void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
 			if (tcp_seq_cmp(tcp->lost.hill[j].l, tcp->lost.hill[i].r) > 0)
 				break;
 
-			tcp->lost.hill[i].r = tcp->lost.hill[j].r;
+			if (tcp_seq_cmp(tcp->lost.hill[j].r, tcp->lost.hill[i].r) > 0)
+				tcp->lost.hill[i].r = tcp->lost.hill[j].r;
 			cnt_move++;
 		}
 
@@ -727,7 +839,8 @@ void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
 			if (cnt > i + cnt_move + 1)
 				memmove(&tcp->lost.hill[i + 1],
 					&tcp->lost.hill[i + cnt_move + 1],
-					cnt_move * sizeof(struct sack_edges));
+					(cnt - i - cnt_move - 1) *
+					sizeof(struct sack_edges));
 
 			cnt -= cnt_move;
 			tcp->lost.len = TCP_OPT_LEN_2 + cnt * TCP_OPT_LEN_8;
@@ -750,8 +863,9 @@ void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
 		cnt_move = cnt - i;
 		cnt++;
 	} else {
+		/* no room, so forget the furthest hill */
 		cnt = TCP_SACK_HILLS;
-		cnt_move = TCP_SACK_HILLS - i;
+		cnt_move = TCP_SACK_HILLS - i - 1;
 	}
 
 	if (cnt_move > 0)
@@ -771,8 +885,10 @@ void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
  * @tcp: tcp stream
  * @o: pointer to the option field.
  * @o_len: length of the option field.
+ * @syn: true if this is a SYN segment, the only one which may negotiate
+ *	window scaling and SACK
  */
-void tcp_parse_options(struct tcp_stream *tcp, uchar *o, int o_len)
+void tcp_parse_options(struct tcp_stream *tcp, uchar *o, int o_len, bool syn)
 {
 	struct tcp_t_opt  *tsopt;
 	struct tcp_scale  *wsopt;
@@ -790,12 +906,19 @@ void tcp_parse_options(struct tcp_stream *tcp, uchar *o, int o_len)
 		case TCP_O_END:
 			return;
 		case TCP_O_MSS:
-		case TCP_P_SACK:
 		case TCP_V_SACK:
 			break;
+		case TCP_P_SACK:
+			if (syn)
+				tcp->sack_ok = 1;
+			break;
 		case TCP_O_SCL:
+			if (!syn)
+				break;
 			wsopt = (struct tcp_scale *)p;
-			tcp->rmt_win_scale = wsopt->scale;
+			tcp->rmt_win_scale = min_t(u8, wsopt->scale,
+						   TCP_MAX_SCALE);
+			tcp->win_scale_ok = 1;
 			break;
 		case TCP_O_TS:
 			tsopt = (struct tcp_t_opt *)p;
@@ -918,7 +1041,7 @@ static int tcp_rx_check_ack_num(struct tcp_stream *tcp, u32 tcp_seq_num,
 }
 
 static int tcp_rx_user_data(struct tcp_stream *tcp, u32 tcp_seq_num,
-			    char *buf, int len)
+			    char *buf, int len, int opt_len)
 {
 	int tmp_len;
 	u32 buf_offs, old_offs, new_offs;
@@ -958,6 +1081,21 @@ static int tcp_rx_user_data(struct tcp_stream *tcp, u32 tcp_seq_num,
 	if (tcp->on_rcv_nxt_update && old_offs != new_offs)
 		tcp->on_rcv_nxt_update(tcp, new_offs);
 
+	/*
+	 * Acknowledge every second full-sized segment (RFC 5681). Anything
+	 * else, such as a short or out-of-order segment, or one which fills
+	 * a hole, is acknowledged straight away so that the sender learns of
+	 * it quickly. A segment is full-sized if it uses the whole MSS we
+	 * advertised, less the space taken by its options.
+	 */
+	if (!tcp->ack_pending && tcp->state == TCP_ESTABLISHED &&
+	    len + opt_len >= TCP_MSS && new_offs - old_offs == len &&
+	    tcp->lost.len <= TCP_OPT_LEN_2) {
+		tcp->ack_pending = 1;
+		tcp->ack_time = get_timer(0);
+		return TCP_PACKET_OK;
+	}
+
 	action = tcp_stream_fin_needed(tcp, tcp->snd_una) | TCP_ACK;
 	tcp_send_packet(tcp, action, tcp->snd_una, tcp->rcv_nxt, 0);
 
@@ -974,19 +1112,21 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 
 	tcp_hdr_len = GET_TCP_HDR_LEN_IN_BYTES(b->ip.hdr.tcp_hlen);
 	payload_len = tcp_len - tcp_hdr_len;
+	tcp_flags = b->ip.hdr.tcp_flags;
 
 	if (tcp_hdr_len > TCP_HDR_SIZE)
 		tcp_parse_options(tcp, (uchar *)b + IP_TCP_HDR_SIZE,
-				  tcp_hdr_len - TCP_HDR_SIZE);
+				  tcp_hdr_len - TCP_HDR_SIZE,
+				  tcp_flags & TCP_SYN);
 	/*
 	 * Incoming sequence and ack numbers are server's view of the numbers.
 	 * The app must swap the numbers when responding.
 	 */
 	tcp_seq_num = ntohl(b->ip.hdr.tcp_seq);
 	tcp_ack_num = ntohl(b->ip.hdr.tcp_ack);
-	tcp_win_size = ntohs(b->ip.hdr.tcp_win) << tcp->rmt_win_scale;
-
-	tcp_flags = b->ip.hdr.tcp_flags;
+	tcp_win_size = ntohs(b->ip.hdr.tcp_win);
+	if (!(tcp_flags & TCP_SYN))
+		tcp_win_size <<= tcp->rmt_win_scale;
 
 //	printf("pkt: seq=%d, ack=%d, flags=%x, len=%d\n",
 //		tcp_seq_num - tcp->irs, tcp_ack_num - tcp->iss, tcp_flags, pkt_len);
@@ -1009,6 +1149,15 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 		tcp->irs = tcp_seq_num;
 		tcp->rcv_nxt = tcp->irs + 1;
 
+		/*
+		 * Our SYN-ACK carries neither window scale nor SACK-permitted
+		 * options, so neither may be used on this connection
+		 */
+		tcp->loc_win_scale = 0;
+		tcp->rmt_win_scale = 0;
+		tcp->win_scale_ok = 0;
+		tcp->sack_ok = 0;
+
 		tcp->iss = tcp_get_start_seq();
 		tcp->snd_una = tcp->iss;
 		tcp->snd_nxt = tcp->iss + 1;
@@ -1044,6 +1193,10 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 		/* stop retransmit of SYN */
 		tcp_stream_set_time_handler(tcp, 0, NULL);
 
+		/* window scaling is only used if both sides asked for it */
+		if (!tcp->win_scale_ok)
+			tcp->loc_win_scale = 0;
+
 		tcp->irs = tcp_seq_num;
 		tcp->rcv_nxt = tcp->irs + 1;
 		tcp->snd_una = tcp_ack_num;
@@ -1060,7 +1213,7 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 		tcp_send_packet(tcp, action, tcp->snd_una, tcp->rcv_nxt, 0);
 		tcp_rx_user_data(tcp, tcp_seq_num,
 				 ((char *)b) + pkt_len - payload_len,
-				 payload_len);
+				 payload_len, tcp_hdr_len - TCP_HDR_SIZE);
 		return;
 
 	case TCP_SYN_RECEIVED:
@@ -1103,7 +1256,8 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 
 		if (tcp_rx_user_data(tcp, tcp_seq_num,
 				     ((char *)b) + pkt_len - payload_len,
-				     payload_len) == TCP_PACKET_DROP) {
+				     payload_len, tcp_hdr_len - TCP_HDR_SIZE) ==
+		    TCP_PACKET_DROP) {
 			return;
 		}
 
@@ -1184,10 +1338,11 @@ void rxhand_tcp_f(union tcp_build_pkt *b, unsigned int pkt_len)
 		return;
 	}
 
-	/* Build pseudo header and verify TCP header */
+	/* Build pseudo header and verify TCP header, unless the device did */
 	tcp_rx_xsum = b->ip.hdr.tcp_xsum;
 	b->ip.hdr.tcp_xsum = 0;
-	if (tcp_rx_xsum != tcp_set_pseudo_header((uchar *)b, b->ip.hdr.ip_src,
+	if (!net_rx_csum_ok &&
+	    tcp_rx_xsum != tcp_set_pseudo_header((uchar *)b, b->ip.hdr.ip_src,
 						 b->ip.hdr.ip_dst, tcp_len,
 						 pkt_len)) {
 		debug_cond(DEBUG_DEV_PKT,
@@ -1212,7 +1367,7 @@ struct tcp_stream *tcp_stream_connect(struct in_addr rhost, u16 rport)
 {
 	struct tcp_stream *tcp;
 
-	tcp = tcp_stream_add(rhost, rport, random_port());
+	tcp = tcp_stream_add(rhost, rport, tcp_local_port());
 	if (!tcp)
 		return NULL;
 
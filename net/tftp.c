@@ -34,6 +34,12 @@
 #define TIMEOUT		5000UL
 /* Number of "loading" hashes per line (for checking the image size) */
 #define HASHES_PER_LINE	65
+/* Shortest time to wait before prompting the server again, in ms */
+#define TFTP_MIN_RTO	100UL
+/* Number of blocks past a gap which can be held, waiting for the gap */
+#define TFTP_OOO_BLOCKS	256
+/* Blocks received past a gap before asking for it to be sent again */
+#define TFTP_REORDER_MAX	3
 
 /*
  *	TFTP operations.
@@ -101,6 +107,37 @@ static ushort	tftp_windowsize;
 static ushort	tftp_next_ack;
 /* Last nack block we send */
 static ushort	tftp_last_nack;
+/* The window size to ask for, adapted to the loss seen */
+static ushort	tftp_window_req;
+/* The window size option that tftp_window_req was adapted from */
+static ushort	tftp_window_limit;
+/* Blocks already received past the current one, by absolute block number */
+static bool	tftp_ooo_map[TFTP_OOO_BLOCKS];
+/* Absolute number of the last block if already received, else 0 */
+static ulong	tftp_last_block;
+/* Blocks received past a gap since it was last asked for */
+static int	tftp_gap_blocks;
+/* Time the last ACK was sent, 0 if a reply has been seen since */
+static ulong	tftp_ack_time;
+/* Smoothed time for the server to reply to an ACK, in ms */
+static ulong	tftp_srtt;
+/* Time to wait before prompting the server again, in ms */
+static ulong	tftp_rto;
+
+/**
+ * struct tftp_stats - Statistics for a transfer
+ *
+ * @nacks: Number of times a block was asked for again
+ * @timeouts: Number of times the server was prompted after a timeout
+ * @ooo: Number of blocks received out of order and kept
+ * @dups: Number of blocks received more than once
+ */
+static struct tftp_stats {
+	ulong nacks;
+	ulong timeouts;
+	ulong ooo;
+	ulong dups;
+} tftp_stats;
 #ifdef CMD_TFTPPUT
 /* 1 if writing, else 0 */
 static int	tftp_put_active;
@@ -189,6 +226,10 @@ static void new_transfer(void)
 	tftp_prev_block = 0;
 	tftp_block_wrap = 0;
 	tftp_block_wrap_offset = 0;
+	memset(tftp_ooo_map, '\0', sizeof(tftp_ooo_map));
+	tftp_last_block = 0;
+	tftp_gap_blocks = 0;
+	memset(&tftp_stats, '\0', sizeof(tftp_stats));
 #ifdef CMD_TFTPPUT
 	tftp_put_final_block_sent = 0;
 #endif
@@ -283,6 +324,29 @@ static void update_block_number(void)
 	show_block_marker();
 }
 
+/* Absolute number of the current block, counting wraps */
+static ulong tftp_abs_block(void)
+{
+	return tftp_block_wrap * TFTP_SEQUENCE_SIZE + tftp_cur_block;
+}
+
+/*
+ * Adapt the window size asked for in the next transfer to the loss seen in
+ * this one: double it after a clean transfer and halve it if more than a
+ * quarter of the windows needed help.
+ */
+static void tftp_adapt_window(void)
+{
+	ulong losses = tftp_stats.nacks + tftp_stats.timeouts;
+	ulong windows = tftp_abs_block() / tftp_windowsize + 1;
+
+	if (!losses)
+		tftp_window_req = min_t(ulong, tftp_window_req * 2,
+					tftp_window_limit);
+	else if (losses * 4 > windows)
+		tftp_window_req = max(tftp_window_req / 2, 1);
+}
+
 /* The TFTP get or put is complete */
 static void tftp_complete(void)
 {
@@ -301,7 +365,14 @@ static void tftp_complete(void)
 		print_size(net_boot_file_size /
 			time_start * 1000, "/s");
 	}
+	if (tftp_stats.nacks || tftp_stats.timeouts || tftp_stats.ooo) {
+		printf("\n\t %lu resent, %lu timeouts, %lu out of order, %lu duplicates, window %d",
+		       tftp_stats.nacks, tftp_stats.timeouts, tftp_stats.ooo,
+		       tftp_stats.dups, tftp_windowsize);
+	}
 	puts("\ndone\n");
+	if (!tftp_put_active && tftp_windowsize > 1)
+		tftp_adapt_window();
 
 	led_activity_off();
 
@@ -363,9 +434,9 @@ static void tftp_send(void)
 		 * Implemented only for tftp get.
 		 * Don't bother sending if it's 1
 		 */
-		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_option > 1)
+		if (tftp_state == STATE_SEND_RRQ && tftp_window_req > 1)
 			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
-					0, tftp_window_size_option, 0);
+					0, tftp_window_req, 0);
 		len = pkt - xp;
 		break;
 
@@ -388,6 +459,8 @@ static void tftp_send(void)
 			tftp_put_final_block_sent = (loaded < toload);
 		}
 #endif
+		if (tftp_state == STATE_DATA && !tftp_put_active)
+			tftp_ack_time = get_timer(0);
 		len = pkt - xp;
 		break;
 
@@ -455,6 +528,105 @@ static void icmp_handler(unsigned type, unsigned code, unsigned dest,
 }
 #endif
 
+/* Time how long the server takes to reply to an ACK */
+static void tftp_rtt_sample(void)
+{
+	ulong rtt;
+
+	if (!tftp_ack_time)
+		return;
+	rtt = get_timer(tftp_ack_time);
+	tftp_ack_time = 0;
+	tftp_srtt = tftp_srtt ? (tftp_srtt * 7 + rtt) / 8 : rtt;
+	tftp_rto = clamp(tftp_srtt * 4, TFTP_MIN_RTO, timeout_ms);
+}
+
+/* Ask the server to send the window again, starting after the current block */
+static void tftp_send_nack(void)
+{
+	tftp_send();
+	tftp_stats.nacks++;
+	tftp_last_nack = tftp_cur_block;
+	tftp_next_ack = (ushort)(tftp_cur_block + tftp_windowsize);
+	tftp_gap_blocks = 0;
+}
+
+/*
+ * Move past the blocks already received out of order, sending an ACK at the
+ * end of each window
+ */
+static void tftp_advance(void)
+{
+	ulong next;
+
+	while (1) {
+		if (tftp_cur_block == tftp_next_ack) {
+			tftp_send();
+			tftp_next_ack += tftp_windowsize;
+		}
+		next = tftp_abs_block() + 1;
+		if (!tftp_ooo_map[next % TFTP_OOO_BLOCKS])
+			return;
+		tftp_ooo_map[next % TFTP_OOO_BLOCKS] = false;
+
+		tftp_prev_block = tftp_cur_block;
+		tftp_cur_block = (tftp_cur_block + 1) % TFTP_SEQUENCE_SIZE;
+		update_block_number();
+		if (next == tftp_last_block) {
+			tftp_send();
+			tftp_complete();
+			return;
+		}
+	}
+}
+
+/*
+ * Handle a data block which is not the next one expected. A block from
+ * further on in the window is stored straight away, so that it need not be
+ * sent again once the gap is filled. The gap is only asked for again once a
+ * few blocks have arrived past it, since it may just have been reordered,
+ * or when the server has reached the end of its window.
+ */
+static void tftp_data_out_of_order(ushort block, uchar *data, unsigned len)
+{
+	ushort dist = block - (ushort)(tftp_cur_block + 1);
+	ulong abs;
+
+	net_set_timeout_handler(tftp_rto, tftp_timeout_handler);
+
+	/* an old block, sent again */
+	if (dist >= TFTP_SEQUENCE_SIZE / 2) {
+		tftp_stats.dups++;
+		if (block == tftp_next_ack) {
+			tftp_send();
+			tftp_next_ack = (ushort)(tftp_cur_block +
+						 tftp_windowsize);
+		}
+		return;
+	}
+
+	abs = tftp_abs_block() + 1 + dist;
+	if (dist < TFTP_OOO_BLOCKS && !tftp_ooo_map[abs % TFTP_OOO_BLOCKS]) {
+		if (store_block(tftp_cur_block + 1 + dist, data, len)) {
+			eth_halt_state_only();
+			net_set_state(NETLOOP_FAIL);
+			return;
+		}
+		tftp_ooo_map[abs % TFTP_OOO_BLOCKS] = true;
+		tftp_stats.ooo++;
+		if (len < tftp_block_size)
+			tftp_last_block = abs;
+	} else if (dist < TFTP_OOO_BLOCKS) {
+		tftp_stats.dups++;
+	}
+
+	tftp_gap_blocks++;
+	if (block == tftp_next_ack ||
+	    (tftp_last_nack != tftp_cur_block &&
+	     (tftp_gap_blocks >= TFTP_REORDER_MAX || dist >= TFTP_OOO_BLOCKS)))
+		tftp_send_nack();
+}
+
 static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 unsigned src, unsigned len)
 {
@@ -598,10 +770,18 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			return;
 		len -= 2;
 
+		if (tftp_state == STATE_DATA)
+			tftp_rtt_sample();
+
 		if (ntohs(*(__be16 *)pkt) != (ushort)(tftp_cur_block + 1)) {
 			debug("Received unexpected block: %d, expected: %d\n",
 			      ntohs(*(__be16 *)pkt),
 			      (ushort)(tftp_cur_block + 1));
+			if (tftp_state == STATE_DATA) {
+				tftp_data_out_of_order(ntohs(*(__be16 *)pkt),
+						       pkt + 2, len);
+				break;
+			}
 			/*
 			 * Only ACK if the block count received is greater than
 			 * the expected block count, otherwise skip ACK.
@@ -616,12 +796,8 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 * that will arrive will cause a sending NACK.
 			 * This just overwellms the server, let's just send one.
 			 */
-			if (tftp_last_nack != tftp_cur_block) {
-				tftp_send();
-				tftp_last_nack = tftp_cur_block;
-				tftp_next_ack = (ushort)(tftp_cur_block +
-							 tftp_windowsize);
-			}
+			if (tftp_last_nack != tftp_cur_block)
+				tftp_send_nack();
 			break;
 		}
 
@@ -658,7 +834,7 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		update_block_number();
 		tftp_prev_block = tftp_cur_block;
 		timeout_count_max = tftp_timeout_count_max;
-		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+		net_set_timeout_handler(tftp_rto, tftp_timeout_handler);
 
 		if (store_block(tftp_cur_block, pkt + 2, len)) {
 			eth_halt_state_only();
@@ -675,12 +851,11 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 		/*
 		 *	Acknowledge the block just received, which will prompt
-		 *	the remote for the next one.
+		 *	the remote for the next one, after moving past any
+		 *	blocks already received.
 		 */
-		if (tftp_cur_block == tftp_next_ack) {
-			tftp_send();
-			tftp_next_ack += tftp_windowsize;
-		}
+		tftp_gap_blocks = 0;
+		tftp_advance();
 		break;
 
 	case TFTP_ERROR:
@@ -710,7 +885,21 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 static void tftp_timeout_handler(void)
 {
+	/*
+	 * Well before the server gives up on us, prompt it again, backing off
+	 * until the negotiated timeout is reached
+	 */
+	if (tftp_rto < timeout_ms) {
+		tftp_rto = min(tftp_rto * 2, timeout_ms);
+		tftp_stats.timeouts++;
+		net_set_timeout_handler(tftp_rto, tftp_timeout_handler);
+		tftp_send();
+		return;
+	}
+
 	if (++timeout_count > timeout_count_max) {
+		/* ask for a smaller window next time */
+		tftp_window_req = max(tftp_window_req / 2, 1);
 		restart("Retry count exceeded");
 	} else {
 		puts("T ");
@@ -811,6 +1000,12 @@ void tftp_start(enum proto_t protocol)
 
 	sanitize_tftp_block_size_option(protocol);
 
+	/* start again from the window size option if it has been changed */
+	if (tftp_window_limit != tftp_window_size_option) {
+		tftp_window_limit = tftp_window_size_option;
+		tftp_window_req = tftp_window_size_option;
+	}
+
 	debug("TFTP blocksize = %i, TFTP windowsize = %d timeout = %ld ms\n",
 	      tftp_block_size_option, tftp_window_size_option, timeout_ms);
 
@@ -935,6 +1130,9 @@ void tftp_start(enum proto_t protocol)
 	tftp_cur_block = 0;
 	tftp_windowsize = 1;
 	tftp_last_nack = 0;
+	tftp_ack_time = 0;
+	tftp_srtt = 0;
+	tftp_rto = timeout_ms;
 	/* zero out server ether in case the server ip has changed */
 	memset(net_server_ethaddr, 0, 6);
 	/* Revert tftp_block_size to dflt */
@@ -962,6 +1160,9 @@ void tftp_start_server(void)
 	timeout_count_max = tftp_timeout_count_max;
 	timeout_count = 0;
 	timeout_ms = TIMEOUT;
+	tftp_ack_time = 0;
+	tftp_srtt = 0;
+	tftp_rto = timeout_ms;
 	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 
 	/* Revert tftp_block_size to dflt */
@@ -15,6 +15,7 @@
 #include <net/tcp.h>
 #include <net/wget.h>
 #include <stdlib.h>
+#include <linux/sizes.h>
 
 /* The default, change with environment variable 'httpdstp' */
 #define SERVER_PORT		80
@@ -25,19 +26,56 @@
 
 #define HTTP_STATUS_BAD		0
 #define HTTP_STATUS_OK		200
+#define HTTP_STATUS_PARTIAL	206
+
+/* Smallest slice of a file worth fetching over its own connection */
+#define WGET_MIN_SLICE		SZ_1M
 
 static const char http_proto[] = "HTTP/1.0";
 static const char http_eom[] = "\r\n\r\n";
 static const char content_len[] = "Content-Length:";
+static const char accept_ranges[] = "Accept-Ranges: bytes";
 static const char linefeed[] = "\r\n";
 static struct in_addr web_server_ip;
 static unsigned int server_port;
 static unsigned long content_length;
-static u32 http_hdr_size, max_rx_pos;
+static bool ranges_ok;
 static int wget_tsize_num_hash;
 
 static char *image_url;
-static enum net_loop_state wget_loop_state;
+
+/**
+ * struct wget_conn - An HTTP connection used for a download
+ *
+ * @tcp: TCP stream, NULL when not connected
+ * @cut: true if this connection asked for the whole file but only keeps
+ *	the first @len bytes, the rest being fetched over other connections
+ * @start: Offset in the file of the first byte requested
+ * @len: Number of bytes requested with a Range header or kept from the
+ *	whole file, 0 for the whole file
+ * @hdr_size: Size of the HTTP header, 0 until it has been received
+ * @max_rx_pos: Furthest offset received in the TCP stream, (u32)-1 if none
+ * @body: Number of body bytes received without gaps
+ * @ok: true once the response header has been accepted, false again if the
+ *	connection then fails
+ */
+struct wget_conn {
+	struct tcp_stream *tcp;
+	bool cut;
+	ulong start;
+	ulong len;
+	u32 hdr_size;
+	u32 max_rx_pos;
+	ulong body;
+	bool ok;
+};
+
+static struct wget_conn wget_conns[CONFIG_PROT_TCP_STREAMS];
+static int wget_num_conns;
+/* connection being opened, picked up by tcp_stream_on_create() */
+static struct wget_conn *wget_new_conn;
+static u32 wget_rx_packets;
+static enum tcp_status wget_tcp_status;
 
 /**
  * store_block() - store block in memory
@@ -95,23 +133,61 @@ static void show_block_marker(u32 packets)
 	}
 }
 
-static void tcp_stream_on_closed(struct tcp_stream *tcp)
+/*
+ * Read the Content-Length field of an HTTP header, returning (ulong)-1 if
+ * it is missing or malformed
+ */
+static ulong wget_content_length(char *hdr)
+{
+	char *pos, *tail;
+	ulong len;
+
+	pos = strstr(hdr, content_len);
+	if (!pos)
+		return -1;
+
+	pos += strlen(content_len);
+	while (*pos == ' ')
+		pos++;
+	len = simple_strtoul(pos, &tail, 10);
+	if (*tail != '\r' && *tail != '\n' && *tail != '\0')
+		return -1;
+
+	return len;
+}
+
+/* Count the body bytes received over all connections */
+static void wget_update_size(void)
 {
-	if (tcp->status != TCP_ERR_OK)
-		wget_loop_state = NETLOOP_FAIL;
+	int i;
 
-	net_set_state(wget_loop_state);
-	if (wget_loop_state != NETLOOP_SUCCESS) {
+	net_boot_file_size = 0;
+	for (i = 0; i < wget_num_conns; i++)
+		net_boot_file_size += wget_conns[i].body;
+}
+
+static void wget_finish(void)
+{
+	enum net_loop_state state = NETLOOP_SUCCESS;
+	int i;
+
+	for (i = 0; i < wget_num_conns; i++) {
+		if (!wget_conns[i].ok)
+			state = NETLOOP_FAIL;
+	}
+
+	net_set_state(state);
+	if (state != NETLOOP_SUCCESS) {
 		net_boot_file_size = 0;
 		if (!wget_info->silent)
 			printf("\nwget: Transfer Fail, TCP status - %d\n",
-			       tcp->status);
+			       wget_tcp_status);
 		return;
 	}
 
 	if (!wget_info->silent)
 		printf("\nPackets received %d, Transfer Successful\n",
-		       tcp->rx_packets);
+		       wget_rx_packets);
 	wget_info->file_size = net_boot_file_size;
 	if (wget_info->method == WGET_HTTP_METHOD_GET && wget_info->set_bootdev) {
 		efi_set_bootdev("Http", NULL, image_url,
@@ -121,19 +197,111 @@ static void tcp_stream_on_closed(struct tcp_stream *tcp)
 	}
 }
 
+static int wget_connect(struct wget_conn *conn)
+{
+	struct tcp_stream *tcp;
+
+	wget_new_conn = conn;
+	tcp = tcp_stream_connect(web_server_ip, server_port);
+	wget_new_conn = NULL;
+	if (!tcp)
+		return -ENOSPC;
+	tcp_stream_put(tcp);
+
+	return 0;
+}
+
+static void wget_init_conn(struct wget_conn *conn, ulong start, ulong len)
+{
+	memset(conn, '\0', sizeof(*conn));
+	conn->start = start;
+	conn->len = len;
+	conn->max_rx_pos = (u32)(-1);
+}
+
+/*
+ * The response to the first request shows that the server accepts Range
+ * requests for a file large enough to split. Keep the start of the file on
+ * this connection and fetch the rest in slices over new ones, from the end.
+ * If fewer connections can be opened, this one keeps all that is left.
+ */
+static void wget_split(struct wget_conn *conn)
+{
+	ulong slice, start;
+	int i, count;
+
+	count = min_t(ulong, CONFIG_PROT_TCP_STREAMS,
+		      content_length / WGET_MIN_SLICE);
+	if (count < 2)
+		return;
+	slice = DIV_ROUND_UP(content_length, count);
+
+	for (i = 1; i < count; i++) {
+		start = (count - i) * slice;
+		wget_init_conn(&wget_conns[i], start,
+			       min(slice, content_length - start));
+		if (wget_connect(&wget_conns[i]))
+			break;
+	}
+	wget_num_conns = i;
+	if (i == 1)
+		return;
+
+	debug_cond(DEBUG_WGET, "wget: fetching over %d connection(s)\n", i);
+	conn->len = wget_conns[i - 1].start;
+	conn->cut = true;
+}
+
+static void tcp_stream_on_closed(struct tcp_stream *tcp)
+{
+	struct wget_conn *conn = tcp->priv;
+	int i;
+
+	conn->tcp = NULL;
+	wget_rx_packets += tcp->rx_packets;
+	/* a cut connection is reset once it has what it keeps */
+	if ((tcp->status != TCP_ERR_OK && !conn->cut) ||
+	    (conn->len && conn->body != conn->len)) {
+		if (conn->ok || !wget_tcp_status)
+			wget_tcp_status = tcp->status;
+		conn->ok = false;
+	}
+
+	/* the download cannot complete, so stop the other connections */
+	if (!conn->ok) {
+		for (i = 0; i < wget_num_conns; i++) {
+			if (wget_conns[i].tcp)
+				tcp_stream_reset(wget_conns[i].tcp);
+		}
+	}
+
+	for (i = 0; i < wget_num_conns; i++) {
+		if (wget_conns[i].tcp)
+			return;
+	}
+	wget_finish();
+}
+
 static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 {
+	struct wget_conn *conn = tcp->priv;
 	char	*pos, *tail;
 	uchar	saved, *ptr;
 	int	reply_len;
+	u32	expect;
 
-	if (http_hdr_size) {
-		net_boot_file_size = rx_bytes - http_hdr_size;
+	if (conn->hdr_size) {
+		conn->body = rx_bytes - conn->hdr_size;
+		if (conn->cut && conn->body >= conn->len) {
+			conn->body = conn->len;
+			tcp_stream_reset(tcp);
+		}
+		wget_update_size();
 		show_block_marker(tcp->rx_packets);
 		return;
 	}
 
-	ptr = map_sysmem(image_load_addr, rx_bytes + 1);
+	ptr = map_sysmem(image_load_addr + conn->start, rx_bytes + 1);
 
 	saved = ptr[rx_bytes];
 	ptr[rx_bytes] = '\0';
@@ -151,10 +319,11 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 		goto end;
 	}
 
-	http_hdr_size = pos - (char *)ptr + strlen(http_eom);
+	conn->hdr_size = pos - (char *)ptr + strlen(http_eom);
 	*pos = '\0';
 
-	if (wget_info->headers && http_hdr_size < MAX_HTTP_HEADERS_SIZE)
+	if (wget_info->headers && !conn->start &&
+	    conn->hdr_size < MAX_HTTP_HEADERS_SIZE)
 		strcpy(wget_info->headers, ptr);
 
 	/* check for HTTP proto */
@@ -170,7 +339,7 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 	if (pos)
 		reply_len = pos - (char *)ptr;
 	else
-		reply_len = http_hdr_size - strlen(http_eom);
+		reply_len = conn->hdr_size - strlen(http_eom);
 
 	pos = strchr((char *)ptr, ' ');
 	if (!pos || pos - (char *)ptr > reply_len) {
@@ -191,26 +360,30 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 	debug_cond(DEBUG_WGET,
 		   "wget: HTTP Status Code %d\n", wget_info->status_code);
 
-	if (wget_info->status_code != HTTP_STATUS_OK) {
+	/* a server which ignores the Range header sends the whole file */
+	expect = conn->len ? HTTP_STATUS_PARTIAL : HTTP_STATUS_OK;
+	if (wget_info->status_code != expect) {
 		debug_cond(DEBUG_WGET, "wget: Connected Bad Xfer\n");
 		tcp_stream_close(tcp);
 		goto end;
 	}
+	wget_info->status_code = HTTP_STATUS_OK;
 
 	debug_cond(DEBUG_WGET, "wget: Connctd pkt %p  hlen %x\n",
-		   ptr, http_hdr_size);
+		   ptr, conn->hdr_size);
 
-	content_length = -1;
-	pos = strstr((char *)ptr, content_len);
-	if (pos) {
-		pos += strlen(content_len) + 1;
-		while (*pos == ' ')
-			pos++;
-		content_length = simple_strtoul(pos, &tail, 10);
-		if (*tail != '\r' && *tail != '\n' && *tail != '\0')
-			content_length = -1;
+	if (conn->len) {
+		if (wget_content_length((char *)ptr) != conn->len) {
+			debug_cond(DEBUG_WGET,
+				   "wget: Connected Bad Xfer (bad range)\n");
+			tcp_stream_close(tcp);
+			goto end;
+		}
+		goto accept;
 	}
 
+	ranges_ok = strstr((char *)ptr, accept_ranges);
+	content_length = wget_content_length((char *)ptr);
 	if (content_length != -1) {
 		debug_cond(DEBUG_WGET,
 			   "wget: Connected Len %lu\n",
@@ -221,11 +394,21 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 			goto end;
 		}
 
+		if (CONFIG_IS_ENABLED(WGET_PARALLEL) && ranges_ok &&
+		    wget_info->method == WGET_HTTP_METHOD_GET)
+			wget_split(conn);
 	}
 
-	net_boot_file_size = rx_bytes - http_hdr_size;
-	memmove(ptr, ptr + http_hdr_size, max_rx_pos + 1 - http_hdr_size);
-	wget_loop_state = NETLOOP_SUCCESS;
+accept:
+	conn->body = rx_bytes - conn->hdr_size;
+	memmove(ptr, ptr + conn->hdr_size,
+		conn->max_rx_pos + 1 - conn->hdr_size);
+	if (conn->cut && conn->body >= conn->len) {
+		conn->body = conn->len;
+		tcp_stream_reset(tcp);
+	}
+	wget_update_size();
+	conn->ok = true;
 
 end:
 	unmap_sysmem(ptr);
@@ -233,11 +416,33 @@ end:
 
 static int tcp_stream_rx(struct tcp_stream *tcp, u32 rx_offs, void *buf, int len)
 {
-	if ((max_rx_pos == (u32)(-1)) || (max_rx_pos < rx_offs + len - 1))
-		max_rx_pos = rx_offs + len - 1;
+	struct wget_conn *conn = tcp->priv;
+
+	/*
+	 * Keep to this connection's slice of the buffer. Until the header
+	 * has been seen, data is stored straight after it, so refuse anything
+	 * which would run past the slice; it is sent again later.
+	 */
+	if (conn->len) {
+		if (!conn->hdr_size && rx_offs + len > conn->len)
+			return 0;
+		if (conn->hdr_size &&
+		    rx_offs - conn->hdr_size + len > conn->len) {
+			if (!conn->cut)
+				return -1;
+			/* drop what the other connections fetch */
+			if (rx_offs - conn->hdr_size >= conn->len)
+				return 0;
+			len = conn->len - (rx_offs - conn->hdr_size);
+		}
+	}
+
+	if ((conn->max_rx_pos == (u32)(-1)) ||
+	    (conn->max_rx_pos < rx_offs + len - 1))
+		conn->max_rx_pos = rx_offs + len - 1;
 
 	// Avoid overflow
-	if (store_block(buf, rx_offs - http_hdr_size, len) < 0)
+	if (store_block(buf, conn->start + rx_offs - conn->hdr_size, len) < 0)
 		return -1;
 
 	return len;
@@ -245,6 +450,7 @@ static int tcp_stream_rx(struct tcp_stream *tcp, u32 rx_offs, void *buf, int len
 
 static int tcp_stream_tx(struct tcp_stream *tcp, u32 tx_offs, void *buf, int maxlen)
 {
+	struct wget_conn *conn = tcp->priv;
 	int ret;
 	const char *method;
 
@@ -261,16 +467,40 @@ static int tcp_stream_tx(struct tcp_stream *tcp, u32 tx_offs, void *buf, int max
 		break;
 	}
 
-	ret = snprintf(buf, maxlen, "%s %s %s\r\n\r\n",
-		       method, image_url, http_proto);
+	if (conn->len)
+		ret = snprintf(buf, maxlen,
+			       "%s %s %s\r\nRange: bytes=%lu-%lu\r\n\r\n",
+			       method, image_url, http_proto, conn->start,
+			       conn->start + conn->len - 1);
+	else
+		ret = snprintf(buf, maxlen, "%s %s %s\r\n\r\n",
+			       method, image_url, http_proto);
 
 	return ret;
 }
 
+/*
+ * Incoming segments are stored at their final place as they arrive, even out
+ * of order, so offer a receive window as large as the space left for the
+ * download.
+ */
+static u32 wget_rcv_wnd(struct tcp_stream *tcp)
+{
+	ulong avail = CONFIG_PROT_TCP_MAX_RCV_WND * SZ_1K;
+
+	if (wget_info->buffer_size)
+		avail = min(avail, wget_info->buffer_size);
+	else if (CONFIG_IS_ENABLED(LMB) && wget_info->set_bootdev)
+		avail = min_t(ulong, avail,
+			      lmb_get_free_size(image_load_addr));
+
+	return max_t(ulong, avail, tcp->rcv_wnd);
+}
+
 static int tcp_stream_on_create(struct tcp_stream *tcp)
 {
 	if (tcp->rhost.s_addr != web_server_ip.s_addr ||
-	    tcp->rport != server_port)
+	    tcp->rport != server_port || !wget_new_conn)
 		return 0;
 
 	tcp->max_retry_count = WGET_RETRY_COUNT;
@@ -279,6 +509,9 @@ static int tcp_stream_on_create(struct tcp_stream *tcp)
 	tcp->on_rcv_nxt_update = tcp_stream_on_rcv_nxt_update;
 	tcp->rx = tcp_stream_rx;
 	tcp->tx = tcp_stream_tx;
+	tcp->rcv_wnd = wget_rcv_wnd(tcp);
+	tcp->priv = wget_new_conn;
+	wget_new_conn->tcp = tcp;
 
 	return 1;
 }
@@ -287,8 +520,6 @@ static int tcp_stream_on_create(struct tcp_stream *tcp)
 
 void wget_start(void)
 {
-	struct tcp_stream *tcp;
-
 	if (!wget_info)
 		wget_info = &default_wget_info;
 
@@ -337,11 +568,12 @@ void wget_start(void)
 
 	memset(net_server_ethaddr, 0, 6);
 
-	max_rx_pos = (u32)(-1);
 	net_boot_file_size = 0;
-	http_hdr_size = 0;
 	wget_tsize_num_hash = 0;
-	wget_loop_state = NETLOOP_FAIL;
+	wget_rx_packets = 0;
+	wget_tcp_status = TCP_ERR_OK;
+	content_length = -1;
+	ranges_ok = false;
 
 	wget_info->status_code = HTTP_STATUS_BAD;
 	wget_info->file_size = 0;
@@ -349,16 +581,21 @@ void wget_start(void)
 	if (wget_info->headers)
 		wget_info->headers[0] = 0;
 
+	/*
+	 * Ask for the whole file. Its response shows whether it is worth
+	 * fetching the rest over several connections.
+	 */
+	wget_num_conns = 1;
+	wget_init_conn(&wget_conns[0], 0, 0);
+
 	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
 	tcp_stream_set_on_create_handler(tcp_stream_on_create);
-	tcp = tcp_stream_connect(web_server_ip, server_port);
-	if (!tcp) {
+	if (wget_connect(&wget_conns[0])) {
 		if (!wget_info->silent)
 			printf("No free tcp streams\n");
 		net_set_state(NETLOOP_FAIL);
 		return;
 	}
-	tcp_stream_put(tcp);
 }
 
 int wget_do_request(ulong dst_addr, char *uri)
@@ -6,8 +6,12 @@
  * Written by Simon Glass <sjg@chromium.org>
  */
 
+#include <bootstage.h>
 #include <image.h>
+#include <mapmem.h>
 #include <test/ut.h>
+#include <u-boot/sha256.h>
+#include <linux/libfdt.h>
 #include "bootstd_common.h"
 
 /* Test of image phase */
@@ -32,3 +36,224 @@ static int test_image_phase(struct unit_test_state *uts)
 	return 0;
 }
 BOOTSTD_TEST(test_image_phase, 0);
+
+/* Test calculating FIT image hashes ahead of verification */
+static int test_image_fit_hash(struct unit_test_state *uts)
+{
+	u8 digest[SHA256_SUM_LEN], value[FIT_MAX_HASH_LEN];
+	struct fit_hash_stream hs;
+	int images, node, hash;
+	int value_len;
+	char fit[0x2000];
+	u8 buf[0x1000];
+	int i;
+
+	if (!CONFIG_IS_ENABLED(FIT_HASH_CACHE))
+		return -EAGAIN;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 7;
+	sha256_csum_wd(buf, sizeof(buf), digest, CHUNKSZ_SHA256);
+
+	ut_assertok(fdt_create_empty_tree(fit, sizeof(fit)));
+	images = fdt_add_subnode(fit, 0, "images");
+	ut_assert(images >= 0);
+	node = fdt_add_subnode(fit, images, "kernel");
+	ut_assert(node >= 0);
+	ut_assertok(fdt_setprop(fit, node, FIT_DATA_PROP, buf, sizeof(buf)));
+	hash = fdt_add_subnode(fit, node, "hash-1");
+	ut_assert(hash >= 0);
+	ut_assertok(fdt_setprop_string(fit, hash, FIT_ALGO_PROP, "sha256"));
+	ut_assertok(fdt_setprop(fit, hash, FIT_VALUE_PROP, digest,
+				sizeof(digest)));
+
+	/* hash the data in pieces, as if it were being read */
+	ut_asserteq(1, fit_image_hash_stream_start(&hs, fit, node));
+	fit_image_hash_stream_update(&hs, buf, 0x300);
+	fit_image_hash_stream_update(&hs, buf + 0x300, sizeof(buf) - 0x300);
+	fit_image_hash_stream_finish(&hs, buf, sizeof(buf));
+	ut_assertok(fit_image_hash_lookup(fit, hash, buf, sizeof(buf), value,
+					  &value_len));
+	ut_asserteq(SHA256_SUM_LEN, value_len);
+	ut_asserteq_mem(digest, value, value_len);
+
+	/* the result only applies to the data which was hashed */
+	ut_asserteq(-ENOENT, fit_image_hash_lookup(fit, hash, buf, 0x300,
+						   value, &value_len));
+	fit_image_hash_clear();
+	ut_asserteq(-ENOENT, fit_image_hash_lookup(fit, hash, buf, sizeof(buf),
+						   value, &value_len));
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_hash, 0);
+
+/* Addresses used for loading a FIT with external data */
+#define TEST_FIT_ADDR		0x200000
+#define TEST_FIT_LOAD		0x300000
+#define TEST_FIT_HDR_SIZE	0x1000
+
+static int test_fit_reads;
+
+/* Read the external data of the FIT, which follows the header */
+static int test_fit_read(struct fit_loader *ldr, ulong offset, ulong size,
+			 void *buf)
+{
+	memcpy(buf, ldr->priv + offset - TEST_FIT_HDR_SIZE, size);
+	test_fit_reads++;
+
+	return 0;
+}
+
+/* Set up a FIT header with a kernel whose data follows the header */
+static int setup_test_fit(struct unit_test_state *uts, const void *data,
+			  int size, const char *comp)
+{
+	u8 digest[SHA256_SUM_LEN];
+	int node, hash;
+	void *fit;
+
+	sha256_csum_wd(data, size, digest, CHUNKSZ_SHA256);
+	fit = map_sysmem(TEST_FIT_ADDR, TEST_FIT_HDR_SIZE);
+	ut_assertok(fdt_create_empty_tree(fit, TEST_FIT_HDR_SIZE));
+	ut_assertok(fdt_setprop_string(fit, 0, FIT_DESC_PROP, "test"));
+	ut_assertok(fdt_setprop_u32(fit, 0, FIT_TIMESTAMP_PROP, 0));
+	node = fdt_add_subnode(fit, 0, "images");
+	ut_assert(node >= 0);
+	node = fdt_add_subnode(fit, node, "kernel");
+	ut_assert(node >= 0);
+	ut_assertok(fdt_setprop_string(fit, node, FIT_TYPE_PROP, "kernel"));
+	ut_assertok(fdt_setprop_string(fit, node, FIT_OS_PROP, "linux"));
+	ut_assertok(fdt_setprop_string(fit, node, FIT_ARCH_PROP,
+				       genimg_get_arch_short_name(IH_ARCH_DEFAULT)));
+	ut_assertok(fdt_setprop_string(fit, node, FIT_COMP_PROP, comp));
+	ut_assertok(fdt_setprop_u32(fit, node, FIT_LOAD_PROP, TEST_FIT_LOAD));
+	ut_assertok(fdt_setprop_u32(fit, node, FIT_DATA_POSITION_PROP,
+				    TEST_FIT_HDR_SIZE));
+	ut_assertok(fdt_setprop_u32(fit, node, FIT_DATA_SIZE_PROP, size));
+	hash = fdt_add_subnode(fit, node, "hash-1");
+	ut_assert(hash >= 0);
+	ut_assertok(fdt_setprop_string(fit, hash, FIT_ALGO_PROP, "sha256"));
+	ut_assertok(fdt_setprop(fit, hash, FIT_VALUE_PROP, digest,
+				sizeof(digest)));
+
+	return 0;
+}
+
+static int test_fit_load(struct bootm_headers *images,
+			 enum fit_load_op load_op, ulong *datap, ulong *lenp)
+{
+	const char *uname = "kernel";
+
+	return fit_image_load(images, TEST_FIT_ADDR, &uname, NULL,
+			      IH_ARCH_DEFAULT, IH_TYPE_KERNEL,
+			      BOOTSTAGE_ID_FIT_KERNEL_START, load_op, datap,
+			      lenp);
+}
+
+/* Test reading image data only when the image is loaded */
+static int test_image_fit_external(struct unit_test_state *uts)
+{
+	struct bootm_headers images;
+	struct fit_loader ldr;
+	ulong data, len;
+	u8 ext[0x1000];
+	int i;
+
+	if (!CONFIG_IS_ENABLED(FIT_EXTERNAL_LOAD))
+		return -EAGAIN;
+
+	for (i = 0; i < sizeof(ext); i++)
+		ext[i] = i * 3;
+	ut_assertok(setup_test_fit(uts, ext, sizeof(ext), "none"));
+
+	ldr.read = test_fit_read;
+	ldr.priv = ext;
+	ldr.addr = TEST_FIT_ADDR;
+	fit_set_loader(&ldr);
+
+	/* the data should be read straight to the load address */
+	memset(&images, '\0', sizeof(images));
+	images.verify = 1;
+	memset(map_sysmem(TEST_FIT_LOAD, sizeof(ext)), '\0', sizeof(ext));
+	test_fit_reads = 0;
+	ut_assert(test_fit_load(&images, FIT_LOAD_OPTIONAL, &data, &len) >= 0);
+	ut_asserteq(TEST_FIT_LOAD, data);
+	ut_asserteq(sizeof(ext), len);
+	ut_asserteq_mem(ext, map_sysmem(TEST_FIT_LOAD, len), len);
+	ut_asserteq(1, test_fit_reads);
+
+	/* a corrupted image must be rejected */
+	ext[0x10] ^= 1;
+	ut_asserteq(-EACCES, test_fit_load(&images, FIT_LOAD_OPTIONAL, &data,
+					   &len));
+	ext[0x10] ^= 1;
+
+	/* the loader must not be used once the header has changed */
+	ut_assertok(fdt_setprop_string(map_sysmem(TEST_FIT_ADDR, 0), 0,
+				       FIT_DESC_PROP, "other"));
+	test_fit_reads = 0;
+	test_fit_load(&images, FIT_LOAD_OPTIONAL, &data, &len);
+	ut_asserteq(0, test_fit_reads);
+	fit_set_loader(NULL);
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_external, 0);
+
+/* Test decompressing a kernel while it is read */
+static int test_image_fit_external_decomp(struct unit_test_state *uts)
+{
+	/* LZ4 frame holding two uncompressed blocks, as lz4 -BD would */
+	static const u8 frame[] = {
+		0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0x82,
+		0x05, 0x00, 0x00, 0x80, 'h', 'e', 'l', 'l', 'o',
+		0x06, 0x00, 0x00, 0x80, ' ', 'w', 'o', 'r', 'l', 'd',
+		0x00, 0x00, 0x00, 0x00,
+	};
+	struct bootm_headers images;
+	struct fit_loader ldr;
+	ulong data, len;
+	u8 ext[sizeof(frame)];
+
+	if (!CONFIG_IS_ENABLED(FIT_EXTERNAL_DECOMP) ||
+	    !CONFIG_IS_ENABLED(LZ4))
+		return -EAGAIN;
+
+	memcpy(ext, frame, sizeof(frame));
+	ut_assertok(setup_test_fit(uts, ext, sizeof(ext), "lz4"));
+	ldr.read = test_fit_read;
+	ldr.priv = ext;
+	ldr.addr = TEST_FIT_ADDR;
+	fit_set_loader(&ldr);
+
+	/* bootm ignores the load address here, but decompresses to it */
+	memset(&images, '\0', sizeof(images));
+	images.verify = 1;
+	memset(map_sysmem(TEST_FIT_LOAD, 0x10), '\0', 0x10);
+	ut_assert(test_fit_load(&images, FIT_LOAD_IGNORED, &data, &len) >= 0);
+	ut_asserteq(TEST_FIT_LOAD, data);
+	ut_asserteq(11, len);
+	ut_asserteq_mem("hello world", map_sysmem(TEST_FIT_LOAD, len), len);
+	ut_assert(images.fit_os_decomp);
+
+	/* corrupted data must be rejected before it is decompressed */
+	ext[sizeof(ext) - 6] ^= 1;
+	memset(map_sysmem(TEST_FIT_LOAD, 0x10), '\0', 0x10);
+	ut_asserteq(-EACCES, test_fit_load(&images, FIT_LOAD_IGNORED, &data,
+					   &len));
+	ut_asserteq(0, *(u8 *)map_sysmem(TEST_FIT_LOAD, 1));
+	ext[sizeof(ext) - 6] ^= 1;
+
+	/* without verification, the data is decompressed as it is read */
+	memset(&images, '\0', sizeof(images));
+	memset(map_sysmem(TEST_FIT_LOAD, 0x10), '\0', 0x10);
+	ut_assert(test_fit_load(&images, FIT_LOAD_IGNORED, &data, &len) >= 0);
+	fit_set_loader(NULL);
+	ut_asserteq(11, len);
+	ut_asserteq_mem("hello world", map_sysmem(TEST_FIT_LOAD, len), len);
+	ut_assert(images.fit_os_decomp);
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_external_decomp, 0);
@@ -12,6 +12,7 @@
 #include <fdtdec.h>
 #include <log.h>
 #include <malloc.h>
+#include <mapmem.h>
 #include <net.h>
 #include <net/tcp.h>
 #include <net/wget.h>
@@ -22,6 +23,7 @@
 #include <test/cmd.h>
 #include <test/test.h>
 #include <test/ut.h>
+#include <linux/sizes.h>
 
 #define SHIFT_TO_TCPHDRLEN_FIELD(x) ((x) << 4)
 #define LEN_B_TO_DW(x) ((x) >> 2)
@@ -226,6 +228,7 @@ static int net_test_wget(struct unit_test_state *uts)
 	env_set("wgetaddr", "0x20000");
 	ut_assertok(run_command("wget ${wgetaddr} 1.1.2.2:/index.html", 0));
 	ut_assert_nextline_empty();
+	/* the file is too small to split, so there is only one request */
 	ut_assert_nextline("Packets received 5, Transfer Successful");
 	ut_assert_nextline("Bytes transferred = 29 (1d hex)");
 
@@ -242,6 +245,345 @@ static int net_test_wget(struct unit_test_state *uts)
 }
 CMD_TEST(net_test_wget, UTF_CONSOLE);
 
+/* Number of connections the Range server can track */
+#define SB_RANGE_CONNS		4
+
+/* Payload of each segment, short enough that every one is ACKed at once */
+#define SB_RANGE_SEG		1024
+
+/* Size of the file, large enough to be fetched over two connections */
+#define SB_RANGE_FILE_SIZE	(SZ_2M + 1000)
+
+/**
+ * struct sb_range_conn - A connection to the fake HTTP server
+ *
+ * @port: Client port, 0 if unused
+ * @irs: Initial sequence number of the client
+ * @iss: Initial sequence number of the server
+ * @req: true once the request has been received
+ * @start: Offset in the file of the first byte sent
+ * @len: Number of bytes of the file sent, 0 for a HEAD request
+ * @hdr_len: Length of the response header
+ * @hdr: Response header
+ */
+struct sb_range_conn {
+	u16 port;
+	u32 irs;
+	u32 iss;
+	bool req;
+	ulong start;
+	ulong len;
+	int hdr_len;
+	char hdr[256];
+};
+
+/**
+ * struct sb_range_server - A fake HTTP server which may accept Range requests
+ *
+ * @advertise: true to send 'Accept-Ranges: bytes'
+ * @honour: true to answer Range requests with 206, false to send the whole
+ *	file instead
+ * @range_reqs: Number of requests with a Range header
+ * @conns: Open connections
+ */
+static struct sb_range_server {
+	bool advertise;
+	bool honour;
+	int range_reqs;
+	struct sb_range_conn conns[SB_RANGE_CONNS];
+} sb_range;
+
+/* Contents of the file, different in each slice and each 256-byte block */
+static u8 sb_range_byte(ulong ofs)
+{
+	return ofs ^ (ofs >> 8) ^ (ofs >> 16);
+}
+
+static struct sb_range_conn *sb_range_find(u16 port, bool add)
+{
+	int i;
+
+	for (i = 0; i < SB_RANGE_CONNS; i++) {
+		if (sb_range.conns[i].port == port)
+			return &sb_range.conns[i];
+	}
+	if (!add)
+		return NULL;
+	for (i = 0; i < SB_RANGE_CONNS; i++) {
+		if (!sb_range.conns[i].port)
+			return &sb_range.conns[i];
+	}
+
+	return NULL;
+}
+
+/* Send a segment with @len bytes of the response, starting at @ofs */
+static int sb_range_send(struct udevice *dev, void *packet,
+			 struct sb_range_conn *conn, u32 ofs, u32 ack,
+			 u8 flags, int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_send;
+	struct ip_tcp_hdr *tcp_send;
+	int i, pkt_len;
+	u8 *data;
+
+	/* Don't allow the buffer to overrun */
+	if (priv->recv_packets >= PKTBUFSRX)
+		return 0;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+	tcp_send = (void *)eth_send + ETHER_HDR_SIZE;
+	tcp_send->tcp_src = tcp->tcp_dst;
+	tcp_send->tcp_dst = tcp->tcp_src;
+	tcp_send->tcp_seq = htonl(conn->iss + 1 + ofs);
+	tcp_send->tcp_ack = htonl(ack);
+	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
+	tcp_send->tcp_flags = flags;
+	tcp_send->tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
+	tcp_send->tcp_xsum = 0;
+	tcp_send->tcp_ugr = 0;
+
+	data = (void *)tcp_send + IP_TCP_HDR_SIZE;
+	for (i = 0; i < len; i++, ofs++) {
+		if (ofs < conn->hdr_len)
+			data[i] = conn->hdr[ofs];
+		else
+			data[i] = sb_range_byte(conn->start + ofs -
+						conn->hdr_len);
+	}
+
+	pkt_len = IP_TCP_HDR_SIZE + len;
+	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
+						   tcp->ip_src,
+						   tcp->ip_dst,
+						   pkt_len - IP_HDR_SIZE,
+						   pkt_len);
+	net_set_ip_header((uchar *)tcp_send,
+			  tcp->ip_src,
+			  tcp->ip_dst,
+			  pkt_len,
+			  IPPROTO_TCP);
+
+	priv->recv_packet_length[priv->recv_packets] = ETHER_HDR_SIZE + pkt_len;
+	++priv->recv_packets;
+
+	return 0;
+}
+
+/* Work out the response to an HTTP request */
+static void sb_range_request(struct sb_range_conn *conn, const char *data,
+			     int len)
+{
+	ulong total = SB_RANGE_FILE_SIZE;
+	char req[256], *range, *end;
+	ulong last;
+
+	strlcpy(req, data, min_t(int, len + 1, sizeof(req)));
+	conn->req = true;
+	conn->start = 0;
+	conn->len = total;
+
+	range = strstr(req, "Range: bytes=");
+	if (range)
+		sb_range.range_reqs++;
+	if (range && sb_range.honour) {
+		conn->start = simple_strtoul(range + 13, &end, 10);
+		last = simple_strtoul(end + 1, NULL, 10);
+		conn->len = last + 1 - conn->start;
+		snprintf(conn->hdr, sizeof(conn->hdr),
+			 "HTTP/1.1 206 Partial Content\r\n"
+			 "Content-Range: bytes %lu-%lu/%lu\r\n"
+			 "Content-Length: %lu\r\n\r\n",
+			 conn->start, last, total, conn->len);
+	} else {
+		snprintf(conn->hdr, sizeof(conn->hdr),
+			 "HTTP/1.1 200 OK\r\n%s"
+			 "Content-Length: %lu\r\n\r\n",
+			 sb_range.advertise ? "Accept-Ranges: bytes\r\n" : "",
+			 total);
+	}
+	if (!strncmp(req, "HEAD ", 5))
+		conn->len = 0;
+	conn->hdr_len = strlen(conn->hdr);
+}
+
+static int sb_range_syn_handler(struct udevice *dev, void *packet,
+				unsigned int len)
+{
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	struct sb_range_conn *conn;
+
+	conn = sb_range_find(ntohs(tcp->tcp_src), true);
+	if (!conn)
+		return 0;
+
+	memset(conn, '\0', sizeof(*conn));
+	conn->port = ntohs(tcp->tcp_src);
+	conn->irs = ntohl(tcp->tcp_seq);
+	conn->iss = ~conn->irs; /* just to differ from irs */
+
+	/* the SYN takes the sequence number before the response */
+	return sb_range_send(dev, packet, conn, -1, conn->irs + 1,
+			     TCP_SYN | TCP_ACK, 0);
+}
+
+/*
+ * Send the next segment of the response each time the client acknowledges
+ * one, then close the connection
+ */
+static int sb_range_ack_handler(struct udevice *dev, void *packet,
+				unsigned int len)
+{
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	struct sb_range_conn *conn;
+	int hdr_len, data_len;
+	u32 ofs, ack, resp_len;
+
+	conn = sb_range_find(ntohs(tcp->tcp_src), false);
+	if (!conn)
+		return 0;
+	if (tcp->tcp_flags & TCP_RST) {
+		conn->port = 0;
+		return 0;
+	}
+
+	hdr_len = IP_HDR_SIZE + GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	data_len = len - ETHER_HDR_SIZE - hdr_len;
+	ack = ntohl(tcp->tcp_seq) + data_len;
+	if (tcp->tcp_flags & TCP_FIN)
+		ack++;
+	ofs = ntohl(tcp->tcp_ack) - conn->iss - 1;
+
+	if (data_len && !conn->req)
+		sb_range_request(conn, (void *)tcp + hdr_len, data_len);
+	if (!conn->req)
+		return 0;
+
+	resp_len = conn->hdr_len + conn->len;
+	if (tcp->tcp_flags & TCP_FIN) {
+		/* the client is closing, perhaps before the end */
+		if (ofs > resp_len)
+			return sb_range_send(dev, packet, conn, ofs, ack,
+					     TCP_ACK, 0);
+		return sb_range_send(dev, packet, conn, ofs, ack,
+				     TCP_ACK | TCP_FIN, 0);
+	}
+	if (ofs < resp_len)
+		return sb_range_send(dev, packet, conn, ofs, ack, TCP_ACK,
+				     min_t(u32, SB_RANGE_SEG, resp_len - ofs));
+	if (ofs == resp_len)
+		return sb_range_send(dev, packet, conn, ofs, ack,
+				     TCP_ACK | TCP_FIN, 0);
+
+	return 0;
+}
+
+static int sb_range_handler(struct udevice *dev, void *packet,
+			    unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_hdr *ip;
+	struct ip_tcp_hdr *tcp;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP) {
+		return sb_arp_handler(dev, packet, len);
+	} else if (ntohs(eth->et_protlen) == PROT_IP) {
+		ip = packet + ETHER_HDR_SIZE;
+		if (ip->ip_p == IPPROTO_TCP) {
+			tcp = packet + ETHER_HDR_SIZE;
+			if (tcp->tcp_flags == TCP_SYN)
+				return sb_range_syn_handler(dev, packet, len);
+			return sb_range_ack_handler(dev, packet, len);
+		}
+		return -EPROTONOSUPPORT;
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+/* Check that the file was put together correctly at the load address */
+static int check_range_file(struct unit_test_state *uts, ulong addr)
+{
+	ulong i, size = SB_RANGE_FILE_SIZE;
+	u8 *buf;
+
+	ut_asserteq(size, env_get_hex("filesize", 0));
+	buf = map_sysmem(addr, size);
+	for (i = 0; i < size; i++) {
+		if (buf[i] != sb_range_byte(i)) {
+			unmap_sysmem(buf);
+			ut_reportf("wrong data at offset %lx", i);
+		}
+	}
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+/* Fetch a file from a server, which may accept Range requests */
+static int fetch_range(struct unit_test_state *uts, bool advertise,
+		       bool honour)
+{
+	memset(&sb_range, '\0', sizeof(sb_range));
+	sb_range.advertise = advertise;
+	sb_range.honour = honour;
+	env_set("filesize", NULL);
+
+	return run_command("wget ${wgetaddr} 1.1.2.2:/range.bin", 0);
+}
+
+/* Test downloading a file in slices over several connections */
+static int net_test_wget_parallel(struct unit_test_state *uts)
+{
+	char *prev_ethact = env_get("ethact");
+	char *prev_ethrotate = env_get("ethrotate");
+	ulong addr = 0x1000000;
+	void *buf;
+
+	if (!IS_ENABLED(CONFIG_WGET_PARALLEL))
+		return -EAGAIN;
+
+	sandbox_eth_set_tx_handler(0, sb_range_handler);
+	sandbox_eth_set_priv(0, uts);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set_hex("wgetaddr", addr);
+
+	/*
+	 * the first request keeps the first half of the file and the second
+	 * half is fetched over another connection
+	 */
+	ut_assertok(fetch_range(uts, true, true));
+	ut_asserteq(1, sb_range.range_reqs);
+	ut_assertok(check_range_file(uts, addr));
+
+	/* a server which does not accept ranges is asked for the whole file */
+	buf = map_sysmem(addr, SB_RANGE_FILE_SIZE);
+	memset(buf, '\0', SB_RANGE_FILE_SIZE);
+	unmap_sysmem(buf);
+	ut_assertok(fetch_range(uts, false, false));
+	ut_asserteq(0, sb_range.range_reqs);
+	ut_assertok(check_range_file(uts, addr));
+
+	/* one which offers ranges but then ignores them makes wget fail */
+	ut_asserteq(1, fetch_range(uts, true, false));
+	ut_assert(sb_range.range_reqs > 0);
+	ut_assertnull(env_get("filesize"));
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	env_set("ethact", prev_ethact);
+	env_set("ethrotate", prev_ethrotate);
+
+	return 0;
+}
+CMD_TEST(net_test_wget_parallel, 0);
+
 static int net_test_wget_uri_validate(struct unit_test_state *uts)
 {
 	ut_asserteq(true, wget_validate_uri("http://foo.com/bar.html"));
@@ -5,6 +5,8 @@
 
 #include <blk.h>
 #include <dm.h>
+#include <malloc.h>
+#include <os.h>
 #include <part.h>
 #include <sandbox_host.h>
 #include <usb.h>
@@ -291,3 +293,124 @@ static int dm_test_blk_foreach(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_foreach, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+/* Test queued block requests */
+static int dm_test_blk_async(struct unit_test_state *uts)
+{
+	struct udevice *dev, *blk;
+	struct blk_req reqs[3];
+	struct blk_desc *desc;
+	char fname[256];
+	char *buf, *cmp;
+	int i;
+
+	if (!CONFIG_IS_ENABLED(BLK_ASYNC))
+		return -EAGAIN;
+
+	ut_assertok(os_persistent_file(fname, sizeof(fname), "2MB.ext2.img"));
+	ut_assertok(host_create_attach_file("test", fname, false,
+					    DEFAULT_BLKSZ, &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	desc = dev_get_uclass_plat(blk);
+
+	buf = malloc(64 * DEFAULT_BLKSZ);
+	cmp = malloc(64 * DEFAULT_BLKSZ);
+	ut_assertnonnull(buf);
+	ut_assertnonnull(cmp);
+
+	/* A large read is split into several queued requests */
+	ut_asserteq(64, blk_read(blk, 0, 64, buf));
+
+	/* Submit requests directly, then wait for them out of order */
+	for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+		blk_req_init(&reqs[i], BLK_REQ_READ, i * 16, 16,
+			     cmp + i * 16 * DEFAULT_BLKSZ);
+		ut_assertok(blk_submit(blk, &reqs[i]));
+	}
+	ut_assertok(blk_wait(blk, &reqs[2]));
+	ut_assertok(blk_wait(blk, &reqs[0]));
+	ut_assertok(blk_wait(blk, &reqs[1]));
+	for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+		ut_assert(reqs[i].done);
+		ut_asserteq(16, reqs[i].result);
+	}
+	ut_asserteq_mem(buf, cmp, 48 * DEFAULT_BLKSZ);
+
+	/* Nothing should be left in flight */
+	ut_asserteq(0, blk_poll(blk));
+
+	/* A read running off the end of the device is cut short */
+	ut_asserteq(20, blk_read(blk, desc->lba - 20, 32, buf));
+
+	free(cmp);
+	free(buf);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_async, UTF_SCAN_FDT);
+
+/* Test that sequential reads are satisfied by block-cache read-ahead */
+static int dm_test_blk_readahead(struct unit_test_state *uts)
+{
+	struct block_cache_dev_stats dstats;
+	struct block_cache_stats stats;
+	char buf[DEFAULT_BLKSZ];
+	struct udevice *dev, *blk;
+	char fname[256];
+	bool found;
+	char *cmp;
+	int i;
+
+	if (!CONFIG_IS_ENABLED(BLOCK_CACHE))
+		return -EAGAIN;
+
+	ut_assertok(os_persistent_file(fname, sizeof(fname), "2MB.ext2.img"));
+	ut_assertok(host_create_attach_file("test", fname, false,
+					    DEFAULT_BLKSZ, &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+
+	/* Too large to be cached, so this reads the device directly */
+	cmp = malloc(10 * DEFAULT_BLKSZ);
+	ut_assertnonnull(cmp);
+	ut_asserteq(10, blk_read(blk, 100, 10, cmp));
+
+	blkcache_configure(8, 32);
+	blkcache_configure_size(256 * 1024, 16);
+	blkcache_stats(&stats);
+
+	/* The second read is sequential, so the following ones are cached */
+	for (i = 0; i < 10; i++) {
+		ut_asserteq(1, blk_read(blk, 100 + i, 1, buf));
+		ut_asserteq_mem(cmp + i * DEFAULT_BLKSZ, buf, DEFAULT_BLKSZ);
+	}
+
+	found = false;
+	for (i = 0; !blkcache_dev_stats(i, &dstats); i++) {
+		if (dstats.iftype != UCLASS_HOST)
+			continue;
+		ut_asserteq(8, dstats.hits);
+		ut_asserteq(2, dstats.misses);
+		ut_asserteq(1, dstats.readaheads);
+		found = true;
+	}
+	ut_assert(found);
+
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.readaheads);
+	ut_asserteq(2, stats.entries);
+	ut_asserteq(10 * DEFAULT_BLKSZ, stats.size);
+
+	/* A random read does not trigger read-ahead */
+	ut_asserteq(1, blk_read(blk, 200, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.readaheads);
+	ut_asserteq(1, stats.misses);
+
+	blkcache_configure(8, CONFIG_BLOCK_CACHE_ENTRIES);
+	blkcache_configure_size(CONFIG_BLOCK_CACHE_SIZE * 1024,
+				CONFIG_BLOCK_CACHE_READAHEAD);
+	free(cmp);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_readahead, UTF_SCAN_FDT);
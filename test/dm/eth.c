@@ -621,6 +621,76 @@ static int dm_test_eth_async_ping_reply(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_eth_async_ping_reply, UTF_SCAN_FDT);
+
+static int sb_batch_rx_count;
+static bool sb_batch_rx_halt;
+
+static void sb_batch_udp_handler(uchar *pkt, unsigned int dport,
+				 struct in_addr sip, unsigned int sport,
+				 unsigned int len)
+{
+	sb_batch_rx_count++;
+	if (sb_batch_rx_halt)
+		eth_halt();
+}
+
+/* Queue a broadcast UDP packet for the sandbox device to receive */
+static void sb_batch_queue_udp(struct udevice *dev)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	uchar *pkt = priv->recv_packet_buffer[priv->recv_packets];
+	int len;
+
+	len = net_set_ether(pkt, net_bcast_ethaddr, PROT_IP);
+	net_set_udp_header(pkt + len, string_to_ip("255.255.255.255"), 1234,
+			   4321, 0);
+	priv->recv_packet_length[priv->recv_packets++] = len + IP_UDP_HDR_SIZE;
+}
+
+static int dm_test_eth_rx_batch(struct unit_test_state *uts)
+{
+	struct eth_sandbox_priv *priv;
+	struct udevice *dev;
+	int i;
+
+	ut_assertok(net_init());
+	env_set("ethact", "eth@10002000");
+	ut_assertok(eth_init());
+	dev = eth_get_dev();
+	ut_asserteq_str("eth@10002000", dev->name);
+	priv = dev_get_priv(dev);
+
+	sandbox_eth_set_batch(0, true);
+	net_set_udp_handler(sb_batch_udp_handler);
+
+	/* All the waiting packets are processed, then freed */
+	sb_batch_rx_count = 0;
+	sb_batch_rx_halt = false;
+	for (i = 0; i < 3; i++)
+		sb_batch_queue_udp(dev);
+	ut_assertok(eth_rx());
+	ut_asserteq(3, sb_batch_rx_count);
+	ut_asserteq(0, priv->recv_packets);
+
+	/*
+	 * Stopping the device from a handler drops the rest of the batch,
+	 * and leaves its buffers alone, even the one which was processed
+	 */
+	sb_batch_rx_count = 0;
+	sb_batch_rx_halt = true;
+	for (i = 0; i < 3; i++)
+		sb_batch_queue_udp(dev);
+	ut_assertok(eth_rx());
+	ut_asserteq(1, sb_batch_rx_count);
+	ut_asserteq(3, priv->recv_packets);
+	ut_assert(!eth_is_active(dev));
+
+	net_set_udp_handler(NULL);
+	sandbox_eth_set_batch(0, false);
+
+	return 0;
+}
+DM_TEST(dm_test_eth_rx_batch, UTF_SCAN_FDT);
 #endif
 
 #if IS_ENABLED(CONFIG_IPV6_ROUTER_DISCOVERY)
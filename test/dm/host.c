@@ -108,6 +108,79 @@ static int dm_test_host_dup(struct unit_test_state *uts)
 }
 DM_TEST(dm_test_host_dup, UTF_SCAN_FDT);
 
+/* Check that cached path lookups are dropped when the filesystem changes */
+static int dm_test_host_dcache(struct unit_test_state *uts)
+{
+	static char label[] = "test";
+	char fname[256], scratch[256];
+	struct udevice *dev, *blk;
+	struct blk_desc *desc;
+	loff_t actwrite, size;
+	uint write_gen, hits;
+	void *buf;
+	int len;
+
+	/* Work on a copy, since other tests use the same image */
+	ut_assertok(os_persistent_file(fname, sizeof(fname), "2MB.ext2.img"));
+	ut_assertok(os_persistent_file(scratch, sizeof(scratch),
+				       "dcache.ext2.img"));
+	ut_assertok(os_read_file(fname, &buf, &len));
+	ut_assertok(os_write_file(scratch, buf, len));
+	os_free(buf);
+
+	ut_assertok(host_create_device(label, true, DEFAULT_BLKSZ, &dev));
+	ut_assertok(host_attach_file(dev, scratch));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(device_probe(blk));
+	desc = dev_get_uclass_plat(blk);
+
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_write("/dcache", 0, 0, 0x10, &actwrite));
+
+	/* The second lookup of each path is answered from the cache */
+	hits = fs_dcache_get_hits();
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/dcache", &size));
+	ut_asserteq(0x10, size);
+	ut_asserteq(hits, fs_dcache_get_hits());
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/dcache", &size));
+	ut_asserteq(0x10, size);
+	ut_asserteq(hits + 1, fs_dcache_get_hits());
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assert(fs_size("/dcache-missing", &size));
+	ut_asserteq(hits + 1, fs_dcache_get_hits());
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assert(fs_size("/dcache-missing", &size));
+	ut_asserteq(hits + 2, fs_dcache_get_hits());
+
+	/* Marking the device as changed drops the cached lookups */
+	blk_mark_changed(desc);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/dcache", &size));
+	ut_asserteq(0x10, size);
+	ut_asserteq(hits + 2, fs_dcache_get_hits());
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/dcache", &size));
+	ut_asserteq(hits + 3, fs_dcache_get_hits());
+
+	/* Writing the file must not leave a stale size behind */
+	write_gen = desc->write_gen;
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_write("/dcache", 0, 0, 0x20, &actwrite));
+	ut_assert(desc->write_gen != write_gen);
+	ut_assertok(fs_set_blk_dev_with_part(desc, 0));
+	ut_assertok(fs_size("/dcache", &size));
+	ut_asserteq(0x20, size);
+
+	ut_assertok(host_detach_file(dev));
+	ut_assertok(device_unbind(dev));
+	ut_assertok(os_unlink(scratch));
+
+	return 0;
+}
+DM_TEST(dm_test_host_dcache, UTF_SCAN_FDT);
+
 /* Basic test of 'host' command */
 static int dm_test_cmd_host(struct unit_test_state *uts)
 {
@@ -4,11 +4,15 @@
  */
 
 #include <dm.h>
+#include <env.h>
 #include <mmc.h>
+#include <malloc.h>
 #include <part.h>
+#include <asm/test.h>
 #include <dm/test.h>
 #include <test/test.h>
 #include <test/ut.h>
+#include "../../drivers/mmc/mmc_private.h"
 
 /*
  * Basic test of the mmc uclass. We could expand this by implementing an MMC
@@ -51,3 +55,158 @@ static int dm_test_mmc_blk(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_mmc_blk, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+#if CONFIG_IS_ENABLED(MMC_CQE)
+/* Test queued reads, the fallback to CMD18 and recovery of a stuck card */
+static int dm_test_mmc_cqe(struct unit_test_state *uts)
+{
+	const lbaint_t count = MMC_CQE_MIN_BLKS;
+	struct blk_desc *dev_desc;
+	struct udevice *dev;
+	char *write, *read;
+	struct mmc *mmc;
+	int i, size;
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	mmc = mmc_get_mmc_dev(dev);
+	ut_assertok(sandbox_mmc_set_cqe(dev, 0, false));
+	mmc->has_init = 0;
+	ut_assertok(mmc_init(mmc));
+	ut_assertok(blk_get_device_by_str("mmc", "0", &dev_desc));
+	ut_assert(dev_desc->lba >= count);
+
+	size = count * dev_desc->blksz;
+	write = malloc(size);
+	ut_assertnonnull(write);
+	read = malloc(size);
+	ut_assertnonnull(read);
+	for (i = 0; i < size; i++)
+		write[i] = i / dev_desc->blksz + i;
+	ut_asserteq(count, blk_dwrite(dev_desc, 0, count, write));
+
+	/* The emulated SD card cannot queue, so pretend that it can */
+	mmc->cmdq_depth = 2;
+
+	/* A large read goes to the engine, a small one does not */
+	memset(read, '\0', size);
+	ut_asserteq(count, blk_dread(dev_desc, 0, count, read));
+	ut_asserteq(1, sandbox_mmc_get_cqe_reads(dev));
+	ut_asserteq_mem(write, read, size);
+	ut_asserteq(4, blk_dread(dev_desc, 0, 4, read));
+	ut_asserteq(1, sandbox_mmc_get_cqe_reads(dev));
+
+	/* The engine fails, so the read is done again with CMD18 */
+	ut_assertok(sandbox_mmc_set_cqe(dev, -EIO, false));
+	memset(read, '\0', size);
+	ut_asserteq(count, blk_dread(dev_desc, 0, count, read));
+	ut_asserteq(2, sandbox_mmc_get_cqe_reads(dev));
+	ut_asserteq_mem(write, read, size);
+	ut_asserteq(2, mmc->cmdq_depth);
+
+	/* The card also stays in queue mode, so it is reset and not queued again */
+	ut_assertok(sandbox_mmc_set_cqe(dev, -EIO, true));
+	memset(read, '\0', size);
+	ut_asserteq(count, blk_dread(dev_desc, 0, count, read));
+	ut_asserteq(3, sandbox_mmc_get_cqe_reads(dev));
+	ut_asserteq_mem(write, read, size);
+	ut_asserteq(0, mmc->cmdq_depth);
+
+	ut_asserteq(count, blk_dread(dev_desc, 0, count, read));
+	ut_asserteq(3, sandbox_mmc_get_cqe_reads(dev));
+	ut_asserteq_mem(write, read, size);
+
+	free(read);
+	free(write);
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_cqe, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+#endif
+
+#if CONFIG_IS_ENABLED(MMC_INIT_CACHE)
+/* Test writing and parsing the mmc<N>_bus variable */
+static int dm_test_mmc_init_cache(struct unit_test_state *uts)
+{
+	static const u32 cid[4] = {
+		0x11223344, 0x55667788, 0x99aabbcc, 0xddeeff00,
+	};
+	struct mmc_init_cache *c;
+	struct udevice *dev;
+	char name[16], val[64];
+	struct mmc *mmc;
+
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	mmc = mmc_get_mmc_dev(dev);
+	c = &mmc->init_cache;
+	memcpy(mmc->cid, cid, sizeof(cid));
+	snprintf(name, sizeof(name), "mmc%d_bus", dev_seq(dev));
+
+	/* A setup without a tuning value */
+	mmc->selected_mode = MMC_HS_52;
+	mmc->bus_width = 8;
+	c->has_tap = false;
+	mmc_init_cache_store(mmc);
+	snprintf(val, sizeof(val), "112233445566778899aabbccddeeff00,%d,8",
+		 MMC_HS_52);
+	ut_asserteq_str(val, env_get(name));
+
+	mmc_init_cache_load(mmc);
+	ut_assert(c->valid);
+	ut_asserteq(MMC_HS_52, c->mode);
+	ut_asserteq(MMC_MODE_8BIT, c->width);
+	ut_assert(!c->has_tap);
+
+	/* One with a tuning value */
+	mmc->selected_mode = MMC_HS_200;
+	mmc->bus_width = 4;
+	c->has_tap = true;
+	c->tap = 0x1f;
+	mmc_init_cache_store(mmc);
+	snprintf(val, sizeof(val), "112233445566778899aabbccddeeff00,%d,4,1f",
+		 MMC_HS_200);
+	ut_asserteq_str(val, env_get(name));
+
+	mmc_init_cache_load(mmc);
+	ut_assert(c->valid);
+	ut_asserteq(MMC_HS_200, c->mode);
+	ut_asserteq(MMC_MODE_4BIT, c->width);
+	ut_assert(c->has_tap);
+	ut_asserteq(0x1f, c->tap);
+
+	/* The value is for another card */
+	mmc->cid[3]++;
+	mmc_init_cache_load(mmc);
+	ut_assert(!c->valid);
+	ut_assert(!c->has_tap);
+	mmc->cid[3]--;
+
+	/* The width is not one the bus can have */
+	snprintf(val, sizeof(val), "112233445566778899aabbccddeeff00,%d,3",
+		 MMC_HS_52);
+	ut_assertok(env_set(name, val));
+	mmc_init_cache_load(mmc);
+	ut_assert(!c->valid);
+
+	/* There is something after the tuning value */
+	snprintf(val, sizeof(val), "112233445566778899aabbccddeeff00,%d,8,1fz",
+		 MMC_HS_52);
+	ut_assertok(env_set(name, val));
+	mmc_init_cache_load(mmc);
+	ut_assert(!c->valid);
+	ut_assert(!c->has_tap);
+
+	/* The mode is out of range */
+	snprintf(val, sizeof(val), "112233445566778899aabbccddeeff00,%d,8",
+		 MMC_MODES_END);
+	ut_assertok(env_set(name, val));
+	mmc_init_cache_load(mmc);
+	ut_assert(!c->valid);
+
+	ut_assertok(env_set(name, NULL));
+	mmc_init_cache_load(mmc);
+	ut_assert(!c->valid);
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_init_cache, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+#endif
@@ -9,9 +9,11 @@
 #include <mapmem.h>
 #include <os.h>
 #include <spi.h>
+#include <spi-mem.h>
 #include <spi_flash.h>
 #include <asm/state.h>
 #include <asm/test.h>
+#include <dm/device-internal.h>
 #include <dm/test.h>
 #include <dm/util.h>
 #include <test/test.h>
@@ -74,6 +76,161 @@ static int dm_test_spi_flash(struct unit_test_state *uts)
 }
 DM_TEST(dm_test_spi_flash, UTF_SCAN_PDATA | UTF_SCAN_FDT);
 
+/* Test that reads go through the direct mapping set up at probe time */
+static int dm_test_spi_flash_dirmap(struct unit_test_state *uts)
+{
+	struct spi_flash *flash;
+	struct udevice *dev, *bus;
+	int full_size = 0x200000;
+	int size = 0x10000;
+	uint reads;
+	u8 *src, *dst;
+
+	if (!CONFIG_IS_ENABLED(SPI_DIRMAP))
+		return -EAGAIN;
+
+	src = map_sysmem(0x20000, full_size);
+	ut_assertok(os_write_file("spi.bin", src, full_size));
+	ut_assertok(uclass_first_device_err(UCLASS_SPI_FLASH, &dev));
+	bus = dev_get_parent(dev);
+	flash = dev_get_uclass_priv(dev);
+	ut_assertnonnull(flash->dirmap.rdesc);
+	ut_assert(!flash->dirmap.rdesc->nodirmap);
+
+	/* The whole read is served by the mapping */
+	reads = sandbox_spi_get_dirmap_reads(bus);
+	dst = map_sysmem(0x20000 + full_size, full_size);
+	ut_assertok(spi_flash_read_dm(dev, 0, size, dst));
+	ut_asserteq_mem(src, dst, size);
+	ut_assert(sandbox_spi_get_dirmap_reads(bus) > reads);
+
+	/* Read from the mapping directly, at an offset */
+	memset(dst, '\0', size);
+	ut_asserteq(size, spi_mem_dirmap_read(flash->dirmap.rdesc, size, size,
+					      dst));
+	ut_asserteq_mem(src + size, dst, size);
+
+	/* Reads past the end of the mapping are refused */
+	ut_asserteq(-EINVAL, spi_mem_dirmap_read(flash->dirmap.rdesc,
+						 flash->dirmap.rdesc->info.length,
+						 size, dst));
+
+	/* Writes are not mapped and fall back to plain ops */
+	ut_assert(flash->dirmap.wdesc->nodirmap);
+
+	/*
+	 * Since we are about to destroy all devices, we must tell sandbox
+	 * to forget the emulation device
+	 */
+	sandbox_sf_unbind_emul(state_get_current(), 0, 0);
+
+	return 0;
+}
+DM_TEST(dm_test_spi_flash_dirmap, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+#if CONFIG_IS_ENABLED(SPI_FLASH_SFDP_SUPPORT)
+/* Offsets of the SFDP tables served by the emulator, in DWORDs */
+#define SFDP_BFPT	0x0c
+#define SFDP_PROFILE1	0x20
+#define SFDP_SCCR	0x40
+#define SFDP_OCTAL_DDR	0x60
+#define SFDP_DWORDS	(SFDP_OCTAL_DDR + 8)
+
+/*
+ * SFDP area of a 2MB flash which can be switched to 8D-8D-8D mode with the
+ * commands of the Command Sequences to Change to Octal DDR table
+ */
+static const u32 sandbox_sfdp[SFDP_DWORDS] = {
+	/* "SFDP", JESD216B, four parameter headers */
+	[0] = 0x50444653,
+	[1] = 0xff030106,
+	/* Basic Flash Parameter Table: 16 DWORDs */
+	[2] = 0x10010600,
+	[3] = 0xff000000 | SFDP_BFPT * 4,
+	/* xSPI Profile 1.0: 5 DWORDs */
+	[4] = 0x05010005,
+	[5] = 0xff000000 | SFDP_PROFILE1 * 4,
+	/* Status, Control and Configuration Register Map: 22 DWORDs */
+	[6] = 0x16010087,
+	[7] = 0xff000000 | SFDP_SCCR * 4,
+	/* Command Sequences to Change to Octal DDR: 8 DWORDs */
+	[8] = 0x0801000a,
+	[9] = 0xff000000 | SFDP_OCTAL_DDR * 4,
+
+	/* 16Mbit, 4KB erase with 0x20, 64KB erase with 0xd8, 256B pages */
+	[SFDP_BFPT + 1] = 0x00ffffff,
+	[SFDP_BFPT + 7] = 0xd810200c,
+	[SFDP_BFPT + 10] = 0x00000080,
+
+	/* 8D-8D-8D Fast Read with 0xee and 20 dummy cycles at 200MHz */
+	[SFDP_PROFILE1 + 0] = 0x0000ee00,
+	[SFDP_PROFILE1 + 3] = 20 << 7,
+
+	/* Octal DTR can be enabled in a volatile way */
+	[SFDP_SCCR + 21] = 0x80000000,
+
+	/* Write Enable, then write 0x02 to the register at address 0 */
+	[SFDP_OCTAL_DDR + 0] = 0x01060000,
+	[SFDP_OCTAL_DDR + 2] = 0x06720000,
+	[SFDP_OCTAL_DDR + 3] = 0x00000200,
+};
+
+/* Test that 8D-8D-8D mode is offered from the SFDP tables */
+static int dm_test_spi_flash_sfdp_octal_dtr(struct unit_test_state *uts)
+{
+	__le32 sfdp[SFDP_DWORDS];
+	struct udevice *dev, *emul;
+	struct spi_flash *flash;
+	int full_size = 0x200000;
+	int i;
+
+	for (i = 0; i < SFDP_DWORDS; i++)
+		sfdp[i] = cpu_to_le32(sandbox_sfdp[i]);
+
+	ut_assertok(os_write_file("spi.bin", map_sysmem(0x20000, full_size),
+				  full_size));
+	ut_assertok(uclass_first_device_err(UCLASS_SPI_FLASH, &dev));
+	ut_assertok(uclass_first_device_err(UCLASS_SPI_EMUL, &emul));
+
+	/* Probe again as a flash whose SFDP tables are parsed */
+	ut_assertok(sandbox_sf_set_sfdp(emul, "mx25r1635f", sfdp,
+					sizeof(sfdp)));
+	ut_assertok(device_remove(dev, DM_REMOVE_NORMAL));
+	ut_assertok(device_probe(dev));
+	flash = dev_get_uclass_priv(dev);
+	ut_asserteq_str("mx25r1635f", flash->name);
+
+	/*
+	 * The enable sequence is kept and 8D-8D-8D offered, but the sandbox
+	 * bus is single-wire so the flash stays in 1S-1S-1S mode
+	 */
+	ut_asserteq_mem(&sandbox_sfdp[SFDP_OCTAL_DDR], flash->octal_dtr_seq,
+			sizeof(flash->octal_dtr_seq));
+	ut_assert(flash->flags & SNOR_F_IO_MODE_EN_VOLATILE);
+	ut_assertnonnull(flash->octal_dtr_enable);
+	ut_asserteq(SNOR_PROTO_1_1_1, flash->read_proto);
+	ut_asserteq(SNOR_PROTO_1_1_1, flash->reg_proto);
+
+	/* Without a volatile way to enable it, 8D-8D-8D is not offered */
+	sfdp[SFDP_SCCR + 21] = 0;
+	ut_assertok(device_remove(dev, DM_REMOVE_NORMAL));
+	ut_assertok(device_probe(dev));
+	flash = dev_get_uclass_priv(dev);
+	ut_asserteq_mem(&sandbox_sfdp[SFDP_OCTAL_DDR], flash->octal_dtr_seq,
+			sizeof(flash->octal_dtr_seq));
+	ut_assertnull(flash->octal_dtr_enable);
+
+	/*
+	 * Since we are about to destroy all devices, we must tell sandbox
+	 * to forget the emulation device
+	 */
+	sandbox_sf_unbind_emul(state_get_current(), 0, 0);
+
+	return 0;
+}
+DM_TEST(dm_test_spi_flash_sfdp_octal_dtr, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+#endif
+
 /* Functional test that sandbox SPI flash works correctly */
 static int dm_test_spi_flash_func(struct unit_test_state *uts)
 {
@@ -122,3 +122,61 @@ static int env_test_htab_deletes(struct unit_test_state *uts)
 	return 0;
 }
 ENV_TEST(env_test_htab_deletes, 0);
+
+/* Fill the hashtable well beyond its initial size and check it grows */
+static int env_test_htab_grow(struct unit_test_state *uts)
+{
+	struct hsearch_data htab;
+	char *res = NULL;
+	char key[20];
+	int i;
+
+	memset(&htab, 0, sizeof(htab));
+	ut_asserteq(1, hcreate_r(SIZE, &htab));
+
+	ut_assertok(htab_fill(uts, &htab, SIZE * 16));
+	ut_assertok(htab_check_fill(uts, &htab, SIZE * 16));
+	ut_asserteq(SIZE * 16, htab.filled);
+	ut_assert(htab.size > SIZE * 16);
+
+	/* Deleting entries must keep the export in order */
+	for (i = 0; i < SIZE * 16; i += 2) {
+		sprintf(key, "%d", i);
+		ut_assertok(hdelete_r(key, &htab, 0));
+	}
+	ut_assert(hexport_r(&htab, '\n', 0, &res, 0, 0, NULL) > 0);
+	ut_asserteq_strn("1=1\n101=101\n103=103\n", res);
+	free(res);
+
+	hdestroy_r(&htab);
+	return 0;
+}
+ENV_TEST(env_test_htab_grow, 0);
+
+/* Import many more entries than the default table size, out of order */
+static int env_test_htab_import(struct unit_test_state *uts)
+{
+	const int count = CONFIG_ENV_MAX_ENTRIES * 2;
+	struct hsearch_data htab;
+	char *buf, *p, *res = NULL;
+	int i;
+
+	buf = malloc(count * 20);
+	ut_assertnonnull(buf);
+	for (i = count - 1, p = buf; i >= 0; i--)
+		p += sprintf(p, "%d=%d\n", i, i);
+
+	memset(&htab, 0, sizeof(htab));
+	ut_asserteq(1, himport_r(&htab, buf, p - buf, '\n', 0, 0, 0, NULL));
+	free(buf);
+	ut_assertok(htab_check_fill(uts, &htab, count));
+	ut_asserteq(count, htab.filled);
+
+	ut_assert(hexport_r(&htab, '\n', 0, &res, 0, 0, NULL) > 0);
+	ut_asserteq_strn("0=0\n1=1\n10=10\n100=100\n", res);
+	free(res);
+
+	hdestroy_r(&htab);
+	return 0;
+}
+ENV_TEST(env_test_htab_import, 0);
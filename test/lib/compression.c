@@ -606,3 +606,68 @@ static int compression_test_bootm_none(struct unit_test_state *uts)
 	return run_bootm_test(uts, IH_COMP_NONE, compress_using_none);
 }
 LIB_TEST(compression_test_bootm_none, 0);
+
+/**
+ * run_stream_test() - Test decompressing data as it arrives
+ *
+ * The compressed data is made available one byte at a time
+ *
+ * @comp_type:	Compression type to test
+ * @compress:	Our function to compress data
+ * Return: 0 if OK, non-zero on failure
+ */
+static int run_stream_test(struct unit_test_state *uts, int comp_type,
+			   mutate_func compress)
+{
+	ulong compress_size = TEST_BUFFER_SIZE;
+	char in[TEST_BUFFER_SIZE], out[TEST_BUFFER_SIZE];
+	struct image_decomp_stream ds;
+	ulong avail;
+	int ret;
+
+	if (!CONFIG_IS_ENABLED(FIT_EXTERNAL_DECOMP))
+		return -EAGAIN;
+
+	printf("Testing: %s\n", genimg_get_comp_name(comp_type));
+	ut_assertok(compress(uts, (void *)plain, strlen(plain), in,
+			     compress_size, &compress_size));
+	ut_assertok(image_decomp_stream_start(&ds, comp_type, in, out,
+					      sizeof(out)));
+	for (ret = -EAGAIN, avail = 1; ret == -EAGAIN; avail++) {
+		ut_assert(avail <= compress_size);
+		ret = image_decomp_stream_run(&ds, avail,
+					      avail == compress_size);
+	}
+	ut_assertok(ret);
+	ut_asserteq(strlen(plain), ds.out_len);
+	ut_asserteq_mem(plain, out, ds.out_len);
+	image_decomp_stream_end(&ds);
+
+	/* Make sure decompression does not over-run */
+	memset(out, 'A', sizeof(out));
+	ut_assertok(image_decomp_stream_start(&ds, comp_type, in, out,
+					      strlen(plain) - 1));
+	ut_assert(image_decomp_stream_run(&ds, compress_size, true) < 0);
+	ut_asserteq('A', out[strlen(plain) - 1]);
+	image_decomp_stream_end(&ds);
+
+	return 0;
+}
+
+static int compression_test_stream_gzip(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_GZIP, compress_using_gzip);
+}
+LIB_TEST(compression_test_stream_gzip, 0);
+
+static int compression_test_stream_lz4(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_LZ4, compress_using_lz4);
+}
+LIB_TEST(compression_test_stream_lz4, 0);
+
+static int compression_test_stream_zstd(struct unit_test_state *uts)
+{
+	return run_stream_test(uts, IH_COMP_ZSTD, compress_using_zstd);
+}
+LIB_TEST(compression_test_stream_zstd, 0);
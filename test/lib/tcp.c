@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for TCP option parsing and SACK bookkeeping
+ */
+
+#include <net.h>
+#include <net/tcp.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include <asm/unaligned.h>
+
+static void tcp_test_init(struct tcp_stream *tcp, u32 rcv_nxt)
+{
+	memset(tcp, '\0', sizeof(*tcp));
+	tcp->lost.len = TCP_OPT_LEN_2;
+	tcp->rcv_nxt = rcv_nxt;
+}
+
+/* Check the number of hills and the edges of one of them */
+static int check_hill(struct unit_test_state *uts, struct tcp_stream *tcp,
+		      int cnt, int i, u32 l, u32 r)
+{
+	ut_asserteq(TCP_OPT_LEN_2 + cnt * TCP_OPT_LEN_8, tcp->lost.len);
+	ut_asserteq(l, tcp->lost.hill[i].l);
+	ut_asserteq(r, tcp->lost.hill[i].r);
+
+	return 0;
+}
+
+/* Test parsing the window-scale, SACK-permitted and timestamp options */
+static int lib_tcp_parse_options(struct unit_test_state *uts)
+{
+	uchar opts[] = {
+		TCP_O_MSS, TCP_OPT_LEN_4, 0x05, 0xb4,
+		TCP_1_NOP,
+		TCP_O_SCL, TCP_OPT_LEN_3, 7,
+		TCP_P_SACK, TCP_OPT_LEN_2,
+		TCP_O_TS, TCP_OPT_LEN_A, 1, 2, 3, 4, 0, 0, 0, 0,
+		TCP_O_END, 0,
+	};
+	struct tcp_stream tcp;
+
+	tcp_test_init(&tcp, 0);
+	tcp_parse_options(&tcp, opts, sizeof(opts), true);
+	ut_asserteq(1, tcp.win_scale_ok);
+	ut_asserteq(7, tcp.rmt_win_scale);
+	ut_asserteq(1, tcp.sack_ok);
+	ut_asserteq(get_unaligned((u32 *)&opts[12]), tcp.rmt_timestamp);
+
+	/* Shifts above 14 are treated as 14 (RFC 7323) */
+	opts[7] = 20;
+	tcp_test_init(&tcp, 0);
+	tcp_parse_options(&tcp, opts, sizeof(opts), true);
+	ut_asserteq(1, tcp.win_scale_ok);
+	ut_asserteq(TCP_MAX_SCALE, tcp.rmt_win_scale);
+
+	/* Scaling and SACK can only be negotiated in a SYN */
+	tcp_test_init(&tcp, 0);
+	tcp_parse_options(&tcp, opts, sizeof(opts), false);
+	ut_asserteq(0, tcp.win_scale_ok);
+	ut_asserteq(0, tcp.rmt_win_scale);
+	ut_asserteq(0, tcp.sack_ok);
+	ut_asserteq(get_unaligned((u32 *)&opts[12]), tcp.rmt_timestamp);
+
+	return 0;
+}
+LIB_TEST(lib_tcp_parse_options, 0);
+
+/* Test merging hills as the holes between them are filled */
+static int lib_tcp_hole_merge(struct unit_test_state *uts)
+{
+	struct tcp_stream tcp;
+
+	tcp_test_init(&tcp, 1000);
+	tcp_hole(&tcp, 2000, 100);
+	tcp_hole(&tcp, 3000, 100);
+	tcp_hole(&tcp, 4000, 100);
+	ut_assertok(check_hill(uts, &tcp, 3, 2, 4000, 4100));
+
+	/* Filling the first hole joins two hills and moves the third down */
+	tcp_hole(&tcp, 2100, 900);
+	ut_assertok(check_hill(uts, &tcp, 2, 0, 2000, 3100));
+	ut_assertok(check_hill(uts, &tcp, 2, 1, 4000, 4100));
+	ut_asserteq(TCP_O_NOP, tcp.lost.hill[2].l);
+	ut_asserteq(1000, tcp.rcv_nxt);
+
+	/* Receiving the missing start advances rcv_nxt over the first hill */
+	tcp_hole(&tcp, 1000, 1000);
+	ut_asserteq(3100, tcp.rcv_nxt);
+	ut_assertok(check_hill(uts, &tcp, 1, 0, 4000, 4100));
+
+	/* A segment bridging several hills merges them all */
+	tcp_hole(&tcp, 5000, 100);
+	tcp_hole(&tcp, 6000, 100);
+	tcp_hole(&tcp, 4100, 1900);
+	ut_assertok(check_hill(uts, &tcp, 1, 0, 4000, 6100));
+
+	return 0;
+}
+LIB_TEST(lib_tcp_hole_merge, 0);
+
+/* Test that a new hill is added without overflowing a full list */
+static int lib_tcp_hole_full(struct unit_test_state *uts)
+{
+	struct tcp_stream tcp;
+	int i;
+
+	tcp_test_init(&tcp, 1000);
+	for (i = 0; i < TCP_SACK_HILLS; i++)
+		tcp_hole(&tcp, 2000 + i * 1000, 100);
+	ut_assertok(check_hill(uts, &tcp, TCP_SACK_HILLS, TCP_SACK_HILLS - 1,
+			       9000, 9100));
+
+	/* The furthest hill is dropped to make room */
+	tcp_hole(&tcp, 1500, 100);
+	ut_assertok(check_hill(uts, &tcp, TCP_SACK_HILLS, 0, 1500, 1600));
+	for (i = 1; i < TCP_SACK_HILLS; i++)
+		ut_assertok(check_hill(uts, &tcp, TCP_SACK_HILLS, i,
+				       1000 + i * 1000, 1100 + i * 1000));
+
+	/* Nothing was written past the end of the list */
+	ut_asserteq(1500, tcp.sack_recent);
+
+	return 0;
+}
+LIB_TEST(lib_tcp_hole_full, 0);
+
+/* Test that the block holding the latest segment is reported first */
+static int lib_tcp_sack_order(struct unit_test_state *uts)
+{
+	static union tcp_build_pkt b;
+	struct sack_edges *hill = b.sack.sack_v.hill;
+	struct tcp_stream tcp;
+	int hdr_len;
+
+	if (!IS_ENABLED(CONFIG_PROT_TCP_SACK))
+		return -EAGAIN;
+
+	tcp_test_init(&tcp, 1000);
+	tcp.sack_ok = 1;
+	tcp_hole(&tcp, 2000, 100);
+	tcp_hole(&tcp, 3000, 100);
+	tcp_hole(&tcp, 5000, 100);
+	tcp_hole(&tcp, 4000, 100);
+
+	hdr_len = net_set_ack_options(&tcp, &b);
+	ut_asserteq(TCP_V_SACK, b.sack.sack_v.kind);
+	ut_asserteq(TCP_OPT_LEN_2 + TCP_SACK_BLOCKS * TCP_OPT_LEN_8,
+		    b.sack.sack_v.len);
+	ut_asserteq(b.sack.hdr.tcp_hlen >> 2, hdr_len);
+
+	/* Only three blocks fit, the most recent first, then in order */
+	ut_asserteq(4000, ntohl(hill[0].l));
+	ut_asserteq(4100, ntohl(hill[0].r));
+	ut_asserteq(2000, ntohl(hill[1].l));
+	ut_asserteq(2100, ntohl(hill[1].r));
+	ut_asserteq(3000, ntohl(hill[2].l));
+	ut_asserteq(3100, ntohl(hill[2].r));
+
+	/* Without permission from the peer no blocks are sent */
+	tcp.sack_ok = 0;
+	net_set_ack_options(&tcp, &b);
+	ut_asserteq(TCP_1_NOP, b.sack.sack_v.kind);
+
+	return 0;
+}
+LIB_TEST(lib_tcp_sack_order, 0);
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for CPU-accelerated checksums and hashes
+ *
+ * These check that the accelerated implementations (where the CPU supports
+ * them) agree with the portable ones, then report the throughput of each.
+ */
+
+#include <malloc.h>
+#include <time.h>
+#include <linux/sizes.h>
+#include <test/lib.h>
+#include <test/ut.h>
+#include <u-boot/crc.h>
+#include <u-boot/sha256.h>
+
+/* Size of buffer used for timing */
+#define BENCH_SIZE	SZ_1M
+
+static const char check_str[] = "123456789";
+
+static u8 *bench_buf(void)
+{
+	u8 *buf;
+	int i;
+
+	buf = malloc(BENCH_SIZE + 8);
+	if (buf) {
+		for (i = 0; i < BENCH_SIZE + 8; i++)
+			buf[i] = i * 7 + (i >> 8);
+	}
+
+	return buf;
+}
+
+static void bench_show(const char *name, ulong start)
+{
+	ulong us = max(timer_get_us() - start, 1UL);
+
+	printf("%-20s %6lu MB/s\n", name, (ulong)BENCH_SIZE / us);
+}
+
+static int lib_hash_accel_crc32(struct unit_test_state *uts)
+{
+	const u8 *check = (const u8 *)check_str;
+	ulong start;
+	u32 crc;
+	u8 *buf;
+	int ofs;
+
+	ut_asserteq(0xcbf43926, crc32(0, check, strlen(check_str)));
+	buf = bench_buf();
+	ut_assertnonnull(buf);
+
+	/* Cover the unaligned head and tail of the accelerated loop */
+	for (ofs = 0; ofs < 8; ofs++) {
+		ut_asserteq(crc32_no_comp_generic(~0, buf + ofs, 1000 + ofs),
+			    crc32_no_comp(~0, buf + ofs, 1000 + ofs));
+	}
+
+	start = timer_get_us();
+	crc = crc32_no_comp_generic(0, buf, BENCH_SIZE);
+	bench_show("crc32 generic", start);
+	start = timer_get_us();
+	ut_asserteq(crc, crc32_no_comp(0, buf, BENCH_SIZE));
+	bench_show("crc32", start);
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_hash_accel_crc32, 0);
+
+#if CONFIG_IS_ENABLED(CRC32C)
+static int lib_hash_accel_crc32c(struct unit_test_state *uts)
+{
+	uint32_t table[256];
+	ulong start;
+	u32 crc;
+	u8 *buf;
+	int ofs;
+
+	crc32c_init(table, 0x82f63b78);
+	ut_asserteq(0xe3069283, ~crc32c_cal(~0, check_str, strlen(check_str),
+					     table));
+	buf = bench_buf();
+	ut_assertnonnull(buf);
+
+	for (ofs = 0; ofs < 8; ofs++) {
+		const char *data = (char *)buf + ofs;
+
+		ut_asserteq(crc32c_cal_generic(~0, data, 1000 + ofs, table),
+			    crc32c_cal(~0, data, 1000 + ofs, table));
+	}
+
+	start = timer_get_us();
+	crc = crc32c_cal_generic(0, (char *)buf, BENCH_SIZE, table);
+	bench_show("crc32c generic", start);
+	start = timer_get_us();
+	ut_asserteq(crc, crc32c_cal(0, (char *)buf, BENCH_SIZE, table));
+	bench_show("crc32c", start);
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_hash_accel_crc32c, 0);
+#endif
+
+#if CONFIG_IS_ENABLED(SHA256_LEGACY)
+static int lib_hash_accel_sha256(struct unit_test_state *uts)
+{
+	sha256_context ctx, ctx_generic;
+	ulong start;
+	u8 *buf;
+
+	buf = bench_buf();
+	ut_assertnonnull(buf);
+
+	sha256_starts(&ctx);
+	sha256_starts(&ctx_generic);
+	sha256_process(&ctx, buf, 16);
+	sha256_process_generic(&ctx_generic, buf, 16);
+	ut_asserteq_mem(ctx_generic.state, ctx.state, sizeof(ctx.state));
+
+	start = timer_get_us();
+	sha256_process_generic(&ctx_generic, buf, BENCH_SIZE / 64);
+	bench_show("sha256 generic", start);
+	start = timer_get_us();
+	sha256_process(&ctx, buf, BENCH_SIZE / 64);
+	bench_show("sha256", start);
+	ut_asserteq_mem(ctx_generic.state, ctx.state, sizeof(ctx.state));
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_hash_accel_sha256, 0);
+#endif
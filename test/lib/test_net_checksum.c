@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the IP checksum
+ */
+
+#include <malloc.h>
+#include <net.h>
+#include <test/lib.h>
+#include <test/ut.h>
+#include <asm/byteorder.h>
+
+#define TEST_SIZE	1600
+
+/* Checksum 16 bits at a time, as compute_ip_checksum() used to */
+static uint ip_checksum_ref(const u8 *ptr, uint nbytes)
+{
+	ulong sum = 0;
+	u16 word;
+
+	for (; nbytes > 1; ptr += 2, nbytes -= 2) {
+		memcpy(&word, ptr, 2);
+		sum += word;
+	}
+	if (nbytes) {
+		word = 0;
+		*(u8 *)&word = *ptr;
+		sum += word;
+	}
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+
+	return ~sum & 0xffff;
+}
+
+static int lib_test_ip_checksum(struct unit_test_state *uts)
+{
+	/* example from RFC 1071, whose sum is ddf2 */
+	u8 rfc1071[10] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7 };
+	u16 sum;
+	u8 *buf;
+	int ofs, len, i;
+
+	ut_asserteq(0x220d, be16_to_cpu(compute_ip_checksum(rfc1071, 8)));
+	sum = compute_ip_checksum(rfc1071, 8);
+	memcpy(&rfc1071[8], &sum, 2);
+	ut_assert(ip_checksum_ok(rfc1071, sizeof(rfc1071)));
+	rfc1071[3]++;
+	ut_assert(!ip_checksum_ok(rfc1071, sizeof(rfc1071)));
+
+	buf = malloc(TEST_SIZE + 8);
+	ut_assertnonnull(buf);
+	for (i = 0; i < TEST_SIZE + 8; i++)
+		buf[i] = i * 7 + (i >> 8);
+
+	/* Cover each alignment, odd ones too, and every length of tail */
+	for (ofs = 0; ofs < 8; ofs++) {
+		for (len = 0; len < 40; len++)
+			ut_asserteq(ip_checksum_ref(buf + ofs, len),
+				    compute_ip_checksum(buf + ofs, len));
+		ut_asserteq(ip_checksum_ref(buf + ofs, TEST_SIZE),
+			    compute_ip_checksum(buf + ofs, TEST_SIZE));
+		ut_asserteq(ip_checksum_ref(buf + ofs, TEST_SIZE - 1),
+			    compute_ip_checksum(buf + ofs, TEST_SIZE - 1));
+	}
+
+	/* Check that carries are folded back in */
+	memset(buf, 0xff, TEST_SIZE);
+	for (ofs = 0; ofs < 4; ofs++)
+		ut_asserteq(ip_checksum_ref(buf + ofs, 64),
+			    compute_ip_checksum(buf + ofs, 64));
+	ut_asserteq(ip_checksum_ref(buf, TEST_SIZE),
+		    compute_ip_checksum(buf, TEST_SIZE));
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_test_ip_checksum, 0);